@@ -43,10 +43,18 @@ float myADC::readAverageVoltage() const {
     return voltage;
 }
 
+// Read one calibrated voltage sample, unlike readAverageVoltage() this never sleeps
+float myADC::readSupplyVoltage() const {
+    uint16_t result = adc_read();
+    return (result * conversionFactor * 2) + offset;  // Adjust for 1:1 voltage divider
+}
+
 // Calculate the battery level as a percentage based on the voltage
 float myADC::calculateBatteryLevel() const {
-    float voltage = readAverageVoltage();
+    return calculateBatteryLevel(readAverageVoltage());
+}
 
+float myADC::calculateBatteryLevel(float voltage) const {
     if (voltage < minVoltage) {
         //printf("INFO: Voltage %.3fV is below the minimum threshold. Battery level is 0%%.\n", voltage);
         return 0.0f;
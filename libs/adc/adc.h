@@ -23,7 +23,9 @@ public:
     void init() const;
     float readVoltage() const;
     float readAverageVoltage() const;  // New method to read averaged voltage
+    float readSupplyVoltage() const;   // Single calibrated sample without delays, usable from a timer callback
     float calculateBatteryLevel() const;
+    float calculateBatteryLevel(float voltage) const;  // Level of a voltage read elsewhere (PowerMonitor)
 };
 
 #endif // MY_PROJECT_MYADC_H
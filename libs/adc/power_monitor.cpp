@@ -0,0 +1,72 @@
+#include "power_monitor.h"
+
+PowerMonitor::PowerMonitor(const myADC& adc) : _adc(adc) {
+}
+
+bool PowerMonitor::start(int32_t interval_ms) {
+    if (_running) {
+        return true;
+    }
+
+    _running = add_repeating_timer_ms(interval_ms, timerCallback, this, &_timer);
+    if (!_running) {
+        printf("ERROR: Failed to start power monitor timer\n");
+    }
+    return _running;
+}
+
+void PowerMonitor::stop() {
+    if (_running) {
+        cancel_repeating_timer(&_timer);
+        _running = false;
+    }
+}
+
+bool PowerMonitor::timerCallback(struct repeating_timer* timer) {
+    ((PowerMonitor*)timer->user_data)->sample();
+    return true;
+}
+
+void PowerMonitor::sample() {
+    // Runs in interrupt context: no printf, no sleeping
+    float voltage = _adc.readSupplyVoltage();
+    _voltage = voltage;
+    if (voltage < _min_voltage) {
+        _min_voltage = voltage;
+    }
+
+    // Published as one float write, a main loop read never sees half an update
+    _sample_sum += voltage;
+    if (++_sample_count >= POWER_AVERAGE_SAMPLES) {
+        _average_voltage = _sample_sum / _sample_count;
+        _sample_sum = 0.0f;
+        _sample_count = 0;
+    } else if (_average_voltage == 0.0f) {
+        _average_voltage = voltage;
+    }
+
+    if (_average == 0.0f) {
+        _average = voltage;
+    }
+
+    bool collapsing = voltage < POWER_BROWNOUT_VOLTAGE || _average - voltage > POWER_DROP_VOLTAGE;
+
+    if (!collapsing) {
+        _bad_samples = 0;
+        _average += (voltage - _average) * 0.1f;
+
+        if (voltage > POWER_BROWNOUT_VOLTAGE + POWER_REARM_HYSTERESIS) {
+            _armed = true;
+            _armed_once = true;
+        }
+        return;
+    }
+
+    // The average is not updated while the voltage is dropping, the drop stays measurable
+    if (_armed && ++_bad_samples >= POWER_BROWNOUT_SAMPLES) {
+        _brownout = true;
+        _brownout_count++;
+        _armed = false;
+        _bad_samples = 0;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef POWER_MONITOR_H
+#define POWER_MONITOR_H
+
+#include <cstdint>
+#include "pico/stdlib.h"
+#include "adc.h"
+
+// Supply voltage below which the battery is about to collapse (myADC reports 0% at 3.5 V)
+#define POWER_BROWNOUT_VOLTAGE    3.40f
+// Sudden drop against the running average that is treated as a collapsing supply
+#define POWER_DROP_VOLTAGE        0.25f
+// Consecutive bad samples before a brownout is reported (filters ADC noise and load spikes)
+#define POWER_BROWNOUT_SAMPLES    3
+// Voltage above POWER_BROWNOUT_VOLTAGE needed to arm the monitor again after a brownout
+#define POWER_REARM_HYSTERESIS    0.10f
+// Default sampling interval
+#define POWER_SAMPLE_INTERVAL_MS  100
+// Samples averaged into the voltage the main loop reads (1 s at the default interval)
+#define POWER_AVERAGE_SAMPLES     10
+
+// Samples the battery voltage from a repeating timer and flags a collapsing supply.
+// The timer callback only sets a flag, the main loop has to check brownoutDetected()
+// and write out whatever it holds in RAM.
+//
+// While it runs the timer is the only reader of the ADC. The main loop takes the battery
+// voltage from getAverageVoltage() instead of calling adc_read() itself, which would race
+// the callback. The detection state is only touched by the callback.
+//
+// The monitor only arms once the voltage was above the brownout level, so running
+// from USB without a battery (ADC reading near 0 V) does not trigger it.
+class PowerMonitor {
+public:
+    PowerMonitor(const myADC& adc);
+
+    // Start or stop sampling
+    bool start(int32_t interval_ms = POWER_SAMPLE_INTERVAL_MS);
+    void stop();
+    bool isRunning() const { return _running; }
+
+    // Set from the timer callback when the supply collapses, stays set until cleared
+    bool brownoutDetected() const { return _brownout; }
+    void clearBrownout() { _brownout = false; }
+
+    // Whether the supply is currently below the brownout level
+    bool isSupplyLow() const { return _armed_once && _voltage < POWER_BROWNOUT_VOLTAGE; }
+
+    float getVoltage() const { return _voltage; }
+
+    // Mean of the last POWER_AVERAGE_SAMPLES samples (the first sample until there are
+    // that many), 0 before the first sample
+    float getAverageVoltage() const { return _average_voltage; }
+    float getMinVoltage() const { return _min_voltage; }
+    uint32_t getBrownoutCount() const { return _brownout_count; }
+
+private:
+    static bool timerCallback(struct repeating_timer* timer);
+    void sample();
+
+    const myADC& _adc;
+    struct repeating_timer _timer;
+    bool _running = false;
+
+    volatile bool _brownout = false;
+    volatile float _voltage = 0.0f;
+    volatile float _min_voltage = 99.0f;
+    volatile uint32_t _brownout_count = 0;
+    volatile float _average_voltage = 0.0f;
+    volatile bool _armed_once = false;   // A battery voltage was seen at all
+
+    // Only used by the timer callback
+    float _average = 0.0f;           // Running average of the supply voltage
+    uint8_t _bad_samples = 0;        // Consecutive samples below the limits
+    bool _armed = false;             // A brownout can be reported
+    float _sample_sum = 0.0f;        // Samples since _average_voltage was published
+    uint8_t _sample_count = 0;
+};
+
+#endif // POWER_MONITOR_H
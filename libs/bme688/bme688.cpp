@@ -16,7 +16,19 @@ BME688::BME688(i2c_inst_t *i2c, uint8_t address, uint8_t sda, uint8_t scl)
         if (result < 0) return -1;
 
         result = i2c_read_blocking(self->i2c_, self->address_, data, len, false);
-        return result < 0 ? -1 : 0;
+        if (result < 0) return -1;
+
+        // Keep the raw registers the compensation works on
+        if (reg == BME68X_REG_COEFF1 && len == BME68X_LEN_COEFF1) {
+            memcpy(self->calib_dump_, data, len);
+        } else if (reg == BME68X_REG_COEFF2 && len == BME68X_LEN_COEFF2) {
+            memcpy(self->calib_dump_ + BME68X_LEN_COEFF1, data, len);
+        } else if (reg == BME68X_REG_COEFF3 && len == BME68X_LEN_COEFF3) {
+            memcpy(self->calib_dump_ + BME68X_LEN_COEFF1 + BME68X_LEN_COEFF2, data, len);
+        } else if (reg == BME68X_REG_FIELD0 && len == BME68X_LEN_FIELD) {
+            memcpy(self->field_dump_, data, len);
+        }
+        return 0;
     };
 
     dev_.write = [](uint8_t reg, const uint8_t *data, uint32_t len, void *intf) -> int8_t {
@@ -40,6 +52,7 @@ bool BME688::begin() {
     if (bme68x_init(&dev_) != BME68X_OK) {
         return false;
     }
+    calib_dump_[BME68X_LEN_COEFF_ALL] = dev_.variant_id;
 
     // Set configuration in force mode
     conf_.os_hum = BME68X_OS_2X;
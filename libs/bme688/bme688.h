@@ -6,12 +6,22 @@
 #include "hardware/i2c.h"
 #include "libs/bme688/api/BME68x_SensorAPI/bme68x.h"  // Include Bosch's sensor API
 
+// Register dumps kept for raw capture: the calibration registers read by begin()
+// (COEFF1, COEFF2, COEFF3 in the order bme68x_init() reads them, then the variant ID) and
+// the field registers of the last measurement
+#define BME688_CALIB_DUMP_SIZE (BME68X_LEN_COEFF_ALL + 1)
+#define BME688_FIELD_DUMP_SIZE BME68X_LEN_FIELD
+
 class BME688 {
 public:
     BME688(i2c_inst_t *i2c, uint8_t address, uint8_t sda, uint8_t scl);
     bool begin();
     bool readData(float &temperature, float &humidity, float &pressure, float &gas_resistance);
 
+    // Register dumps for raw capture, see BME688_*_DUMP_SIZE
+    const uint8_t *calibrationDump() const { return calib_dump_; }
+    const uint8_t *fieldDump() const { return field_dump_; }
+
 private:
     i2c_inst_t *i2c_;
     uint8_t address_;
@@ -20,6 +30,8 @@ private:
     struct bme68x_heatr_conf heatr_conf_;
 
     bool heaterConfigured_ = true;  // Flag to track heater configuration
+    uint8_t calib_dump_[BME688_CALIB_DUMP_SIZE] = {0};
+    uint8_t field_dump_[BME688_FIELD_DUMP_SIZE] = {0};
 };
 
 #endif // BME688_H
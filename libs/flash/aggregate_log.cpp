@@ -0,0 +1,96 @@
+#include "aggregate_log.h"
+#include <cstdio>
+#include <cstring>
+
+AggregateLog::AggregateLog(FlashStream& stream) : _stream(stream) {
+}
+
+void AggregateLog::startMinute(uint32_t timestamp) {
+    _minute = timestamp - timestamp % 60;
+    _samples = 0;
+    _fix_samples = 0;
+    _temp_sum = 0.0f;
+    _hum_sum = 0.0f;
+    _pres_sum = 0.0f;
+    _co2_sum = 0;
+    _pm1_0_sum = 0;
+    _pm2_5_sum = 0;
+    _pm10_sum = 0;
+    _pm2_5_max = 0;
+    _pm10_max = 0;
+    _battery_min = 0xFFFF;
+    _latitude = 0;
+    _longitude = 0;
+}
+
+bool AggregateLog::add(const SensorData& data) {
+    bool written = true;
+
+    if (_samples > 0 && data.timestamp - data.timestamp % 60 != _minute) {
+        written = flush();
+    }
+    if (_samples == 0) {
+        startMinute(data.timestamp);
+    }
+
+    _samples++;
+    _temp_sum += data.temp;
+    _hum_sum += data.hum;
+    _pres_sum += data.pres;
+    _co2_sum += data.co2;
+    _pm1_0_sum += data.pm1_0;
+    _pm2_5_sum += data.pm2_5;
+    _pm10_sum += data.pm10;
+    if (data.pm2_5 > _pm2_5_max) {
+        _pm2_5_max = data.pm2_5;
+    }
+    if (data.pm10 > _pm10_max) {
+        _pm10_max = data.pm10;
+    }
+    if (data.battery_mv > 0 && data.battery_mv < _battery_min) {
+        _battery_min = data.battery_mv;
+    }
+    if (data.sensor_status & SENSOR_STATUS_GPS_FIX) {
+        _fix_samples++;
+        _latitude = data.latitude;
+        _longitude = data.longitude;
+    }
+
+    return written;
+}
+
+bool AggregateLog::flush() {
+    if (_samples == 0) {
+        return true;
+    }
+
+    AggregateRecord record;
+    record.timestamp = _minute;
+    record.latitude = _latitude;
+    record.longitude = _longitude;
+    record.temp = (int16_t)(_temp_sum * 100.0f / _samples);
+    record.hum = (uint16_t)(_hum_sum * 100.0f / _samples);
+    record.pres = (uint16_t)(_pres_sum * 10.0f / _samples);
+    record.co2 = (uint16_t)(_co2_sum / _samples);
+    record.pm1_0 = (uint16_t)(_pm1_0_sum / _samples);
+    record.pm2_5 = (uint16_t)(_pm2_5_sum / _samples);
+    record.pm10 = (uint16_t)(_pm10_sum / _samples);
+    record.pm2_5_max = _pm2_5_max;
+    record.pm10_max = _pm10_max;
+    record.battery_mv = _battery_min == 0xFFFF ? 0 : _battery_min;
+    record.samples = _samples > 255 ? 255 : (uint8_t)_samples;
+    record.fix_samples = _fix_samples > 255 ? 255 : (uint8_t)_fix_samples;
+
+    // The minute is done either way, a failed write is not retried
+    _samples = 0;
+    return _stream.append(AGGREGATE_TYPE_MINUTE, &record, sizeof(record));
+}
+
+bool AggregateLog::decode(const FlashStreamEntry& entry, AggregateRecord& record) {
+    if (entry.type != AGGREGATE_TYPE_MINUTE || entry.size < sizeof(AggregateRecord)) {
+        return false;
+    }
+
+    memcpy(&record, entry.payload, sizeof(record));
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef AGGREGATE_LOG_H
+#define AGGREGATE_LOG_H
+
+#include "flash.h"
+#include "flash_stream.h"
+
+// Entry types of the aggregate stream
+#define AGGREGATE_TYPE_MINUTE     1
+
+#pragma pack(push, 1)
+// Summary of the readings of one minute, a few dozen bytes instead of one record per reading
+struct AggregateRecord {
+    uint32_t timestamp;      // Start of the minute (Unix time)
+    uint32_t latitude;       // Last position of the minute with a fix, SensorData format
+    uint32_t longitude;
+    int16_t temp;            // Mean temperature in 0.01 degC
+    uint16_t hum;            // Mean humidity in 0.01 %
+    uint16_t pres;           // Mean pressure in 0.1 hPa
+    uint16_t co2;            // Mean CO2 in ppm
+    uint16_t pm1_0;          // Mean particulate matter in ug/m3
+    uint16_t pm2_5;
+    uint16_t pm10;
+    uint16_t pm2_5_max;      // Highest readings of the minute
+    uint16_t pm10_max;
+    uint16_t battery_mv;     // Lowest battery voltage of the minute
+    uint8_t samples;         // Readings in the minute
+    uint8_t fix_samples;     // Readings with a GPS fix
+};
+#pragma pack(pop)
+
+// Builds per-minute aggregates from the sensor readings and appends them to the
+// aggregate stream. Only the minute in progress is kept in RAM.
+class AggregateLog {
+public:
+    AggregateLog(FlashStream& stream);
+
+    // Add a reading. When it starts a new minute the previous one is written first.
+    bool add(const SensorData& data);
+
+    // Write the minute in progress now (before sleep or on a brownout)
+    bool flush();
+
+    // Decode an entry of the aggregate stream
+    static bool decode(const FlashStreamEntry& entry, AggregateRecord& record);
+
+    FlashStream& stream() { return _stream; }
+
+private:
+    // Reset the running sums for the minute starting at timestamp
+    void startMinute(uint32_t timestamp);
+
+    FlashStream& _stream;
+    uint32_t _minute = 0;           // Start of the minute in progress, 0 if none
+    uint32_t _samples = 0;
+    uint32_t _fix_samples = 0;
+    float _temp_sum = 0.0f;
+    float _hum_sum = 0.0f;
+    float _pres_sum = 0.0f;
+    uint32_t _co2_sum = 0;
+    uint32_t _pm1_0_sum = 0;
+    uint32_t _pm2_5_sum = 0;
+    uint32_t _pm10_sum = 0;
+    uint16_t _pm2_5_max = 0;
+    uint16_t _pm10_max = 0;
+    uint16_t _battery_min = 0;
+    uint32_t _latitude = 0;
+    uint32_t _longitude = 0;
+};
+
+#endif // AGGREGATE_LOG_H
@@ -0,0 +1,76 @@
+#include "crc32.h"
+
+#if PICO_ON_DEVICE
+#include "hardware/dma.h"
+#endif
+
+// Reflected polynomial of CRC-32 (IEEE 802.3)
+#define CRC32_POLYNOMIAL 0xEDB88320
+
+static uint32_t crc32_table[256];
+static bool crc32_table_ready = false;
+
+static uint32_t crc32Table(const uint8_t* data, size_t size) {
+    if (!crc32_table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLYNOMIAL : crc >> 1;
+            }
+            crc32_table[i] = crc;
+        }
+        crc32_table_ready = true;
+    }
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc32_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if PICO_ON_DEVICE
+// DMA channel used for checksums, claimed on first use (-1 if none was free)
+static int crc32_dma_channel = -1;
+static bool crc32_dma_checked = false;
+
+static uint32_t crc32Sniffer(uint channel, const void* data, size_t size) {
+    // The data is written byte by byte into this dummy, only the sniffer sees it
+    static uint8_t dma_sink;
+
+    dma_channel_config config = dma_channel_get_default_config(channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_sniff_enable(&config, true);
+
+    // CRC32R shifts the bit-reversed data, reversing and inverting the result gives
+    // the standard reflected CRC-32
+    dma_sniffer_set_data_accumulator(0xFFFFFFFF);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+
+    dma_channel_configure(channel, &config, &dma_sink, data, size, true);
+    dma_channel_wait_for_finish_blocking(channel);
+
+    uint32_t crc = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    return crc;
+}
+#endif
+
+uint32_t crc32Compute(const void* data, size_t size) {
+#if PICO_ON_DEVICE
+    if (!crc32_dma_checked) {
+        crc32_dma_channel = dma_claim_unused_channel(false);
+        crc32_dma_checked = true;
+    }
+
+    if (crc32_dma_channel >= 0 && size > 0) {
+        return crc32Sniffer((uint)crc32_dma_channel, data, size);
+    }
+#endif
+
+    return crc32Table((const uint8_t*)data, size);
+}
@@ -0,0 +1,16 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3, same result as zlib crc32()) used for record and page integrity checks.
+//
+// On the Pico the checksum is computed by the DMA sniffer while a DMA channel streams the
+// data into a dummy register, so the CPU only sets up the transfer. Host builds and boards
+// without a free DMA channel use a table-driven implementation with the same result.
+
+// CRC-32 of size bytes at data (RAM or XIP flash)
+uint32_t crc32Compute(const void* data, size_t size);
+
+#endif // CRC32_H
@@ -0,0 +1,65 @@
+#include "event_log.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include "pico/stdlib.h"
+
+EventLog::EventLog(FlashStream& stream) : _stream(stream) {
+}
+
+bool EventLog::log(uint8_t type, int32_t value, int32_t value2) {
+    EventRecord record;
+    record.timestamp = (uint32_t)time(NULL);
+    record.uptime_ms = to_ms_since_boot(get_absolute_time());
+    record.value = value;
+    record.value2 = value2;
+
+    if (!_stream.append(type, &record, sizeof(record))) {
+        printf("FLASH WARNING: Event %s could not be logged\n", eventName(type));
+        return false;
+    }
+    return true;
+}
+
+void EventLog::printEvents(uint32_t count) {
+    uint32_t total = _stream.getEntryCount();
+    uint32_t skip = total > count ? total - count : 0;
+
+    printf("EVENTS: %lu stored, showing the newest %lu\n",
+           (unsigned long)total, (unsigned long)(total - skip));
+
+    FlashStreamCursor cursor = _stream.entries();
+    FlashStreamEntry entry;
+    EventRecord record;
+    while (cursor.next(entry)) {
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        if (decode(entry, record)) {
+            printf("EVENTS: %lu (uptime %lu ms) %s %ld %ld\n",
+                   (unsigned long)record.timestamp, (unsigned long)record.uptime_ms,
+                   eventName(entry.type), (long)record.value, (long)record.value2);
+        }
+    }
+}
+
+bool EventLog::decode(const FlashStreamEntry& entry, EventRecord& record) {
+    if (entry.size < sizeof(EventRecord)) {
+        return false;
+    }
+
+    memcpy(&record, entry.payload, sizeof(record));
+    return true;
+}
+
+const char* EventLog::eventName(uint8_t type) {
+    switch (type) {
+        case EVENT_BOOT:        return "BOOT";
+        case EVENT_UPLOAD:      return "UPLOAD";
+        case EVENT_GPS_FIX:     return "GPS_FIX";
+        case EVENT_BROWNOUT:    return "BROWNOUT";
+        case EVENT_FLASH_ERROR: return "FLASH_ERROR";
+        default:                return "UNKNOWN";
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include "flash_stream.h"
+
+// Event types of the event stream and the meaning of their values
+#define EVENT_BOOT                1             // value: 1 if the watchdog caused the reset
+#define EVENT_UPLOAD              2             // value: records, value2: 1 = success, 0 = failure
+#define EVENT_GPS_FIX             3             // value: 1 = fix gained, 0 = fix lost, value2: satellites
+#define EVENT_BROWNOUT            4             // value: supply voltage in mV, value2: records flushed
+#define EVENT_FLASH_ERROR         5             // value: failed batch writes so far
+
+#pragma pack(push, 1)
+// Payload of an event entry
+struct EventRecord {
+    uint32_t timestamp;      // Unix time (small values before the clock was set)
+    uint32_t uptime_ms;      // Time since boot
+    int32_t value;
+    int32_t value2;
+};
+#pragma pack(pop)
+
+// Compact binary diagnostics log on top of a flash stream, replaces debugging over USB
+// printf for things that happen in the field.
+class EventLog {
+public:
+    EventLog(FlashStream& stream);
+
+    // Append an event stamped with the current time
+    bool log(uint8_t type, int32_t value = 0, int32_t value2 = 0);
+
+    // Print the newest count events over USB
+    void printEvents(uint32_t count);
+
+    // Decode an entry of the event stream
+    static bool decode(const FlashStreamEntry& entry, EventRecord& record);
+
+    // Name of an event type for log output
+    static const char* eventName(uint8_t type);
+
+    FlashStream& stream() { return _stream; }
+
+private:
+    FlashStream& _stream;
+};
+
+#endif // EVENT_LOG_H
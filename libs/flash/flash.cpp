@@ -1,21 +1,137 @@
 #include "flash.h"
+#include "flash_bulk_reader.h"
+#include "crc32.h"
+#include <cstddef>
 #include <cstring>
 #include <algorithm>
 #include <cstdio>  // Add this include for printf
 #include <cmath>  // For fabs()
 #include <string.h>
-#include "pico/unique_id.h"
 
 // Constants - Using the SDK's macros directly instead of redefining them
 // (removes the redefinition warnings)
-#define DATA_COUNT_SIZE   sizeof(uint32_t)
 
-// Default flash target offset (1.8MB from beginning of flash)
-#define DEFAULT_FLASH_TARGET_OFFSET (1792 * 1024)
+// Where firmware before the sized region kept its fixed 32 sector journal (1.75MB into flash)
+#define LEGACY_FLASH_TARGET_OFFSET (1792 * 1024)
 
-Flash::Flash(uint32_t flash_offset) {
+// Erased per call while formatting, interrupts are serviced between the calls
+#define FLASH_FORMAT_ERASE_SIZE (64 * 1024)
+
+// Bytes a wear entry takes in the upload log, the counters padded to whole words
+static uint32_t wearEntrySize(uint32_t sector_count, uint32_t counter_size = sizeof(uint32_t)) {
+    return sizeof(WearLogEntry) + ((sector_count * counter_size + 3) & ~3u);
+}
+
+// Schema 1 records (magic 0xABCD1234), upgraded to the current fields while decoding
+static bool decodeRecordV1(const uint8_t* bytes, SensorData& data, uint8_t& flags) {
+    const SerializedSensorData* record = (const SerializedSensorData*)bytes;
+    flags = record->flags;
+    
+    // Erased slots, tombstones and torn writes all fail one of these checks
+    if (record->magic != 0xABCD1234 ||
+        record->checksum != crc32Compute(record, offsetof(SerializedSensorData, checksum))) {
+        return false;
+    }
+    
+    data.temp = record->temp;
+    data.hum = record->hum;
+    data.pres = record->pres;
+    data.gasRes = record->gasRes;
+    data.pm2_5 = record->pm2_5;
+    data.pm5 = record->pm5;
+    data.pm10 = record->pm10;
+    data.co2 = record->co2;
+    data.latitude = record->latitude;
+    data.longitude = record->longitude;
+    data.timestamp = record->timestamp;
+    data.is_fake_gps = (record->flags & RECORD_FLAG_FAKE_GPS) != 0;
+    upgradeSensorData(data, RECORD_SCHEMA_V1);
+    
+    return true;
+}
+
+// Schema 2 and 3 share the raw layout
+static bool decodeRecordV2Layout(const uint8_t* bytes, uint8_t schema, SensorData& data, uint8_t& flags) {
+    const SerializedSensorDataV2* record = (const SerializedSensorDataV2*)bytes;
+    flags = record->flags;
+    
+    if (record->header.magic != RECORD_MAGIC || record->header.schema != schema ||
+        record->header.size != sizeof(SerializedSensorDataV2) ||
+        record->checksum != crc32Compute(record, offsetof(SerializedSensorDataV2, checksum))) {
+        return false;
+    }
+    
+    data.timestamp = record->timestamp;
+    data.latitude = record->latitude;
+    data.longitude = record->longitude;
+    data.temp = record->temp;
+    data.hum = record->hum;
+    data.pres = record->pres;
+    data.gasRes = record->gasRes;
+    data.co2 = record->co2;
+    data.pm1_0 = record->pm1_0;
+    data.pm2_5 = record->pm2_5;
+    data.pm5 = record->pm5;
+    data.pm10 = record->pm10;
+    data.battery_mv = record->battery_mv;
+    data.hdop = record->hdop;
+    data.speed = record->speed;
+    data.sensor_status = record->sensor_status;
+    data.is_fake_gps = (record->flags & RECORD_FLAG_FAKE_GPS) != 0;
+    data.fix_type = record->fix_type;
+    data.satellites_used = record->satellites_used;
+    
+    return true;
+}
+
+static bool decodeRecordV2(const uint8_t* bytes, SensorData& data, uint8_t& flags) {
+    if (!decodeRecordV2Layout(bytes, RECORD_SCHEMA_V2, data, flags)) {
+        return false;
+    }
+    upgradeSensorData(data, RECORD_SCHEMA_V2);
+    return true;
+}
+
+static bool decodeRecordV3(const uint8_t* bytes, SensorData& data, uint8_t& flags) {
+    return decodeRecordV2Layout(bytes, RECORD_SCHEMA_V3, data, flags);
+}
+
+// Raw record layout of every schema that can be read
+struct RawRecordSchema {
+    uint8_t schema;
+    uint32_t size;
+    RawRecordDecoder decode;
+};
+
+static const RawRecordSchema raw_schemas[] = {
+    { RECORD_SCHEMA_V1, sizeof(SerializedSensorData),   decodeRecordV1 },
+    { RECORD_SCHEMA_V2, sizeof(SerializedSensorDataV2), decodeRecordV2 },
+    { RECORD_SCHEMA_V3, sizeof(SerializedSensorDataV2), decodeRecordV3 },
+};
+
+static const RawRecordSchema* rawRecordSchema(uint8_t schema) {
+    for (size_t i = 0; i < sizeof(raw_schemas) / sizeof(raw_schemas[0]); i++) {
+        if (raw_schemas[i].schema == schema) {
+            return &raw_schemas[i];
+        }
+    }
+    return nullptr;
+}
+
+Flash::Flash(uint32_t flash_offset, FlashHal* hal, uint32_t reserved_sectors) {
+    _hal = hal ? hal : &defaultFlashHal();
+    
+    // The region grows downwards from a fixed end, so its top sector with the region header
+    // stays in place whatever size the region had when it was formatted
+    _configured_region_end = _hal->size() - reserved_sectors * FLASH_SECTOR_SIZE;
+    setRegionEnd(_configured_region_end);
+    
+    // Nothing may be stored below the end of the firmware image
+    _min_offset = _hal->imageEnd() + (FLASH_SECTOR_SIZE - 1);
+    _min_offset -= _min_offset % FLASH_SECTOR_SIZE;
+    
     if (flash_offset == 0) {
-        _flash_offset = DEFAULT_FLASH_TARGET_OFFSET;
+        _flash_offset = _min_offset + FLASH_REGION_MARGIN;
     } else {
         _flash_offset = flash_offset;
     }
@@ -28,24 +144,103 @@ Flash::Flash(uint32_t flash_offset) {
         _flash_offset = aligned_offset;
     }
     
-    // Setup addresses - ensure sector alignment
-    _data_count_address = _flash_offset;
+    if (_flash_offset < _min_offset) {
+        printf("FLASH WARNING: Offset 0x%08x is inside the firmware image (ends at 0x%08x), using 0x%08x\n",
+               (unsigned int)_flash_offset, (unsigned int)_hal->imageEnd(), (unsigned int)(_min_offset + FLASH_REGION_MARGIN));
+        _flash_offset = _min_offset + FLASH_REGION_MARGIN;
+    }
+    
+    // _flash_offset is the preferred start from here on, init() may keep a smaller stored region
+    _preferred_offset = _flash_offset;
     
-    // Calculate sector-aligned data start address
-    // Use a full sector for the count information
-    _data_start_address = _flash_offset + FLASH_SECTOR_SIZE;
+    memset(_erase_counts, 0, sizeof(_erase_counts));
+    memset(_boot_erase_counts, 0, sizeof(_boot_erase_counts));
     
-    // Calculate max data count
-    // Increase storage from 16 sectors to 32 sectors for more capacity
-    uint32_t storage_size = 32 * FLASH_SECTOR_SIZE - FLASH_SECTOR_SIZE;
-    _max_data_count = storage_size / SENSOR_DATA_SIZE;
+    uint32_t sectors = preferredRegionSectors();
+    if (sectors == 0) {
+        printf("FLASH ERROR: No room for the storage region between 0x%08x and 0x%08x, flash writes disabled\n",
+               (unsigned int)_preferred_offset, (unsigned int)_region_end);
+        // Keeps the journal state consistent, nothing is ever written with this geometry
+        setRegionGeometry(FLASH_MIN_REGION_SECTORS);
+        _region_sectors = 0;
+        _flash_enabled = false;
+    } else {
+        setRegionGeometry(sectors);
+    }
     
     _stored_data_count = 0;
+    resetJournalState();
     
     printf("FLASH: Storage initialized with offset 0x%08x, data start 0x%08x, capacity %lu records\n",
            (unsigned int)_flash_offset, (unsigned int)_data_start_address, _max_data_count);
 }
 
+void Flash::setRegionEnd(uint32_t region_end) {
+    _region_end = region_end;
+    _header_address = _region_end - FLASH_SECTOR_SIZE;
+    _upload_log_address = _header_address - FLASH_UPLOAD_LOG_SECTORS * FLASH_SECTOR_SIZE;
+}
+
+bool Flash::isRegionHeaderValid(const FlashRegionHeader& header, uint32_t region_end) const {
+    return header.magic == FLASH_REGION_MAGIC &&
+           header.version == FLASH_JOURNAL_VERSION &&
+           header.header_size == sizeof(JournalSectorHeader) &&
+           header.sector_count >= FLASH_MIN_REGION_SECTORS &&
+           header.sector_count <= FLASH_MAX_REGION_SECTORS &&
+           header.region_offset == region_end - header.sector_count * FLASH_SECTOR_SIZE &&
+           header.record_size == JOURNAL_RECORD_SIZE;
+}
+
+uint32_t Flash::findMovedRegion() const {
+    // The header is the top sector of the region, look for one that matches its own end.
+    // Of several (an old header left in a pool) the one closest to the configured end wins.
+    uint32_t lowest_end = _min_offset + FLASH_MIN_REGION_SECTORS * FLASH_SECTOR_SIZE;
+    uint32_t found_end = 0;
+    uint32_t found_distance = 0;
+    
+    for (uint32_t end = _hal->size(); end >= lowest_end && end > 0; end -= FLASH_SECTOR_SIZE) {
+        if (end == _configured_region_end) {
+            continue;
+        }
+        
+        FlashRegionHeader header;
+        memcpy(&header, _hal->map(end - FLASH_SECTOR_SIZE), sizeof(header));
+        if (!isRegionHeaderValid(header, end)) {
+            continue;
+        }
+        
+        uint32_t distance = end > _configured_region_end ? end - _configured_region_end : _configured_region_end - end;
+        if (found_end == 0 || distance < found_distance) {
+            found_end = end;
+            found_distance = distance;
+        }
+    }
+    
+    return found_end;
+}
+
+void Flash::setRegionGeometry(uint32_t sector_count) {
+    _region_sectors = sector_count;
+    _flash_offset = _region_end - sector_count * FLASH_SECTOR_SIZE;
+    
+    // Journal sectors from the bottom of the region up to the upload log
+    _data_start_address = _flash_offset;
+    _data_sector_count = sector_count - 1 - FLASH_UPLOAD_LOG_SECTORS;
+    
+    // Calculate max data count, the journal wraps around so every sector holds records
+    _max_data_count = _data_sector_count * JOURNAL_RECORDS_PER_SECTOR;
+}
+
+uint32_t Flash::preferredRegionSectors() const {
+    if (_preferred_offset >= _region_end) {
+        return 0;
+    }
+    
+    uint32_t sectors = std::min((_region_end - _preferred_offset) / FLASH_SECTOR_SIZE,
+                                (uint32_t)FLASH_MAX_REGION_SECTORS);
+    return sectors >= FLASH_MIN_REGION_SECTORS ? sectors : 0;
+}
+
 Flash::~Flash() {
     // Nothing to clean up
 }
@@ -61,733 +256,1856 @@ bool Flash::init() {
         return true;
     }
     
-    // Ensure addresses are sector-aligned for operations
-    uint32_t count_sector_offset = _data_count_address % FLASH_SECTOR_SIZE;
-    uint32_t count_sector_address = _data_count_address - count_sector_offset;
-    
-    // Recalculate data start address to be after count sector
-    uint32_t aligned_data_start = count_sector_address + FLASH_SECTOR_SIZE;
-    
-    // If the original _data_start_address isn't aligned, update it
-    if (_data_start_address != aligned_data_start) {
-        printf("FLASH: Adjusting data start address for sector alignment: 0x%08x -> 0x%08x\n",
-               (unsigned int)_data_start_address, (unsigned int)aligned_data_start);
-        _data_start_address = aligned_data_start;
-    }
-    
-    // Read stored count from flash
-    const uint32_t* stored_count_ptr = (const uint32_t*)flashAddressToXIP(_data_count_address);
-    uint32_t stored_count = *stored_count_ptr;
-    
-    printf("FLASH: Read stored count: %lu (0x%08x)\n", stored_count, stored_count);
-    
     // Check if we should force a full storage reset for debugging purposes
     #if defined(FORCE_FLASH_RESET) && FORCE_FLASH_RESET == 1
     printf("FLASH: FORCE_FLASH_RESET defined, performing full reset\n");
-    resetStorage();
-    stored_count = 0;
+    if (!formatRegion()) {
+        printf("FLASH ERROR: Storage reset failed, continuing with in-memory only mode\n");
+        _stored_data_count = 0;
+        _flash_enabled = false;  // Disable flash operations after failure
+        return true;  // Return true to continue with in-memory mode
+    }
     #endif
     
-    // Validate count (simple check to see if flash is initialized)
-    if (stored_count == 0xFFFFFFFF) { // Erased flash is all 1's
-        printf("FLASH: First-time initialization (all 0xFF)\n");
-        _stored_data_count = 0;
-        
-        // Initialize by writing 0 as the count
-        uint32_t count = 0;
-        
-        // Erase the page containing the count using our safe function
-        printf("FLASH: Initializing count at 0x%08x\n", (unsigned int)_data_count_address);
+    // Read the region header to find out which layout is stored in flash
+    FlashRegionHeader header;
+    memcpy(&header, flashPointer(_header_address), sizeof(header));
+    bool layout_valid = isRegionHeaderValid(header, _region_end);
+    
+    // A region formatted while a different number of sectors was reserved after it ends
+    // elsewhere. It stays there, formatting would drop records that were not uploaded.
+    if (!layout_valid) {
+        uint32_t moved_end = findMovedRegion();
+        if (moved_end != 0) {
+            printf("FLASH WARNING: Storage region ends at 0x%08x instead of 0x%08x (reserved sectors changed), "
+                   "kept there until the storage is erased\n",
+                   (unsigned int)moved_end, (unsigned int)_configured_region_end);
+            setRegionEnd(moved_end);
+            memcpy(&header, flashPointer(_header_address), sizeof(header));
+            layout_valid = true;
+        }
+    }
+    
+    // A firmware update that grew the image into the region overwrote its lowest sectors.
+    // The header and upload log at the top survived, the wear counters are kept.
+    bool image_overlap = layout_valid && header.region_offset < _min_offset;
+    if (image_overlap) {
+        setRegionGeometry(header.sector_count);
+        resetJournalState();
+        loadUploadState();
+    }
+    
+    if (!layout_valid || image_overlap) {
+        if (image_overlap) {
+            printf("FLASH WARNING: Firmware image (ends at 0x%08x) reaches into the storage region at 0x%08x, "
+                   "relocating the region and dropping its records\n",
+                   (unsigned int)_hal->imageEnd(), (unsigned int)header.region_offset);
+        } else if (header.magic == 0xFFFFFFFF) {
+            printf("FLASH: First-time initialization (all 0xFF)\n");
+            
+            // The old layout sits inside the new region, formatting erases it
+            if (LEGACY_FLASH_TARGET_OFFSET >= _flash_offset && LEGACY_FLASH_TARGET_OFFSET < _header_address) {
+                FlashRegionHeader legacy_header;
+                memcpy(&legacy_header, flashPointer(LEGACY_FLASH_TARGET_OFFSET), sizeof(legacy_header));
+                if (legacy_header.magic == FLASH_REGION_MAGIC) {
+                    printf("FLASH WARNING: Journal of the fixed 32 sector layout found at 0x%08x, its records are not carried over\n",
+                           (unsigned int)LEGACY_FLASH_TARGET_OFFSET);
+                }
+            }
+        } else if (header.magic == FLASH_REGION_MAGIC && header.version != FLASH_JOURNAL_VERSION) {
+            // Version 1 journals used an additive checksum, version 2 had no upload log
+            printf("FLASH WARNING: Journal version %u is not supported, formatting region\n", header.version);
+        } else {
+            // Old count-sector layout or a different journal geometry, the records
+            // cannot be located reliably so the region is formatted
+            printf("FLASH WARNING: Unknown storage layout (magic 0x%08x), formatting region\n",
+                   (unsigned int)header.magic);
+        }
         
-        // Use our safe erase function that handles failures better
-        if (!safeFlashErase(_data_count_address, FLASH_PAGE_SIZE)) {
-            printf("FLASH ERROR: Failed to erase count page during initialization\n");
+        if (!formatRegion()) {
+            printf("FLASH ERROR: Failed to format storage region\n");
             printf("FLASH: Continuing with in-memory only mode (_stored_data_count = 0)\n");
             _stored_data_count = 0;
             _flash_enabled = false;  // Disable flash operations after failure
             return true;  // Return true to continue with in-memory mode
         }
         
-        // Program the count (0) using our safe function
-        if (!safeFlashProgram(_data_count_address, (const uint8_t*)&count, DATA_COUNT_SIZE)) {
-            printf("FLASH ERROR: Failed to program count during initialization\n");
-            printf("FLASH: Continuing with in-memory only mode (_stored_data_count = 0)\n");
-            _stored_data_count = 0;
-            _flash_enabled = false;  // Disable flash operations after failure
-            return true;  // Return true to continue with in-memory mode
+        if (!image_overlap) {
+            printf("FLASH: First-time initialization completed successfully\n");
         }
+    } else {
+        // Keep the stored region size, a firmware image that shrank leaves the space unused
+        // until the storage is erased
+        setRegionGeometry(header.sector_count);
         
-        printf("FLASH: First-time initialization completed successfully\n");
-    } else if (stored_count > _max_data_count) {
-        printf("FLASH ERROR: Invalid count (%lu) exceeds maximum (%lu), resetting storage\n", 
-               stored_count, _max_data_count);
+        // Rebuild the record count from the journal sector headers
+        scanJournal();
+        loadUploadState();
+    }
+    
+    printf("FLASH: Region of %lu sectors at 0x%08x-0x%08x, firmware image ends at 0x%08x\n",
+           _region_sectors, (unsigned int)_flash_offset, (unsigned int)_region_end,
+           (unsigned int)_hal->imageEnd());
+    printf("FLASH: Initialization complete. Storage can hold %lu records, %lu currently stored.\n", 
+           _max_data_count, _stored_data_count);
+    
+    if (_debug_level > 0 && _stored_data_count > 0) {
+        printf("FLASH: Journal tail sector %lu, head sector %lu (offset %lu, format %u), next sequence %lu\n",
+               _tail_sector, _head_sector, _head_offset, _head_format, _next_sequence);
+    }
+    
+    return true;
+}
+
+bool Flash::formatRegion() {
+    // A region kept at another end moves back to the configured one
+    uint32_t old_header_address = _header_address;
+    setRegionEnd(_configured_region_end);
+    
+    uint32_t sectors = preferredRegionSectors();
+    if (sectors == 0) {
+        printf("FLASH ERROR: No room for the storage region\n");
+        return false;
+    }
+    setRegionGeometry(sectors);
+    
+    printf("FLASH: Formatting %lu sectors starting at 0x%08x\n",
+           _region_sectors, (unsigned int)_flash_offset);
+    
+    for (uint32_t address = _flash_offset; address < _region_end; address += FLASH_FORMAT_ERASE_SIZE) {
+        uint32_t size = std::min((uint32_t)FLASH_FORMAT_ERASE_SIZE, _region_end - address);
+        if (!safeFlashErase(address, size)) {
+            printf("FLASH ERROR: Failed to erase storage region\n");
+            return false;
+        }
+    }
+    
+    resetJournalState();
+    _log_sector = 0;
+    _log_offset = 0;
+    _log_next_erased = true;
+    _log_self_contained = true;
+    for (uint32_t sector = 0; sector < _data_sector_count; sector++) {
+        _sector_erased[sector] = true;
+    }
+    
+    FlashRegionHeader header;
+    header.magic = FLASH_REGION_MAGIC;
+    header.version = FLASH_JOURNAL_VERSION;
+    header.header_size = sizeof(JournalSectorHeader);
+    header.sector_count = _region_sectors;
+    header.record_size = JOURNAL_RECORD_SIZE;
+    header.region_offset = _flash_offset;
+    header.image_end = _hal->imageEnd();
+    
+    if (!programRange(_header_address, (const uint8_t*)&header, sizeof(header))) {
+        printf("FLASH ERROR: Failed to write region header\n");
+        return false;
+    }
+    
+    // The upload log was erased with the region, keep the wear statistics
+    saveWearState();
+    
+    // A header left outside the new region would be found again by findMovedRegion()
+    if (old_header_address < _flash_offset || old_header_address >= _region_end) {
+        FlashRegionHeader old_header;
+        memcpy(&old_header, flashPointer(old_header_address), sizeof(old_header));
+        if (old_header.magic == FLASH_REGION_MAGIC &&
+            !safeFlashErase(old_header_address, FLASH_SECTOR_SIZE)) {
+            printf("FLASH WARNING: Failed to erase the old region header at 0x%08x\n",
+                   (unsigned int)old_header_address);
+        }
+    }
+    
+    return true;
+}
+
+void Flash::resetJournalState() {
+    _stored_data_count = 0;
+    _uploaded_count = 0;
+    _tail_sector = 0;
+    _head_sector = _data_sector_count - 1;
+    _head_offset = FLASH_SECTOR_SIZE;
+    _head_format = _record_format;
+    _used_sectors = 0;
+    _next_sequence = 0;
+    _head_open = false;
+    _head_full = false;
+    resetDeltaState(_head_delta);
+    memset(_sector_records, 0, sizeof(_sector_records));
+    memset(_sector_erased, 0, sizeof(_sector_erased));
+    for (uint32_t sector = 0; sector < FLASH_MAX_REGION_SECTORS; sector++) {
+        clearSectorSummary(sector);
+    }
+    clearChunkAcks();
+    updateCapacityEstimate();
+}
+
+void Flash::scanJournal() {
+    bool found = false;
+    uint32_t min_sequence = 0;
+    uint32_t max_sequence = 0;
+    uint8_t head_schema = RECORD_SCHEMA_CURRENT;
+    
+    resetJournalState();
+    
+    // Find the oldest and newest journal sector by their sequence numbers.
+    // The upload watermark is restored afterwards by loadUploadState().
+    for (uint32_t sector = 0; sector < _data_sector_count; sector++) {
+        JournalSectorHeader sector_header;
+        memcpy(&sector_header, journalPointer(sector, 0), sizeof(sector_header));
         
-        if (!resetStorage()) {
-            printf("FLASH ERROR: Storage reset failed, continuing with in-memory only mode\n");
-            _stored_data_count = 0;
-            _flash_enabled = false;  // Disable flash operations after failure
-            return true;  // Return true to continue with in-memory mode
+        if (sector_header.magic != JOURNAL_SECTOR_MAGIC) {
+            continue;
         }
         
-        _stored_data_count = 0;
-        return true;
+        if (!found || sector_header.sequence < min_sequence) {
+            min_sequence = sector_header.sequence;
+            _tail_sector = sector;
+        }
+        if (!found || sector_header.sequence > max_sequence) {
+            max_sequence = sector_header.sequence;
+            _head_sector = sector;
+            _head_format = sector_header.format;
+            head_schema = sector_header.schema == 0xFF ? RECORD_SCHEMA_V1 : sector_header.schema;
+        }
+        found = true;
+    }
+    
+    if (!found) {
+        // Formatted but nothing appended yet
+        resetJournalState();
+        return;
+    }
+    
+    // Count the records of every sector from the oldest to the newest one
+    uint32_t corrupted_pages = 0;
+    _used_sectors = (_head_sector + _data_sector_count - _tail_sector) % _data_sector_count + 1;
+    for (uint32_t i = 0; i < _used_sectors; i++) {
+        uint32_t sector = (_tail_sector + i) % _data_sector_count;
+        _sector_records[sector] = countSectorRecords(sector, _head_offset, corrupted_pages);
+        _stored_data_count += _sector_records[sector];
+    }
+    
+    if (corrupted_pages > 0) {
+        printf("FLASH WARNING: %lu journal pages failed their CRC check, their records are skipped\n",
+               corrupted_pages);
+    }
+    
+    // _head_offset now holds the end of the head sector. The delta encoder state is not
+    // rebuilt, appending continues with a keyframe on the next page instead.
+    if (_head_format == JOURNAL_FORMAT_DELTA && _head_offset % FLASH_PAGE_SIZE != 0) {
+        _head_offset += FLASH_PAGE_SIZE - (_head_offset % FLASH_PAGE_SIZE);
+    }
+    resetDeltaState(_head_delta);
+    
+    _head_open = true;
+    // Records of the current schema are never appended to a sector of an older one
+    _head_full = (_head_format != JOURNAL_FORMAT_RAW && _head_format != JOURNAL_FORMAT_DELTA) ||
+                 head_schema != RECORD_SCHEMA_CURRENT;
+    _next_sequence = max_sequence + 1;
+    updateCapacityEstimate();
+    
+    if (_debug_level > 0) {
+        printf("FLASH: Journal scan found %lu sectors (sequence %lu..%lu), %lu records\n",
+               _used_sectors, min_sequence, max_sequence, _stored_data_count);
+    }
+    
+    discardUncommittedRecords();
+    
+    // The last page written before the reset stays partially filled, seal it now
+    if (_head_format == JOURNAL_FORMAT_DELTA && _head_offset >= FLASH_PAGE_SIZE) {
+        sealPage(_head_sector, _head_offset - 1);
+    }
+}
+
+uint32_t Flash::countSectorRecords(uint32_t sector, uint32_t& end_offset, uint32_t& corrupted_pages) {
+    JournalPosition pos;
+    startPosition(pos, sector);
+    
+    uint32_t count = 0;
+    uint32_t offset = sizeof(JournalSectorHeader);
+    
+    if (pos.format == JOURNAL_FORMAT_RAW) {
+        // A slot counts as used as soon as any byte of it was programmed
+        while (offset + pos.record_size <= FLASH_SECTOR_SIZE &&
+               !isErased(journalSectorAddress(sector) + offset, pos.record_size)) {
+            offset += pos.record_size;
+            count++;
+        }
+    } else if (pos.format == JOURNAL_FORMAT_DELTA) {
+        uint32_t last_page = 0xFFFFFFFF;
+        const uint8_t* sector_data = journalPointer(sector, 0);
+        while (findDeltaRecord(sector_data, offset)) {
+            if (offset / FLASH_PAGE_SIZE != last_page) {
+                last_page = offset / FLASH_PAGE_SIZE;
+                if (checkPageCrc(sector_data, last_page) == 0) {
+                    corrupted_pages++;
+                }
+            }
+            offset += sector_data[offset] + 1;
+            count++;
+        }
     } else {
-        printf("FLASH: Found valid count: %lu\n", stored_count);
-        _stored_data_count = stored_count;
+        // Missing header or unknown format, nothing in this sector can be read
+        offset = FLASH_SECTOR_SIZE;
+    }
+    
+    end_offset = offset;
+    return count;
+}
+
+int Flash::checkPageCrc(const uint8_t* sector_data, uint32_t page) {
+    uint32_t page_start = page * FLASH_PAGE_SIZE;
+    uint32_t data_start = page == 0 ? sizeof(JournalSectorHeader) : page_start;
+    uint32_t record_end = page_start + FLASH_PAGE_SIZE - JOURNAL_PAGE_CRC_SIZE;
+    
+    uint32_t trailer;
+    memcpy(&trailer, sector_data + record_end, sizeof(trailer));
+    if (trailer == JOURNAL_PAGE_CRC_OPEN || trailer == JOURNAL_PAGE_CRC_REVOKED) {
+        return -1;
+    }
+    
+    return crc32Compute(sector_data + data_start, record_end - data_start) == trailer ? 1 : 0;
+}
+
+bool Flash::sealPage(uint32_t sector, uint32_t offset) {
+    uint32_t page_start = offset - (offset % FLASH_PAGE_SIZE);
+    uint32_t data_start = page_start == 0 ? sizeof(JournalSectorHeader) : page_start;
+    uint32_t record_end = page_start + FLASH_PAGE_SIZE - JOURNAL_PAGE_CRC_SIZE;
+    
+    // Already sealed or revoked, a trailer can only be written once
+    if (!isErased(journalSectorAddress(sector) + record_end, JOURNAL_PAGE_CRC_SIZE)) {
+        return true;
+    }
+    
+    // A CRC that looks like an open or revoked trailer is left out, the records keep their own checks
+    uint32_t crc = crc32Compute(journalPointer(sector, data_start), record_end - data_start);
+    if (crc == JOURNAL_PAGE_CRC_OPEN || crc == JOURNAL_PAGE_CRC_REVOKED) {
+        return true;
+    }
+    
+    return programRange(journalSectorAddress(sector) + record_end, (const uint8_t*)&crc, sizeof(crc));
+}
+
+bool Flash::findDeltaRecord(const uint8_t* sector_data, uint32_t& offset) {
+    while (offset < FLASH_SECTOR_SIZE) {
+        uint32_t page_start = offset - (offset % FLASH_PAGE_SIZE);
+        uint32_t page_end = page_start + FLASH_PAGE_SIZE;
+        uint32_t record_end = page_end - JOURNAL_PAGE_CRC_SIZE;
+        uint32_t data_start = page_start == 0 ? sizeof(JournalSectorHeader) : page_start;
         
-        // Verify if actual data exists and matches the count
-        bool valid_data_found = false;
-        if (_stored_data_count > 0) {
-            // Check the first record to see if it has valid data
-            uint32_t test_address = _data_start_address;
-            const uint32_t* magic_ptr = (const uint32_t*)flashAddressToXIP(test_address);
-            printf("FLASH: Testing first record at 0x%08x, magic=0x%08x\n", 
-                  (unsigned int)test_address, (unsigned int)*magic_ptr);
-                  
-            if (*magic_ptr == 0xABCD1234) {
-                valid_data_found = true;
-                printf("FLASH: Found valid data signature\n");
-            } else if (*magic_ptr == 0xFFFFFFFF) {
-                printf("FLASH WARNING: Count > 0 but data area contains 0xFF values\n");
-                printf("FLASH WARNING: Data may be corrupted or missing\n");
-                
-                printf("FLASH: Detected inconsistency between count and data, resetting storage\n");
-                if (!resetStorage()) {
-                    printf("FLASH ERROR: Storage reset failed, continuing with in-memory only mode\n");
-                    _stored_data_count = 0;
-                    _flash_enabled = false;  // Disable flash operations after failure
-                    return true;  // Return true to continue with in-memory mode
-                }
-                return true;
-            } else {
-                printf("FLASH WARNING: Count > 0 but data has invalid magic number: 0x%08x\n", 
-                       (unsigned int)*magic_ptr);
-                printf("FLASH: Detected corrupted data, resetting storage\n");
-                
-                if (!resetStorage()) {
-                    printf("FLASH ERROR: Storage reset failed, continuing with in-memory only mode\n");
-                    _stored_data_count = 0;
-                    _flash_enabled = false;  // Disable flash operations after failure
-                    return true;  // Return true to continue with in-memory mode
-                }
-                return true;
+        if (offset >= record_end || record_end - offset < DELTA_RECORD_MIN_SIZE) {
+            offset = page_end;
+            continue;
+        }
+        
+        uint8_t length = sector_data[offset];
+        if (length == 0xFF) {
+            // The rest of the page is empty, a page without any record ends the sector
+            if (offset == data_start) {
+                return false;
             }
+            offset = page_end;
+            continue;
+        }
+        
+        uint32_t size = (uint32_t)length + 1;
+        if (size < DELTA_RECORD_MIN_SIZE || size > DELTA_RECORD_MAX_SIZE || offset + size > record_end) {
+            // Corrupted length byte, the rest of the page cannot be walked
+            offset = page_end;
+            continue;
         }
+        
+        return true;
     }
     
-    printf("FLASH: Initialization complete. Storage can hold %lu records, %lu currently stored.\n", 
-           _max_data_count, _stored_data_count);
+    return false;
+}
+
+void Flash::discardUncommittedRecords() {
+    // Find the last run of records still waiting for the final record of their batch.
+    // Torn records are invalid and neither open nor close a run.
+    JournalPosition pos;
+    SensorData data;
+    uint8_t flags;
+    uint32_t record_offset;
+    bool run_open = false;
+    uint32_t run_start = 0;
+    uint32_t invalid = 0;
+    
+    seekPosition(pos, 0);
+    for (uint32_t i = 0; i < _stored_data_count; i++) {
+        if (!readRecordAt(pos, data, flags, record_offset)) {
+            invalid++;
+            continue;
+        }
+        
+        // Records discarded below stay in the summary, it only has to be a superset
+        addToSectorSummary(pos.sector, data);
+        
+        if (flags & RECORD_FLAG_BATCH_PENDING) {
+            if (!run_open) {
+                run_open = true;
+                run_start = i;
+            }
+        } else {
+            run_open = false;
+        }
+    }
     
-    // Dump the first few bytes of the first record for diagnosis
-    if (_stored_data_count > 0) {
-        const uint8_t* data_ptr = (const uint8_t*)flashAddressToXIP(_data_start_address);
-        printf("FLASH: First record data preview: ");
-        for (int i = 0; i < 16; i++) {
-            printf("%02x ", data_ptr[i]);
+    // Includes records that were discarded before, they fail the check by design
+    if (invalid > 0 && _debug_level > 0) {
+        printf("FLASH: %lu stored records are discarded or failed their integrity check\n", invalid);
+    }
+    
+    if (!run_open) {
+        return;
+    }
+    
+    size_t discarded = 0;
+    seekPosition(pos, run_start);
+    for (uint32_t i = run_start; i < _stored_data_count; i++) {
+        if (readRecordAt(pos, data, flags, record_offset)) {
+            tombstoneRecord(pos.sector, record_offset, pos.format);
+            discarded++;
         }
-        printf("\n");
+    }
+    
+    printf("FLASH WARNING: Discarded %lu records of an incomplete batch\n", (unsigned long)discarded);
+}
+
+void Flash::tombstoneRecord(uint32_t sector, uint32_t offset, uint8_t format) {
+    uint32_t address = journalSectorAddress(sector) + offset;
+    
+    if (format == JOURNAL_FORMAT_RAW) {
+        // Clear the magic number
+        uint32_t tombstone = 0;
+        programRange(address, (const uint8_t*)&tombstone, sizeof(tombstone));
+    } else if (format == JOURNAL_FORMAT_DELTA) {
+        // Clear the flags byte including the live bit, the deltas stay decodable
+        uint8_t tombstone = 0;
+        programRange(address + 1, &tombstone, sizeof(tombstone));
+        
+        // The page CRC no longer matches, revoke the seal so the record checks are used instead
+        uint32_t trailer_offset = offset - (offset % FLASH_PAGE_SIZE) + FLASH_PAGE_SIZE - JOURNAL_PAGE_CRC_SIZE;
+        uint32_t revoked = JOURNAL_PAGE_CRC_REVOKED;
+        if (memcmp(journalPointer(sector, trailer_offset), &revoked, sizeof(revoked)) != 0) {
+            programRange(journalSectorAddress(sector) + trailer_offset, (const uint8_t*)&revoked, sizeof(revoked));
+        }
+    }
+}
+
+void Flash::clearSectorSummary(uint32_t sector) {
+    JournalSectorSummary& summary = _sector_summary[sector];
+    summary.min_timestamp = 0xFFFFFFFF;
+    summary.max_timestamp = 0;
+    summary.min_latitude = INT32_MAX;
+    summary.max_latitude = INT32_MIN;
+    summary.min_longitude = INT32_MAX;
+    summary.max_longitude = INT32_MIN;
+    summary.record_count = 0;
+    summary.position_count = 0;
+}
+
+void Flash::addToSectorSummary(uint32_t sector, const SensorData& data) {
+    JournalSectorSummary& summary = _sector_summary[sector];
+    summary.min_timestamp = std::min(summary.min_timestamp, data.timestamp);
+    summary.max_timestamp = std::max(summary.max_timestamp, data.timestamp);
+    summary.record_count++;
+    
+    if (data.latitude != 0 || data.longitude != 0) {
+        int32_t latitude = (int32_t)data.latitude;
+        int32_t longitude = (int32_t)data.longitude;
+        summary.min_latitude = std::min(summary.min_latitude, latitude);
+        summary.max_latitude = std::max(summary.max_latitude, latitude);
+        summary.min_longitude = std::min(summary.min_longitude, longitude);
+        summary.max_longitude = std::max(summary.max_longitude, longitude);
+        summary.position_count++;
+    }
+}
+
+bool Flash::sectorMatches(uint32_t sector, const FlashQuery& filter) const {
+    const JournalSectorSummary& summary = _sector_summary[sector];
+    if (summary.record_count == 0 ||
+        summary.max_timestamp < filter.from_timestamp || summary.min_timestamp > filter.to_timestamp) {
+        return false;
+    }
+    
+    if (filter.use_area) {
+        return summary.position_count > 0 &&
+               summary.max_latitude >= filter.min_latitude && summary.min_latitude <= filter.max_latitude &&
+               summary.max_longitude >= filter.min_longitude && summary.min_longitude <= filter.max_longitude;
     }
     
     return true;
 }
 
-bool Flash::saveSensorData(const SensorData& data) {
-    if (!_flash_enabled) {
-        if (_debug_level > 0) {
-            printf("FLASH: [DISABLED] Skipping sensor data save (operating in memory-only mode)\n");
+uint32_t Flash::skipUnmatchedSectors(JournalPosition& pos, const FlashQuery& filter) {
+    uint32_t skipped = 0;
+    
+    for (uint32_t i = 0; i < _data_sector_count; i++) {
+        if (pos.record < _sector_records[pos.sector]) {
+            if (sectorMatches(pos.sector, filter)) {
+                break;
+            }
+            skipped += _sector_records[pos.sector] - pos.record;
         }
-        return true;
+        startPosition(pos, (pos.sector + 1) % _data_sector_count);
     }
     
-    // Check if there's space
-    if (_stored_data_count >= _max_data_count) {
-        printf("FLASH ERROR: No space left for new records (max: %lu)\n", _max_data_count);
-        return false;
+    return skipped;
+}
+
+void Flash::startPosition(JournalPosition& pos, uint32_t sector, const uint8_t* image) {
+    JournalSectorHeader sector_header;
+    memcpy(&sector_header, image ? image : journalPointer(sector, 0), sizeof(sector_header));
+    
+    pos.sector = sector;
+    pos.image = image;
+    pos.record = 0;
+    pos.offset = sizeof(JournalSectorHeader);
+    pos.format = sector_header.magic == JOURNAL_SECTOR_MAGIC ? sector_header.format : 0;
+    pos.delta_page = 0xFFFFFFFF;
+    pos.delta_valid = false;
+    
+    // The decoders are picked once per sector, records are upgraded to the current schema as they are read
+    pos.schema = sector_header.schema == 0xFF ? RECORD_SCHEMA_V1 : sector_header.schema;
+    const RawRecordSchema* raw_schema = rawRecordSchema(pos.schema);
+    pos.delta_schema = deltaSchema(pos.schema);
+    pos.record_size = raw_schema ? raw_schema->size : 0;
+    pos.decode_raw = raw_schema ? raw_schema->decode : nullptr;
+    
+    // Sectors of a schema this firmware does not know cannot be read
+    if (!raw_schema || !pos.delta_schema) {
+        pos.format = 0;
+    }
+}
+
+void Flash::seekPosition(JournalPosition& pos, uint32_t index) {
+    uint32_t sector = _tail_sector;
+    for (uint32_t i = 0; i + 1 < _used_sectors && index >= _sector_records[sector]; i++) {
+        index -= _sector_records[sector];
+        sector = (sector + 1) % _data_sector_count;
     }
     
-    // Calculate storage address for this data point
-    uint32_t data_address = _data_start_address + (_stored_data_count * SENSOR_DATA_SIZE);
+    startPosition(pos, sector);
     
-    // Check if this write would cross a page boundary
-    uint32_t page_offset = data_address % FLASH_PAGE_SIZE;
-    uint32_t page_address = data_address - page_offset; // Get the start of the page
+    if (pos.format == JOURNAL_FORMAT_RAW) {
+        pos.record = index;
+        pos.offset += index * pos.record_size;
+        return;
+    }
+    
+    // Delta records can only be reached by decoding the chain of their page
+    SensorData data;
+    uint8_t flags;
+    uint32_t record_offset;
+    while (index-- > 0 && pos.record < _sector_records[pos.sector]) {
+        readRecordAt(pos, data, flags, record_offset);
+    }
+}
+
+bool Flash::readRecordAt(JournalPosition& pos, SensorData& data, uint8_t& flags, uint32_t& record_offset) {
+    // Move on to the next sector once all records of this one were read
+    for (uint32_t i = 0; i < _data_sector_count && pos.record >= _sector_records[pos.sector]; i++) {
+        startPosition(pos, (pos.sector + 1) % _data_sector_count);
+    }
     
-    // Calculate sector-aligned address for erasing
-    uint32_t sector_offset = page_address % FLASH_SECTOR_SIZE;
-    uint32_t sector_address = page_address - sector_offset;
+    flags = 0;
+    record_offset = pos.offset;
+    pos.record++;
     
-    // For safety, ensure we're in a valid region of flash
-    // Instead of checking against _data_start_address, check against overall flash area
-    if (sector_address < _flash_offset) {
-        printf("FLASH ERROR: Invalid sector address calculation: 0x%08x is below flash storage area (0x%08x)\n", 
-               (unsigned int)sector_address, (unsigned int)_flash_offset);
-        return false;
+    if (pos.format == JOURNAL_FORMAT_RAW) {
+        const uint8_t* record = sectorData(pos) + pos.offset;
+        pos.offset += pos.record_size;
+        return pos.decode_raw(record, data, flags);
     }
     
-    // Also check we're not too far beyond our allocated storage
-    uint32_t max_allowed_address = _flash_offset + (16 * FLASH_SECTOR_SIZE);
-    if (sector_address >= max_allowed_address) {
-        printf("FLASH ERROR: Invalid sector address calculation: 0x%08x exceeds allocated flash area (0x%08x)\n", 
-               (unsigned int)sector_address, (unsigned int)max_allowed_address);
+    const uint8_t* sector_data = sectorData(pos);
+    if (pos.format != JOURNAL_FORMAT_DELTA || !findDeltaRecord(sector_data, pos.offset)) {
         return false;
     }
     
-    if (page_offset + SENSOR_DATA_SIZE > FLASH_PAGE_SIZE) {
-        if (_debug_level > 0) {
-            printf("FLASH: Adjusting to prevent crossing page boundary\n");
+    record_offset = pos.offset;
+    uint32_t page = record_offset / FLASH_PAGE_SIZE;
+    if (page != pos.delta_page) {
+        // First record of a page is a keyframe, a page failing its CRC is skipped as a whole
+        resetDeltaState(pos.delta);
+        pos.delta_page = page;
+        pos.delta_valid = checkPageCrc(sector_data, page) != 0;
+        
+        if (!pos.delta_valid && _debug_level > 0) {
+            printf("FLASH WARNING: Page %lu of journal sector %lu failed its CRC check\n", page, pos.sector);
+        }
+    }
+    
+    bool valid;
+    uint32_t record_end = (page + 1) * FLASH_PAGE_SIZE - JOURNAL_PAGE_CRC_SIZE;
+    pos.offset += decodeDeltaRecord(sector_data + record_offset, record_end - record_offset,
+                                    pos.delta_schema, pos.delta, data, flags, valid);
+    
+    // A corrupted record breaks the delta chain for the rest of its page
+    if (!valid) {
+        pos.delta_valid = false;
+    }
+    
+    return pos.delta_valid && (flags & DELTA_FLAG_LIVE);
+}
+
+bool Flash::isErased(uint32_t address, size_t size) {
+    const uint8_t* ptr = (const uint8_t*)flashPointer(address);
+    for (size_t i = 0; i < size; i++) {
+        if (ptr[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Flash::programRange(uint32_t address, const uint8_t* data, size_t size) {
+    // Bytes outside the range are programmed as 0xFF, which leaves the flash contents unchanged
+    uint8_t* page_buffer = _program_buffer;
+    
+    uint32_t end_address = address + size;
+    uint32_t chunk_address = address - (address % FLASH_PAGE_SIZE);
+    
+    while (chunk_address < end_address) {
+        uint32_t chunk_end = chunk_address + sizeof(_program_buffer);
+        if (chunk_end > end_address) {
+            // Round the last chunk up to a whole page
+            chunk_end = end_address + (FLASH_PAGE_SIZE - 1);
+            chunk_end -= chunk_end % FLASH_PAGE_SIZE;
+        }
+        
+        memset(page_buffer, 0xFF, sizeof(_program_buffer));
+        uint32_t copy_start = std::max(chunk_address, address);
+        uint32_t copy_end = std::min(chunk_end, end_address);
+        memcpy(page_buffer + (copy_start - chunk_address), data + (copy_start - address), copy_end - copy_start);
+        
+        if (!safeFlashProgram(chunk_address, page_buffer, chunk_end - chunk_address)) {
+            return false;
         }
-        // Skip to the next page to avoid crossing page boundary
-        page_address += FLASH_PAGE_SIZE;
-        page_offset = 0;
-        data_address = page_address; // Start at beginning of next page
         
-        // Recalculate sector alignment for the new page address
-        sector_offset = page_address % FLASH_SECTOR_SIZE;
-        sector_address = page_address - sector_offset;
+        chunk_address = chunk_end;
+    }
+    
+    return true;
+}
+
+bool Flash::saveSensorData(const SensorData& data) {
+    if (!_flash_enabled) {
+        if (_debug_level > 0) {
+            printf("FLASH: [DISABLED] Skipping sensor data save (operating in memory-only mode)\n");
+        }
+        return true;
+    }
+    
+    // Check if there's space
+    if (!hasSpaceFor(1)) {
+        printf("FLASH ERROR: No space left for new records (max: %lu, pending: %lu)\n",
+               _max_data_count, getPendingCount());
+        return false;
+    }
+    
+    if (!appendRecords(&data, 1)) {
+        return false;
+    }
+    
+    if (_debug_level > 0) {
+        printf("FLASH: Successfully saved record %lu\n", _stored_data_count - 1);
+    }
+    
+    return true;
+}
+
+bool Flash::saveSensorDataBatch(const std::vector<SensorData>& data) {
+    if (data.empty()) {
+        return true;
+    }
+    
+    if (!_flash_enabled) {
+        if (_debug_level > 0) {
+            printf("FLASH: [DISABLED] Skipping batch save of %lu records (operating in memory-only mode)\n",
+                   (unsigned long)data.size());
+        }
+        return true;
+    }
+    
+    // Check if there's enough space
+    if (!hasSpaceFor(data.size())) {
+        printf("FLASH ERROR: No space left for batch of %lu records (stored: %lu, max: %lu)\n",
+               (unsigned long)data.size(), _stored_data_count, _max_data_count);
+        return false;
+    }
+    
+    if (!appendRecords(data.data(), data.size())) {
+        return false;
+    }
+    
+    if (_debug_level > 0) {
+        printf("FLASH: Successfully saved batch of %lu records, total %lu\n",
+               (unsigned long)data.size(), _stored_data_count);
+    }
+    
+    return true;
+}
+
+uint32_t Flash::headRoom() {
+    if (!_head_open || _head_full || _head_offset >= FLASH_SECTOR_SIZE) {
+        return 0;
+    }
+    
+    if (_head_format == JOURNAL_FORMAT_RAW) {
+        return (FLASH_SECTOR_SIZE - _head_offset) / JOURNAL_RAW_RECORD_SIZE;
+    }
+    
+    // Delta records never cross a page or its CRC trailer, assume the worst case size for each of them
+    uint32_t page_left = FLASH_PAGE_SIZE - (_head_offset % FLASH_PAGE_SIZE);
+    uint32_t pages_after = (FLASH_SECTOR_SIZE - _head_offset - page_left) / FLASH_PAGE_SIZE;
+    uint32_t page_records = (FLASH_PAGE_SIZE - JOURNAL_PAGE_CRC_SIZE) / DELTA_RECORD_MAX_SIZE;
+    if (page_left <= JOURNAL_PAGE_CRC_SIZE) {
+        return pages_after * page_records;
+    }
+    return (page_left - JOURNAL_PAGE_CRC_SIZE) / DELTA_RECORD_MAX_SIZE + pages_after * page_records;
+}
+
+uint32_t Flash::minRecordsPerSector(uint8_t format) const {
+    return format == JOURNAL_FORMAT_DELTA ? JOURNAL_DELTA_MIN_RECORDS_PER_SECTOR : JOURNAL_RECORDS_PER_SECTOR;
+}
+
+void Flash::updateCapacityEstimate() {
+    uint32_t per_sector = JOURNAL_RECORDS_PER_SECTOR;
+    
+    if (_record_format == JOURNAL_FORMAT_DELTA) {
+        // Full delta sectors tell how many records really fit, the head sector is still filling
+        uint32_t delta_records = 0;
+        uint32_t delta_sectors = 0;
+        for (uint32_t i = 0; i + 1 < _used_sectors; i++) {
+            uint32_t sector = (_tail_sector + i) % _data_sector_count;
+            const JournalSectorHeader* sector_header = (const JournalSectorHeader*)journalPointer(sector, 0);
+            if (sector_header->magic == JOURNAL_SECTOR_MAGIC && sector_header->format == JOURNAL_FORMAT_DELTA) {
+                delta_records += _sector_records[sector];
+                delta_sectors++;
+            }
+        }
+        per_sector = delta_sectors > 0 ? delta_records / delta_sectors : JOURNAL_DELTA_RECORDS_ESTIMATE;
+    }
+    
+    _max_data_count = _data_sector_count * per_sector;
+}
+
+bool Flash::hasSpaceFor(size_t count) {
+    uint32_t per_sector = minRecordsPerSector(_record_format);
+    uint32_t room = headRoom() + (_data_sector_count - _used_sectors) * per_sector;
+    if (count <= room) {
+        return true;
+    }
+    
+    // A batch must never need to reclaim the sector it is being written into
+    if (count > (_data_sector_count - 1) * per_sector) {
+        return false;
+    }
+    
+    if (_retention_policy == FLASH_RETENTION_OVERWRITE_OLDEST) {
+        return true;
+    }
+    
+    // Only sectors whose records were all uploaded can be reclaimed, never the head sector
+    uint32_t uploaded = _uploaded_count;
+    uint32_t sector = _tail_sector;
+    for (uint32_t i = 0; i + 1 < _used_sectors && _sector_records[sector] <= uploaded; i++) {
+        uploaded -= _sector_records[sector];
+        room += per_sector;
+        sector = (sector + 1) % _data_sector_count;
+    }
+    
+    return count <= room;
+}
+
+bool Flash::reclaimOldestSector() {
+    uint32_t sector_records = _sector_records[_tail_sector];
+    uint32_t uploaded_records = std::min(_uploaded_count, sector_records);
+    
+    if (uploaded_records < sector_records) {
+        if (_retention_policy == FLASH_RETENTION_KEEP_UNUPLOADED) {
+            printf("FLASH ERROR: Oldest sector holds %lu records that were not uploaded\n",
+                   sector_records - uploaded_records);
+            return false;
+        }
+        
+        printf("FLASH WARNING: Overwriting %lu records that were not uploaded\n",
+               sector_records - uploaded_records);
+        _dropped_count += sector_records - uploaded_records;
+        
+        // The watermark moves to the next sector, acknowledged chunks were relative to the old one
+        clearChunkAcks();
+    }
+    
+    if (_debug_level > 0) {
+        printf("FLASH: Reclaiming journal sector %lu (%lu records)\n", _tail_sector, sector_records);
+    }
+    
+    if (!safeFlashErase(journalSectorAddress(_tail_sector), FLASH_SECTOR_SIZE)) {
+        printf("FLASH ERROR: Failed to erase journal sector %lu\n", _tail_sector);
+        return false;
+    }
+    
+    _sector_records[_tail_sector] = 0;
+    _sector_erased[_tail_sector] = true;
+    clearSectorSummary(_tail_sector);
+    _tail_sector = (_tail_sector + 1) % _data_sector_count;
+    _used_sectors--;
+    _stored_data_count -= sector_records;
+    _uploaded_count -= uploaded_records;
+    
+    return true;
+}
+
+bool Flash::isSectorErased(uint32_t sector) {
+    if (!_sector_erased[sector]) {
+        _sector_erased[sector] = isErased(journalSectorAddress(sector), FLASH_SECTOR_SIZE);
+    }
+    return _sector_erased[sector];
+}
+
+bool Flash::eraseAhead() {
+    if (!_flash_enabled) {
+        return false;
+    }
+    
+    // Wear entries switch upload log sectors on the append path, the other log sector is
+    // erased once the current one is nearly full. Only while the current sector holds
+    // both newest entries, the other one may still be needed otherwise.
+    if (_erase_ahead_sectors > 0 && !_log_next_erased && _log_self_contained &&
+        FLASH_SECTOR_SIZE - _log_offset < 2 * wearEntrySize(_region_sectors)) {
+        uint32_t next_sector = (_log_sector + 1) % FLASH_UPLOAD_LOG_SECTORS;
+        if (!safeFlashErase(_upload_log_address + next_sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE)) {
+            printf("FLASH ERROR: Failed to erase upload log sector %lu\n", next_sector);
+            return false;
+        }
+        _log_next_erased = true;
+        _erase_ahead_count++;
+        return true;
+    }
+    
+    for (uint32_t i = 1; i <= _erase_ahead_sectors && i < _data_sector_count; i++) {
+        uint32_t sector = (_head_sector + i) % _data_sector_count;
+        
+        if (_used_sectors > 0 && sector == _tail_sector) {
+            // The reserve reached the oldest sector, reclaim it now instead of on the next append.
+            // Data that was not uploaded yet is only given up early if it would be overwritten anyway.
+            if (_retention_policy == FLASH_RETENTION_KEEP_UNUPLOADED &&
+                _uploaded_count < _sector_records[_tail_sector]) {
+                return false;
+            }
+            if (!reclaimOldestSector()) {
+                return false;
+            }
+            _erase_ahead_count++;
+            return true;
+        }
+        
+        if (isSectorErased(sector)) {
+            continue;
+        }
+        
+        if (_debug_level > 0) {
+            printf("FLASH: Erasing journal sector %lu ahead of use\n", sector);
+        }
+        if (!safeFlashErase(journalSectorAddress(sector), FLASH_SECTOR_SIZE)) {
+            printf("FLASH ERROR: Failed to erase journal sector %lu\n", sector);
+            return false;
+        }
+        _sector_erased[sector] = true;
+        _erase_ahead_count++;
+        return true;
+    }
+    
+    return false;
+}
+
+bool Flash::appendRecords(const SensorData* data, size_t count) {
+    size_t written = 0;
+    
+    while (written < count) {
+        bool write_header = false;
+        
+        // Open the next journal sector when the current one is full
+        if (!_head_open || _head_full) {
+            uint32_t next_sector = (_head_sector + 1) % _data_sector_count;
+            uint32_t sector_address = journalSectorAddress(next_sector);
+            
+            // Every sector is in use, the journal wraps onto its oldest sector.
+            // eraseAhead() normally did this already while the main loop was idle.
+            if (_used_sectors > 0 && next_sector == _tail_sector) {
+                _sync_erase_count++;
+                if (!reclaimOldestSector()) {
+                    return false;
+                }
+            }
+            
+            // Sectors are erased when they are formatted or reclaimed, this only triggers if a
+            // previous run was interrupted while the sector was being written
+            if (!isSectorErased(next_sector)) {
+                _sync_erase_count++;
+                if (!safeFlashErase(sector_address, FLASH_SECTOR_SIZE)) {
+                    printf("FLASH ERROR: Failed to erase journal sector %lu\n", next_sector);
+                    return false;
+                }
+            }
+            
+            if (_used_sectors == 0) {
+                _tail_sector = next_sector;
+            }
+            _head_sector = next_sector;
+            _head_offset = sizeof(JournalSectorHeader);
+            _head_format = _record_format;
+            _sector_records[next_sector] = 0;
+            _sector_erased[next_sector] = false;
+            clearSectorSummary(next_sector);
+            _used_sectors++;
+            _head_open = true;
+            _head_full = false;
+            resetDeltaState(_head_delta);
+            write_header = true;
+            
+            // The previous head sector is full now and refines the capacity estimate
+            updateCapacityEstimate();
+        }
+        
+        // Stage the sector header (if new) and as many records as fit into whole pages.
+        // Unused bytes stay 0xFF so the surrounding flash contents are left untouched.
+        uint32_t chunk_offset = write_header ? 0 : _head_offset - (_head_offset % FLASH_PAGE_SIZE);
+        uint32_t chunk_end = std::min(chunk_offset + (uint32_t)sizeof(_program_buffer), (uint32_t)FLASH_SECTOR_SIZE);
+        
+        memset(_program_buffer, 0xFF, sizeof(_program_buffer));
+        
+        if (write_header) {
+            JournalSectorHeader sector_header;
+            memset(&sector_header, 0xFF, sizeof(sector_header));
+            sector_header.magic = JOURNAL_SECTOR_MAGIC;
+            sector_header.sequence = _next_sequence++;
+            sector_header.format = _head_format;
+            sector_header.schema = RECORD_SCHEMA_CURRENT;
+            memcpy(_program_buffer, &sector_header, sizeof(sector_header));
+        } else {
+            // Mirror what is already programmed in the first page, so a page filled by this
+            // chunk can be sealed from the buffer. Cleared again before programming.
+            memcpy(_program_buffer, journalPointer(_head_sector, chunk_offset), _head_offset - chunk_offset);
+        }
+        
+        uint32_t records_offset = _head_offset;
+        uint32_t offset = _head_offset;
+        uint32_t stage_end = _head_offset;
+        size_t staged = 0;
+        while (written + staged < count) {
+            const SensorData& record = data[written + staged];
+            
+            // Everything but the final record of the batch is marked as pending
+            uint8_t extra_flags = (written + staged + 1 < count) ? RECORD_FLAG_BATCH_PENDING : 0;
+            
+            if (_head_format == JOURNAL_FORMAT_RAW) {
+                if (offset + JOURNAL_RAW_RECORD_SIZE > chunk_end) {
+                    break;
+                }
+                serializeSensorData(record, _program_buffer + (offset - chunk_offset), extra_flags);
+                offset += JOURNAL_RAW_RECORD_SIZE;
+            } else if (_head_format == JOURNAL_FORMAT_DELTA) {
+                uint8_t encoded[DELTA_RECORD_MAX_SIZE];
+                uint8_t record_flags = extra_flags | (record.is_fake_gps ? RECORD_FLAG_FAKE_GPS : 0);
+                RecordDeltaState state = _head_delta;
+                size_t size = encodeDeltaRecord(record, record_flags, state, encoded);
+                
+                uint32_t page_start = offset - (offset % FLASH_PAGE_SIZE);
+                uint32_t record_end = page_start + FLASH_PAGE_SIZE - JOURNAL_PAGE_CRC_SIZE;
+                if (offset + size > record_end) {
+                    // Records never cross a page. Seal the full page with its CRC and start
+                    // the next page with a keyframe.
+                    uint32_t data_start = page_start == 0 ? sizeof(JournalSectorHeader) : page_start;
+                    uint32_t crc = crc32Compute(_program_buffer + (data_start - chunk_offset), record_end - data_start);
+                    if (crc != JOURNAL_PAGE_CRC_OPEN && crc != JOURNAL_PAGE_CRC_REVOKED) {
+                        memcpy(_program_buffer + (record_end - chunk_offset), &crc, sizeof(crc));
+                    }
+                    
+                    offset = page_start + FLASH_PAGE_SIZE;
+                    stage_end = offset;
+                    resetDeltaState(_head_delta);
+                    state = _head_delta;
+                    size = encodeDeltaRecord(record, record_flags, state, encoded);
+                }
+                if (offset + size > chunk_end) {
+                    break;
+                }
+                memcpy(_program_buffer + (offset - chunk_offset), encoded, size);
+                offset += size;
+                _head_delta = state;
+            } else {
+                break;
+            }
+            addToSectorSummary(_head_sector, record);
+            stage_end = offset;
+            staged++;
+        }
+        
+        if (stage_end == records_offset) {
+            if (write_header) {
+                printf("FLASH ERROR: Unknown record format %u\n", _head_format);
+                return false;
+            }
+            _head_full = true;
+            continue;
+        }
+        
+        if (!write_header) {
+            memset(_program_buffer, 0xFF, records_offset - chunk_offset);
+        }
+        
+        uint32_t program_size = (stage_end - chunk_offset) + (FLASH_PAGE_SIZE - 1);
+        program_size -= program_size % FLASH_PAGE_SIZE;
+        
+        if (_debug_level > 0) {
+            printf("FLASH: Appending %lu records at 0x%08x (sector %lu, offset %lu, %lu bytes)\n",
+                   (unsigned long)staged, (unsigned int)(journalSectorAddress(_head_sector) + records_offset),
+                   _head_sector, records_offset, (unsigned long)(offset - records_offset));
+        }
+        
+        bool programmed = safeFlashProgram(journalSectorAddress(_head_sector) + chunk_offset,
+                                           _program_buffer, program_size);
+        
+        // Verify the records and page seals were written correctly
+        bool verified = programmed &&
+            memcmp(journalPointer(_head_sector, records_offset), _program_buffer + (records_offset - chunk_offset),
+                   stage_end - records_offset) == 0;
+        
+        // The bytes may be partially programmed even on failure, never reuse them
+        _head_offset = offset;
+        _sector_records[_head_sector] += staged;
+        _stored_data_count += staged;
+        written += staged;
+        
+        if (!programmed || !verified) {
+            if (_head_format == JOURNAL_FORMAT_DELTA && _head_offset % FLASH_PAGE_SIZE != 0) {
+                // The delta chain of this page is broken, continue on the next page
+                _head_offset += FLASH_PAGE_SIZE - (_head_offset % FLASH_PAGE_SIZE);
+                resetDeltaState(_head_delta);
+            }
+            printf("FLASH ERROR: %s failed during append\n", programmed ? "Data verification" : "Programming");
+            return false;
+        }
+        
+        // Logical size is the uncompressed record, whatever format the sector uses
+        _logical_bytes += (uint64_t)staged * JOURNAL_RAW_RECORD_SIZE;
+        
+        // Persist the wear statistics every few journal sectors
+        if (write_header && ++_sectors_since_wear_save >= FLASH_WEAR_SAVE_SECTORS) {
+            saveWearState();
+        }
+    }
+    
+    return true;
+}
+
+SensorData Flash::loadSensorData(size_t index) {
+    if (index >= _stored_data_count) {
+        printf("FLASH ERROR: Attempted to read index %lu but only %lu records stored\n", 
+               index, _stored_data_count);
+        return getSensorDataError();
+    }
+    
+    JournalPosition pos;
+    SensorData result;
+    uint8_t flags;
+    uint32_t record_offset;
+    
+    seekPosition(pos, index);
+    bool valid = readRecordAt(pos, result, flags, record_offset);
+    
+    if (_debug_level > 1) {
+        printf("FLASH DEBUG: Raw bytes for record %lu at 0x%08x: ", index,
+               (unsigned int)(journalSectorAddress(pos.sector) + record_offset));
+        const uint8_t* data_ptr = journalPointer(pos.sector, record_offset);
+        for (size_t i = 0; i < 16; i++) {
+            printf("%02x ", data_ptr[i]);
+        }
+        printf("\n");
+    }
+    
+    if (!valid) {
+        if (_debug_level > 0) {
+            printf("FLASH ERROR: Record %lu is erased or corrupted\n", index);
+        }
+        return getSensorDataError();
+    }
+    
+    return result;
+}
+
+FlashRecordCursor::FlashRecordCursor(Flash& flash, uint32_t begin, uint32_t end)
+    : _flash(flash), _position(begin), _end(end) {
+    if (_position < _end) {
+        _flash.seekPosition(_journal_position, _position);
+    }
+}
+
+FlashRecordCursor::FlashRecordCursor(Flash& flash, uint32_t begin, uint32_t end, const FlashQuery& filter)
+    : FlashRecordCursor(flash, begin, end) {
+    _filtered = true;
+    _filter = filter;
+}
+
+bool FlashRecordCursor::next(SensorData& data) {
+    if (!_flash._flash_enabled) {
+        return false;
+    }
+    
+    while (_position < _end) {
+        if (_filtered) {
+            _position += _flash.skipUnmatchedSectors(_journal_position, _filter);
+            if (_position >= _end) {
+                break;
+            }
+        }
+        
+        uint8_t flags;
+        uint32_t record_offset;
+        _position++;
+        if (_flash.readRecordAt(_journal_position, data, flags, record_offset)) {
+            if (_held_only && _flash.isUploadable(data)) {
+                continue;
+            }
+            if (!_filtered || _filter.matches(data)) {
+                return true;
+            }
+            continue;
+        }
+        
+        _skipped++;
+        if (_flash._debug_level > 0) {
+            printf("FLASH WARNING: Skipping invalid record at index %lu\n", _position - 1);
+        }
+    }
+    
+    return false;
+}
+
+bool FlashQuery::matches(const SensorData& data) const {
+    if (data.timestamp < from_timestamp || data.timestamp > to_timestamp) {
+        return false;
+    }
+    
+    if (use_area) {
+        int32_t latitude = (int32_t)data.latitude;
+        int32_t longitude = (int32_t)data.longitude;
+        return (data.latitude != 0 || data.longitude != 0) &&
+               latitude >= min_latitude && latitude <= max_latitude &&
+               longitude >= min_longitude && longitude <= max_longitude;
+    }
+    
+    return true;
+}
+
+FlashRecordCursor Flash::query(const FlashQuery& filter, bool pending_only) {
+    uint32_t begin = pending_only ? _uploaded_count : 0;
+    uint32_t first = _stored_data_count;
+    uint32_t last = _stored_data_count;
+    
+    // Narrow the range down to the first and last sector that can hold matching records
+    uint32_t index = 0;
+    uint32_t sector = _tail_sector;
+    for (uint32_t i = 0; i < _used_sectors; i++) {
+        uint32_t sector_end = index + _sector_records[sector];
+        if (sector_end > begin && sectorMatches(sector, filter)) {
+            if (first == _stored_data_count) {
+                first = std::max(index, begin);
+            }
+            last = sector_end;
+        }
+        index = sector_end;
+        sector = (sector + 1) % _data_sector_count;
+    }
+    
+    if (_debug_level > 1) {
+        printf("FLASH DEBUG: Query %lu..%lu covers records %lu..%lu of %lu\n",
+               filter.from_timestamp, filter.to_timestamp, first, last, _stored_data_count);
+    }
+    
+    return FlashRecordCursor(*this, first, last, filter);
+}
+
+FlashRecordCursor Flash::recordsSince(uint32_t timestamp) {
+    FlashQuery filter;
+    filter.from_timestamp = timestamp;
+    return query(filter);
+}
+
+uint32_t Flash::getNewestTimestamp() const {
+    uint32_t newest = 0;
+    for (uint32_t i = 0; i < _used_sectors; i++) {
+        const JournalSectorSummary& summary = _sector_summary[(_tail_sector + i) % _data_sector_count];
+        if (summary.record_count > 0) {
+            newest = std::max(newest, summary.max_timestamp);
+        }
+    }
+    return newest;
+}
+
+bool Flash::getSectorSummary(uint32_t index, JournalSectorSummary& summary) const {
+    if (index >= _used_sectors) {
+        return false;
+    }
+    summary = _sector_summary[(_tail_sector + index) % _data_sector_count];
+    return true;
+}
+
+std::vector<SensorData> Flash::loadAllSensorData() {
+    std::vector<SensorData> result;
+    
+    // Return empty vector if no data or flash disabled
+    if (!_flash_enabled || getStoredCount() == 0) {
+        printf("FLASH: No records found to load or flash disabled\n");
+        return result;
+    }
+    
+    // Reserve space for all records
+    uint32_t count = getStoredCount();
+    result.reserve(count);
+    printf("FLASH: Loading %lu records from flash\n", count);
+    
+    // Only valid records are returned, whole sectors are staged in RAM while decoding
+    FlashBulkReader reader(*this, 0, count);
+    SensorData data;
+    while (reader.next(data)) {
+        result.push_back(data);
+    }
+    if (_debug_level > 0) {
+        reader.printStats();
+    }
+    
+    printf("FLASH: Successfully loaded %lu valid records (out of %lu total)\n", 
+           result.size(), count);
+    return result;
+}
+
+bool Flash::eraseStorage() {
+    printf("FLASH: Erasing flash storage...\n");
+    
+    if (!formatRegion()) {
+        printf("FLASH ERROR: Failed to erase storage\n");
+        return false;
+    }
+    
+    printf("FLASH: Storage erased successfully. Ready for new records.\n");
+    return true;
+}
+
+uint32_t Flash::getStoredCount() {
+    return _stored_data_count;
+}
+
+bool Flash::isStorageFull() {
+    return !hasSpaceFor(1);
+}
+
+// Acknowledged chunk bits, chunk 0 is the chunk starting at the upload watermark
+static bool chunkBit(const uint32_t* bitmap, uint32_t chunk) {
+    return (bitmap[chunk / 32] >> (chunk % 32)) & 1;
+}
+
+static void setChunkBit(uint32_t* bitmap, uint32_t chunk, bool value) {
+    if (value) {
+        bitmap[chunk / 32] |= 1u << (chunk % 32);
+    } else {
+        bitmap[chunk / 32] &= ~(1u << (chunk % 32));
     }
+}
+
+void Flash::markUploaded(uint32_t count) {
+    advanceWatermark(count);
+    saveUploadState();
     
     if (_debug_level > 0) {
-        printf("FLASH: Writing record at address 0x%08x (page 0x%08x + offset %u)\n", 
-               (unsigned int)data_address, (unsigned int)page_address, (unsigned int)page_offset);
-        printf("FLASH: Using sector-aligned address 0x%08x for erase operation\n", 
-               (unsigned int)sector_address);
+        printf("FLASH: %lu records marked as uploaded, %lu pending\n", _uploaded_count, getPendingCount());
     }
+}
+
+void Flash::clearChunkAcks() {
+    memset(_ack_bitmap, 0, sizeof(_ack_bitmap));
+    _ack_chunk_records = _upload_chunk_records;
+}
+
+void Flash::advanceWatermark(uint32_t count) {
+    count = std::min(count, getPendingCount());
+    _uploaded_count += count;
+    _upload_advance += count;
     
-    // Allocate a buffer for the entire sector (not just the page)
-    uint8_t* sector_buffer = new uint8_t[FLASH_SECTOR_SIZE];
-    if (!sector_buffer) {
-        printf("FLASH ERROR: Failed to allocate sector buffer\n");
-        return false;
+    if (count % _ack_chunk_records != 0) {
+        // Only happens for the last, partial chunk, nothing can be acknowledged after it
+        clearChunkAcks();
+        return;
     }
     
-    // Read current contents of the sector - we need to preserve other data
-    const uint8_t* existing_sector = (const uint8_t*)flashAddressToXIP(sector_address);
-    memcpy(sector_buffer, existing_sector, FLASH_SECTOR_SIZE);
+    uint32_t shift = count / _ack_chunk_records;
+    for (uint32_t chunk = 0; chunk < FLASH_UPLOAD_WINDOW_CHUNKS; chunk++) {
+        bool acknowledged = chunk + shift < FLASH_UPLOAD_WINDOW_CHUNKS && chunkBit(_ack_bitmap, chunk + shift);
+        setChunkBit(_ack_bitmap, chunk, acknowledged);
+    }
+}
+
+uint32_t Flash::beginUpload() {
+    // A new chunk size only takes effect once no chunks of the old size are acknowledged
+    bool acknowledged = false;
+    for (size_t i = 0; i < FLASH_UPLOAD_WINDOW_CHUNKS / 32; i++) {
+        acknowledged = acknowledged || _ack_bitmap[i] != 0;
+    }
+    if (!acknowledged) {
+        _ack_chunk_records = _upload_chunk_records;
+    }
     
-    // Calculate the offset within the sector where our page is located
-    uint32_t page_offset_in_sector = page_address - sector_address;
+    _upload_advance = 0;
+    uint32_t chunks = (getPendingCount() + _ack_chunk_records - 1) / _ack_chunk_records;
     
-    // Calculate where in the buffer to place our data
-    uint32_t data_offset_in_buffer = page_offset_in_sector + page_offset;
+    if (_debug_level > 0) {
+        printf("FLASH: Upload of %lu pending records in %lu chunks of %u\n",
+               getPendingCount(), chunks, _ack_chunk_records);
+    }
     
-    // Serialize sensor data directly into the sector buffer at the right offset
-    serializeSensorData(data, sector_buffer + data_offset_in_buffer);
+    return chunks;
+}
+
+bool Flash::isChunkAcknowledged(uint32_t chunk) const {
+    // Chunks the watermark moved past since beginUpload() are done
+    uint32_t first = (_upload_advance + _ack_chunk_records - 1) / _ack_chunk_records;
+    if (chunk < first) {
+        return true;
+    }
     
-    // Use our safe erase function on the sector-aligned address
-    if (!safeFlashErase(sector_address, FLASH_SECTOR_SIZE)) {
-        printf("FLASH ERROR: Failed to erase sector during saveSensorData\n");
-        delete[] sector_buffer;
-        return false;
+    return chunk - first < FLASH_UPLOAD_WINDOW_CHUNKS && chunkBit(_ack_bitmap, chunk - first);
+}
+
+bool Flash::canTrackChunk(uint32_t chunk) const {
+    uint32_t first = (_upload_advance + _ack_chunk_records - 1) / _ack_chunk_records;
+    if (chunk < first) {
+        return true;
     }
     
-    // Use our safe program function for the entire sector
-    if (!safeFlashProgram(sector_address, sector_buffer, FLASH_SECTOR_SIZE)) {
-        printf("FLASH ERROR: Failed to program sector during saveSensorData\n");
-        delete[] sector_buffer;
+    uint32_t relative = chunk - first;
+    if (relative >= FLASH_UPLOAD_WINDOW_CHUNKS) {
         return false;
     }
     
-    delete[] sector_buffer;
+    // A partial chunk grows with new records, it is only acknowledged once the watermark reaches it
+    uint32_t chunk_end = _uploaded_count + (relative + 1) * _ack_chunk_records;
+    return relative == 0 || chunk_end <= _stored_data_count;
+}
+
+FlashRecordCursor Flash::chunkRecords(uint32_t chunk) {
+    uint32_t first = (_upload_advance + _ack_chunk_records - 1) / _ack_chunk_records;
+    if (chunk < first) {
+        return FlashRecordCursor(*this, _stored_data_count, _stored_data_count);
+    }
     
-    // Verify the data was written correctly
-    const uint8_t* verification_ptr = (const uint8_t*)flashAddressToXIP(data_address);
-    if (_debug_level > 0) {
-        printf("FLASH VERIFICATION: Raw bytes at 0x%08x: ", (unsigned int)data_address);
-        for (size_t i = 0; i < 16 && i < SENSOR_DATA_SIZE; i++) {
-            printf("%02x ", verification_ptr[i]);
+    uint32_t begin = std::min(_uploaded_count + (chunk - first) * _ack_chunk_records, _stored_data_count);
+    uint32_t end = std::min(begin + _ack_chunk_records, _stored_data_count);
+    return FlashRecordCursor(*this, begin, end);
+}
+
+bool Flash::acknowledgeChunk(uint32_t chunk) {
+    return completeChunk(chunk);
+}
+
+bool Flash::holdChunk(uint32_t chunk) {
+    FlashRecordCursor cursor = chunkRecords(chunk);
+    SensorData data;
+    while (cursor.next(data)) {
+        if (isUploadable(data)) {
+            return false;
         }
-        printf("\n");
     }
     
-    // Double-check the magic number directly
-    uint32_t written_magic = *((const uint32_t*)verification_ptr);
-    if (written_magic != 0xABCD1234) {
-        printf("FLASH ERROR: Magic number verification failed! Expected 0xABCD1234, got 0x%08x\n", 
-               written_magic);
+    return completeChunk(chunk);
+}
+
+FlashRecordCursor Flash::heldRecords() {
+    FlashRecordCursor cursor(*this, 0, _upload_filter != nullptr ? _uploaded_count : 0);
+    cursor._held_only = true;
+    return cursor;
+}
+
+bool Flash::completeChunk(uint32_t chunk) {
+    uint32_t first = (_upload_advance + _ack_chunk_records - 1) / _ack_chunk_records;
+    if (chunk < first) {
+        return true;
+    }
+    if (!canTrackChunk(chunk)) {
         return false;
     }
     
-    // Read back for verification
-    SensorData verify = deserializeSensorData(verification_ptr);
-    if (_debug_level > 0) {
-        printf("FLASH VERIFICATION: Read back: Time=%u, Temp=%.2f, Hum=%.2f, CO2=%u, PM2.5=%u\n",
-               verify.timestamp, verify.temp, verify.hum, verify.co2, verify.pm2_5);
-    }
+    setChunkBit(_ack_bitmap, chunk - first, true);
     
-    // Verify a few key fields match what we intended to write
-    bool verification_failed = false;
-    if (std::fabs(verify.temp - data.temp) > 0.01) {
-        printf("FLASH ERROR: Temperature verification failed! %.2f != %.2f\n", 
-               verify.temp, data.temp);
-        verification_failed = true;
-    }
-    if (std::fabs(verify.hum - data.hum) > 0.01) {
-        printf("FLASH ERROR: Humidity verification failed! %.2f != %.2f\n", 
-               verify.hum, data.hum);
-        verification_failed = true;
+    // Move the watermark over the chunks acknowledged without a gap
+    uint32_t contiguous = 0;
+    while (contiguous < FLASH_UPLOAD_WINDOW_CHUNKS && chunkBit(_ack_bitmap, contiguous)) {
+        contiguous++;
     }
-    if (verify.co2 != data.co2) {
-        printf("FLASH ERROR: CO2 verification failed! %u != %u\n", 
-               verify.co2, data.co2);
-        verification_failed = true;
-    }
-    if (verify.timestamp != data.timestamp) {
-        printf("FLASH ERROR: Timestamp verification failed! %u != %u\n", 
-               verify.timestamp, data.timestamp);
-        verification_failed = true;
+    if (contiguous > 0) {
+        advanceWatermark(contiguous * _ack_chunk_records);
     }
     
-    if (verification_failed) {
-        printf("FLASH ERROR: Data verification failed, record may be corrupted\n");
-        return false;
+    return saveUploadState();
+}
+
+void Flash::loadUploadState() {
+    UploadLogEntry newest;
+    WearLogEntry newest_wear;
+    bool found = false;
+    bool found_wear = false;
+    uint32_t wear_sector = 0;
+    uint32_t wear_address = 0;
+    uint32_t wear_counter_size = sizeof(uint32_t);
+    uint32_t log_end[FLASH_UPLOAD_LOG_SECTORS];
+    
+    // Entries are appended one after the other, the first erased slot ends a sector.
+    // Wear entries start with WEAR_LOG_MARKER(_V1), their size depends on the region size.
+    for (uint32_t sector = 0; sector < FLASH_UPLOAD_LOG_SECTORS; sector++) {
+        log_end[sector] = 0;
+        uint32_t offset = 0;
+        while (offset + sizeof(UploadLogEntry) <= FLASH_SECTOR_SIZE) {
+            uint32_t address = _upload_log_address + sector * FLASH_SECTOR_SIZE + offset;
+            if (isErased(address, sizeof(UploadLogEntry))) {
+                break;
+            }
+            
+            uint32_t marker;
+            memcpy(&marker, flashPointer(address), sizeof(marker));
+            
+            WearLogEntry wear;
+            memcpy(&wear, flashPointer(address), std::min(sizeof(wear), (size_t)(FLASH_SECTOR_SIZE - offset)));
+            
+            // A torn wear entry has no size to trust, it is stepped over like an upload entry.
+            // Its counters were never written, the next slot is erased.
+            uint32_t counter_size = marker == WEAR_LOG_MARKER_V1 ? sizeof(uint16_t) : sizeof(uint32_t);
+            if ((marker == WEAR_LOG_MARKER || marker == WEAR_LOG_MARKER_V1) &&
+                offset + sizeof(WearLogEntry) <= FLASH_SECTOR_SIZE &&
+                wear.crc == crc32Compute(&wear, offsetof(WearLogEntry, crc)) &&
+                offset + wearEntrySize(wear.sector_count, counter_size) <= FLASH_SECTOR_SIZE) {
+                offset += wearEntrySize(wear.sector_count, counter_size);
+                log_end[sector] = offset;
+                
+                // Counters torn by a power loss fail their CRC, the older entry is used
+                if (wear.counts_crc != crc32Compute(flashPointer(address + sizeof(wear)),
+                                                    wear.sector_count * counter_size)) {
+                    continue;
+                }
+                
+                if (!found_wear || wear.serial > newest_wear.serial) {
+                    newest_wear = wear;
+                    found_wear = true;
+                    wear_sector = sector;
+                    wear_address = address;
+                    wear_counter_size = counter_size;
+                }
+                continue;
+            }
+            
+            offset += sizeof(UploadLogEntry);
+            log_end[sector] = offset;
+            
+            // Entries torn by a power loss fail the CRC and are ignored
+            UploadLogEntry entry;
+            memcpy(&entry, flashPointer(address), sizeof(entry));
+            if (entry.crc != crc32Compute(&entry, offsetof(UploadLogEntry, crc))) {
+                continue;
+            }
+            
+            if (!found || entry.serial > newest.serial) {
+                newest = entry;
+                found = true;
+                _log_sector = sector;
+            }
+        }
     }
     
-    // Update stored count and save to flash
-    _stored_data_count++;
-    if (_debug_level > 0) {
-        printf("FLASH: Successfully saved record %lu\n", _stored_data_count - 1);
+    if (found_wear) {
+        _wear_serial = newest_wear.serial;
+        _logical_bytes = newest_wear.logical_bytes;
+        _programmed_bytes = newest_wear.programmed_bytes;
+        // 16 bit counters of older firmware are widened, the next wear entry has 32 bit ones
+        const uint8_t* counters = (const uint8_t*)flashPointer(wear_address + sizeof(WearLogEntry));
+        uint32_t count = std::min((uint32_t)newest_wear.sector_count, (uint32_t)FLASH_MAX_REGION_SECTORS);
+        for (uint32_t sector = 0; sector < count; sector++) {
+            if (wear_counter_size == sizeof(uint16_t)) {
+                uint16_t value;
+                memcpy(&value, counters + sector * sizeof(value), sizeof(value));
+                _erase_counts[sector] = value;
+            } else {
+                memcpy(&_erase_counts[sector], counters + sector * sizeof(uint32_t), sizeof(uint32_t));
+            }
+        }
+        memcpy(_boot_erase_counts, _erase_counts, sizeof(_boot_erase_counts));
+        if (!found) {
+            _log_sector = wear_sector;
+        }
     }
     
-    // Now update the count in flash
-    uint32_t count_buffer = _stored_data_count;
-    
-    // For count page, ensure it's also sector-aligned
-    uint32_t count_sector_offset = _data_count_address % FLASH_SECTOR_SIZE;
-    uint32_t count_sector_address = _data_count_address - count_sector_offset;
+    _log_offset = log_end[_log_sector];
+    _log_next_erased = false;
+    _log_self_contained = !(found && found_wear && wear_sector != _log_sector);
+    _uploaded_count = 0;
+    clearChunkAcks();
     
-    // Read current sector, update count, then write back
-    uint8_t* count_sector_buffer = new uint8_t[FLASH_SECTOR_SIZE];
-    if (!count_sector_buffer) {
-        printf("FLASH ERROR: Failed to allocate count sector buffer\n");
-        // Revert the in-memory count to match what was previously in flash
-        _stored_data_count--;
-        return false;
+    if (!found) {
+        return;
     }
     
-    // Read existing sector
-    const uint8_t* existing_count_sector = (const uint8_t*)flashAddressToXIP(count_sector_address);
-    memcpy(count_sector_buffer, existing_count_sector, FLASH_SECTOR_SIZE);
-    
-    // Update count in buffer
-    uint32_t count_offset_in_sector = _data_count_address - count_sector_address;
-    memcpy(count_sector_buffer + count_offset_in_sector, &count_buffer, DATA_COUNT_SIZE);
-    
-    // Use our safe erase function for count sector
-    if (!safeFlashErase(count_sector_address, FLASH_SECTOR_SIZE)) {
-        printf("FLASH ERROR: Failed to erase count sector while updating count\n");
-        delete[] count_sector_buffer;
-        // Revert the in-memory count to match what was previously in flash
-        _stored_data_count--;
-        return false;
+    _log_serial = newest.serial;
+    if (_used_sectors == 0) {
+        return;
     }
     
-    // Use our safe program function to update the count
-    if (!safeFlashProgram(count_sector_address, count_sector_buffer, FLASH_SECTOR_SIZE)) {
-        printf("FLASH ERROR: Failed to program count while updating count\n");
-        delete[] count_sector_buffer;
-        // Revert the in-memory count to match what was previously in flash
-        _stored_data_count--;
-        return false;
-    }
+    // Sequence numbers of the used sectors are consecutive from the tail sector on
+    JournalSectorHeader tail_header;
+    memcpy(&tail_header, journalPointer(_tail_sector, 0), sizeof(tail_header));
     
-    delete[] count_sector_buffer;
+    if (newest.sequence < tail_header.sequence) {
+        printf("FLASH WARNING: Upload watermark points to an overwritten sector, all records are pending\n");
+        return;
+    }
     
-    // Verify the count was written correctly
-    const uint32_t* verify_count = (const uint32_t*)flashAddressToXIP(_data_count_address);
-    if (*verify_count != _stored_data_count) {
-        printf("FLASH ERROR: Count verification failed! %lu != %lu\n", 
-               *verify_count, _stored_data_count);
+    uint32_t index = newest.sequence - tail_header.sequence;
+    if (index >= _used_sectors) {
+        _uploaded_count = _stored_data_count;
+    } else {
+        for (uint32_t i = 0; i < index; i++) {
+            _uploaded_count += _sector_records[(_tail_sector + i) % _data_sector_count];
+        }
+        _uploaded_count += std::min((uint32_t)newest.record,
+                                    (uint32_t)_sector_records[(_tail_sector + index) % _data_sector_count]);
         
-        // Revert the in-memory count to match what was previously in flash
-        _stored_data_count = *verify_count;
-        return false;
+        _ack_chunk_records = newest.chunk_records > 0 ? newest.chunk_records : _upload_chunk_records;
+        memcpy(_ack_bitmap, newest.chunk_bitmap, sizeof(_ack_bitmap));
     }
     
-    return true;
+    if (_debug_level > 0) {
+        printf("FLASH: Upload watermark restored, %lu records uploaded, %lu pending\n",
+               _uploaded_count, getPendingCount());
+    }
 }
 
-bool Flash::saveSensorDataBatch(const std::vector<SensorData>& data) {
-    // Check if there's enough space
-    if (_stored_data_count + data.size() > _max_data_count) {
-        return false;
+bool Flash::saveUploadState() {
+    if (!_flash_enabled) {
+        return true;
     }
     
-    // Calculate how many pages we need
-    size_t totalSize = data.size() * SENSOR_DATA_SIZE;
-    size_t pages = (totalSize + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    UploadLogEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.serial = _log_serial + 1;
+    entry.chunk_records = _ack_chunk_records;
+    memcpy(entry.chunk_bitmap, _ack_bitmap, sizeof(entry.chunk_bitmap));
     
-    // Serialize all data into a buffer
-    uint8_t* buffer = new uint8_t[pages * FLASH_PAGE_SIZE];
-    memset(buffer, 0xFF, pages * FLASH_PAGE_SIZE); // Initialize with 0xFF (erased flash value)
-    
-    for (size_t i = 0; i < data.size(); i++) {
-        serializeSensorData(data[i], buffer + (i * SENSOR_DATA_SIZE));
+    // Store the watermark as sector sequence and record index, it stays valid when sectors are reclaimed
+    entry.sequence = _next_sequence;
+    entry.record = 0;
+    if (_used_sectors > 0) {
+        JournalSectorHeader tail_header;
+        memcpy(&tail_header, journalPointer(_tail_sector, 0), sizeof(tail_header));
+        
+        uint32_t remaining = _uploaded_count;
+        uint32_t index = 0;
+        while (index + 1 < _used_sectors && remaining >= _sector_records[(_tail_sector + index) % _data_sector_count]) {
+            remaining -= _sector_records[(_tail_sector + index) % _data_sector_count];
+            index++;
+        }
+        entry.sequence = tail_header.sequence + index;
+        entry.record = remaining;
     }
     
-    // Calculate storage address for this batch
-    uint32_t data_address = _data_start_address + (_stored_data_count * SENSOR_DATA_SIZE);
+    entry.crc = crc32Compute(&entry, offsetof(UploadLogEntry, crc));
     
-    // Write data to flash
-    uint32_t interrupt_state = save_and_disable_interrupts();
-    flash_range_program(data_address, buffer, pages * FLASH_PAGE_SIZE);
-    restore_interrupts(interrupt_state);
+    bool switched;
+    if (!reserveLogSpace(sizeof(entry), switched)) {
+        return false;
+    }
     
-    delete[] buffer;
+    if (!appendLogEntry(&entry, sizeof(entry))) {
+        printf("FLASH ERROR: Failed to write upload log entry\n");
+        return false;
+    }
     
-    // Update count in flash
-    _stored_data_count += data.size();
-    uint32_t interrupt_state2 = save_and_disable_interrupts();
-    flash_range_program(_data_count_address, (const uint8_t*)&_stored_data_count, DATA_COUNT_SIZE);
-    restore_interrupts(interrupt_state2);
+    _log_serial = entry.serial;
+    _logical_bytes += sizeof(entry);
     
+    // The erased sector may have held the newest wear entry
+    if (switched) {
+        _log_self_contained = saveWearState();
+        return _log_self_contained;
+    }
     return true;
 }
 
-SensorData Flash::loadSensorData(size_t index) {
-    if (index >= _stored_data_count) {
-        printf("FLASH ERROR: Attempted to read index %lu but only %lu records stored\n", 
-               index, _stored_data_count);
-        return getSensorDataError();
+bool Flash::saveWearState() {
+    if (!_flash_enabled) {
+        return true;
     }
     
-    uint32_t address = _data_start_address + (index * SENSOR_DATA_SIZE);
-    printf("FLASH DEBUG: Loading record %lu from address 0x%08x\n", index, (unsigned int)address);
-    
-    // Validate this address is within our flash data region
-    if (address < _data_start_address || 
-        address >= (_data_start_address + (_max_data_count * SENSOR_DATA_SIZE))) {
-        printf("FLASH ERROR: Address 0x%08x is outside valid data range\n", (unsigned int)address);
-        return getSensorDataError();
+    // Switching log sectors erases one, which is counted before the counters are taken
+    uint32_t size = wearEntrySize(_region_sectors);
+    bool switched;
+    if (!reserveLogSpace(size, switched)) {
+        return false;
     }
     
-    // Get a pointer to the flash memory at the calculated address
-    const uint8_t* data_ptr = (const uint8_t*)flashAddressToXIP(address);
-    
-    // Print first 16 bytes for debug
-    printf("FLASH DEBUG: Raw bytes for record %lu: ", index);
-    for (size_t i = 0; i < 16 && i < SENSOR_DATA_SIZE; i++) {
-        printf("%02x ", data_ptr[i]);
+    WearLogEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.marker = WEAR_LOG_MARKER;
+    entry.serial = _wear_serial + 1;
+    entry.logical_bytes = _logical_bytes;
+    entry.programmed_bytes = _programmed_bytes;
+    entry.sector_count = _region_sectors;
+    entry.counts_crc = crc32Compute(_erase_counts, _region_sectors * sizeof(uint32_t));
+    entry.crc = crc32Compute(&entry, offsetof(WearLogEntry, crc));
+    
+    // The entry goes first, torn counters behind it are detected by counts_crc
+    uint32_t entry_offset = _log_offset;
+    bool written = appendLogEntry(&entry, sizeof(entry)) &&
+                   appendLogEntry(_erase_counts, _region_sectors * sizeof(uint32_t));
+    _log_offset = entry_offset + size;
+    
+    if (!written) {
+        printf("FLASH ERROR: Failed to write wear log entry\n");
+        return false;
     }
-    printf("\n");
     
-    // Quick check for erased flash (all 0xFF)
-    bool is_erased = true;
-    for (size_t i = 0; i < 16 && i < SENSOR_DATA_SIZE; i++) {
-        if (data_ptr[i] != 0xFF) {
-            is_erased = false;
-            break;
-        }
-    }
+    _wear_serial = entry.serial;
+    _sectors_since_wear_save = 0;
     
-    if (is_erased) {
-        printf("FLASH ERROR: Record %lu appears to be erased (all 0xFF)\n", index);
-        return getSensorDataError();
+    // The erased sector may have held the newest upload entry
+    if (switched) {
+        _log_self_contained = saveUploadState();
+        return _log_self_contained;
     }
-    
-    // Check magic number directly from the serialized data
-    uint32_t magic = *((const uint32_t*)data_ptr);
-    if (magic != 0xABCD1234) {
-        printf("FLASH ERROR: Invalid magic number in record %lu: 0x%08x\n", 
-               index, magic);
-        return getSensorDataError();
+    return true;
+}
+
+bool Flash::reserveLogSpace(size_t size, bool& switched) {
+    switched = false;
+    if (_log_offset + size <= FLASH_SECTOR_SIZE) {
+        return true;
     }
     
-    // Deserialize and return the data
-    SensorData result = deserializeSensorData(data_ptr);
-    
-    // Validate deserialized data for reasonableness
-    if (result.temp < -50.0f || result.temp > 100.0f || 
-        result.hum < 0.0f || result.hum > 100.0f || 
-        result.timestamp < 1600000000 || result.timestamp > 2000000000) {
-        printf("FLASH ERROR: Deserialized data contains suspicious values:");
-        printf(" Time=%u, Temp=%.2f, Hum=%.2f, CO2=%u, PM2.5=%u\n",
-               result.timestamp, result.temp, result.hum, result.co2, result.pm2_5);
-    } else {
-        printf("FLASH DEBUG: Successfully loaded record %lu: Time=%u, Temp=%.2f, Hum=%.2f\n", 
-               index, result.timestamp, result.temp, result.hum);
+    // Switch log sectors when the current one is full. The full sector keeps the current
+    // state until the first entries in the other one were written.
+    uint32_t next_sector = (_log_sector + 1) % FLASH_UPLOAD_LOG_SECTORS;
+    if (!_log_next_erased &&
+        !safeFlashErase(_upload_log_address + next_sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE)) {
+        printf("FLASH ERROR: Failed to erase upload log sector %lu\n", next_sector);
+        return false;
     }
-    
-    return result;
+    _log_sector = next_sector;
+    _log_offset = 0;
+    _log_next_erased = false;
+    _log_self_contained = false;
+    switched = true;
+    return true;
 }
 
-/**
- * Load all sensor data records from flash storage
- * 
- * @return Vector containing all valid sensor data records
- */
-std::vector<SensorData> Flash::loadAllSensorData() {
-    std::vector<SensorData> result;
-    
-    // Return empty vector if no data or flash disabled
-    if (!_flash_enabled || getStoredCount() == 0) {
-        printf("FLASH: No records found to load or flash disabled\n");
-        return result;
-    }
-    
-    // Reserve space for all records
-    uint32_t count = getStoredCount();
-    result.reserve(count);
-    printf("FLASH: Loading %lu records from flash\n", count);
+bool Flash::appendLogEntry(const void* entry, size_t size) {
+    uint32_t address = _upload_log_address + _log_sector * FLASH_SECTOR_SIZE + _log_offset;
+    _log_offset += size;
     
-    // Read each record using the single-record method
-    for (size_t i = 0; i < count; i++) {
-        SensorData data = loadSensorData(i);
+    return programRange(address, (const uint8_t*)entry, size);
+}
+
+FlashWearStats Flash::getStats() const {
+    FlashWearStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.logical_bytes = _logical_bytes;
+    stats.programmed_bytes = _programmed_bytes;
+    stats.write_amplification = _logical_bytes > 0 ? (float)_programmed_bytes / _logical_bytes : 0.0f;
+    stats.session_erases = _session_erases;
+    stats.region_sectors = _region_sectors;
+    stats.min_erase_count = _region_sectors > 0 ? 0xFFFFFFFF : 0;
+    
+    for (uint32_t sector = 0; sector < _region_sectors; sector++) {
+        stats.total_erases += _erase_counts[sector];
+        stats.max_erase_count = std::max(stats.max_erase_count, _erase_counts[sector]);
+        stats.min_erase_count = std::min(stats.min_erase_count, _erase_counts[sector]);
+    }
+    
+    return stats;
+}
+
+float Flash::estimateLifetimeDays(uint32_t uptime_ms) const {
+    if (_session_erases == 0 || uptime_ms == 0) {
+        return -1.0f;
+    }
+    
+    // Each sector wears at its own rate (the upload log faster than the journal),
+    // the first one to reach the rated cycles ends the lifetime
+    float days = -1.0f;
+    for (uint32_t sector = 0; sector < _region_sectors; sector++) {
+        uint32_t erases = _erase_counts[sector] - _boot_erase_counts[sector];
+        if (erases == 0) {
+            continue;
+        }
         
-        // Only add valid records to the vector (check timestamp as a validity indicator)
-        if (data.timestamp != 0) {
-            result.push_back(data);
-        } else {
-            printf("FLASH WARNING: Skipping invalid record at index %lu\n", i);
+        float erases_per_day = erases * (86400000.0f / uptime_ms);
+        float remaining = _erase_counts[sector] < FLASH_RATED_ERASE_CYCLES ?
+                          (float)(FLASH_RATED_ERASE_CYCLES - _erase_counts[sector]) : 0.0f;
+        float sector_days = remaining / erases_per_day;
+        if (days < 0.0f || sector_days < days) {
+            days = sector_days;
         }
     }
     
-    printf("FLASH: Successfully loaded %lu valid records (out of %lu total)\n", 
-           result.size(), count);
-    return result;
+    return days;
 }
 
-bool Flash::eraseStorage() {
-    printf("FLASH: Erasing flash storage...\n");
-    
-    // Calculate total sectors to erase (16 sectors = 64KB by default)
-    uint32_t sectors_to_erase = 16; // Using a fixed number for safety
-    
-    // Erase sectors (count page and data pages)
-    uint32_t interrupt_state = save_and_disable_interrupts();
-    printf("FLASH: Erasing %u sectors starting at 0x%08x\n", 
-           (unsigned int)sectors_to_erase, (unsigned int)_flash_offset);
-    flash_range_erase(_flash_offset, sectors_to_erase * FLASH_SECTOR_SIZE);
-    restore_interrupts(interrupt_state);
-    
-    // Reset count to 0
-    _stored_data_count = 0;
-    uint32_t count = 0;
+void Flash::printStats(uint32_t uptime_ms) const {
+    FlashWearStats stats = getStats();
     
-    // Program count (0) to flash
-    uint32_t interrupt_state2 = save_and_disable_interrupts();
-    printf("FLASH: Writing count (0) after erase\n");
-    flash_range_program(_data_count_address, (const uint8_t*)&count, DATA_COUNT_SIZE);
-    restore_interrupts(interrupt_state2);
+    printf("FLASH: Wear: %lu erases total (%lu since boot), sector erase counts %lu..%lu of %lu rated\n",
+           (unsigned long)stats.total_erases, (unsigned long)stats.session_erases,
+           (unsigned long)stats.min_erase_count, (unsigned long)stats.max_erase_count,
+           (unsigned long)FLASH_RATED_ERASE_CYCLES);
+    printf("FLASH: Wear: %llu bytes logical, %llu bytes programmed, write amplification %.2f\n",
+           (unsigned long long)stats.logical_bytes, (unsigned long long)stats.programmed_bytes,
+           stats.write_amplification);
     
-    // Verify count was written correctly
-    const uint32_t* verify_count = (const uint32_t*)flashAddressToXIP(_data_count_address);
-    if (*verify_count != 0) {
-        printf("FLASH ERROR: Failed to reset count after erase!\n");
-        return false;
+    float days = estimateLifetimeDays(uptime_ms);
+    if (days >= 0.0f) {
+        printf("FLASH: Wear: estimated lifetime %.0f days at the current erase rate\n", days);
     }
     
-    printf("FLASH: Storage erased successfully. Ready for new records.\n");
-    return true;
-}
-
-uint32_t Flash::getStoredCount() {
-    return _stored_data_count;
+    if (_debug_level > 0) {
+        printf("FLASH: Wear: erase counts per sector:");
+        for (uint32_t sector = 0; sector < _region_sectors; sector++) {
+            printf(" %lu", (unsigned long)_erase_counts[sector]);
+        }
+        printf("\n");
+    }
 }
 
-bool Flash::isStorageFull() {
-    return _stored_data_count >= _max_data_count;
+bool Flash::isAboveHighWatermark() const {
+    if (getPendingCount() == 0) {
+        return false;
+    }
+    
+    // Count the sectors from the first one holding pending records up to the head
+    uint32_t uploaded = _uploaded_count;
+    uint32_t sector = _tail_sector;
+    uint32_t pending_sectors = _used_sectors;
+    for (uint32_t i = 0; i + 1 < _used_sectors && _sector_records[sector] <= uploaded; i++) {
+        uploaded -= _sector_records[sector];
+        pending_sectors--;
+        sector = (sector + 1) % _data_sector_count;
+    }
+    
+    return pending_sectors * 100 >= _data_sector_count * _high_watermark_percent;
 }
 
-void Flash::serializeSensorData(const SensorData& data, uint8_t* buffer) {
+void Flash::serializeSensorData(const SensorData& data, uint8_t* buffer, uint8_t extra_flags) {
     // Add detailed debugging to track serialization issues
-    printf("SERIALIZING: Temp=%.2f, Hum=%.2f, CO2=%u, PM2.5=%u, Timestamp=%u, FakeGPS=%s\n",
-           data.temp, data.hum, data.co2, data.pm2_5, data.timestamp, 
-           data.is_fake_gps ? "true" : "false");
+    if (_debug_level > 1) {
+        printf("SERIALIZING: Temp=%.2f, Hum=%.2f, CO2=%u, PM2.5=%u, Timestamp=%u, FakeGPS=%s\n",
+               data.temp, data.hum, data.co2, data.pm2_5, data.timestamp, 
+               data.is_fake_gps ? "true" : "false");
+    }
     
     // Create a packed struct for serialization
-    SerializedSensorData serialized;
+    SerializedSensorDataV2 serialized;
     
-    // Set magic number for validation
-    serialized.magic = 0xABCD1234;
+    // Self-describing header
+    serialized.header.magic = RECORD_MAGIC;
+    serialized.header.schema = RECORD_SCHEMA_V3;
+    serialized.header.size = sizeof(SerializedSensorDataV2);
     
     // Copy data fields
+    serialized.timestamp = data.timestamp;
+    serialized.latitude = data.latitude;
+    serialized.longitude = data.longitude;
     serialized.temp = data.temp;
     serialized.hum = data.hum;
     serialized.pres = data.pres;
     serialized.gasRes = data.gasRes;
+    serialized.co2 = data.co2;
+    serialized.pm1_0 = data.pm1_0;
     serialized.pm2_5 = data.pm2_5;
     serialized.pm5 = data.pm5;
     serialized.pm10 = data.pm10;
-    serialized.padding = 0; // Zero out padding
-    serialized.co2 = data.co2;
-    serialized.latitude = data.latitude;
-    serialized.longitude = data.longitude;
-    serialized.timestamp = data.timestamp;
+    serialized.battery_mv = data.battery_mv;
+    serialized.hdop = data.hdop;
+    serialized.speed = data.speed;
+    serialized.sensor_status = data.sensor_status;
+    serialized.fix_type = data.fix_type;
+    serialized.satellites_used = data.satellites_used;
     
     // Set flags
-    serialized.flags = data.is_fake_gps ? 0x01 : 0x00;  // Bit 0 = is_fake_gps
-    memset(serialized.reserved, 0, sizeof(serialized.reserved));  // Clear reserved bytes
+    serialized.flags = data.is_fake_gps ? RECORD_FLAG_FAKE_GPS : 0x00;  // Bit 0 = is_fake_gps
+    serialized.flags |= extra_flags;
+    serialized.reserved = 0;  // Clear reserved byte
     
     // Zero out the checksum field first to ensure consistent calculation
     serialized.checksum = 0;
     
-    // Create a simple numeric checksum from the actual values
-    // This is deliberately separate from the binary representation to avoid layout issues
-    uint32_t value_checksum = 0xABCD1234;  // Initial seed
-    
-    // Add the primary numeric values to the checksum
-    value_checksum += serialized.co2;
-    value_checksum += serialized.pm2_5;
-    value_checksum += serialized.pm10;
-    value_checksum += serialized.timestamp;
-    
-    // Add the latitude and longitude
-    value_checksum += serialized.latitude % 1000000;  // Only use the less significant digits
-    value_checksum += serialized.longitude % 1000000;
-    
-    // Convert floats to integers in a consistent way
-    int temp_int = (int)(serialized.temp * 100);
-    int hum_int = (int)(serialized.hum * 100);
-    value_checksum += temp_int;
-    value_checksum += hum_int;
-    
-    // Add the flags
-    value_checksum += serialized.flags;
-    
     // Now set the checksum in the serialized data
-    serialized.checksum = value_checksum;
-    
-    // Debug the binary representation before writing
-    printf("SERIALIZED BYTES: ");
-    const uint8_t* bytes = (const uint8_t*)&serialized;
-    for (size_t i = 0; i < 16; i++) {
-        printf("%02x ", bytes[i]);
-    }
-    printf("...\n");
+    serialized.checksum = calculateChecksum(serialized);
     
     // Copy the entire struct to the buffer
-    memcpy(buffer, &serialized, sizeof(SerializedSensorData));
+    memcpy(buffer, &serialized, sizeof(SerializedSensorDataV2));
     
-    // Verify the buffer contains what we expect
-    printf("BUFFER AFTER MEMCPY: ");
-    for (size_t i = 0; i < 16; i++) {
-        printf("%02x ", buffer[i]);
+    // Debug the binary representation before writing
+    if (_debug_level > 1) {
+        printf("SERIALIZED BYTES: ");
+        for (size_t i = 0; i < 16; i++) {
+            printf("%02x ", buffer[i]);
+        }
+        printf("...\n");
     }
-    printf("...\n");
 }
 
-SensorData Flash::deserializeSensorData(const uint8_t* buffer) {
-    // Debug what we're reading from flash
-    printf("DESERIALIZING BYTES: ");
-    for (size_t i = 0; i < 16; i++) {
-        printf("%02x ", buffer[i]);
-    }
-    printf("...\n");
-    
-    SensorData data;
-    SerializedSensorData serialized;
-    
-    // Copy from buffer to packed struct
-    memcpy(&serialized, buffer, sizeof(SerializedSensorData));
-    
-    // Debug the binary representation after reading
-    printf("SERIALIZED STRUCT BYTES: ");
-    const uint8_t* bytes = (const uint8_t*)&serialized;
-    for (size_t i = 0; i < 16; i++) {
-        printf("%02x ", bytes[i]);
-    }
-    printf("...\n");
-    
-    // Validate magic number
-    if (serialized.magic != 0xABCD1234) {
-        printf("FLASH ERROR: Invalid magic number in record: 0x%08x\n", serialized.magic);
-        // Return empty data if validation fails
-        return data;
-    }
-    
-    // Save the stored checksum for comparison
-    uint32_t stored_checksum = serialized.checksum;
-    
-    // Zero out the checksum for calculation just like in serialization
-    serialized.checksum = 0;
-    
-    // Calculate the checksum using the exact same method as in serialization
-    uint32_t value_checksum = 0xABCD1234;  // Initial seed
-    
-    // Add the primary numeric values to the checksum
-    value_checksum += serialized.co2;
-    value_checksum += serialized.pm2_5;
-    value_checksum += serialized.pm10;
-    value_checksum += serialized.timestamp;
-    
-    // Add the latitude and longitude
-    value_checksum += serialized.latitude % 1000000;  // Only use the less significant digits
-    value_checksum += serialized.longitude % 1000000;
-    
-    // Convert floats to integers in a consistent way
-    int temp_int = (int)(serialized.temp * 100);
-    int hum_int = (int)(serialized.hum * 100);
-    value_checksum += temp_int;
-    value_checksum += hum_int;
-    
-    // Add the flags
-    value_checksum += serialized.flags;
-    
-    // Restore the original checksum for logging
-    serialized.checksum = stored_checksum;
-    
-    // Now the calculated checksum should match what was stored
-    if (value_checksum != stored_checksum) {
-        printf("ERROR: Checksum mismatch: Expected 0x%08x, Got 0x%08x\n", 
-               stored_checksum, value_checksum);
-        
-        // Instead of immediately returning, check if the data still looks reasonable
-        // This can help recover partially corrupted records
-        bool data_looks_valid = 
-            serialized.temp > -50.0f && serialized.temp < 100.0f && 
-            serialized.hum >= 0.0f && serialized.hum <= 100.0f && 
-            serialized.timestamp > 1600000000 && serialized.timestamp < 2000000000;
-            
-        if (!data_looks_valid) {
-            printf("ERROR: Data validation failed, record appears corrupted\n");
-            return data; // Return empty data
-        } else {
-            printf("WARNING: Checksum mismatch but data appears valid. Attempting recovery...\n");
-            // Continue with recovery attempt
-        }
-    }
-    
-    // Extract fields
-    data.temp = serialized.temp;
-    data.hum = serialized.hum;
-    data.pres = serialized.pres;
-    data.gasRes = serialized.gasRes;
-    data.pm2_5 = serialized.pm2_5;
-    data.pm5 = serialized.pm5;
-    data.pm10 = serialized.pm10;
-    data.co2 = serialized.co2;
-    data.latitude = serialized.latitude;
-    data.longitude = serialized.longitude;
-    data.timestamp = serialized.timestamp;
-    
-    // Extract flags
-    data.is_fake_gps = (serialized.flags & 0x01) != 0;  // Bit 0 = is_fake_gps
-    
-    // Debug what we extracted
-    printf("DESERIALIZED: Temp=%.2f, Hum=%.2f, CO2=%u, PM2.5=%u, Timestamp=%u, FakeGPS=%s\n",
-           data.temp, data.hum, data.co2, data.pm2_5, data.timestamp,
-           data.is_fake_gps ? "true" : "false");
-    
-    return data;
+uint32_t Flash::calculateChecksum(const SerializedSensorDataV2& record) {
+    // Covers every byte in front of the checksum field, including the record header and flags
+    return crc32Compute(&record, offsetof(SerializedSensorDataV2, checksum));
 }
 
 void Flash::dumpRawFlashContents(size_t max_records) {
     printf("Raw flash contents (first %zu records):\n", max_records);
     
-    // Dump count
-    const uint32_t* count_ptr = (const uint32_t*)flashAddressToXIP(_data_count_address);
-    printf("Count value at 0x%08x: %lu\n", (unsigned int)_data_count_address, *count_ptr);
+    // Dump region header
+    const FlashRegionHeader* header = (const FlashRegionHeader*)flashPointer(_header_address);
+    printf("Region header at 0x%08x: magic=0x%08x version=%u sectors=%lu record size=%lu\n",
+           (unsigned int)_header_address, (unsigned int)header->magic, header->version,
+           header->sector_count, header->record_size);
+    
+    // Dump journal sector headers
+    for (uint32_t sector = 0; sector < _data_sector_count; sector++) {
+        const JournalSectorHeader* sector_header = (const JournalSectorHeader*)journalPointer(sector, 0);
+        if (sector_header->magic == JOURNAL_SECTOR_MAGIC) {
+            printf("Sector %lu at 0x%08x: sequence=%lu format=%u schema=%u records=%u\n", sector,
+                   (unsigned int)journalSectorAddress(sector), sector_header->sequence,
+                   sector_header->format, sector_header->schema == 0xFF ? RECORD_SCHEMA_V1 : sector_header->schema,
+                   _sector_records[sector]);
+        }
+    }
     
     // Limit to maximum records or stored count, whichever is smaller
     size_t records_to_dump = (_stored_data_count < max_records) ? _stored_data_count : max_records;
     
+    JournalPosition pos;
+    seekPosition(pos, 0);
     for (size_t i = 0; i < records_to_dump; i++) {
-        uint32_t data_address = _data_start_address + (i * SENSOR_DATA_SIZE);
-        const uint8_t* data_ptr = (const uint8_t*)flashAddressToXIP(data_address);
+        SensorData data;
+        uint8_t flags;
+        uint32_t record_offset;
+        readRecordAt(pos, data, flags, record_offset);
+        
+        uint32_t data_address = journalSectorAddress(pos.sector) + record_offset;
+        const uint8_t* data_ptr = journalPointer(pos.sector, record_offset);
         
         printf("Record %zu at 0x%08x: ", i, (unsigned int)data_address);
         // Dump first 16 bytes in hex
-        for (size_t j = 0; j < 16 && j < SENSOR_DATA_SIZE; j++) {
+        for (size_t j = 0; j < 16; j++) {
             printf("%02x ", data_ptr[j]);
         }
         printf("\n");
@@ -803,87 +2121,12 @@ bool Flash::resetStorage() {
         return true;
     }
     
-    // Ensure flash address is sector-aligned
-    uint32_t flash_offset_aligned = _flash_offset;
-    if (flash_offset_aligned % FLASH_SECTOR_SIZE != 0) {
-        // Round down to nearest sector boundary
-        flash_offset_aligned = (flash_offset_aligned / FLASH_SECTOR_SIZE) * FLASH_SECTOR_SIZE;
-        printf("FLASH: Aligning flash offset to sector boundary: 0x%08x -> 0x%08x\n", 
-               (unsigned int)_flash_offset, (unsigned int)flash_offset_aligned);
-    }
-    
-    // Calculate total sectors to erase (16 sectors = 64KB)
-    uint32_t sectors_to_erase = 16;
-    
-    // Use our safe erase function that handles errors gracefully
-    if (!safeFlashErase(flash_offset_aligned, sectors_to_erase * FLASH_SECTOR_SIZE)) {
+    if (!formatRegion()) {
         printf("FLASH ERROR: Failed to erase storage during reset\n");
         return false;
     }
     
-    // Reset count in memory
-    _stored_data_count = 0;
-    
-    // For count, ensure we're also sector-aligned
-    uint32_t count_sector_offset = _data_count_address % FLASH_SECTOR_SIZE;
-    uint32_t count_sector_address = _data_count_address - count_sector_offset;
-    
-    // Prepare a buffer with the entire sector
-    uint8_t* sector_buffer = new uint8_t[FLASH_SECTOR_SIZE];
-    if (!sector_buffer) {
-        printf("FLASH ERROR: Failed to allocate sector buffer for count\n");
-        return false;
-    }
-    
-    // Fill with 0xFF (erased state) first
-    memset(sector_buffer, 0xFF, FLASH_SECTOR_SIZE);
-    
-    // Set count = 0 at the appropriate offset in the buffer
-    uint32_t count = 0;
-    uint32_t count_offset_in_sector = _data_count_address - count_sector_address;
-    memcpy(sector_buffer + count_offset_in_sector, &count, DATA_COUNT_SIZE);
-    
-    // Use our safe program function to write the count in the context of the sector
-    if (!safeFlashProgram(count_sector_address, sector_buffer, FLASH_SECTOR_SIZE)) {
-        printf("FLASH ERROR: Failed to write count (0) during reset\n");
-        delete[] sector_buffer;
-        return false;
-    }
-    
-    delete[] sector_buffer;
-    
-    printf("FLASH: Storage reset complete - all data and count have been erased\n");
-    return true;
-}
-
-bool Flash::readSensorDataRecord(uint32_t addr, SensorData &data) {
-    // Check if the record would cross a page boundary
-    uint32_t page_offset = addr % FLASH_PAGE_SIZE;
-    if (page_offset + sizeof(SensorData) > FLASH_PAGE_SIZE) {
-        // Handle cross-page reading - need to read in two parts
-        uint8_t buffer[sizeof(SensorData)];
-        
-        // Read first part from current page
-        uint32_t first_part_size = FLASH_PAGE_SIZE - page_offset;
-        memcpy(buffer, (const void*)addr, first_part_size);
-        
-        // Read second part from next page
-        uint32_t next_page_addr = (addr & ~(FLASH_PAGE_SIZE - 1)) + FLASH_PAGE_SIZE;
-        memcpy(buffer + first_part_size, (const void*)next_page_addr, sizeof(SensorData) - first_part_size);
-        
-        // Copy from buffer to data struct
-        memcpy(&data, buffer, sizeof(SensorData));
-    } else {
-        // Standard single-page read
-        memcpy(&data, (const void*)addr, sizeof(SensorData));
-    }
-    
-    // Verify record validity (optional, adjust as needed)
-    if (data.timestamp == 0xFFFFFFFF || data.co2 == 0xFFFFFFFF) {
-        printf("FLASH: Detected potentially corrupted record at 0x%08x\n", addr);
-        return false;
-    }
-    
+    printf("FLASH: Storage reset complete - all data and journal headers have been erased\n");
     return true;
 }
 
@@ -903,6 +2146,13 @@ SensorData Flash::getSensorDataError() {
     error.pm5 = 0;
     error.pm10 = 0;
     error.is_fake_gps = false;
+    error.pm1_0 = 0;
+    error.battery_mv = 0;
+    error.hdop = 0;
+    error.speed = 0;
+    error.sensor_status = 0;
+    error.fix_type = GPS_FIX_TYPE_UNKNOWN;
+    error.satellites_used = 0;
     return error;
 }
 
@@ -927,33 +2177,28 @@ bool Flash::safeFlashErase(uint32_t address, size_t size) {
                (unsigned int)address, (unsigned long)size);
     }
     
-    // Save interrupts, do the erase, then restore
-    if (_debug_level > 1) printf("FLASH: Disabling interrupts for erase\n");
-    uint32_t interrupt_state = save_and_disable_interrupts();
-    
-    try {
-        flash_range_erase(address, size);
-    } catch (...) {
-        // This shouldn't happen, but just in case
-        restore_interrupts(interrupt_state);
-        printf("FLASH ERROR: Exception during erase operation!\n");
+    if (!_hal->erase(address, size)) {
+        printf("FLASH ERROR: Erase at 0x%08x failed\n", (unsigned int)address);
         return false;
     }
     
-    restore_interrupts(interrupt_state);
-    if (_debug_level > 1) printf("FLASH: Interrupts restored after erase\n");
-    
-    // Add a delay to ensure the erase completes
-    if (_debug_level > 0) printf("FLASH: Delay (50ms) after erase to ensure completion\n");
-    sleep_ms(50);
+    // Count the erase cycles of the region sectors, a failed verification still wore them.
+    // Counters are indexed down from the top sector, which stays put when the region is resized.
+    for (uint32_t sector_address = address; sector_address < address + size; sector_address += FLASH_SECTOR_SIZE) {
+        uint32_t sector = (_region_end - FLASH_SECTOR_SIZE - sector_address) / FLASH_SECTOR_SIZE;
+        if (sector_address < _region_end && sector < _region_sectors) {
+            _erase_counts[sector]++;
+            _session_erases++;
+        }
+    }
     
     // Verify the erase worked by checking a few spots in the range
     if (_debug_level > 0) printf("FLASH: Verifying erase operation\n");
     
     // Check beginning, middle, and end of range
-    const uint32_t* verify_begin = (const uint32_t*)flashAddressToXIP(address);
-    const uint32_t* verify_middle = (const uint32_t*)flashAddressToXIP(address + (size / 2));
-    const uint32_t* verify_end = (const uint32_t*)flashAddressToXIP(address + size - 4);
+    const uint32_t* verify_begin = (const uint32_t*)flashPointer(address);
+    const uint32_t* verify_middle = (const uint32_t*)flashPointer(address + (size / 2));
+    const uint32_t* verify_end = (const uint32_t*)flashPointer(address + size - 4);
     
     if (*verify_begin != 0xFFFFFFFF || *verify_middle != 0xFFFFFFFF || *verify_end != 0xFFFFFFFF) {
         printf("FLASH ERROR: Erase verification failed!\n");
@@ -997,36 +2242,22 @@ bool Flash::safeFlashProgram(uint32_t address, const uint8_t* data, size_t size)
         printf("\n");
     }
     
-    // Save interrupts, do the program, then restore
-    if (_debug_level > 1) printf("FLASH: Disabling interrupts for program\n");
-    uint32_t interrupt_state = save_and_disable_interrupts();
+    _programmed_bytes += size;
     
-    try {
-        flash_range_program(address, data, size);
-    } catch (...) {
-        // This shouldn't happen, but just in case
-        restore_interrupts(interrupt_state);
-        printf("FLASH ERROR: Exception during program operation!\n");
+    if (!_hal->program(address, data, size)) {
+        printf("FLASH ERROR: Program at 0x%08x failed\n", (unsigned int)address);
         return false;
     }
     
-    restore_interrupts(interrupt_state);
-    if (_debug_level > 1) printf("FLASH: Interrupts restored after program\n");
-    
-    // Add a delay to ensure the program completes
-    if (_debug_level > 0) printf("FLASH: Delay (50ms) after program to ensure completion\n");
-    sleep_ms(50);
-    
     // Verify the program worked by checking the data
     if (_debug_level > 0) printf("FLASH: Verifying program operation\n");
     
-    // Only check the first few bytes for efficiency
-    size_t verify_size = std::min(size, (size_t)16);
-    const uint8_t* verify_data = (const uint8_t*)flashAddressToXIP(address);
+    // Bytes programmed as 0xFF leave the existing contents untouched, so they are skipped
+    const uint8_t* verify_data = (const uint8_t*)flashPointer(address);
     
     bool verification_passed = true;
-    for (size_t i = 0; i < verify_size; i++) {
-        if (verify_data[i] != data[i]) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != 0xFF && verify_data[i] != data[i]) {
             printf("FLASH ERROR: Program verification failed at offset %lu!\n", (unsigned long)i);
             printf("  Expected: 0x%02x, Got: 0x%02x\n", data[i], verify_data[i]);
             verification_passed = false;
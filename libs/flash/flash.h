@@ -2,12 +2,8 @@
 #define FLASH_H
 
 #include <vector>
-#include "hardware/flash.h"
-#include "hardware/sync.h"
-#include "pico/stdlib.h"
-
-// Add this definition at the top of the file, after the struct definitions
-#define SENSOR_DATA_SIZE  sizeof(SensorData)
+#include "flash_hal.h"
+#include "record_codec.h"
 
 // SensorData struct matches the one in pico_eu.cpp
 struct SensorData {
@@ -23,10 +19,38 @@ struct SensorData {
     uint32_t longitude = 0;
     uint32_t timestamp = 0;
     bool is_fake_gps = false;  // Flag to indicate if this reading used fake GPS data
+    
+    // Added with record schema 2
+    uint16_t pm1_0 = 0;
+    uint16_t battery_mv = 0;       // Battery voltage in mV
+    uint16_t hdop = 0;             // Horizontal dilution of precision * 100
+    uint16_t speed = 0;            // Ground speed in 0.01 km/h
+    uint16_t sensor_status = 0;    // SENSOR_STATUS_* bits
+    
+    // Added with record schema 3
+    uint8_t fix_type = 0;          // GPS_FIX_TYPE_*
+    uint8_t satellites_used = 0;   // Satellites used for the fix, 0 if unknown
 };
 
-// Add this struct to ensure aligned, packed serialization
+// Sensor status bits
+#define SENSOR_STATUS_BME688_OK   0x0001
+#define SENSOR_STATUS_HM3301_OK   0x0002
+#define SENSOR_STATUS_CO2_OK      0x0004
+#define SENSOR_STATUS_GPS_FIX     0x0008
+#define SENSOR_STATUS_UNKNOWN     0x8000        // Record written before the status was stored
+
+// GPS fix types (the NMEA GSA fix type)
+#define GPS_FIX_TYPE_UNKNOWN      0             // Not reported, or record written before schema 3
+#define GPS_FIX_TYPE_NONE         1
+#define GPS_FIX_TYPE_2D           2
+#define GPS_FIX_TYPE_3D           3
+
+// Number of upload chunks after the watermark whose acknowledgement can be remembered
+#define FLASH_UPLOAD_WINDOW_CHUNKS 256
+
 #pragma pack(push, 1)
+// Raw record of schema 1, still read from sectors written by older firmware.
+// The fields added later are filled in by upgradeSensorData() when it is decoded.
 struct SerializedSensorData {
     // Header with magic number for validation
     uint32_t magic;      // Magic number to validate record integrity (0xABCD1234)
@@ -50,17 +74,271 @@ struct SerializedSensorData {
     uint32_t timestamp;
     
     // Flags
-    uint8_t flags;       // Bit 0: is_fake_gps, Bits 1-7: reserved for future use
+    uint8_t flags;       // Bit 0: is_fake_gps, Bit 1: batch pending, Bits 2-7: reserved for future use
     uint8_t reserved[3]; // Reserved for future expansion, keeps alignment
     
     // Validation checksum
-    uint32_t checksum;  // Simple checksum (sum of all values)
+    uint32_t checksum;  // CRC-32 over all preceding bytes of the record
+};
+
+// Header of raw records from schema 2 on. A reader knows the layout of a record from
+// its schema and size alone, without relying on the firmware that wrote it.
+struct RecordHeader {
+    uint16_t magic;      // RECORD_MAGIC
+    uint8_t schema;      // RECORD_SCHEMA_*
+    uint8_t size;        // Size of the whole record including header and checksum
+};
+
+// Raw record of schema 2 and 3. Schema 3 stores the fix quality in two bytes schema 2
+// wrote as 0.
+struct SerializedSensorDataV2 {
+    RecordHeader header;
+    
+    uint32_t timestamp;
+    uint32_t latitude;
+    uint32_t longitude;
+    
+    float temp;
+    float hum;
+    float pres;
+    float gasRes;
+    uint32_t co2;
+    
+    uint16_t pm1_0;
+    uint16_t pm2_5;
+    uint16_t pm5;
+    uint16_t pm10;
+    
+    uint16_t battery_mv;
+    uint16_t hdop;
+    uint16_t speed;
+    uint16_t sensor_status;
+    
+    uint8_t flags;       // RECORD_FLAG_* bits
+    uint8_t fix_type;    // Schema 3, GPS_FIX_TYPE_*
+    uint8_t satellites_used;    // Schema 3
+    uint8_t reserved;    // Keeps the checksum aligned, written as 0
+    
+    uint32_t checksum;   // CRC-32 over all preceding bytes of the record
+};
+
+// Header in the top sector of the storage region, describes the journal layout. The top
+// sector stays at the same address when the region is resized, so the header is always found.
+struct FlashRegionHeader {
+    uint32_t magic;         // FLASH_REGION_MAGIC
+    uint16_t version;       // FLASH_JOURNAL_VERSION
+    uint16_t header_size;   // sizeof(JournalSectorHeader)
+    uint32_t sector_count;  // Sectors in the region, including this header sector
+    uint32_t record_size;   // sizeof(SerializedSensorData)
+    uint32_t region_offset; // Flash offset of the lowest region sector
+    uint32_t image_end;     // End of the firmware image when the region was formatted
+};
+
+// Header at the start of every journal data sector. The sequence number grows by one
+// for every sector that is opened, so Flash::init can find the oldest and newest sector
+// and rebuild the record count without a separately stored count.
+struct JournalSectorHeader {
+    uint32_t magic;         // JOURNAL_SECTOR_MAGIC
+    uint32_t sequence;      // Sector sequence number
+    uint8_t format;         // Record format stored in this sector (JOURNAL_FORMAT_*)
+    uint8_t schema;         // Record schema (RECORD_SCHEMA_*), erased (0xFF) means schema 1
+    uint8_t reserved[6];    // Reserved for future use, left erased (0xFF)
+};
+
+// Entry of the upload log. Every acknowledged upload chunk appends one entry, the entry
+// with the highest serial number holds the current state.
+struct UploadLogEntry {
+    uint32_t serial;        // Grows by one for every entry written
+    uint32_t sequence;      // Journal sector sequence of the first record not uploaded (watermark)
+    uint16_t record;        // Index of that record inside its sector
+    uint16_t chunk_records; // Records per chunk in chunk_bitmap
+    uint32_t chunk_bitmap[FLASH_UPLOAD_WINDOW_CHUNKS / 32]; // Chunks after the watermark already uploaded or held back
+    uint32_t crc;           // CRC-32 over the fields above
+};
+
+// Wear statistics, kept in the upload log next to the upload entries. A new entry is written
+// every FLASH_WEAR_SAVE_SECTORS journal sectors, the one with the highest serial holds the
+// counters. The entry is followed by sector_count uint32_t erase counters (index 0 = region
+// header sector, counting down). Entries with WEAR_LOG_MARKER_V1 have uint16_t counters that
+// stopped at 0xFFFF, padded to a multiple of 4 bytes; they are still read.
+struct WearLogEntry {
+    uint32_t marker;        // WEAR_LOG_MARKER(_V1), where an upload entry has its serial number
+    uint32_t serial;        // Grows by one for every wear entry written
+    uint64_t logical_bytes; // Bytes the storage was asked to keep (uncompressed records, log entries)
+    uint64_t programmed_bytes;  // Bytes handed to flash program calls (whole pages)
+    uint16_t sector_count;  // Erase counters following the entry
+    uint16_t reserved;      // Written as 0
+    uint32_t counts_crc;    // CRC-32 over the erase counters
+    uint32_t crc;           // CRC-32 over the fields above
 };
 #pragma pack(pop)
 
+// Journal layout constants. The region spans from FLASH_REGION_MARGIN after the firmware
+// image to the end of flash (minus sectors reserved for other data), sized at boot.
+#define FLASH_MAX_REGION_SECTORS  384           // Bounds the per-sector tables, about 40 bytes of RAM per sector
+#define FLASH_MIN_REGION_SECTORS  8             // Header sector + upload log sectors + 5 data sectors
+#define FLASH_REGION_MARGIN       (64 * 1024)   // Kept free after the image so a firmware update can grow
+#define FLASH_UPLOAD_LOG_SECTORS  2             // Used alternately, the full one is kept until the other is written
+#define FLASH_REGION_MAGIC        0x4C4E524A    // "JRNL"
+#define FLASH_JOURNAL_VERSION     4
+#define JOURNAL_SECTOR_MAGIC      0x5443534A    // "JSCT"
+#define JOURNAL_FORMAT_RAW        1             // Packed SerializedSensorData records
+#define JOURNAL_FORMAT_DELTA      2             // Page keyframes + varint deltas (record_codec.h)
+#define JOURNAL_RECORD_SIZE       sizeof(SerializedSensorData)      // Schema 1, kept in the region header
+#define JOURNAL_RAW_RECORD_SIZE   sizeof(SerializedSensorDataV2)    // Raw records of the current schema
+#define JOURNAL_RECORDS_PER_SECTOR \
+    ((FLASH_SECTOR_SIZE - sizeof(JournalSectorHeader)) / JOURNAL_RAW_RECORD_SIZE)
+#define RECORD_MAGIC              0x5352        // "RS", first bytes of raw records from schema 2 on
+#define WEAR_LOG_MARKER           0x32414557    // "WEA2", starts a WearLogEntry in the upload log
+#define WEAR_LOG_MARKER_V1        0x52414557    // "WEAR", wear entry with 16 bit counters
+#define FLASH_WEAR_SAVE_SECTORS   8             // Journal sectors opened between two wear entries
+
+// Erase cycles the flash is specified for (W25Q16JV), used for the lifetime estimate
+#define FLASH_RATED_ERASE_CYCLES  100000
+
+// Delta pages end with a CRC-32 over the rest of the page, written once the page is full.
+// An erased trailer marks a page that was never sealed, a zero trailer one whose seal was
+// revoked because records in it were discarded. Both fall back to the record check bytes.
+#define JOURNAL_PAGE_CRC_SIZE     4
+#define JOURNAL_PAGE_CRC_OPEN     0xFFFFFFFF
+#define JOURNAL_PAGE_CRC_REVOKED  0x00000000
+
+// Worst case number of delta records per sector (every record at its maximum size)
+#define JOURNAL_DELTA_MIN_RECORDS_PER_SECTOR \
+    ((FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE) * \
+     ((FLASH_PAGE_SIZE - JOURNAL_PAGE_CRC_SIZE - sizeof(JournalSectorHeader)) / DELTA_RECORD_MAX_SIZE))
+
+// Assumed delta records per sector until a full delta sector was measured
+#define JOURNAL_DELTA_RECORDS_ESTIMATE (3 * JOURNAL_RECORDS_PER_SECTOR)
+
+// Record flag bits
+#define RECORD_FLAG_FAKE_GPS      0x01
+#define RECORD_FLAG_BATCH_PENDING 0x02          // Set on every record of a batch except the last one
+
+// Retention policy applied when the journal is full and the oldest sector was not uploaded yet
+#define FLASH_RETENTION_OVERWRITE_OLDEST 0      // Reuse the oldest sector anyway, collection never stalls
+#define FLASH_RETENTION_KEEP_UNUPLOADED  1      // Reject new records until the data was uploaded
+
+// Default share of the capacity that may hold un-uploaded records before an upload is requested
+#define FLASH_DEFAULT_HIGH_WATERMARK_PERCENT 80
+
+// Records per upload chunk unless set with Flash::setUploadChunkSize()
+#define FLASH_DEFAULT_UPLOAD_CHUNK_RECORDS 5
+
+// Sectors after the head sector kept erased by Flash::eraseAhead(), at most 2
+#define FLASH_DEFAULT_ERASE_AHEAD_SECTORS 1
+
+// Size of the staging buffer used to program whole pages (a 10 record batch fits in one program call)
+#define FLASH_PROGRAM_BUFFER_PAGES 4
+
+class Flash;
+
+// Decoder for the raw records of one schema, validates the record and fills data and flags
+typedef bool (*RawRecordDecoder)(const uint8_t* record, SensorData& data, uint8_t& flags);
+
+// Upload filter, false for records the upload holds back (see Flash::setUploadFilter())
+typedef bool (*UploadFilter)(const SensorData& data);
+
+// Summary of the records in one journal sector, kept in RAM. Maintained while appending
+// and rebuilt at init, it lets queries skip sectors without decoding their records.
+// Positions at 0/0 (no fix yet) are left out of the bounding box.
+struct JournalSectorSummary {
+    uint32_t min_timestamp;
+    uint32_t max_timestamp;
+    int32_t min_latitude;       // Bounding box in the fixed-point SensorData format
+    int32_t max_latitude;
+    int32_t min_longitude;
+    int32_t max_longitude;
+    uint16_t record_count;      // Records included in the summary
+    uint16_t position_count;    // Records included in the bounding box
+};
+
+// Wear and write amplification statistics of the storage region, see Flash::getStats()
+struct FlashWearStats {
+    uint64_t logical_bytes;         // Bytes the storage was asked to keep
+    uint64_t programmed_bytes;      // Bytes actually programmed, including page padding and metadata
+    float write_amplification;      // programmed_bytes / logical_bytes
+    uint32_t total_erases;          // Sector erases over the lifetime of the region
+    uint32_t max_erase_count;       // Erase cycles of the most worn sector
+    uint32_t min_erase_count;       // Erase cycles of the least worn sector
+    uint32_t session_erases;        // Sector erases since boot
+    uint32_t region_sectors;        // Sectors of the region, see Flash::getEraseCount()
+};
+
+// Filter for Flash::query(). Timestamps and coordinates are inclusive bounds.
+struct FlashQuery {
+    uint32_t from_timestamp = 0;
+    uint32_t to_timestamp = 0xFFFFFFFF;
+    bool use_area = false;      // Also filter by the bounding box below
+    int32_t min_latitude = 0;
+    int32_t max_latitude = 0;
+    int32_t min_longitude = 0;
+    int32_t max_longitude = 0;
+    
+    // Check whether a record matches the filter
+    bool matches(const SensorData& data) const;
+};
+
+// Position of a record inside the journal, used to walk records of either format
+struct JournalPosition {
+    uint32_t sector;            // Journal sector
+    uint32_t record;            // Record number inside the sector
+    uint32_t offset;            // Byte offset inside the sector where the walk continues
+    uint8_t format;             // Format of the sector (JOURNAL_FORMAT_*)
+    uint8_t schema;             // Record schema of the sector (RECORD_SCHEMA_*)
+    uint32_t record_size;       // Raw record size of that schema
+    RawRecordDecoder decode_raw;         // Raw record decoder of that schema
+    const DeltaSchema* delta_schema;     // Delta field layout of that schema
+    const uint8_t* image;       // Copy of the sector in RAM to read from, nullptr reads through XIP
+    uint32_t delta_page;        // Page the delta state belongs to
+    bool delta_valid;           // Whether the delta state can still be trusted
+    RecordDeltaState delta;     // Delta decoder state for JOURNAL_FORMAT_DELTA
+};
+
+// Forward cursor over a range of journal records. Records are validated and decoded
+// straight from the memory-mapped (XIP) flash, one at a time, without heap allocations.
+class FlashRecordCursor {
+public:
+    FlashRecordCursor(Flash& flash, uint32_t begin, uint32_t end);
+    
+    // Cursor that only returns records matching filter, sectors without any are skipped
+    FlashRecordCursor(Flash& flash, uint32_t begin, uint32_t end, const FlashQuery& filter);
+    
+    // Decode the next valid record into data, invalid records are skipped.
+    // Returns false once the end of the range is reached.
+    bool next(SensorData& data);
+    
+    // Logical index of the record that next() looks at
+    uint32_t position() const { return _position; }
+    
+    // Check if the end of the range was reached
+    bool atEnd() const { return _position >= _end; }
+    
+    // Number of records left in the range (including invalid ones)
+    uint32_t remaining() const { return _position < _end ? _end - _position : 0; }
+    
+    // Number of invalid records skipped so far
+    uint32_t skippedCount() const { return _skipped; }
+    
+private:
+    Flash& _flash;
+    uint32_t _position;
+    uint32_t _end;
+    uint32_t _skipped = 0;
+    JournalPosition _journal_position;
+    bool _filtered = false;
+    FlashQuery _filter;
+    bool _held_only = false;    // Only records the upload filter holds back
+    
+    friend class Flash;
+};
+
 class Flash {
 public:
-    Flash(uint32_t flash_offset = 0);
+    // The region ends reserved_sectors before the end of flash and starts at flash_offset,
+    // or FLASH_REGION_MARGIN after the firmware image if flash_offset is 0.
+    // hal selects the flash backend, nullptr uses defaultFlashHal()
+    Flash(uint32_t flash_offset = 0, FlashHal* hal = nullptr, uint32_t reserved_sectors = 0);
     ~Flash();
 
     // Initialize flash storage
@@ -69,7 +347,8 @@ public:
     // Save sensor data
     bool saveSensorData(const SensorData& data);
     
-    // Save a vector of sensor data points to flash
+    // Save a vector of sensor data points to flash as one batch.
+    // The batch only becomes visible after a restart if its last record reached flash.
     bool saveSensorDataBatch(const std::vector<SensorData>& data);
     
     // Load all sensor data
@@ -81,6 +360,25 @@ public:
     // Load all stored sensor data at once
     std::vector<SensorData> loadAllSensorData();
     
+    // Cursor over every stored record, oldest first
+    FlashRecordCursor records() { return FlashRecordCursor(*this, 0, _stored_data_count); }
+    
+    // Cursor over the records that were not uploaded yet, oldest first
+    FlashRecordCursor pendingRecords() { return FlashRecordCursor(*this, _uploaded_count, _stored_data_count); }
+    
+    // Cursor over the stored records matching filter, oldest first. Only sectors whose
+    // summary overlaps the filter are read. pending_only limits it to records not uploaded yet.
+    FlashRecordCursor query(const FlashQuery& filter, bool pending_only = false);
+    
+    // Cursor over the records stored at or after timestamp
+    FlashRecordCursor recordsSince(uint32_t timestamp);
+    
+    // Timestamp of the newest stored record (0 if there is none)
+    uint32_t getNewestTimestamp() const;
+    
+    // Summary of the records in the index-th oldest journal sector in use
+    bool getSectorSummary(uint32_t index, JournalSectorSummary& summary) const;
+    
     // Get count of stored records
     uint32_t getStoredCount();
     
@@ -90,9 +388,107 @@ public:
     // Get maximum data count
     uint32_t getMaxDataCount() const { return _max_data_count; }
     
-    // Check if storage is full
+    // Flash address right after the journal region, where further sector pools can start.
+    // Resizing the region moves only its start. A region formatted with a different
+    // reserved_sectors keeps its end after init() until the storage is erased.
+    uint32_t getRegionEnd() const { return _region_end; }
+    
+    // Flash address of the lowest region sector and the number of region sectors
+    uint32_t getRegionStart() const { return _flash_offset; }
+    uint32_t getRegionSectors() const { return _region_sectors; }
+    
+    // Check if storage is full (never true with FLASH_RETENTION_OVERWRITE_OLDEST)
     bool isStorageFull();
     
+    // Number of records that were not uploaded yet
+    uint32_t getPendingCount() const { return _stored_data_count - _uploaded_count; }
+    
+    // Number of oldest records the upload is done with and may be reclaimed. Includes the
+    // records held back by the upload filter, see heldRecords().
+    uint32_t getUploadedCount() const { return _uploaded_count; }
+    
+    // Number of un-uploaded records lost to FLASH_RETENTION_OVERWRITE_OLDEST since boot
+    uint32_t getDroppedCount() const { return _dropped_count; }
+    
+    // Persistent erase counters and logical/physical byte totals of the storage region.
+    // Counters survive restarts and eraseStorage(); at most the writes of the last
+    // FLASH_WEAR_SAVE_SECTORS journal sectors are lost on a reset.
+    FlashWearStats getStats() const;
+    
+    // Erase cycles of a region sector, counted down from the region header (0)
+    uint32_t getEraseCount(uint32_t sector) const {
+        return sector < FLASH_MAX_REGION_SECTORS ? _erase_counts[sector] : 0;
+    }
+    
+    // Days until the first sector reaches FLASH_RATED_ERASE_CYCLES at the erase rates seen
+    // since boot (uptime_ms), negative while no erase happened yet
+    float estimateLifetimeDays(uint32_t uptime_ms) const;
+    
+    // Print the wear statistics
+    void printStats(uint32_t uptime_ms) const;
+    
+    // Erase the next sector of the erased-ahead reserve, call while the main loop is idle.
+    // Erases at most one sector per call, returns true if it did. Once the journal has
+    // wrapped this reclaims the oldest sector early (never un-uploaded data with
+    // FLASH_RETENTION_KEEP_UNUPLOADED). The next upload log sector is erased ahead too.
+    bool eraseAhead();
+    
+    // Number of sectors eraseAhead() keeps ready (0 disables it)
+    void setEraseAheadSectors(uint8_t sectors) { _erase_ahead_sectors = sectors > 2 ? 2 : sectors; }
+    
+    // Sectors erased by eraseAhead(), and erases an append still had to do itself
+    uint32_t getEraseAheadCount() const { return _erase_ahead_count; }
+    uint32_t getSyncEraseCount() const { return _sync_erase_count; }
+    
+    // Mark the oldest count pending records as uploaded, their sectors get reused first.
+    // The upload watermark is persisted, uploaded records stay uploaded after a restart.
+    void markUploaded(uint32_t count);
+    
+    // Chunked upload with persisted acknowledgements. beginUpload() returns the number of chunks
+    // the pending records are split into; chunk numbers stay valid until the next beginUpload().
+    // Chunks acknowledged on an earlier attempt are reported by isChunkAcknowledged() and must
+    // not be sent again. Only chunks for which canTrackChunk() is true should be sent, an
+    // acknowledgement that cannot be persisted would lead to a duplicate upload later.
+    uint32_t beginUpload();
+    bool isChunkAcknowledged(uint32_t chunk) const;
+    bool canTrackChunk(uint32_t chunk) const;
+    FlashRecordCursor chunkRecords(uint32_t chunk);
+    bool acknowledgeChunk(uint32_t chunk);
+    
+    // Records the upload filter rejects are held back: they are not sent, the upload moves
+    // past them and they stay in flash until their sector is reclaimed, in a state of their
+    // own (neither pending nor uploaded). Keeping them pending would stall the upload window
+    // and never let an upload complete. The held state is derived from the records, so the
+    // filter must not change between firmware versions. nullptr uploads every record.
+    void setUploadFilter(UploadFilter filter) { _upload_filter = filter; }
+    bool isUploadable(const SensorData& data) const { return _upload_filter == nullptr || _upload_filter(data); }
+    
+    // Move the upload past a chunk without acknowledging it, fails if the chunk holds a
+    // record the upload filter accepts. For chunks with only held back or invalid records.
+    bool holdChunk(uint32_t chunk);
+    
+    // Cursor over the records the upload moved past without sending them, oldest first
+    FlashRecordCursor heldRecords();
+    
+    // Records per upload chunk, used once no acknowledged chunks of the previous size are left
+    void setUploadChunkSize(uint16_t records) { _upload_chunk_records = records > 0 ? records : 1; }
+    
+    // Check if the pending records exceed the high watermark and should be uploaded
+    bool isAboveHighWatermark() const;
+    
+    // Select what happens to un-uploaded data when the journal wraps around
+    void setRetentionPolicy(int policy) { _retention_policy = policy; }
+    
+    // Set the high watermark as a percentage of the capacity
+    void setHighWatermarkPercent(uint8_t percent) { _high_watermark_percent = percent; }
+    
+    // Store new sectors in the compact delta format (lossy, floats are kept to 0.01).
+    // Takes effect with the next sector that is opened.
+    void setCompressionEnabled(bool enabled) {
+        _record_format = enabled ? JOURNAL_FORMAT_DELTA : JOURNAL_FORMAT_RAW;
+        updateCapacityEstimate();
+    }
+    
     // Erase all user data
     bool eraseStorage();
     
@@ -102,8 +498,8 @@ public:
     // Reset storage (erase and reinitialize)
     bool resetStorage();
     
-    // Enable or disable flash operations (for testing/debugging)
-    void setFlashEnabled(bool enabled) { _flash_enabled = enabled; }
+    // Enable or disable flash operations, stays disabled if there is no room for the region
+    void setFlashEnabled(bool enabled) { _flash_enabled = enabled && _region_sectors > 0; }
     
     // Check if flash is enabled
     bool isFlashEnabled() const { return _flash_enabled; }
@@ -112,31 +508,223 @@ public:
     void setDebugLevel(int level) { _debug_level = level; }
     
 private:
+    friend class FlashRecordCursor;
+    friend class FlashBulkReader;
+    
+    FlashHal* _hal;                        // Backend doing the raw flash access
     uint32_t _flash_offset;                // Where to start storing data in flash
-    uint32_t _data_count_address;          // Where to store the count of records
-    uint32_t _data_start_address;          // Where the actual data starts
-    uint32_t _max_data_count;              // Maximum number of records that can be stored
+    uint32_t _min_offset;                  // Lowest address the region may start at for this image
+    uint32_t _preferred_offset;            // Where a newly formatted region starts
+    uint32_t _region_end;                  // First address after the region
+    uint32_t _configured_region_end;       // Region end for the reserved sectors given to the constructor
+    uint32_t _region_sectors = 0;          // Sectors of the region, 0 if there is no room
+    uint32_t _header_address;              // Where the region header is stored
+    uint32_t _data_start_address;          // Where the first journal sector starts
+    uint32_t _upload_log_address;          // Where the upload log sectors start
+    uint32_t _data_sector_count;           // Number of journal sectors below the log sectors
+    uint32_t _max_data_count;              // Maximum number of records that can be stored (estimated for delta sectors)
     uint32_t _stored_data_count;           // Current count of stored records
     bool _flash_enabled = true;            // Whether flash operations are enabled
     int _debug_level = 1;                  // Debug verbosity level
     
-    // Converts between flash address and XIP mapped address
-    inline void* flashAddressToXIP(uint32_t flash_addr) {
-        return (void*)(XIP_BASE + flash_addr);
+    // Journal state, rebuilt by scanJournal() at init
+    uint32_t _tail_sector = 0;             // Journal sector holding the oldest record
+    uint32_t _head_sector = 0;             // Journal sector currently being appended to
+    uint32_t _head_offset = 0;             // Next free byte in the head sector
+    uint8_t _head_format = JOURNAL_FORMAT_RAW; // Format of the head sector
+    RecordDeltaState _head_delta;          // Delta encoder state of the head page
+    uint32_t _used_sectors = 0;            // Journal sectors holding records (tail to head)
+    uint32_t _next_sequence = 0;           // Sequence number for the next sector opened
+    bool _head_open = false;               // Whether the head sector has a header yet
+    bool _head_full = false;               // Whether the head sector has no room left
+    bool _sector_erased[FLASH_MAX_REGION_SECTORS];      // Journal sectors known to be erased and unused
+    uint16_t _sector_records[FLASH_MAX_REGION_SECTORS]; // Records per journal sector
+    JournalSectorSummary _sector_summary[FLASH_MAX_REGION_SECTORS]; // Time/area index per journal sector
+    uint8_t _record_format = JOURNAL_FORMAT_RAW;    // Format used for new sectors
+    
+    // Retention state
+    uint32_t _uploaded_count = 0;          // Oldest records already uploaded (upload watermark)
+    uint32_t _dropped_count = 0;           // Un-uploaded records overwritten since boot
+    int _retention_policy = FLASH_RETENTION_OVERWRITE_OLDEST;
+    
+    // Erase-ahead state
+    uint8_t _erase_ahead_sectors = FLASH_DEFAULT_ERASE_AHEAD_SECTORS;
+    uint32_t _erase_ahead_count = 0;       // Sectors erased ahead since boot
+    uint32_t _sync_erase_count = 0;        // Erases on the append path since boot
+    uint8_t _high_watermark_percent = FLASH_DEFAULT_HIGH_WATERMARK_PERCENT;
+    
+    // Upload state, persisted in the upload log
+    uint32_t _ack_bitmap[FLASH_UPLOAD_WINDOW_CHUNKS / 32]; // Chunks after the watermark already uploaded or held back
+    uint16_t _ack_chunk_records = FLASH_DEFAULT_UPLOAD_CHUNK_RECORDS;    // Chunk size of _ack_bitmap
+    uint16_t _upload_chunk_records = FLASH_DEFAULT_UPLOAD_CHUNK_RECORDS; // Chunk size for new uploads
+    uint32_t _upload_advance = 0;          // Records the watermark moved since beginUpload()
+    UploadFilter _upload_filter = nullptr; // Records it rejects are held back, not uploaded
+    uint32_t _log_serial = 0;              // Serial number of the newest upload log entry
+    uint32_t _log_sector = 0;              // Upload log sector receiving new entries
+    uint32_t _log_offset = 0;              // Next free byte in that sector
+    bool _log_next_erased = false;         // The other log sector was erased ahead of the switch
+    bool _log_self_contained = false;      // The current log sector holds the newest upload and wear entries
+    
+    // Wear statistics, persisted in the upload log
+    uint32_t _erase_counts[FLASH_MAX_REGION_SECTORS];  // Erase cycles per region sector, from the top
+    uint32_t _boot_erase_counts[FLASH_MAX_REGION_SECTORS];  // Erase cycles at boot, for the wear rate
+    uint64_t _logical_bytes = 0;           // Bytes the storage was asked to keep
+    uint64_t _programmed_bytes = 0;        // Bytes handed to program calls
+    uint32_t _session_erases = 0;          // Sector erases since boot
+    uint32_t _wear_serial = 0;             // Serial number of the newest wear entry
+    uint32_t _sectors_since_wear_save = 0; // Journal sectors opened since the last wear entry
+    
+    // Staging buffer for page programming, kept out of the (small) stack
+    uint8_t _program_buffer[FLASH_PROGRAM_BUFFER_PAGES * FLASH_PAGE_SIZE];
+    
+    // Memory mapped pointer to a flash address
+    inline const void* flashPointer(uint32_t flash_addr) {
+        return _hal->map(flash_addr);
+    }
+    
+    // Flash address of a journal sector (index 0 = lowest sector of the region)
+    inline uint32_t journalSectorAddress(uint32_t sector) const {
+        return _data_start_address + sector * FLASH_SECTOR_SIZE;
+    }
+    
+    // XIP pointer to a byte inside a journal sector
+    inline const uint8_t* journalPointer(uint32_t sector, uint32_t offset) {
+        return (const uint8_t*)flashPointer(journalSectorAddress(sector) + offset);
+    }
+    
+    // Start of the sector a position walks, its RAM copy if there is one
+    inline const uint8_t* sectorData(const JournalPosition& pos) {
+        return pos.image ? pos.image : journalPointer(pos.sector, 0);
     }
     
-    // Serialize sensor data to a byte array
-    void serializeSensorData(const SensorData& data, uint8_t* buffer);
+    // Place the region below _region_end: header sector on top, then the upload log,
+    // then sector_count - 1 - FLASH_UPLOAD_LOG_SECTORS journal sectors
+    void setRegionGeometry(uint32_t sector_count);
     
-    // Deserialize sensor data from a byte array
-    SensorData deserializeSensorData(const uint8_t* buffer);
+    // Move the top of the region (header and upload log addresses)
+    void setRegionEnd(uint32_t region_end);
+    
+    // Check a region header read from the top sector of a region ending at region_end
+    bool isRegionHeaderValid(const FlashRegionHeader& header, uint32_t region_end) const;
+    
+    // End of a valid region whose header is not at the configured end, 0 if there is none
+    uint32_t findMovedRegion() const;
+    
+    // Region size for the current firmware image, limited by FLASH_MAX_REGION_SECTORS
+    uint32_t preferredRegionSectors() const;
+    
+    // Erase the whole region at the preferred size and write a fresh region header
+    bool formatRegion();
+    
+    // Rebuild head, tail and record count from the sector headers
+    void scanJournal();
+    
+    // Forget all journal state, the next appended record opens journal sector 0
+    void resetJournalState();
+    
+    // Walk a journal sector, returns the record count and the offset after the last record.
+    // corrupted_pages counts the sealed delta pages that fail their CRC check.
+    uint32_t countSectorRecords(uint32_t sector, uint32_t& end_offset, uint32_t& corrupted_pages);
+    
+    // Page CRC of a delta page: 1 = valid, 0 = corrupted, -1 = page not sealed.
+    // sector_data points to the start of the sector (XIP or a RAM copy).
+    int checkPageCrc(const uint8_t* sector_data, uint32_t page);
+    
+    // Seal the delta page holding offset with its CRC (page image taken from flash)
+    bool sealPage(uint32_t sector, uint32_t offset);
+    
+    // Move offset to the start of the next delta record in a sector, false at the end of the data
+    bool findDeltaRecord(const uint8_t* sector_data, uint32_t& offset);
+    
+    // Invalidate records of a batch that was interrupted before its last record was written.
+    // Rebuilds the sector summaries during the same walk.
+    void discardUncommittedRecords();
+    
+    // Mark a record as discarded so loaders skip it
+    void tombstoneRecord(uint32_t sector, uint32_t offset, uint8_t format);
+    
+    // Reset the summary of a journal sector and add a record to it
+    void clearSectorSummary(uint32_t sector);
+    void addToSectorSummary(uint32_t sector, const SensorData& data);
+    
+    // Check whether a journal sector can hold records matching filter
+    bool sectorMatches(uint32_t sector, const FlashQuery& filter) const;
+    
+    // Move pos past sectors (or the rest of its sector) without records matching filter.
+    // Returns the number of records skipped.
+    uint32_t skipUnmatchedSectors(JournalPosition& pos, const FlashQuery& filter);
+    
+    // Set pos to the start of a journal sector, image is an optional RAM copy of the sector
+    void startPosition(JournalPosition& pos, uint32_t sector, const uint8_t* image = nullptr);
+    
+    // Set pos to the record with the given logical index (0 = oldest)
+    void seekPosition(JournalPosition& pos, uint32_t index);
+    
+    // Decode the record at pos and advance pos to the next record. Returns false for
+    // invalid or discarded records, record_offset and flags describe the record read.
+    bool readRecordAt(JournalPosition& pos, SensorData& data, uint8_t& flags, uint32_t& record_offset);
+    
+    // Estimated room for records in the head sector and in an empty sector
+    uint32_t headRoom();
+    uint32_t minRecordsPerSector(uint8_t format) const;
+    
+    // Refresh the capacity estimate from the record counts of full sectors
+    void updateCapacityEstimate();
+    
+    // Find the newest upload and wear entries of the upload log and restore the upload
+    // watermark and the wear statistics from them
+    void loadUploadState();
+    
+    // Append the current upload state to the upload log
+    bool saveUploadState();
+    
+    // Append the current wear statistics to the upload log
+    bool saveWearState();
+    
+    // Make room for an upload log entry of size bytes, switching to the other log sector
+    // when the current one is full. switched tells whether the other sector was erased.
+    bool reserveLogSpace(size_t size, bool& switched);
+    
+    // Program an entry at the end of the current upload log sector
+    bool appendLogEntry(const void* entry, size_t size);
+    
+    // Forget the acknowledged chunks, the next upload starts a new chunk grid
+    void clearChunkAcks();
+    
+    // Move the watermark over count records, acknowledged chunks move along with it
+    void advanceWatermark(uint32_t count);
+    
+    // Mark a chunk as done (uploaded or held back) and persist the upload state
+    bool completeChunk(uint32_t chunk);
+    
+    // Check if count records can be appended, taking reclaimable sectors into account
+    bool hasSpaceFor(size_t count);
+    
+    // Erase the oldest journal sector so it can be reused, honours the retention policy
+    bool reclaimOldestSector();
+    
+    // Check if a journal sector is erased, the result is cached until the sector is opened
+    bool isSectorErased(uint32_t sector);
+    
+    // Append records to the journal, packing as many as possible into each program call
+    bool appendRecords(const SensorData* data, size_t count);
+    
+    // Check whether a range of flash is still in the erased state
+    bool isErased(uint32_t address, size_t size);
+    
+    // Program an arbitrary byte range inside already-erased flash.
+    // Only the pages touched by the range are programmed, everything else is left as is.
+    bool programRange(uint32_t address, const uint8_t* data, size_t size);
+    
+    // Serialize sensor data to a byte array, extra_flags are or-ed into the record flags
+    void serializeSensorData(const SensorData& data, uint8_t* buffer, uint8_t extra_flags = 0);
+    
+    // CRC-32 over all bytes of a serialized record except the checksum itself
+    uint32_t calculateChecksum(const SerializedSensorDataV2& record);
     
     // Create an error sensor data record
     SensorData getSensorDataError();
     
-    // Read a single record from a specific address
-    bool readSensorDataRecord(uint32_t addr, SensorData &data);
-    
     // Helper for safe flash operations
     bool safeFlashErase(uint32_t address, size_t size);
     bool safeFlashProgram(uint32_t address, const uint8_t* data, size_t size);
@@ -0,0 +1,109 @@
+#include "flash_bulk_reader.h"
+#include <cstdio>
+#include "pico/stdlib.h"
+
+FlashBulkReader::FlashBulkReader(Flash& flash, uint32_t begin, uint32_t end)
+    : _flash(flash), _position(begin), _end(end), _staging(2 * FLASH_SECTOR_SIZE) {
+    _start_us = time_us_64();
+
+    if (!_flash._flash_enabled || _position >= _end) {
+        return;
+    }
+
+    _flash.seekPosition(_journal_position, _position);
+
+    // Stage the first sector, the position found by the seek stays valid for the copy
+    _flash._hal->startRead(_flash.journalSectorAddress(_journal_position.sector), buffer(_active), FLASH_SECTOR_SIZE);
+    _flash._hal->waitRead();
+    _journal_position.image = buffer(_active);
+    _stats.sectors_read++;
+
+    uint32_t sector_left = _flash._sector_records[_journal_position.sector] - _journal_position.record;
+    if (_end - _position > sector_left) {
+        prefetchSector((_journal_position.sector + 1) % _flash._data_sector_count);
+    }
+}
+
+FlashBulkReader::~FlashBulkReader() {
+    // The DMA must not keep writing into the freed buffers
+    if (_prefetching) {
+        _flash._hal->waitRead();
+    }
+}
+
+void FlashBulkReader::prefetchSector(uint32_t sector) {
+    _flash._hal->startRead(_flash.journalSectorAddress(sector), buffer(_active ^ 1), FLASH_SECTOR_SIZE);
+    _prefetching = true;
+    _prefetch_sector = sector;
+}
+
+void FlashBulkReader::advanceSector() {
+    uint32_t sector = (_journal_position.sector + 1) % _flash._data_sector_count;
+
+    uint64_t wait_start_us = time_us_64();
+    if (!_prefetching || _prefetch_sector != sector) {
+        prefetchSector(sector);
+    }
+    _flash._hal->waitRead();
+    _prefetching = false;
+    _stats.wait_us += time_us_64() - wait_start_us;
+
+    _active ^= 1;
+    _flash.startPosition(_journal_position, sector, buffer(_active));
+    _stats.sectors_read++;
+
+    // Copy the following sector while this one is decoded
+    if (_end - _position > _flash._sector_records[sector]) {
+        prefetchSector((sector + 1) % _flash._data_sector_count);
+    }
+}
+
+bool FlashBulkReader::next(SensorData& data) {
+    if (!_flash._flash_enabled) {
+        return false;
+    }
+
+    uint32_t sectors_advanced = 0;
+    while (_position < _end) {
+        if (_journal_position.record >= _flash._sector_records[_journal_position.sector]) {
+            if (++sectors_advanced > _flash._data_sector_count) {
+                break;
+            }
+            advanceSector();
+            continue;
+        }
+
+        uint8_t flags;
+        uint32_t record_offset;
+        _position++;
+        if (_flash.readRecordAt(_journal_position, data, flags, record_offset)) {
+            _stats.records_read++;
+            return true;
+        }
+
+        _skipped++;
+        if (_flash._debug_level > 0) {
+            printf("FLASH WARNING: Skipping invalid record at index %lu\n", _position - 1);
+        }
+    }
+
+    if (_stats.elapsed_us == 0) {
+        _stats.elapsed_us = time_us_64() - _start_us;
+    }
+    return false;
+}
+
+float FlashBulkReader::throughputMBps() const {
+    uint64_t elapsed_us = _stats.elapsed_us > 0 ? _stats.elapsed_us : time_us_64() - _start_us;
+    if (elapsed_us == 0) {
+        return 0.0f;
+    }
+    // Bytes per microsecond are MB/s
+    return (float)_stats.sectors_read * FLASH_SECTOR_SIZE / elapsed_us;
+}
+
+void FlashBulkReader::printStats() const {
+    printf("FLASH: Bulk read of %lu records from %lu sectors in %lu us (%.2f MB/s), %lu us waiting for copies\n",
+           (unsigned long)_stats.records_read, (unsigned long)_stats.sectors_read,
+           (unsigned long)_stats.elapsed_us, throughputMBps(), (unsigned long)_stats.wait_us);
+}
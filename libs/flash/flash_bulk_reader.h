@@ -0,0 +1,67 @@
+#ifndef FLASH_BULK_READER_H
+#define FLASH_BULK_READER_H
+
+#include <vector>
+#include "flash.h"
+
+// Timing statistics of a bulk read
+struct FlashBulkReaderStats {
+    uint32_t sectors_read = 0;      // Sectors copied into the staging buffers
+    uint32_t records_read = 0;      // Valid records returned by next()
+    uint64_t wait_us = 0;           // Time next() waited for a sector copy to finish
+    uint64_t elapsed_us = 0;        // From construction until the end of the range was reached
+};
+
+// Forward reader over a range of journal records for walks over the whole journal
+// (Flash::loadAllSensorData()). Whole sectors are copied into one of two RAM staging
+// buffers with FlashHal::startRead() (XIP streaming + DMA on the Pico) while the records
+// of the other buffer are decoded, so decoding does not wait on XIP cache misses. No
+// device throughput figures exist. Uploads read with FlashRecordCursor instead: a chunk
+// is a few records of one sector, read once per HTTP request, so staging whole sectors
+// would only add the heap.
+//
+// Returns the same records as FlashRecordCursor. Nothing may be appended to the journal
+// while a reader is in use. Holds 2 * FLASH_SECTOR_SIZE bytes of heap.
+class FlashBulkReader {
+public:
+    FlashBulkReader(Flash& flash, uint32_t begin, uint32_t end);
+    ~FlashBulkReader();
+
+    // Decode the next valid record into data, invalid records are skipped.
+    // Returns false once the end of the range is reached.
+    bool next(SensorData& data);
+
+    uint32_t position() const { return _position; }
+    bool atEnd() const { return _position >= _end; }
+    uint32_t remaining() const { return _position < _end ? _end - _position : 0; }
+    uint32_t skippedCount() const { return _skipped; }
+
+    const FlashBulkReaderStats& stats() const { return _stats; }
+
+    // Sector bytes staged per second of reading, in MB/s
+    float throughputMBps() const;
+    void printStats() const;
+
+private:
+    // Switch to the next journal sector and start copying the one after it
+    void advanceSector();
+
+    // Start copying a sector into the buffer not being decoded
+    void prefetchSector(uint32_t sector);
+
+    uint8_t* buffer(uint8_t index) { return &_staging[index * FLASH_SECTOR_SIZE]; }
+
+    Flash& _flash;
+    uint32_t _position;
+    uint32_t _end;
+    uint32_t _skipped = 0;
+    JournalPosition _journal_position;
+    std::vector<uint8_t> _staging;      // Two sector buffers
+    uint8_t _active = 0;                // Buffer holding the sector being decoded
+    bool _prefetching = false;          // A copy into the other buffer is in flight
+    uint32_t _prefetch_sector = 0;
+    uint64_t _start_us;
+    FlashBulkReaderStats _stats;
+};
+
+#endif // FLASH_BULK_READER_H
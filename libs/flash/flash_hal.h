@@ -0,0 +1,61 @@
+#ifndef FLASH_HAL_H
+#define FLASH_HAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if PICO_ON_DEVICE
+#include "hardware/flash.h"
+#endif
+
+// Geometry of the RP2040 flash (W25Q16JV), also used by host builds
+#ifndef FLASH_PAGE_SIZE
+#define FLASH_PAGE_SIZE   (1u << 8)     // Program unit
+#endif
+#ifndef FLASH_SECTOR_SIZE
+#define FLASH_SECTOR_SIZE (1u << 12)    // Erase unit
+#endif
+
+// Raw flash access used by the Flash class. Addresses are offsets from the start of flash.
+//
+// Backends:
+//   PicoFlashHal     (flash_hal_pico.cpp)     - Pico SDK flash_range_* calls, reads through XIP
+//   EmulatedFlashHal (flash_hal_emulator.cpp) - RAM/file backed emulator for host builds
+class FlashHal {
+public:
+    virtual ~FlashHal() {}
+
+    // Erase whole sectors, address and size must be multiples of FLASH_SECTOR_SIZE
+    virtual bool erase(uint32_t address, size_t size) = 0;
+
+    // Program whole pages, address and size must be multiples of FLASH_PAGE_SIZE.
+    // Programming can only clear bits, 0xFF bytes leave the flash contents untouched.
+    virtual bool program(uint32_t address, const uint8_t* data, size_t size) = 0;
+
+    // Memory mapped view of the flash contents at address
+    virtual const uint8_t* map(uint32_t address) = 0;
+
+    // Size of the flash chip in bytes
+    virtual uint32_t size() = 0;
+
+    // End of the firmware image (first byte after it), storage must stay above it
+    virtual uint32_t imageEnd() = 0;
+    
+    // Copy size bytes (a multiple of 4) starting at address into buffer. The copy may still
+    // be running when this returns, buffer is only valid after waitRead(). One read can be
+    // in flight at a time. The default copies through map() before returning.
+    virtual bool startRead(uint32_t address, uint8_t* buffer, size_t size) {
+        memcpy(buffer, map(address), size);
+        return true;
+    }
+    
+    // Wait for the read started last
+    virtual void waitRead() {}
+};
+
+// Backend used when no other one is passed to Flash: the Pico SDK backend on the device,
+// a shared emulator instance in host builds (whichever backend file is linked in)
+FlashHal& defaultFlashHal();
+
+#endif // FLASH_HAL_H
@@ -0,0 +1,101 @@
+#include "flash_hal_emulator.h"
+#include <cstdio>
+#include <cstring>
+
+EmulatedFlashHal::EmulatedFlashHal(size_t flash_size, const FlashCostModel& cost)
+    : _contents(flash_size, 0xFF), _erase_counts(flash_size / FLASH_SECTOR_SIZE, 0), _cost(cost) {
+}
+
+bool EmulatedFlashHal::erase(uint32_t address, size_t size) {
+    if (address % FLASH_SECTOR_SIZE != 0 || size % FLASH_SECTOR_SIZE != 0 ||
+        (size_t)address + size > _contents.size()) {
+        printf("FLASH EMULATOR ERROR: Invalid erase at 0x%08x (size %lu)\n",
+               (unsigned int)address, (unsigned long)size);
+        _stats.rejected_calls++;
+        return false;
+    }
+
+    memset(&_contents[address], 0xFF, size);
+
+    uint32_t sectors = size / FLASH_SECTOR_SIZE;
+    for (uint32_t i = 0; i < sectors; i++) {
+        _erase_counts[address / FLASH_SECTOR_SIZE + i]++;
+    }
+
+    _stats.erase_calls++;
+    _stats.sectors_erased += sectors;
+    charge(_cost.call_overhead_us + sectors * _cost.sector_erase_us);
+    return true;
+}
+
+bool EmulatedFlashHal::program(uint32_t address, const uint8_t* data, size_t size) {
+    if (address % FLASH_PAGE_SIZE != 0 || size % FLASH_PAGE_SIZE != 0 ||
+        (size_t)address + size > _contents.size()) {
+        printf("FLASH EMULATOR ERROR: Invalid program at 0x%08x (size %lu)\n",
+               (unsigned int)address, (unsigned long)size);
+        _stats.rejected_calls++;
+        return false;
+    }
+
+    // NOR flash can only clear bits, setting a bit needs an erase
+    for (size_t i = 0; i < size; i++) {
+        _contents[address + i] &= data[i];
+    }
+
+    uint32_t pages = size / FLASH_PAGE_SIZE;
+    _stats.program_calls++;
+    _stats.pages_programmed += pages;
+    _stats.bytes_programmed += size;
+    charge(_cost.call_overhead_us + pages * _cost.page_program_us);
+    return true;
+}
+
+const uint8_t* EmulatedFlashHal::map(uint32_t address) {
+    return &_contents[address];
+}
+
+bool EmulatedFlashHal::loadImage(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    // A shorter image leaves the rest of the flash erased
+    memset(_contents.data(), 0xFF, _contents.size());
+    fread(_contents.data(), 1, _contents.size(), file);
+    fclose(file);
+    return true;
+}
+
+bool EmulatedFlashHal::saveImage(const char* path) const {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool written = fwrite(_contents.data(), 1, _contents.size(), file) == _contents.size();
+    fclose(file);
+    return written;
+}
+
+uint32_t EmulatedFlashHal::maxEraseCount() const {
+    uint32_t max_count = 0;
+    for (uint32_t count : _erase_counts) {
+        if (count > max_count) {
+            max_count = count;
+        }
+    }
+    return max_count;
+}
+
+void EmulatedFlashHal::charge(uint32_t duration_us) {
+    _stats.busy_us += duration_us;
+    if (duration_us > _stats.worst_call_us) {
+        _stats.worst_call_us = duration_us;
+    }
+}
+
+FlashHal& defaultFlashHal() {
+    static EmulatedFlashHal hal;
+    return hal;
+}
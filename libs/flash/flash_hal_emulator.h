@@ -0,0 +1,69 @@
+#ifndef FLASH_HAL_EMULATOR_H
+#define FLASH_HAL_EMULATOR_H
+
+#include <vector>
+#include "flash_hal.h"
+
+// Modeled duration of flash operations, defaults are typical W25Q16JV datasheet values
+struct FlashCostModel {
+    uint32_t sector_erase_us = 45000;   // 4 KB sector erase
+    uint32_t page_program_us = 400;     // 256 byte page program
+    uint32_t call_overhead_us = 20;     // Per erase/program call (leaving and re-entering XIP)
+};
+
+// Operation counters of the emulator
+struct FlashEmulatorStats {
+    uint32_t erase_calls = 0;
+    uint32_t program_calls = 0;
+    uint32_t rejected_calls = 0;        // Misaligned or out of range, not executed
+    uint32_t sectors_erased = 0;
+    uint32_t pages_programmed = 0;
+    uint64_t bytes_programmed = 0;      // Whole pages, including 0xFF filler
+    uint64_t busy_us = 0;               // Modeled time spent in erase and program calls
+    uint32_t worst_call_us = 0;         // Longest single erase or program call
+};
+
+// RAM backed flash emulator for host builds. Models sector erase, page program and
+// 1->0 bit semantics, counts erases per sector and charges every operation against
+// the cost model. Optionally loaded from and saved to an image file.
+class EmulatedFlashHal : public FlashHal {
+public:
+    EmulatedFlashHal(size_t flash_size = 2 * 1024 * 1024, const FlashCostModel& cost = FlashCostModel());
+
+    bool erase(uint32_t address, size_t size) override;
+    bool program(uint32_t address, const uint8_t* data, size_t size) override;
+    const uint8_t* map(uint32_t address) override;
+    uint32_t size() override { return _contents.size(); }
+    uint32_t imageEnd() override { return _image_end; }
+
+    // Pretend a firmware image of this size is stored at the start of flash
+    void setImageEnd(uint32_t image_end) { _image_end = image_end; }
+
+    // Load or save the flash contents as a raw image file
+    bool loadImage(const char* path);
+    bool saveImage(const char* path) const;
+
+    // Writable view of the contents for fault injection (bypasses the flash semantics)
+    uint8_t* raw(uint32_t address) { return &_contents[address]; }
+
+    // Erase cycles of a sector and the highest count of any sector
+    uint32_t eraseCount(uint32_t sector) const { return _erase_counts[sector]; }
+    uint32_t maxEraseCount() const;
+
+    const FlashEmulatorStats& stats() const { return _stats; }
+    void resetStats() { _stats = FlashEmulatorStats(); }
+
+    void setCostModel(const FlashCostModel& cost) { _cost = cost; }
+
+private:
+    // Add the modeled duration of one call to the statistics
+    void charge(uint32_t duration_us);
+
+    std::vector<uint8_t> _contents;
+    std::vector<uint32_t> _erase_counts;
+    FlashCostModel _cost;
+    FlashEmulatorStats _stats;
+    uint32_t _image_end = 0;
+};
+
+#endif // FLASH_HAL_EMULATOR_H
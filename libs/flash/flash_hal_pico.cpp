@@ -0,0 +1,121 @@
+#include "flash_hal.h"
+#include <cstdio>
+#include "hardware/flash.h"
+#include "hardware/dma.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "pico/flash.h"
+
+// End of the firmware image in flash, defined by the linker script
+extern char __flash_binary_end;
+
+// How long flash_safe_execute may wait for the other core to park before giving up
+#define FLASH_SAFE_EXECUTE_TIMEOUT_MS 100
+
+// Parameters handed to the flash_safe_execute callbacks
+struct FlashOperation {
+    uint32_t address;
+    const uint8_t* data;
+    size_t size;
+};
+
+static void eraseOperation(void* param) {
+    const FlashOperation* operation = (const FlashOperation*)param;
+    flash_range_erase(operation->address, operation->size);
+}
+
+static void programOperation(void* param) {
+    const FlashOperation* operation = (const FlashOperation*)param;
+    flash_range_program(operation->address, operation->data, operation->size);
+}
+
+// Pico SDK backend. flash_safe_execute disables interrupts and, once the second core
+// runs code, parks it while XIP is unavailable. The flash_range_* calls only return
+// after the operation completed, no extra delay is needed.
+//
+// Bulk reads use the XIP streaming interface: the XIP controller fetches the range into
+// its stream FIFO past the cache and a DMA channel drains it into RAM, so the CPU keeps
+// running (code from the cache) while a sector is copied.
+class PicoFlashHal : public FlashHal {
+public:
+    bool erase(uint32_t address, size_t size) override {
+        waitRead();
+        FlashOperation operation = { address, nullptr, size };
+        int result = flash_safe_execute(eraseOperation, &operation, FLASH_SAFE_EXECUTE_TIMEOUT_MS);
+        if (result != PICO_OK) {
+            printf("FLASH ERROR: flash_safe_execute failed for erase (%d)\n", result);
+            return false;
+        }
+        return true;
+    }
+
+    bool program(uint32_t address, const uint8_t* data, size_t size) override {
+        waitRead();
+        FlashOperation operation = { address, data, size };
+        int result = flash_safe_execute(programOperation, &operation, FLASH_SAFE_EXECUTE_TIMEOUT_MS);
+        if (result != PICO_OK) {
+            printf("FLASH ERROR: flash_safe_execute failed for program (%d)\n", result);
+            return false;
+        }
+        return true;
+    }
+
+    const uint8_t* map(uint32_t address) override {
+        return (const uint8_t*)(XIP_BASE + address);
+    }
+    
+    uint32_t size() override {
+        return PICO_FLASH_SIZE_BYTES;
+    }
+    
+    // The linker places __flash_binary_end right after the last byte of the image
+    uint32_t imageEnd() override {
+        return (uint32_t)((uintptr_t)&__flash_binary_end - XIP_BASE);
+    }
+    
+    bool startRead(uint32_t address, uint8_t* buffer, size_t size) override {
+        waitRead();
+        
+        // Claimed on first use, without a free channel reads fall back to a copy through XIP
+        if (!_dma_checked) {
+            _dma_channel = dma_claim_unused_channel(false);
+            _dma_checked = true;
+        }
+        if (_dma_channel < 0 || size % 4 != 0) {
+            return FlashHal::startRead(address, buffer, size);
+        }
+        
+        // Drop anything left in the stream FIFO from an earlier transfer
+        while (!(xip_ctrl_hw->stat & XIP_STAT_FIFO_EMPTY)) {
+            (void)xip_ctrl_hw->stream_fifo;
+        }
+        xip_ctrl_hw->stream_addr = XIP_BASE + address;
+        xip_ctrl_hw->stream_ctr = size / 4;
+        
+        dma_channel_config config = dma_channel_get_default_config(_dma_channel);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_dreq(&config, DREQ_XIP_STREAM);
+        dma_channel_configure(_dma_channel, &config, buffer, (const void*)XIP_AUX_BASE, size / 4, true);
+        
+        _read_active = true;
+        return true;
+    }
+    
+    void waitRead() override {
+        if (_read_active) {
+            dma_channel_wait_for_finish_blocking(_dma_channel);
+            _read_active = false;
+        }
+    }
+    
+private:
+    int _dma_channel = -1;
+    bool _dma_checked = false;
+    bool _read_active = false;
+};
+
+FlashHal& defaultFlashHal() {
+    static PicoFlashHal hal;
+    return hal;
+}
@@ -0,0 +1,449 @@
+#include "flash_stream.h"
+#include "flash.h"
+#include "crc32.h"
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+
+uint16_t streamEntryCheck(uint8_t size, uint8_t type, const uint8_t* payload) {
+    uint8_t buffer[2 + STREAM_MAX_PAYLOAD];
+    buffer[0] = size;
+    buffer[1] = type;
+    memcpy(buffer + 2, payload, size);
+    return (uint16_t)crc32Compute(buffer, 2 + size);
+}
+
+FlashStreamCursor::FlashStreamCursor(FlashStream& stream, bool pending_only)
+    : _stream(stream), _sector_index(0), _offset(sizeof(StreamSectorHeader)), _pending_only(pending_only) {
+}
+
+bool FlashStreamCursor::next(FlashStreamEntry& entry) {
+    while (_sector_index < _stream._used_sectors) {
+        uint32_t sector = (_stream._tail_sector + _sector_index) % _stream._sector_count;
+        StreamEntryHeader header;
+
+        if (!_stream.entryAt(sector, _offset, header)) {
+            _sector_index++;
+            _offset = sizeof(StreamSectorHeader);
+            continue;
+        }
+
+        uint32_t offset = _offset;
+        _offset += sizeof(StreamEntryHeader) + header.size;
+
+        if (!_stream.entryValid(sector, offset, header)) {
+            _skipped++;
+            continue;
+        }
+        if (_pending_only && !(header.flags & STREAM_ENTRY_PENDING)) {
+            continue;
+        }
+
+        entry.type = header.type;
+        entry.size = header.size;
+        entry.flags = header.flags;
+        memcpy(entry.payload, _stream.sectorPointer(sector, offset + sizeof(StreamEntryHeader)), header.size);
+        return true;
+    }
+
+    return false;
+}
+
+FlashStream::FlashStream(const char* name, uint8_t stream_id, uint32_t address, uint32_t sector_count,
+                         FlashHal* hal)
+    : _name(name), _stream_id(stream_id), _address(address), _sector_count(sector_count),
+      _retention_policy(FLASH_RETENTION_OVERWRITE_OLDEST), _batch_page(STREAM_NO_PAGE) {
+    _hal = hal ? hal : &defaultFlashHal();
+
+    if (_sector_count > STREAM_MAX_SECTORS) {
+        printf("FLASH WARNING: Stream %s limited to %u sectors\n", _name, (unsigned int)STREAM_MAX_SECTORS);
+        _sector_count = STREAM_MAX_SECTORS;
+    }
+
+    memset(_sector_entries, 0, sizeof(_sector_entries));
+    memset(_sector_pending, 0, sizeof(_sector_pending));
+}
+
+void FlashStream::setPool(uint32_t address, uint32_t sector_count) {
+    uint32_t available = address < _hal->size() ? (_hal->size() - address) / FLASH_SECTOR_SIZE : 0;
+    if (sector_count > available) {
+        printf("FLASH WARNING: Stream %s cut to %lu of %lu sectors at the end of flash\n",
+               _name, (unsigned long)available, (unsigned long)sector_count);
+        sector_count = available;
+    }
+    if (sector_count > STREAM_MAX_SECTORS) {
+        printf("FLASH WARNING: Stream %s limited to %u sectors\n", _name, (unsigned int)STREAM_MAX_SECTORS);
+        sector_count = STREAM_MAX_SECTORS;
+    }
+
+    _address = address;
+    _sector_count = sector_count;
+}
+
+bool FlashStream::init() {
+    if (!_flash_enabled) {
+        return true;
+    }
+
+    if (_sector_count < 2 || _address % FLASH_SECTOR_SIZE != 0) {
+        printf("FLASH ERROR: Stream %s needs at least 2 aligned sectors\n", _name);
+        _flash_enabled = false;
+        return false;
+    }
+
+    bool found = false;
+    uint32_t min_sequence = 0;
+    uint32_t max_sequence = 0;
+
+    for (uint32_t sector = 0; sector < _sector_count; sector++) {
+        StreamSectorHeader header;
+        memcpy(&header, sectorPointer(sector, 0), sizeof(header));
+
+        if (header.magic != STREAM_SECTOR_MAGIC || header.stream_id != _stream_id ||
+            header.version != STREAM_FORMAT_VERSION) {
+            continue;
+        }
+
+        if (!found || header.sequence < min_sequence) {
+            min_sequence = header.sequence;
+            _tail_sector = sector;
+        }
+        if (!found || header.sequence > max_sequence) {
+            max_sequence = header.sequence;
+            _head_sector = sector;
+        }
+        found = true;
+    }
+
+    _entry_count = 0;
+    _pending_count = 0;
+    memset(_sector_entries, 0, sizeof(_sector_entries));
+    memset(_sector_pending, 0, sizeof(_sector_pending));
+
+    if (!found) {
+        // Nothing appended yet, the first append opens sector 0
+        _tail_sector = 0;
+        _head_sector = _sector_count - 1;
+        _head_offset = FLASH_SECTOR_SIZE;
+        _used_sectors = 0;
+        _next_sequence = 0;
+    } else {
+        _used_sectors = (_head_sector + _sector_count - _tail_sector) % _sector_count + 1;
+        for (uint32_t i = 0; i < _used_sectors; i++) {
+            uint32_t sector = (_tail_sector + i) % _sector_count;
+            _head_offset = scanSector(sector, _sector_entries[sector], _sector_pending[sector]);
+            _entry_count += _sector_entries[sector];
+            _pending_count += _sector_pending[sector];
+        }
+        _next_sequence = max_sequence + 1;
+    }
+
+    printf("FLASH: Stream %s at 0x%08x (%lu sectors): %lu entries, %lu pending\n",
+           _name, (unsigned int)_address, (unsigned long)_sector_count,
+           (unsigned long)_entry_count, (unsigned long)_pending_count);
+    return true;
+}
+
+bool FlashStream::entryAt(uint32_t sector, uint32_t offset, StreamEntryHeader& header) {
+    if (offset + sizeof(StreamEntryHeader) > FLASH_SECTOR_SIZE) {
+        return false;
+    }
+
+    memcpy(&header, sectorPointer(sector, offset), sizeof(header));
+    return header.size != 0xFF && header.size <= STREAM_MAX_PAYLOAD &&
+           offset + sizeof(StreamEntryHeader) + header.size <= FLASH_SECTOR_SIZE;
+}
+
+bool FlashStream::entryValid(uint32_t sector, uint32_t offset, const StreamEntryHeader& header) {
+    const uint8_t* payload = sectorPointer(sector, offset + sizeof(StreamEntryHeader));
+    return header.check == streamEntryCheck(header.size, header.type, payload);
+}
+
+uint32_t FlashStream::scanSector(uint32_t sector, uint16_t& entries, uint16_t& pending) {
+    uint32_t offset = sizeof(StreamSectorHeader);
+    StreamEntryHeader header;
+
+    entries = 0;
+    pending = 0;
+    while (entryAt(sector, offset, header)) {
+        if (entryValid(sector, offset, header)) {
+            entries++;
+            if (_track_uploads && (header.flags & STREAM_ENTRY_PENDING)) {
+                pending++;
+            }
+        }
+        offset += sizeof(StreamEntryHeader) + header.size;
+    }
+
+    return offset;
+}
+
+bool FlashStream::append(uint8_t type, const void* payload, uint8_t size) {
+    if (!_flash_enabled) {
+        return true;
+    }
+
+    if (size > STREAM_MAX_PAYLOAD) {
+        printf("FLASH ERROR: Stream %s entry of %u bytes is too large\n", _name, (unsigned int)size);
+        return false;
+    }
+
+    uint32_t entry_size = sizeof(StreamEntryHeader) + size;
+    if (_used_sectors == 0 || _head_offset + entry_size > FLASH_SECTOR_SIZE) {
+        if (!openSector()) {
+            return false;
+        }
+    }
+
+    uint8_t entry[sizeof(StreamEntryHeader) + STREAM_MAX_PAYLOAD];
+    StreamEntryHeader header;
+    header.size = size;
+    header.type = type;
+    header.flags = _track_uploads ? 0xFF : (uint8_t)~STREAM_ENTRY_PENDING;
+    header.check = streamEntryCheck(size, type, (const uint8_t*)payload);
+    memcpy(entry, &header, sizeof(header));
+    memcpy(entry + sizeof(header), payload, size);
+
+    uint32_t address = sectorAddress(_head_sector) + _head_offset;
+    bool written = _batching ? stageRange(address, entry, entry_size) : programRange(address, entry, entry_size);
+    if (!written) {
+        printf("FLASH ERROR: Stream %s append failed\n", _name);
+        // Skip the range, it may hold part of the entry
+        _head_offset += entry_size;
+        return false;
+    }
+
+    _head_offset += entry_size;
+    _sector_entries[_head_sector]++;
+    _entry_count++;
+    if (_track_uploads) {
+        _sector_pending[_head_sector]++;
+        _pending_count++;
+    }
+    return true;
+}
+
+bool FlashStream::endBatch() {
+    _batching = false;
+    if (!flushBatch()) {
+        printf("FLASH ERROR: Stream %s batch write failed\n", _name);
+        return false;
+    }
+    return true;
+}
+
+bool FlashStream::openSector() {
+    // The staged page belongs to the previous sector
+    if (!flushBatch()) {
+        printf("FLASH ERROR: Stream %s batch write failed\n", _name);
+    }
+
+    if (_used_sectors == _sector_count && !reclaimOldestSector()) {
+        return false;
+    }
+
+    uint32_t sector = (_head_sector + 1) % _sector_count;
+
+    // Sectors are erased when they are opened, stale or foreign data is dropped here
+    const uint8_t* contents = sectorPointer(sector, 0);
+    for (uint32_t i = 0; i < FLASH_SECTOR_SIZE; i++) {
+        if (contents[i] != 0xFF) {
+            if (!_hal->erase(sectorAddress(sector), FLASH_SECTOR_SIZE)) {
+                printf("FLASH ERROR: Stream %s failed to erase sector %lu\n", _name, (unsigned long)sector);
+                return false;
+            }
+            break;
+        }
+    }
+
+    StreamSectorHeader header;
+    memset(&header, 0xFF, sizeof(header));
+    header.magic = STREAM_SECTOR_MAGIC;
+    header.sequence = _next_sequence;
+    header.stream_id = _stream_id;
+    header.version = STREAM_FORMAT_VERSION;
+
+    if (!programRange(sectorAddress(sector), (const uint8_t*)&header, sizeof(header))) {
+        printf("FLASH ERROR: Stream %s failed to write sector header\n", _name);
+        return false;
+    }
+
+    if (_used_sectors == 0) {
+        _tail_sector = sector;
+    }
+    _head_sector = sector;
+    _head_offset = sizeof(StreamSectorHeader);
+    _sector_entries[sector] = 0;
+    _sector_pending[sector] = 0;
+    _used_sectors++;
+    _next_sequence++;
+
+    if (_debug_level > 0) {
+        printf("FLASH: Stream %s opened sector %lu (sequence %lu)\n",
+               _name, (unsigned long)sector, (unsigned long)header.sequence);
+    }
+    return true;
+}
+
+bool FlashStream::reclaimOldestSector() {
+    uint16_t pending = _sector_pending[_tail_sector];
+
+    if (pending > 0) {
+        if (_retention_policy == FLASH_RETENTION_KEEP_UNUPLOADED) {
+            printf("FLASH ERROR: Stream %s is full of entries that were not uploaded\n", _name);
+            return false;
+        }
+        printf("FLASH WARNING: Stream %s overwriting %u entries that were not uploaded\n",
+               _name, (unsigned int)pending);
+        _dropped_count += pending;
+    }
+
+    if (!_hal->erase(sectorAddress(_tail_sector), FLASH_SECTOR_SIZE)) {
+        printf("FLASH ERROR: Stream %s failed to erase sector %lu\n", _name, (unsigned long)_tail_sector);
+        return false;
+    }
+
+    _entry_count -= _sector_entries[_tail_sector];
+    _pending_count -= pending;
+    _sector_entries[_tail_sector] = 0;
+    _sector_pending[_tail_sector] = 0;
+    _tail_sector = (_tail_sector + 1) % _sector_count;
+    _used_sectors--;
+    return true;
+}
+
+bool FlashStream::isFull() const {
+    return _retention_policy == FLASH_RETENTION_KEEP_UNUPLOADED &&
+           _used_sectors == _sector_count && _sector_pending[_tail_sector] > 0 &&
+           _head_offset + sizeof(StreamEntryHeader) + STREAM_MAX_PAYLOAD > FLASH_SECTOR_SIZE;
+}
+
+bool FlashStream::markUploaded(uint32_t count) {
+    if (!_flash_enabled || !_track_uploads) {
+        return true;
+    }
+
+    if (!flushBatch()) {
+        return false;
+    }
+
+    // Flag bytes of the same page are cleared with one program call
+    uint32_t page_address = 0;
+    bool page_dirty = false;
+
+    for (uint32_t i = 0; i < _used_sectors && count > 0; i++) {
+        uint32_t sector = (_tail_sector + i) % _sector_count;
+        uint32_t offset = sizeof(StreamSectorHeader);
+        StreamEntryHeader header;
+
+        while (count > 0 && entryAt(sector, offset, header)) {
+            if ((header.flags & STREAM_ENTRY_PENDING) && entryValid(sector, offset, header)) {
+                uint32_t flag_address = sectorAddress(sector) + offset + offsetof(StreamEntryHeader, flags);
+                uint32_t flag_page = flag_address - flag_address % FLASH_PAGE_SIZE;
+
+                if (page_dirty && flag_page != page_address) {
+                    if (!_hal->program(page_address, _page_buffer, FLASH_PAGE_SIZE)) {
+                        return false;
+                    }
+                    page_dirty = false;
+                }
+                if (!page_dirty) {
+                    memset(_page_buffer, 0xFF, sizeof(_page_buffer));
+                    page_address = flag_page;
+                    page_dirty = true;
+                }
+
+                _page_buffer[flag_address - flag_page] = header.flags & ~STREAM_ENTRY_PENDING;
+                _sector_pending[sector]--;
+                _pending_count--;
+                count--;
+            }
+            offset += sizeof(StreamEntryHeader) + header.size;
+        }
+    }
+
+    if (page_dirty && !_hal->program(page_address, _page_buffer, FLASH_PAGE_SIZE)) {
+        return false;
+    }
+    return true;
+}
+
+bool FlashStream::eraseStream() {
+    _batch_page = STREAM_NO_PAGE;
+    if (_flash_enabled && !_hal->erase(_address, _sector_count * FLASH_SECTOR_SIZE)) {
+        printf("FLASH ERROR: Stream %s erase failed\n", _name);
+        return false;
+    }
+
+    _tail_sector = 0;
+    _head_sector = _sector_count - 1;
+    _head_offset = FLASH_SECTOR_SIZE;
+    _used_sectors = 0;
+    _entry_count = 0;
+    _pending_count = 0;
+    memset(_sector_entries, 0, sizeof(_sector_entries));
+    memset(_sector_pending, 0, sizeof(_sector_pending));
+    return true;
+}
+
+bool FlashStream::programRange(uint32_t address, const uint8_t* data, size_t size) {
+    // Bytes outside the range are programmed as 0xFF, which leaves the flash contents unchanged
+    uint32_t end_address = address + size;
+    uint32_t page_address = address - (address % FLASH_PAGE_SIZE);
+
+    while (page_address < end_address) {
+        uint32_t copy_start = address > page_address ? address : page_address;
+        uint32_t copy_end = end_address < page_address + FLASH_PAGE_SIZE ? end_address : page_address + FLASH_PAGE_SIZE;
+
+        memset(_page_buffer, 0xFF, sizeof(_page_buffer));
+        memcpy(_page_buffer + (copy_start - page_address), data + (copy_start - address), copy_end - copy_start);
+        if (!_hal->program(page_address, _page_buffer, FLASH_PAGE_SIZE)) {
+            return false;
+        }
+
+        page_address += FLASH_PAGE_SIZE;
+    }
+
+    // Read back, programming can only clear bits
+    return memcmp(_hal->map(address), data, size) == 0;
+}
+
+bool FlashStream::stageRange(uint32_t address, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        uint32_t page_address = address - (address % FLASH_PAGE_SIZE);
+        if (page_address != _batch_page) {
+            if (!flushBatch()) {
+                return false;
+            }
+            memset(_batch_buffer, 0xFF, sizeof(_batch_buffer));
+            _batch_page = page_address;
+            _batch_start = address - page_address;
+        }
+
+        uint32_t offset = address - page_address;
+        uint32_t length = FLASH_PAGE_SIZE - offset < size ? FLASH_PAGE_SIZE - offset : size;
+        memcpy(_batch_buffer + offset, data, length);
+        _batch_end = offset + length;
+
+        address += length;
+        data += length;
+        size -= length;
+    }
+    return true;
+}
+
+bool FlashStream::flushBatch() {
+    if (_batch_page == STREAM_NO_PAGE) {
+        return true;
+    }
+
+    uint32_t page_address = _batch_page;
+    _batch_page = STREAM_NO_PAGE;
+    if (!_hal->program(page_address, _batch_buffer, FLASH_PAGE_SIZE)) {
+        return false;
+    }
+
+    // Read back, programming can only clear bits
+    return memcmp(_hal->map(page_address + _batch_start), _batch_buffer + _batch_start,
+                  _batch_end - _batch_start) == 0;
+}
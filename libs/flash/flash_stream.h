@@ -0,0 +1,207 @@
+#ifndef FLASH_STREAM_H
+#define FLASH_STREAM_H
+
+#include <cstdint>
+#include "flash_hal.h"
+
+// Stream identifiers, stored in every sector header of a stream pool. The raw sensor
+// records are the journal of the Flash class, the other streams live in their own
+// sector pools after the journal region.
+#define FLASH_STREAM_RAW          1             // The Flash journal, not a FlashStream
+#define FLASH_STREAM_AGGREGATES   2             // Per-minute aggregates (aggregate_log.h)
+#define FLASH_STREAM_EVENTS       3             // Event/diagnostic log (event_log.h)
+#define FLASH_STREAM_CAPTURE      4             // Raw GPS bytes and sensor frames (raw_capture.h)
+
+#define STREAM_SECTOR_MAGIC       0x4D525453    // "STRM"
+#define STREAM_FORMAT_VERSION     1
+#define STREAM_MAX_SECTORS        64            // Largest sector pool of a stream
+#define STREAM_MAX_PAYLOAD        64            // Largest entry payload in bytes
+#define STREAM_NO_PAGE            0xFFFFFFFF
+
+// Entry flag bits. Flags are written erased (1) and cleared in place later.
+#define STREAM_ENTRY_PENDING      0x01          // Entry was not uploaded yet
+
+#pragma pack(push, 1)
+// Header at the start of every sector of a stream pool. As in the journal, the sequence
+// number grows with every sector opened so init() finds the oldest and newest sector.
+struct StreamSectorHeader {
+    uint32_t magic;         // STREAM_SECTOR_MAGIC
+    uint32_t sequence;      // Sector sequence number
+    uint8_t stream_id;      // FLASH_STREAM_*
+    uint8_t version;        // STREAM_FORMAT_VERSION
+    uint8_t reserved[2];    // Left erased (0xFF)
+};
+
+// Header in front of every entry. Entries are packed back to back and never cross a
+// sector boundary, an erased size byte marks the end of the data in a sector.
+struct StreamEntryHeader {
+    uint8_t size;           // Payload size in bytes
+    uint8_t type;           // Entry type, defined by the owner of the stream
+    uint8_t flags;          // STREAM_ENTRY_* bits, not covered by the check
+    uint16_t check;         // Low half of a CRC-32 over size, type and payload
+};
+#pragma pack(pop)
+
+// Entry returned by FlashStreamCursor
+struct FlashStreamEntry {
+    uint8_t type;
+    uint8_t size;
+    uint8_t flags;
+    uint8_t payload[STREAM_MAX_PAYLOAD];
+};
+
+class FlashStream;
+
+// Forward cursor over the entries of a stream, oldest first. Entries failing their
+// check (torn writes) are skipped.
+class FlashStreamCursor {
+public:
+    FlashStreamCursor(FlashStream& stream, bool pending_only);
+
+    // Copy the next entry into entry, returns false at the end of the stream
+    bool next(FlashStreamEntry& entry);
+
+    // Number of invalid entries skipped so far
+    uint32_t skippedCount() const { return _skipped; }
+
+private:
+    FlashStream& _stream;
+    uint32_t _sector_index;     // Sectors walked from the oldest one
+    uint32_t _offset;           // Offset of the next entry in that sector
+    bool _pending_only;
+    uint32_t _skipped = 0;
+};
+
+// Append-only log of small binary entries in its own pool of flash sectors. The pool is
+// used as a ring; when it is full the oldest sector is reclaimed according to the
+// retention policy of the stream (FLASH_RETENTION_* in flash.h). Uploaded entries are
+// marked by clearing their pending flag in place, without rewriting the sector.
+//
+// Sectors of the pool that do not belong to the stream are erased before they are used,
+// so the pool needs no formatting.
+class FlashStream {
+public:
+    // name is only used in log messages; hal nullptr uses defaultFlashHal()
+    FlashStream(const char* name, uint8_t stream_id, uint32_t address, uint32_t sector_count,
+                FlashHal* hal = nullptr);
+
+    // Find the oldest and newest sector and count the stored entries
+    bool init();
+
+    // Move the pool, call before init(). For pools that follow the journal region, whose
+    // end is only known after Flash::init(). A pool reaching past the end of flash is cut.
+    void setPool(uint32_t address, uint32_t sector_count);
+
+    // Append one entry, payload may be at most STREAM_MAX_PAYLOAD bytes
+    bool append(uint8_t type, const void* payload, uint8_t size);
+
+    // Collect the entries appended until endBatch() in RAM and program each page once,
+    // instead of one program call per entry. Cursors don't see them before endBatch().
+    void beginBatch() { _batching = true; }
+    bool endBatch();
+
+    // Cursors over all entries and over the ones not uploaded yet
+    FlashStreamCursor entries() { return FlashStreamCursor(*this, false); }
+    FlashStreamCursor pendingEntries() { return FlashStreamCursor(*this, true); }
+
+    // Mark the oldest count pending entries as uploaded
+    bool markUploaded(uint32_t count);
+
+    uint32_t getEntryCount() const { return _entry_count; }
+    uint32_t getPendingCount() const { return _pending_count; }
+
+    // Pending entries lost to FLASH_RETENTION_OVERWRITE_OLDEST since boot
+    uint32_t getDroppedCount() const { return _dropped_count; }
+
+    // Check whether the pool is full of entries that may not be overwritten
+    bool isFull() const;
+
+    // Flash address right after the pool, where the next pool can start
+    uint32_t endAddress() const { return _address + _sector_count * FLASH_SECTOR_SIZE; }
+    uint32_t getSectorCount() const { return _sector_count; }
+
+    // Select what happens to pending entries when the pool wraps around
+    void setRetentionPolicy(int policy) { _retention_policy = policy; }
+
+    // For pools nothing uploads (diagnostics): entries are stored as uploaded, so nothing is
+    // pending and the oldest sector is reclaimed without a warning. Call before init().
+    void setUploadTracking(bool enabled) { _track_uploads = enabled; }
+
+    // Erase every sector of the pool
+    bool eraseStream();
+
+    void setFlashEnabled(bool enabled) { _flash_enabled = enabled; }
+    void setDebugLevel(int level) { _debug_level = level; }
+
+private:
+    friend class FlashStreamCursor;
+
+    FlashHal* _hal;
+    const char* _name;
+    uint8_t _stream_id;
+    uint32_t _address;                     // First sector of the pool
+    uint32_t _sector_count;                // Sectors in the pool
+    bool _flash_enabled = true;
+    int _debug_level = 1;
+    int _retention_policy;
+    bool _track_uploads = true;
+
+    // Ring state, rebuilt by init()
+    uint32_t _tail_sector = 0;             // Sector holding the oldest entry
+    uint32_t _head_sector = 0;             // Sector being appended to
+    uint32_t _head_offset = 0;             // Next free byte in the head sector
+    uint32_t _used_sectors = 0;            // Sectors holding entries (tail to head)
+    uint32_t _next_sequence = 0;           // Sequence number for the next sector opened
+    uint32_t _entry_count = 0;
+    uint32_t _pending_count = 0;
+    uint32_t _dropped_count = 0;
+    uint16_t _sector_entries[STREAM_MAX_SECTORS];
+    uint16_t _sector_pending[STREAM_MAX_SECTORS];
+
+    // Staging buffer for one page
+    uint8_t _page_buffer[FLASH_PAGE_SIZE];
+
+    // Page collecting the entries of a batch
+    bool _batching = false;
+    uint32_t _batch_page;                  // Address, STREAM_NO_PAGE if nothing is staged
+    uint32_t _batch_start = 0;             // Staged byte range in the page
+    uint32_t _batch_end = 0;
+    uint8_t _batch_buffer[FLASH_PAGE_SIZE];
+
+    inline uint32_t sectorAddress(uint32_t sector) const {
+        return _address + sector * FLASH_SECTOR_SIZE;
+    }
+
+    inline const uint8_t* sectorPointer(uint32_t sector, uint32_t offset) {
+        return _hal->map(sectorAddress(sector) + offset);
+    }
+
+    // Walk the entries of a sector, returns the offset after the last one
+    uint32_t scanSector(uint32_t sector, uint16_t& entries, uint16_t& pending);
+
+    // Read the entry header at offset, false at the end of the sector data
+    bool entryAt(uint32_t sector, uint32_t offset, StreamEntryHeader& header);
+
+    // Check an entry against its check value
+    bool entryValid(uint32_t sector, uint32_t offset, const StreamEntryHeader& header);
+
+    // Start a new head sector, reclaiming the oldest one if the pool is full
+    bool openSector();
+
+    // Erase the oldest sector, honours the retention policy
+    bool reclaimOldestSector();
+
+    // Program a byte range inside erased flash, page by page
+    bool programRange(uint32_t address, const uint8_t* data, size_t size);
+
+    // Copy a byte range of a batch into the staged page, programming full pages
+    bool stageRange(uint32_t address, const uint8_t* data, size_t size);
+
+    // Program the staged page of a batch
+    bool flushBatch();
+};
+
+// Check value of an entry: low half of a CRC-32 over size, type and payload
+uint16_t streamEntryCheck(uint8_t size, uint8_t type, const uint8_t* payload);
+
+#endif // FLASH_STREAM_H
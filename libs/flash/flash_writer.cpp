@@ -0,0 +1,104 @@
+#include "flash_writer.h"
+#include <cstdio>
+#include "pico/stdlib.h"
+
+FlashWriter::FlashWriter(Flash& flash) : _flash(flash) {
+    _buffers[0].reserve(FLASH_WRITER_BUFFER_RECORDS);
+    _buffers[1].reserve(FLASH_WRITER_BUFFER_RECORDS);
+    _fill = &_buffers[0];
+    _drain = &_buffers[1];
+}
+
+bool FlashWriter::enqueue(const std::vector<SensorData>& data) {
+    if (data.empty()) {
+        return true;
+    }
+
+    // A full fill buffer moves on to the writer if it is free, otherwise the caller has to wait
+    if (_fill->size() + data.size() > FLASH_WRITER_BUFFER_RECORDS) {
+        handOver();
+    }
+    if (_fill->size() + data.size() > FLASH_WRITER_BUFFER_RECORDS) {
+        _stats.rejected_calls++;
+        _stats.rejected_records += data.size();
+        return false;
+    }
+
+    _fill->insert(_fill->end(), data.begin(), data.end());
+    _stats.enqueued_records += data.size();
+
+    if (queuedCount() > _stats.max_queued) {
+        _stats.max_queued = queuedCount();
+    }
+    return true;
+}
+
+void FlashWriter::commit() {
+    handOver();
+}
+
+bool FlashWriter::handOver() {
+    if (!_drain->empty() || _fill->empty()) {
+        return false;
+    }
+
+    std::vector<SensorData>* buffer = _drain;
+    _drain = _fill;
+    _fill = buffer;
+    return true;
+}
+
+bool FlashWriter::poll() {
+    if (_drain->empty()) {
+        return false;
+    }
+
+    uint64_t start_us = time_us_64();
+    bool saved = _flash.saveSensorDataBatch(*_drain);
+    uint32_t duration_us = (uint32_t)(time_us_64() - start_us);
+
+    _stats.last_write_us = duration_us;
+    _stats.total_write_us += duration_us;
+    if (duration_us > _stats.worst_write_us) {
+        _stats.worst_write_us = duration_us;
+    }
+
+    if (!saved) {
+        // Keep the batch, it is retried on the next poll (e.g. after an upload freed space)
+        _stats.write_failures++;
+        return false;
+    }
+
+    _stats.written_records += _drain->size();
+    _stats.batches_written++;
+    _drain->clear();
+
+    // Records committed while this batch was written are next in line
+    handOver();
+    return true;
+}
+
+bool FlashWriter::flush(uint32_t budget_us) {
+    commit();
+    uint64_t start_us = time_us_64();
+    while (!_drain->empty()) {
+        if (budget_us > 0 && time_us_64() - start_us >= budget_us) {
+            return false;
+        }
+        if (!poll()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FlashWriter::printStats() const {
+    printf("FLASH WRITER: queued %lu (max %lu), written %lu in %lu batches, rejected %lu records (%lu calls), %lu failed writes\n",
+           (unsigned long)queuedCount(), (unsigned long)_stats.max_queued,
+           (unsigned long)_stats.written_records, (unsigned long)_stats.batches_written,
+           (unsigned long)_stats.rejected_records, (unsigned long)_stats.rejected_calls,
+           (unsigned long)_stats.write_failures);
+    printf("FLASH WRITER: batch write time last %lu us, worst %lu us, total %lu ms\n",
+           (unsigned long)_stats.last_write_us, (unsigned long)_stats.worst_write_us,
+           (unsigned long)(_stats.total_write_us / 1000));
+}
@@ -0,0 +1,65 @@
+#ifndef FLASH_WRITER_H
+#define FLASH_WRITER_H
+
+#include <vector>
+#include "flash.h"
+
+// Records each of the two writer buffers can hold (one full RAM buffer of the main loop)
+#define FLASH_WRITER_BUFFER_RECORDS 64
+
+// Back-pressure and timing statistics of the writer
+struct FlashWriterStats {
+    uint32_t enqueued_records = 0;    // Records accepted by enqueue()
+    uint32_t written_records = 0;     // Records saved to flash
+    uint32_t rejected_records = 0;    // Records refused because both buffers were full
+    uint32_t rejected_calls = 0;      // enqueue() calls that returned false
+    uint32_t write_failures = 0;      // Batch writes that failed and will be retried
+    uint32_t batches_written = 0;
+    uint32_t max_queued = 0;          // Highest number of queued records
+    uint32_t last_write_us = 0;       // Duration of the last batch write
+    uint32_t worst_write_us = 0;      // Longest batch write
+    uint64_t total_write_us = 0;
+};
+
+// Decouples the main loop from flash writes. Records are collected in a fill buffer
+// without touching flash, while the other buffer is written by poll(), one batch per
+// call. The producer never waits: when both buffers are full enqueue() returns false
+// and the caller keeps its data for a later attempt.
+class FlashWriter {
+public:
+    FlashWriter(Flash& flash);
+
+    // Queue records for writing, all or nothing. Never blocks.
+    bool enqueue(const std::vector<SensorData>& data);
+
+    // Hand the records collected so far to the writer, they are saved at the next poll()
+    void commit();
+
+    // Write at most one batch, call once per main loop iteration. Returns true if a
+    // batch was written.
+    bool poll();
+
+    // Commit and write everything queued before returning (before uploads and sleep).
+    // With a budget, no new batch is started once budget_us elapsed (emergency flush);
+    // returns false if records are left.
+    bool flush(uint32_t budget_us = 0);
+
+    size_t queuedCount() const { return _fill->size() + _drain->size(); }
+    bool isIdle() const { return queuedCount() == 0; }
+
+    const FlashWriterStats& stats() const { return _stats; }
+    void resetStats() { _stats = FlashWriterStats(); }
+    void printStats() const;
+
+private:
+    // Swap fill and drain buffer if the drain buffer is free
+    bool handOver();
+
+    Flash& _flash;
+    std::vector<SensorData> _buffers[2];
+    std::vector<SensorData>* _fill;   // Receives new records
+    std::vector<SensorData>* _drain;  // Being written to flash
+    FlashWriterStats _stats;
+};
+
+#endif // FLASH_WRITER_H
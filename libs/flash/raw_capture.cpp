@@ -0,0 +1,186 @@
+#include "raw_capture.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include "pico/stdlib.h"
+
+RawCapture::RawCapture(FlashStream& stream) : _stream(stream) {
+}
+
+void RawCapture::start() {
+    _queued = 0;
+    _gps_open = false;
+    _gap_bytes = 0;
+    _gap_frames = 0;
+    _stats = RawCaptureStats();
+    _last_flush_ms = to_ms_since_boot(get_absolute_time());
+    _active = true;
+    queueSync();
+    printf("CAPTURE: Recording raw GPS and sensor data, %lu entries stored\n",
+           (unsigned long)_stream.getEntryCount());
+}
+
+void RawCapture::stop() {
+    flush();
+    _active = false;
+}
+
+RawCapture::QueuedEntry* RawCapture::push(uint8_t type) {
+    // A gap entry goes in front of the first entry after data was dropped
+    bool gap = _gap_bytes > 0 || _gap_frames > 0;
+    if (_queued + (gap ? 2 : 1) > CAPTURE_QUEUE_ENTRIES) {
+        return nullptr;
+    }
+
+    uint32_t now_us = (uint32_t)time_us_64();
+    if (gap) {
+        CaptureGap record;
+        record.time_us = now_us;
+        record.dropped_bytes = _gap_bytes;
+        record.dropped_frames = _gap_frames;
+
+        QueuedEntry& gap_entry = _queue[_queued++];
+        gap_entry.type = CAPTURE_GAP;
+        gap_entry.size = sizeof(record);
+        memcpy(gap_entry.payload, &record, sizeof(record));
+        _gap_bytes = 0;
+        _gap_frames = 0;
+    }
+
+    QueuedEntry& entry = _queue[_queued++];
+    entry.type = type;
+    entry.size = sizeof(now_us);
+    memcpy(entry.payload, &now_us, sizeof(now_us));
+    _gps_open = false;
+    return &entry;
+}
+
+void RawCapture::queueSync() {
+    QueuedEntry* entry = push(CAPTURE_SYNC);
+    if (entry == nullptr) {
+        return;
+    }
+
+    CaptureSync record;
+    record.uptime_us = time_us_64();
+    record.time_us = (uint32_t)record.uptime_us;
+    record.unix_time = (uint32_t)time(NULL);
+    entry->size = sizeof(record);
+    memcpy(entry->payload, &record, sizeof(record));
+    _last_sync_ms = to_ms_since_boot(get_absolute_time());
+
+    if (_static_type != 0) {
+        addFrame(_static_type, _static_data, _static_size);
+    }
+}
+
+void RawCapture::setStaticFrame(uint8_t type, const uint8_t* data, uint32_t size) {
+    if (size > CAPTURE_MAX_DATA) {
+        size = CAPTURE_MAX_DATA;
+    }
+    memcpy(_static_data, data, size);
+    _static_size = size;
+    _static_type = type;
+}
+
+void RawCapture::addGps(const char* data, uint32_t size) {
+    if (!_active) {
+        return;
+    }
+
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    while (size > 0) {
+        // Bytes polled shortly after each other extend the open entry
+        QueuedEntry* entry = nullptr;
+        if (_gps_open && now_ms - _gps_open_ms <= CAPTURE_GPS_CHUNK_MS &&
+            _queue[_queued - 1].size < STREAM_MAX_PAYLOAD) {
+            entry = &_queue[_queued - 1];
+        } else {
+            entry = push(CAPTURE_GPS);
+            if (entry == nullptr) {
+                _stats.dropped_bytes += size;
+                _gap_bytes += size;
+                return;
+            }
+            _gps_open = true;
+            _gps_open_ms = now_ms;
+        }
+
+        uint32_t length = STREAM_MAX_PAYLOAD - entry->size;
+        if (length > size) {
+            length = size;
+        }
+        memcpy(entry->payload + entry->size, data, length);
+        entry->size += length;
+        _stats.gps_bytes += length;
+        data += length;
+        size -= length;
+    }
+}
+
+void RawCapture::addFrame(uint8_t type, const uint8_t* data, uint32_t size) {
+    if (!_active) {
+        return;
+    }
+
+    QueuedEntry* entry = push(type);
+    if (entry == nullptr) {
+        _stats.dropped_frames++;
+        _gap_frames++;
+        return;
+    }
+
+    if (size > CAPTURE_MAX_DATA) {
+        size = CAPTURE_MAX_DATA;
+    }
+    memcpy(entry->payload + entry->size, data, size);
+    entry->size += size;
+    _stats.frames++;
+}
+
+void RawCapture::update() {
+    if (!_active) {
+        return;
+    }
+
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    if (now_ms - _last_sync_ms >= CAPTURE_SYNC_INTERVAL_MS) {
+        queueSync();
+    }
+    if (_queued >= CAPTURE_QUEUE_ENTRIES / 2 || now_ms - _last_flush_ms >= CAPTURE_FLUSH_MS) {
+        flush();
+        _last_flush_ms = now_ms;
+    }
+}
+
+bool RawCapture::flush() {
+    if (_queued == 0) {
+        return true;
+    }
+
+    uint64_t start_us = time_us_64();
+    bool written = true;
+
+    // One program call per page instead of one per entry
+    _stream.beginBatch();
+    for (uint32_t i = 0; i < _queued; i++) {
+        if (_stream.append(_queue[i].type, _queue[i].payload, _queue[i].size)) {
+            _stats.entries_written++;
+        } else {
+            _stats.write_failures++;
+            written = false;
+        }
+    }
+    if (!_stream.endBatch()) {
+        _stats.write_failures++;
+        written = false;
+    }
+    _queued = 0;
+    _gps_open = false;
+
+    uint32_t duration_us = (uint32_t)(time_us_64() - start_us);
+    if (duration_us > _stats.worst_flush_us) {
+        _stats.worst_flush_us = duration_us;
+    }
+    return written;
+}
@@ -0,0 +1,108 @@
+#ifndef RAW_CAPTURE_H
+#define RAW_CAPTURE_H
+
+#include "flash_stream.h"
+
+// Entry types of the capture stream. Every payload starts with the low 32 bits of
+// time_us_64() when the data was taken; sync entries give the full value.
+#define CAPTURE_SYNC              1             // CaptureSync, at start and every CAPTURE_SYNC_INTERVAL_MS
+#define CAPTURE_GPS               2             // Bytes received from the GPS, in order
+#define CAPTURE_HM3301            3             // HM3301 frame (HM3301_FRAME_SIZE bytes)
+#define CAPTURE_BME688            4             // BME688 field registers (BME688_FIELD_DUMP_SIZE bytes)
+#define CAPTURE_BME688_CALIB      5             // BME688 calibration registers (BME688_CALIB_DUMP_SIZE bytes)
+#define CAPTURE_PAS_CO2           6             // PAS CO2 MEAS_STS, CO2PPM_H, CO2PPM_L
+#define CAPTURE_GAP               7             // CaptureGap, data was dropped before this entry
+
+#define CAPTURE_QUEUE_ENTRIES     96            // RAM queue, half full after about 5 s of 1 Hz NMEA at 9600 baud
+#define CAPTURE_FLUSH_MS          5000          // Write the queue at least this often
+#define CAPTURE_GPS_CHUNK_MS      100           // GPS bytes taken within this time share an entry
+#define CAPTURE_SYNC_INTERVAL_MS  60000         // Less than the 71 minute wrap of the 32 bit times
+
+#define CAPTURE_MAX_DATA (STREAM_MAX_PAYLOAD - 4)
+
+#pragma pack(push, 1)
+struct CaptureSync {
+    uint32_t time_us;
+    uint64_t uptime_us;      // Full time_us_64(), restarts after a reset
+    uint32_t unix_time;      // Unix time (small values before the clock was set)
+};
+
+struct CaptureGap {
+    uint32_t time_us;
+    uint32_t dropped_bytes;  // GPS bytes lost because the queue was full
+    uint32_t dropped_frames; // Sensor frames lost
+};
+#pragma pack(pop)
+
+// Counters of the capture since start()
+struct RawCaptureStats {
+    uint32_t gps_bytes = 0;         // GPS bytes queued
+    uint32_t frames = 0;            // Sensor frames queued
+    uint32_t entries_written = 0;
+    uint32_t dropped_bytes = 0;     // GPS bytes lost to a full queue
+    uint32_t dropped_frames = 0;
+    uint32_t write_failures = 0;
+    uint32_t worst_flush_us = 0;    // Longest flush() call
+};
+
+// Records the raw GPS byte stream and the raw sensor frames into their own flash stream,
+// to build replay traces (libs/replay/capture_to_replay.cpp) and to debug field issues.
+// Everything is queued in RAM and written by update() in one batch every few seconds,
+// so capturing costs a few page programs per measurement interval.
+class RawCapture {
+public:
+    RawCapture(FlashStream& stream);
+
+    // Start capturing, writes a sync entry. Nothing is queued before.
+    void start();
+    void stop();
+    bool isActive() const { return _active; }
+
+    // Queue received GPS bytes (myGPS capture callback)
+    void addGps(const char* data, uint32_t size);
+
+    // Queue a sensor frame of type CAPTURE_*, at most CAPTURE_MAX_DATA bytes
+    void addFrame(uint8_t type, const uint8_t* data, uint32_t size);
+
+    // Frame that does not change (BME688 calibration), queued after every sync entry so it
+    // is still stored when the oldest sectors of the stream were reclaimed
+    void setStaticFrame(uint8_t type, const uint8_t* data, uint32_t size);
+
+    // Write the queue once CAPTURE_FLUSH_MS passed or it is half full. Call from the main loop.
+    void update();
+
+    // Write everything queued now
+    bool flush();
+
+    const RawCaptureStats& stats() const { return _stats; }
+
+    FlashStream& stream() { return _stream; }
+
+private:
+    struct QueuedEntry {
+        uint8_t type;
+        uint8_t size;                   // Payload bytes, including the time
+        uint8_t payload[STREAM_MAX_PAYLOAD];
+    };
+
+    // Next free queue entry stamped with the current time, nullptr if the queue is full
+    QueuedEntry* push(uint8_t type);
+    void queueSync();
+
+    FlashStream& _stream;
+    bool _active = false;
+    QueuedEntry _queue[CAPTURE_QUEUE_ENTRIES];
+    uint32_t _queued = 0;
+    bool _gps_open = false;             // Last queued entry is GPS data that may grow
+    uint32_t _gps_open_ms = 0;          // When that entry was started
+    uint32_t _gap_bytes = 0;            // Dropped since the last gap entry
+    uint32_t _gap_frames = 0;
+    uint32_t _last_flush_ms = 0;
+    uint32_t _last_sync_ms = 0;
+    uint8_t _static_type = 0;           // 0 if no static frame was set
+    uint8_t _static_size = 0;
+    uint8_t _static_data[CAPTURE_MAX_DATA];
+    RawCaptureStats _stats;
+};
+
+#endif // RAW_CAPTURE_H
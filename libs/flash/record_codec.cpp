@@ -0,0 +1,211 @@
+#include "record_codec.h"
+#include "flash.h"
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+// Field types of the delta field table
+#define DELTA_FIELD_U16   0
+#define DELTA_FIELD_U32   1
+#define DELTA_FIELD_FLOAT 2
+#define DELTA_FIELD_U8    3
+
+struct DeltaField {
+    size_t offset;      // Offset of the field in SensorData
+    uint8_t type;       // DELTA_FIELD_*
+    float scale;        // Quantization factor for floats
+};
+
+struct DeltaSchema {
+    uint8_t schema;
+    size_t field_count;                 // Leading entries of delta_fields stored by this schema
+    void (*upgrade)(SensorData& data);  // Fills in the fields the schema does not store
+};
+
+// Fields in encoding order. Slowly changing values first keeps the varints short.
+// New fields are only ever appended, older schemas store a prefix of this table.
+static const DeltaField delta_fields[DELTA_FIELD_COUNT] = {
+    { offsetof(SensorData, timestamp), DELTA_FIELD_U32,   1.0f },
+    { offsetof(SensorData, latitude),  DELTA_FIELD_U32,   1.0f },
+    { offsetof(SensorData, longitude), DELTA_FIELD_U32,   1.0f },
+    { offsetof(SensorData, temp),      DELTA_FIELD_FLOAT, 100.0f },
+    { offsetof(SensorData, hum),       DELTA_FIELD_FLOAT, 100.0f },
+    { offsetof(SensorData, pres),      DELTA_FIELD_FLOAT, 100.0f },
+    { offsetof(SensorData, gasRes),    DELTA_FIELD_FLOAT, 1.0f },
+    { offsetof(SensorData, pm2_5),     DELTA_FIELD_U16,   1.0f },
+    { offsetof(SensorData, pm5),       DELTA_FIELD_U16,   1.0f },
+    { offsetof(SensorData, pm10),      DELTA_FIELD_U16,   1.0f },
+    { offsetof(SensorData, co2),       DELTA_FIELD_U32,   1.0f },
+    // Schema 2
+    { offsetof(SensorData, pm1_0),         DELTA_FIELD_U16, 1.0f },
+    { offsetof(SensorData, battery_mv),    DELTA_FIELD_U16, 1.0f },
+    { offsetof(SensorData, hdop),          DELTA_FIELD_U16, 1.0f },
+    { offsetof(SensorData, speed),         DELTA_FIELD_U16, 1.0f },
+    { offsetof(SensorData, sensor_status), DELTA_FIELD_U16, 1.0f },
+    // Schema 3
+    { offsetof(SensorData, fix_type),        DELTA_FIELD_U8, 1.0f },
+    { offsetof(SensorData, satellites_used), DELTA_FIELD_U8, 1.0f },
+};
+
+static void upgradeFromV1(SensorData& data) {
+    upgradeSensorData(data, RECORD_SCHEMA_V1);
+}
+
+static void upgradeFromV2(SensorData& data) {
+    upgradeSensorData(data, RECORD_SCHEMA_V2);
+}
+
+static void upgradeNothing(SensorData&) {
+}
+
+static const DeltaSchema delta_schemas[] = {
+    { RECORD_SCHEMA_V1, DELTA_FIELD_COUNT_V1, upgradeFromV1 },
+    { RECORD_SCHEMA_V2, DELTA_FIELD_COUNT_V2, upgradeFromV2 },
+    { RECORD_SCHEMA_V3, DELTA_FIELD_COUNT,    upgradeNothing },
+};
+
+const DeltaSchema* deltaSchema(uint8_t schema) {
+    for (size_t i = 0; i < sizeof(delta_schemas) / sizeof(delta_schemas[0]); i++) {
+        if (delta_schemas[i].schema == schema) {
+            return &delta_schemas[i];
+        }
+    }
+    return nullptr;
+}
+
+void upgradeSensorData(SensorData& data, uint8_t from_schema) {
+    if (from_schema < RECORD_SCHEMA_V2) {
+        // Schema 1 firmware stored the PM1.0 reading in pm5
+        data.pm1_0 = data.pm5;
+        data.battery_mv = 0;
+        data.hdop = 0;
+        data.speed = 0;
+        data.sensor_status = SENSOR_STATUS_UNKNOWN;
+    }
+    if (from_schema < RECORD_SCHEMA_V3) {
+        data.fix_type = GPS_FIX_TYPE_UNKNOWN;
+        data.satellites_used = 0;
+    }
+}
+
+static uint32_t quantizeField(const SensorData& data, const DeltaField& field) {
+    const uint8_t* ptr = (const uint8_t*)&data + field.offset;
+    switch (field.type) {
+        case DELTA_FIELD_U8:
+            return *ptr;
+        case DELTA_FIELD_U16: {
+            uint16_t value;
+            memcpy(&value, ptr, sizeof(value));
+            return value;
+        }
+        case DELTA_FIELD_U32: {
+            uint32_t value;
+            memcpy(&value, ptr, sizeof(value));
+            return value;
+        }
+        default: {
+            float value;
+            memcpy(&value, ptr, sizeof(value));
+            return (uint32_t)(int32_t)lroundf(value * field.scale);
+        }
+    }
+}
+
+static void restoreField(SensorData& data, const DeltaField& field, uint32_t quantized) {
+    uint8_t* ptr = (uint8_t*)&data + field.offset;
+    switch (field.type) {
+        case DELTA_FIELD_U8:
+            *ptr = (uint8_t)quantized;
+            break;
+        case DELTA_FIELD_U16: {
+            uint16_t value = (uint16_t)quantized;
+            memcpy(ptr, &value, sizeof(value));
+            break;
+        }
+        case DELTA_FIELD_U32:
+            memcpy(ptr, &quantized, sizeof(quantized));
+            break;
+        default: {
+            float value = (float)(int32_t)quantized / field.scale;
+            memcpy(ptr, &value, sizeof(value));
+            break;
+        }
+    }
+}
+
+// CRC-8 (polynomial 0x07), small enough for the few bytes of a delta record
+static uint8_t crc8(uint8_t crc, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+void resetDeltaState(RecordDeltaState& state) {
+    memset(&state, 0, sizeof(state));
+}
+
+size_t encodeDeltaRecord(const SensorData& data, uint8_t flags, RecordDeltaState& state, uint8_t* out) {
+    size_t pos = 2;  // Length and flags are filled in at the end
+
+    for (size_t i = 0; i < DELTA_FIELD_COUNT; i++) {
+        uint32_t value = quantizeField(data, delta_fields[i]);
+        int32_t delta = (int32_t)(value - state.values[i]);
+        state.values[i] = value;
+
+        // Zig-zag so small negative deltas stay short, then LEB128 varint
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        while (zigzag >= 0x80) {
+            out[pos++] = (uint8_t)(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        out[pos++] = (uint8_t)zigzag;
+    }
+
+    out[0] = (uint8_t)pos;          // Bytes after the length byte, including the check byte
+    out[1] = flags | DELTA_FLAG_LIVE;
+    out[pos] = crc8(crc8(0, out, 1), out + 2, pos - 2);
+    return pos + 1;
+}
+
+size_t decodeDeltaRecord(const uint8_t* in, size_t avail, const DeltaSchema* schema, RecordDeltaState& state,
+                         SensorData& data, uint8_t& flags, bool& valid) {
+    size_t size = (size_t)in[0] + 1;
+    if (size < DELTA_RECORD_MIN_SIZE || size > DELTA_RECORD_MAX_SIZE || size > avail) {
+        valid = false;
+        return 0;
+    }
+
+    flags = in[1];
+    valid = in[size - 1] == crc8(crc8(0, in, 1), in + 2, size - 3);
+
+    size_t pos = 2;
+    for (size_t i = 0; i < schema->field_count; i++) {
+        uint32_t zigzag = 0;
+        int shift = 0;
+        while (pos < size - 1 && shift < 35) {
+            uint8_t byte = in[pos++];
+            zigzag |= (uint32_t)(byte & 0x7F) << shift;
+            shift += 7;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        state.values[i] += (uint32_t)delta;
+        restoreField(data, delta_fields[i], state.values[i]);
+    }
+
+    // All varints must end exactly at the check byte
+    if (pos != size - 1) {
+        valid = false;
+    }
+
+    data.is_fake_gps = (flags & RECORD_FLAG_FAKE_GPS) != 0;
+    schema->upgrade(data);
+    return size;
+}
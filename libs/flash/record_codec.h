@@ -0,0 +1,67 @@
+#ifndef RECORD_CODEC_H
+#define RECORD_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct SensorData;
+
+// Compact record encoding for journal sectors using JOURNAL_FORMAT_DELTA.
+//
+// Every flash page starts with a keyframe (a record encoded against an all-zero state),
+// every following record in the same page stores zig-zag varint deltas to its predecessor.
+// Records never cross a page boundary, so every page can be decoded on its own.
+//
+// Encoded record layout:
+//   [length]  number of bytes following this byte (flags, varints and check byte)
+//   [flags]   record flags | DELTA_FLAG_LIVE, the live bit is cleared to discard a record
+//   [varints] one zig-zag varint delta per field of the field table
+//   [check]   CRC-8 over length and varints (not the flags, so discarding keeps the chain intact)
+//
+// Floats are quantized: temperature, humidity and pressure to 0.01, gas resistance to 1 Ohm.
+//
+// The field table only grows at its end. A record of an older schema holds the first
+// fields of the table, the fields added later are filled in by the schema upgrade.
+
+// Record schema versions, stored per journal sector (JournalSectorHeader::schema)
+#define RECORD_SCHEMA_V1        1               // Original fields (magic 0xABCD1234 raw records)
+#define RECORD_SCHEMA_V2        2               // Adds PM1.0, battery voltage, HDOP, speed and sensor status
+#define RECORD_SCHEMA_V3        3               // Adds GPS fix type and satellites used
+#define RECORD_SCHEMA_CURRENT   RECORD_SCHEMA_V3
+
+#define DELTA_FIELD_COUNT_V1    11
+#define DELTA_FIELD_COUNT_V2    16
+#define DELTA_FIELD_COUNT       18              // Fields of the current schema
+#define DELTA_RECORD_MIN_SIZE   (3 + DELTA_FIELD_COUNT_V1)
+// 8 32-bit fields (5 byte varints), 8 16-bit fields (3 bytes), 2 8-bit fields (2 bytes)
+#define DELTA_RECORD_MAX_SIZE   (3 + 8 * 5 + 8 * 3 + 2 * 2)
+#define DELTA_FLAG_LIVE         0x80
+
+// Quantized field values of the previous record in the page
+struct RecordDeltaState {
+    uint32_t values[DELTA_FIELD_COUNT];
+};
+
+// Decoding parameters of one schema version, looked up once per sector
+struct DeltaSchema;
+
+// Schema description for decoding, nullptr for an unknown schema version
+const DeltaSchema* deltaSchema(uint8_t schema);
+
+// Fill in the fields a record of schema from_schema does not store
+void upgradeSensorData(SensorData& data, uint8_t from_schema);
+
+// Reset the state at the start of a page, the next record becomes a keyframe
+void resetDeltaState(RecordDeltaState& state);
+
+// Encode a record with the current schema into out (at least DELTA_RECORD_MAX_SIZE bytes)
+// and advance the state. Returns the number of bytes written.
+size_t encodeDeltaRecord(const SensorData& data, uint8_t flags, RecordDeltaState& state, uint8_t* out);
+
+// Decode the record at in, reading at most avail bytes, and advance the state.
+// Returns the encoded size, or 0 if the length byte does not describe a record.
+// valid is false if the check byte does not match, the state is then unusable for the rest of the page.
+size_t decodeDeltaRecord(const uint8_t* in, size_t avail, const DeltaSchema* schema, RecordDeltaState& state,
+                         SensorData& data, uint8_t& flags, bool& valid);
+
+#endif // RECORD_CODEC_H
@@ -0,0 +1,152 @@
+#include "gps_rx_buffer.h"
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+
+#define GPS_RX_BUFFER_MASK (GPS_RX_BUFFER_SIZE - 1)
+
+// Bytes per DMA transfer, about 51 days at 9600 baud before update() restarts it
+#define GPS_RX_DMA_TRANSFER_COUNT 0xFFFFFFFFu
+
+// One ring per UART, static so the alignment needed by the DMA ring wrap is guaranteed
+static uint8_t rx_rings[NUM_UARTS][GPS_RX_BUFFER_SIZE] __attribute__((aligned(GPS_RX_BUFFER_SIZE)));
+static bool rx_ring_in_use[NUM_UARTS] = {};
+
+GpsRxBuffer::GpsRxBuffer() {
+}
+
+GpsRxBuffer::~GpsRxBuffer() {
+    stop();
+}
+
+bool GpsRxBuffer::start(uart_inst_t *uart) {
+    stop();
+    _uart = uart;
+
+    uint index = uart_get_index(uart);
+    if (rx_ring_in_use[index]) {
+        printf("GPS WARNING: Receive buffer of UART%u already in use, polling the FIFO\n", index);
+        return false;
+    }
+    rx_ring_in_use[index] = true;
+    _ring = rx_rings[index];
+    _dma_base = 0;
+    _head = 0;
+    _tail = 0;
+
+    _dma_channel = dma_claim_unused_channel(false);
+    if (_dma_channel < 0) {
+        printf("GPS WARNING: No free DMA channel, filling the receive buffer from the FIFO\n");
+        return true;
+    }
+
+    // Byte transfers from the RX data register, paced by the UART, wrapping at the ring end
+    dma_channel_config config = dma_channel_get_default_config(_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, GPS_RX_BUFFER_BITS);
+    channel_config_set_dreq(&config, uart_get_dreq(uart, false));
+    dma_channel_configure(_dma_channel, &config, _ring, &uart_get_hw(uart)->dr,
+                          GPS_RX_DMA_TRANSFER_COUNT, true);
+    return true;
+}
+
+void GpsRxBuffer::stop() {
+    if (_dma_channel >= 0) {
+        dma_channel_abort(_dma_channel);
+        dma_channel_unclaim(_dma_channel);
+        _dma_channel = -1;
+    }
+    if (_ring) {
+        rx_ring_in_use[uart_get_index(_uart)] = false;
+        _ring = nullptr;
+    }
+    _uart = nullptr;
+}
+
+void GpsRxBuffer::update() {
+    if (!_uart) {
+        return;
+    }
+
+    // Error flags are sticky until written
+    uart_hw_t *hw = uart_get_hw(_uart);
+    uint32_t errors = hw->rsr;
+    if (errors) {
+        if (errors & UART_UARTRSR_OE_BITS) {
+            _stats.uart_overruns++;
+        }
+        if (errors & (UART_UARTRSR_FE_BITS | UART_UARTRSR_BE_BITS)) {
+            _stats.framing_errors++;
+        }
+        hw->rsr = 0;
+    }
+
+    if (!_ring) {
+        return;
+    }
+
+    uint32_t head = _head;
+    if (_dma_channel >= 0) {
+        if (dma_channel_is_busy(_dma_channel)) {
+            head = _dma_base + (GPS_RX_DMA_TRANSFER_COUNT - dma_channel_hw_addr(_dma_channel)->transfer_count);
+        } else {
+            // Transfer count used up, continue where the ring write address stands
+            head = _dma_base + GPS_RX_DMA_TRANSFER_COUNT;
+            _dma_base = head;
+            dma_channel_set_trans_count(_dma_channel, GPS_RX_DMA_TRANSFER_COUNT, true);
+        }
+    } else {
+        while (uart_is_readable(_uart)) {
+            _ring[head++ & GPS_RX_BUFFER_MASK] = uart_getc(_uart);
+        }
+    }
+
+    _stats.bytes_received += head - _head;
+    _head = head;
+
+    // The writer lapped the reader, the oldest bytes were overwritten
+    uint32_t fill = _head - _tail;
+    if (fill > GPS_RX_BUFFER_SIZE) {
+        _stats.dropped_bytes += fill - GPS_RX_BUFFER_SIZE;
+        _tail = _head - GPS_RX_BUFFER_SIZE;
+        fill = GPS_RX_BUFFER_SIZE;
+    }
+    if (fill > _stats.max_fill) {
+        _stats.max_fill = fill;
+    }
+}
+
+uint32_t GpsRxBuffer::available() {
+    update();
+    if (!_ring) {
+        return _uart && uart_is_readable(_uart) ? 1 : 0;
+    }
+    return _head - _tail;
+}
+
+char GpsRxBuffer::getc() {
+    if (!_ring) {
+        return _uart && uart_is_readable(_uart) ? uart_getc(_uart) : 0;
+    }
+    if (_tail == _head) {
+        return 0;
+    }
+    _stats.bytes_read++;
+    return (char)_ring[_tail++ & GPS_RX_BUFFER_MASK];
+}
+
+void GpsRxBuffer::clear() {
+    update();
+    _tail = _head;
+    if (!_ring) {
+        while (_uart && uart_is_readable(_uart)) {
+            uart_getc(_uart);
+        }
+    }
+}
+
+void GpsRxBuffer::resetStats() {
+    _stats = GpsRxStats();
+}
@@ -0,0 +1,65 @@
+#ifndef GPS_RX_BUFFER_H
+#define GPS_RX_BUFFER_H
+
+#include <cstdint>
+#include "hardware/uart.h"
+#include "libs/gps/nmea_source.h"
+
+// Ring size in bits, the DMA ring wrap needs a power of two aligned to its size
+#define GPS_RX_BUFFER_BITS 13
+#define GPS_RX_BUFFER_SIZE (1u << GPS_RX_BUFFER_BITS)      // About 2.7 s of NMEA at 5 Hz (a full display refresh), 10 s of UBX
+
+// Byte and error counters of the receive buffer
+struct GpsRxStats {
+    uint32_t bytes_received = 0;    // Bytes written into the ring
+    uint32_t bytes_read = 0;        // Bytes taken out by getc()
+    uint32_t dropped_bytes = 0;     // Overwritten before they were read
+    uint32_t uart_overruns = 0;     // UART FIFO overflowed before the bytes were moved (sticky flag, counted per check)
+    uint32_t framing_errors = 0;    // Framing or break errors, usually a baud rate mismatch
+    uint32_t max_fill = 0;          // Most unread bytes seen in the ring
+};
+
+// Receives a UART in the background. A DMA channel paced by the UART RX DREQ copies every
+// byte into a RAM ring, so nothing is lost while the main loop is busy with flash or the
+// display, and reception continues while flash operations disable interrupts. The reader
+// side mirrors uart_is_readable()/uart_getc() and never blocks.
+//
+// Without a free DMA channel the ring is filled from the UART FIFO on each readable() call.
+class GpsRxBuffer : public NmeaSource {
+public:
+    GpsRxBuffer();
+    ~GpsRxBuffer();
+
+    // Start receiving uart into the ring. Returns false if the buffer of this UART is
+    // already in use, the FIFO is then polled directly.
+    bool start(uart_inst_t *uart);
+    void stop();
+
+    // Bytes received and not read yet
+    uint32_t available() override;
+
+    // Next byte, 0 if none is available. Call readable() or available() first.
+    char getc() override;
+
+    // Drop everything received so far
+    void clear();
+
+    bool isDmaActive() const { return _dma_channel >= 0; }
+
+    const GpsRxStats &stats() const { return _stats; }
+    void resetStats();
+
+private:
+    // Fetch the write position of the DMA (or drain the FIFO) and check the error flags
+    void update();
+
+    uart_inst_t *_uart = nullptr;
+    volatile uint8_t *_ring = nullptr;  // Written by the DMA
+    int _dma_channel = -1;
+    uint32_t _dma_base = 0;             // Bytes received by earlier runs of the DMA transfer
+    uint32_t _head = 0;                 // Bytes received in total, wraps
+    uint32_t _tail = 0;                 // Bytes read in total, wraps
+    GpsRxStats _stats;
+};
+
+#endif // GPS_RX_BUFFER_H
@@ -0,0 +1,85 @@
+#include "gps_satellites.h"
+
+void GpsSatelliteTracker::update(const NmeaSentence& sentence, uint32_t now_ms) {
+    if (sentence.type == NMEA_SENTENCE_GSV) {
+        // GN has no constellation of its own, combined GSV output is counted as other
+        uint8_t index = sentence.talker == NMEA_TALKER_COMBINED ? NMEA_TALKER_OTHER : sentence.talker;
+        Constellation& constellation = _constellations[index];
+        constellation.counts.in_view = sentence.satellites_in_view;
+        constellation.gsv_ms = now_ms;
+        constellation.gsv_seen = true;
+
+        // The tracked count is only known once every sentence of the group arrived
+        if (sentence.gsv_index <= 1) {
+            constellation.group_tracked = 0;
+        }
+        for (uint8_t i = 0; i < sentence.satellite_count; i++) {
+            if (sentence.satellites[i].snr > 0) {
+                constellation.group_tracked++;
+            }
+        }
+        if (sentence.gsv_index >= sentence.gsv_count) {
+            constellation.counts.tracked = constellation.group_tracked;
+        }
+    } else if (sentence.type == NMEA_SENTENCE_GSA) {
+        uint8_t index = sentence.used_constellation < GPS_CONSTELLATION_COUNT ? sentence.used_constellation : NMEA_TALKER_OTHER;
+        Constellation& constellation = _constellations[index];
+        constellation.counts.used = sentence.used_prn_count;
+        constellation.gsa_ms = now_ms;
+        constellation.gsa_seen = true;
+    } else if (sentence.type == NMEA_SENTENCE_GGA) {
+        updateUsed(sentence.satellites_used, now_ms);
+    }
+}
+
+void GpsSatelliteTracker::updateUsed(uint8_t satellites_used, uint32_t now_ms) {
+    _solution_used = satellites_used;
+    _solution_ms = now_ms;
+    _solution_seen = true;
+}
+
+GpsSatelliteCounts GpsSatelliteTracker::counts(uint32_t now_ms) const {
+    GpsSatelliteCounts counts;
+    uint32_t gsa_used = 0;
+
+    for (uint8_t i = 0; i < GPS_CONSTELLATION_COUNT; i++) {
+        const Constellation& constellation = _constellations[i];
+        if (constellation.gsv_seen && now_ms - constellation.gsv_ms <= GPS_SATELLITES_MAX_AGE_MS) {
+            counts.constellations[i].in_view = constellation.counts.in_view;
+            counts.constellations[i].tracked = constellation.counts.tracked;
+            counts.in_view += constellation.counts.in_view;
+            counts.tracked += constellation.counts.tracked;
+        }
+        if (constellation.gsa_seen && now_ms - constellation.gsa_ms <= GPS_SATELLITES_MAX_AGE_MS) {
+            counts.constellations[i].used = constellation.counts.used;
+            gsa_used += constellation.counts.used;
+        }
+    }
+
+    // GGA counts all constellations, but older receivers cap it at 12
+    if (_solution_seen && now_ms - _solution_ms <= GPS_SATELLITES_MAX_AGE_MS && _solution_used >= gsa_used) {
+        counts.used = _solution_used;
+    } else {
+        counts.used = gsa_used > 255 ? 255 : gsa_used;
+    }
+    return counts;
+}
+
+void GpsSatelliteTracker::reset() {
+    for (uint8_t i = 0; i < GPS_CONSTELLATION_COUNT; i++) {
+        _constellations[i] = Constellation();
+    }
+    _solution_used = 0;
+    _solution_seen = false;
+}
+
+const char* gpsConstellationName(uint8_t constellation) {
+    switch (constellation) {
+        case NMEA_TALKER_GPS:      return "GPS";
+        case NMEA_TALKER_GLONASS:  return "GLONASS";
+        case NMEA_TALKER_GALILEO:  return "Galileo";
+        case NMEA_TALKER_BEIDOU:   return "BeiDou";
+        case NMEA_TALKER_COMBINED: return "Combined";
+        default:                   return "Other";
+    }
+}
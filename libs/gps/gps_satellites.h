@@ -0,0 +1,61 @@
+#ifndef GPS_SATELLITES_H
+#define GPS_SATELLITES_H
+
+#include <cstdint>
+#include "libs/gps/nmea_parser.h"
+
+// Entries of the per-constellation arrays, indexed by NMEA_TALKER_*
+#define GPS_CONSTELLATION_COUNT 6
+
+// Counts of a constellation are dropped once it was not reported for this long
+#define GPS_SATELLITES_MAX_AGE_MS 5000
+
+struct GpsConstellationCounts {
+    uint8_t in_view = 0;        // GSV satellites in view
+    uint8_t tracked = 0;        // In view with a signal (SNR > 0) in the last complete GSV group
+    uint8_t used = 0;           // Listed in GSA as used for the fix
+};
+
+struct GpsSatelliteCounts {
+    uint8_t in_view = 0;
+    uint8_t tracked = 0;
+    uint8_t used = 0;           // GGA satellites used, or the GSA sum without a recent GGA
+    GpsConstellationCounts constellations[GPS_CONSTELLATION_COUNT];
+};
+
+// Keeps the satellite counts up to date from the NMEA stream. Every GSV, GSA and GGA
+// sentence updates its constellation, so the counts can be read at any time without
+// waiting for the receiver.
+class GpsSatelliteTracker {
+public:
+    // Take the satellite information of a decoded sentence, other sentences are ignored
+    void update(const NmeaSentence& sentence, uint32_t now_ms);
+
+    // Take the satellites used of a fix that comes without GGA (UBX NAV-PVT)
+    void updateUsed(uint8_t satellites_used, uint32_t now_ms);
+
+    // Counts of the constellations reported within GPS_SATELLITES_MAX_AGE_MS
+    GpsSatelliteCounts counts(uint32_t now_ms) const;
+
+    void reset();
+
+private:
+    struct Constellation {
+        GpsConstellationCounts counts;
+        uint8_t group_tracked = 0;      // Tracked so far in the GSV group being received
+        uint32_t gsv_ms = 0;            // Last GSV sentence
+        uint32_t gsa_ms = 0;            // Last GSA sentence
+        bool gsv_seen = false;
+        bool gsa_seen = false;
+    };
+
+    Constellation _constellations[GPS_CONSTELLATION_COUNT];
+    uint8_t _solution_used = 0;         // Satellites used of the last GGA or NAV-PVT
+    uint32_t _solution_ms = 0;
+    bool _solution_seen = false;
+};
+
+// Short name of a constellation (NMEA_TALKER_*) for logs
+const char* gpsConstellationName(uint8_t constellation);
+
+#endif // GPS_SATELLITES_H
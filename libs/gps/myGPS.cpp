@@ -8,13 +8,19 @@
 #include <hardware/gpio.h>
 #include <time.h>  // Add for time functions
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 
 myGPS::myGPS(uart_inst_t *uart_id, int baud_rate, int tx_pin, int rx_pin) {
     this->uart_id = uart_id;
     this->baud_rate = baud_rate;
+    this->default_baud_rate = baud_rate;
     this->tx_pin = tx_pin;
     this->rx_pin = rx_pin;
     this->init();
+    
+    // Receive in the background from now on, readLine() only takes what arrived
+    this->rx.start(this->uart_id);
 }
 
 void myGPS::init() {
@@ -32,10 +38,13 @@ void myGPS::init() {
     // Enable FIFO and set receive interrupt trigger at 1/8 full (more responsive)
     uart_set_fifo_enabled(this->uart_id, true);
     
-    // Flush any pending data in the UART
+    // Flush any pending data in the UART and the receive buffer
     while (uart_is_readable(this->uart_id)) {
         uart_getc(this->uart_id);
     }
+    this->rx.clear();
+    this->parser.reset();
+    this->ubx.reset();
     
     printf("GPS UART initialized with optimized settings\n");
 }
@@ -110,182 +119,318 @@ int myGPS::readLine(std::string &line) {
         return 0;
     }
 
-    // For real GPS data, use even shorter timeouts for quicker polling
-    absolute_time_t master_timeout = make_timeout_time_ms(200); // Reduced from 300ms to 200ms
+    // Parse whatever arrived since the last call, then answer from the latest state.
+    // Never waits for the receiver, the bytes are collected in the background.
+    this->poll();
     
-    // Check if UART has data - if not, return quickly
-    if(!uart_is_readable(this->uart_id)) {
-        return 1; // No data available yet
+    if (this->position_sentences == 0 ||
+        to_ms_since_boot(get_absolute_time()) - this->last_position_ms > GPS_FIX_MAX_AGE_MS) {
+        return 1; // No recent position sentence
     }
-
-    // Use an even shorter timeout for each polling cycle
-    absolute_time_t timeout_time = make_timeout_time_ms(100); // Reduced from 200ms to 100ms
-    
-    bool valid_sentence_found = false;
-    std::string sentence_type;
-    
-    // Safety counter with reduced maximum for faster returns
-    int loop_counter = 0;
-    const int MAX_LOOP_ITERATIONS = 100; // Reduced from 200 to 100 for faster returns
     
-    // Single NMEA sentence buffer with pre-allocated capacity
-    this->buffer.reserve(100); // Pre-allocate memory to reduce reallocations
-    this->buffer.clear();      // Clear buffer for new data
-    
-    // Keep trying until we find a valid sentence or timeout
-    while (!valid_sentence_found && 
-           !absolute_time_diff_us(get_absolute_time(), timeout_time) <= 0 &&
-           loop_counter++ < MAX_LOOP_ITERATIONS) {
-        
-        // If buffer isn't empty and doesn't end with newline, continue reading
-        while(this->buffer.empty() || this->buffer.back() != '\n') {
-            // Break on timeout
-            if (absolute_time_diff_us(get_absolute_time(), master_timeout) <= 0) {
-                return 1; // Timeout reading GPS
-            }
-            
-            if(uart_is_readable(this->uart_id)) {
-                char c = uart_getc(this->uart_id);
-                this->buffer += c;
-                
-                // Look for end of sentence
-                if (c == '\n') {
-                    break;
-                }
-            } else {
-                sleep_us(100); // Reduced from 1ms to 100μs for faster polling
-            }
-            
-            // Buffer safety check
-            if(this->buffer.length() > 100) {
-                // Buffer overflow, reset
-                this->buffer.clear();
-                break;
+    line = this->last_line;
+    return this->fix_status;
+}
+
+void myGPS::poll() {
+    uint32_t available = this->source->available();
+    char captured[64];
+    uint32_t captured_size = 0;
+    bool valid = false;
+    
+    for (uint32_t i = 0; i < available; i++) {
+        char c = this->source->getc();
+        if (this->capture_callback != nullptr) {
+            captured[captured_size++] = c;
+            if (captured_size == sizeof(captured)) {
+                this->capture_callback(captured, captured_size, this->capture_context);
+                captured_size = 0;
             }
         }
-        
-        if(buffer.empty()) {
-            continue;
+        if (this->parser.feed(c)) {
+            this->last_valid_ms = to_ms_since_boot(get_absolute_time());
+            valid = true;
+            this->handleSentence();
         }
-        
-        // Only print raw GPS NMEA sentences if specifically debugging GPS
-#if defined(DEBUG_GPS_LOG) && DEBUG_GPS_LOG
-        printf("%s", this->buffer.c_str());
-#endif
-        
-        // Quickly check for sentence type
-        if (this->buffer.find(GNGLL) == 0 || this->buffer.find("$GPGLL") == 0) {
-            valid_sentence_found = true;
-            sentence_type = "GLL";
-        } else if (this->buffer.find(GNRMC) == 0 || this->buffer.find("$GPRMC") == 0) {
-            valid_sentence_found = true;
-            sentence_type = "RMC";
+        if (this->ubx.feed((uint8_t)c)) {
+            this->last_valid_ms = to_ms_since_boot(get_absolute_time());
+            valid = true;
+            this->handleUbxMessage();
         }
     }
     
-    // If we didn't find a valid sentence
-    if (!valid_sentence_found) {
-        return 1; // No valid data
+    if (captured_size > 0) {
+        this->capture_callback(captured, captured_size, this->capture_context);
     }
-
-    // Return the found sentence
-    line = this->buffer;
     
-    // Now parse the sentence to extract coordinates and fix status
-    std::istringstream iss(this->buffer);
-    std::string token;
-
-    // Skip the first token (sentence identifier)
-    std::getline(iss, token, ',');
-    
-    // Faster parsing with direct string operations rather than multiple getlines
-    if (sentence_type == "GLL") {
-        // Parse GLL sentence
-        std::getline(iss, token, ','); // Latitude
-        if (!token.empty() && token.length() >= 3) {
-            try {
-                this->latitude = std::stod(token.substr(0, 2)) + std::stod(token.substr(2)) / 60.0;
-            } catch (...) {
-                this->latitude = 0;
-            }
+    if (this->source != &this->rx) {
+        return;
+    }
+    
+    if (valid) {
+        if (this->baud_lost && this->baud_rate == this->default_baud_rate) {
+            // The receiver was reset to its defaults, set it up again
+            printf("GPS: Data at %d baud again, negotiating %d baud\n", this->baud_rate, this->negotiated_baud_rate);
+            this->baud_lost = false;
+            this->negotiateBaudRate(this->negotiated_baud_rate);
+            this->setNavigationRate(this->requested_rate_hz);
+        } else {
+            this->baud_lost = false;
         }
-
-        std::getline(iss, token, ','); // N/S indicator
-        if (!token.empty()) this->nsIndicator = token[0];
-
-        std::getline(iss, token, ','); // Longitude
-        if (!token.empty() && token.length() >= 4) {
-            try {
-                this->longitude = std::stod(token.substr(0, 3)) + std::stod(token.substr(3)) / 60.0;
-            } catch (...) {
-                this->longitude = 0;
-            }
+        return;
+    }
+    
+    // A receiver that lost power or was reset talks at its default rate again. Without data
+    // at that rate either, it may still run at the negotiated one: try both in turn.
+    if (to_ms_since_boot(get_absolute_time()) - this->last_valid_ms > GPS_BAUD_LOST_MS) {
+        if (this->baud_rate != this->default_baud_rate) {
+            printf("GPS WARNING: No valid data at %d baud, back to %d baud\n",
+                   this->baud_rate, this->default_baud_rate);
+            this->baud_lost = this->negotiated_baud_rate != 0;
+            this->reopenUart(this->default_baud_rate);
+        } else if (this->baud_lost) {
+            printf("GPS WARNING: No valid data at %d baud, trying %d baud again\n",
+                   this->baud_rate, this->negotiated_baud_rate);
+            this->reopenUart(this->negotiated_baud_rate);
         }
+    }
+}
 
-        std::getline(iss, token, ','); // E/W indicator
-        if (!token.empty()) this->ewIndicator = token[0];
+void myGPS::setSource(NmeaSource *source) {
+    this->source = source != nullptr ? source : &this->rx;
+    
+    // Start over with the new stream, nothing of the old one is current anymore
+    this->parser.reset();
+    this->ubx.reset();
+    this->satellites.reset();
+    this->position_sentences = 0;
+    this->pvt_messages = 0;
+    this->ubx_enabled = false;
+    this->fix_count = 0;
+    this->last_fix_time_valid = false;
+    this->clock_offset_valid = false;
+    this->previous_window_valid = false;
+    this->last_valid_ms = to_ms_since_boot(get_absolute_time());
+    this->fix_status = 1;
+    this->last_line[0] = '\0';
+}
 
-        std::getline(iss, token, ','); // Time
-        if (!token.empty() && token.size() >= 6) {
-            this->time = token.substr(0, 2) + ":" + token.substr(2, 2) + ":" + token.substr(4, 2);
+void myGPS::handleSentence() {
+    const NmeaSentence &sentence = this->parser.sentence();
+    
+    // Only print raw GPS NMEA sentences if specifically debugging GPS
+#if defined(DEBUG_GPS_LOG) && DEBUG_GPS_LOG
+    printf("%s\n", this->parser.line());
+#endif
+    
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    this->satellites.update(sentence, now);
+    
+    // Fix quality, kept with every record
+    if (sentence.type == NMEA_SENTENCE_GGA) {
+        this->hdop = sentence.hdop;
+        this->hdop_ms = now;
+        this->hdop_from_gga = true;
+    } else if (sentence.type == NMEA_SENTENCE_GSA) {
+        this->fix_type = sentence.fix_type;
+        this->fix_type_ms = now;
+        if (!this->hdop_from_gga || now - this->hdop_ms > GPS_FIX_MAX_AGE_MS) {
+            this->hdop = sentence.hdop;
+            this->hdop_ms = now;
+            this->hdop_from_gga = false;
         }
-
-        std::getline(iss, token, ','); // Fix validity (A=valid, V=invalid)
-        bool valid_fix = (token == "A");
-        
-        return valid_fix ? 0 : 2;  // Return 0 for valid fix, 2 for invalid
     }
-    else if (sentence_type == "RMC") {
-        // Parse RMC sentence - more efficient parsing
-        std::getline(iss, token, ','); // Time
-        if (!token.empty() && token.size() >= 6) {
-            this->time = token.substr(0, 2) + ":" + token.substr(2, 2) + ":" + token.substr(4, 2);
+    if (sentence.speed_valid) {
+        this->speed = sentence.speed > 0xFFFF ? 0xFFFF : sentence.speed;
+        this->speed_ms = now;
+    }
+    
+    if (sentence.type != NMEA_SENTENCE_GLL && sentence.type != NMEA_SENTENCE_RMC) {
+        return;
+    }
+    
+    // Position sentences are off in UBX mode, the receiver was reset to its defaults
+    if (this->ubx_enabled && now - this->last_pvt_ms > GPS_FIX_MAX_AGE_MS) {
+        printf("GPS WARNING: NAV-PVT stopped, using NMEA position sentences again\n");
+        this->ubx_enabled = false;
+    }
+    
+    strncpy(this->last_line, this->parser.line(), sizeof(this->last_line) - 1);
+    this->last_position_ms = to_ms_since_boot(get_absolute_time());
+    this->position_sentences++;
+    
+    if (sentence.time_valid) {
+        char time_buffer[9];
+        snprintf(time_buffer, sizeof(time_buffer), "%02d:%02d:%02d",
+                 sentence.hour, sentence.minute, sentence.second);
+        this->time = time_buffer;
+    }
+    
+    // An invalid RMC fix keeps position and date of the last fix
+    if (sentence.type == NMEA_SENTENCE_RMC && !sentence.fix_valid) {
+        this->fix_status = 2;
+        return;
+    }
+    
+    // Coordinates are kept as magnitudes with the hemisphere in the indicators
+    if (sentence.position_valid) {
+        this->latitude = std::abs(sentence.latitude) / 10000000.0;
+        this->nsIndicator = sentence.latitude < 0 ? 'S' : 'N';
+        this->longitude = std::abs(sentence.longitude) / 10000000.0;
+        this->ewIndicator = sentence.longitude < 0 ? 'W' : 'E';
+        if (sentence.fix_valid) {
+            this->recordFix(sentence.time_valid,
+                            ((sentence.hour * 60 + sentence.minute) * 60 + sentence.second) * 1000 +
+                            sentence.millisecond, sentence.latitude, sentence.longitude);
         }
-        
-        std::getline(iss, token, ','); // Fix validity
-        bool valid_fix = (token == "A");
-        
-        if (!valid_fix) return 2; // Early return if invalid fix
-        
-        std::getline(iss, token, ','); // Latitude
-        if (!token.empty() && token.length() >= 3) {
-            try {
-                this->latitude = std::stod(token.substr(0, 2)) + std::stod(token.substr(2)) / 60.0;
-            } catch (...) {
-                this->latitude = 0;
+    }
+    
+    if (sentence.date_valid) {
+        char date_buffer[7];
+        snprintf(date_buffer, sizeof(date_buffer), "%02d%02d%02d",
+                 sentence.day, sentence.month, sentence.year);
+        this->date = date_buffer;
+    }
+    
+    this->fix_status = sentence.fix_valid ? 0 : 2;  // 0 for valid fix, 2 for invalid
+}
+
+void myGPS::handleUbxMessage() {
+    const UbxMessage &message = this->ubx.message();
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    
+    if (message.type == UBX_MESSAGE_ACK) {
+        this->ack_received = true;
+        this->ack_positive = message.ack.acknowledged;
+        this->ack_class = message.ack.msg_class;
+        this->ack_id = message.ack.msg_id;
+        return;
+    }
+    
+    if (message.type == UBX_MESSAGE_NAV_DOP) {
+        this->hdop = message.nav_dop.hdop;
+        this->hdop_ms = now;
+        this->hdop_from_gga = true;
+        return;
+    }
+    
+    if (message.type != UBX_MESSAGE_NAV_PVT) {
+        return;
+    }
+    
+    // Same state as from RMC, GGA and GSA, so readLine() and getFixQuality() don't care
+    // which protocol the receiver uses
+    const UbxNavPvt &pvt = message.nav_pvt;
+    this->pvt_messages++;
+    this->last_pvt_ms = now;
+    this->last_position_ms = now;
+    this->position_sentences++;
+    this->satellites.updateUsed(pvt.satellites_used, now);
+    
+    // GSA fix type: 1 = none, 2 = 2D, 3 = 3D
+    if (pvt.fix_type == UBX_FIX_2D) {
+        this->fix_type = 2;
+    } else if (pvt.fix_type == UBX_FIX_3D || pvt.fix_type == UBX_FIX_GNSS_DEAD_RECKONING) {
+        this->fix_type = 3;
+    } else {
+        this->fix_type = 1;
+    }
+    this->fix_type_ms = now;
+    
+    if (pvt.time_valid) {
+        char time_buffer[9];
+        snprintf(time_buffer, sizeof(time_buffer), "%02d:%02d:%02d", pvt.hour, pvt.minute, pvt.second);
+        this->time = time_buffer;
+    }
+    
+    // readLine() hands out a line, there is no sentence text in UBX mode
+    snprintf(this->last_line, sizeof(this->last_line), "UBX NAV-PVT,%02d%02d%02d.%02d,%ld,%ld,%d,%d",
+             pvt.hour, pvt.minute, pvt.second, pvt.millisecond / 10, (long)pvt.latitude,
+             (long)pvt.longitude, pvt.fix_type, pvt.satellites_used);
+    
+    // Like an invalid RMC, no fix keeps position and date of the last fix
+    if (!pvt.fix_valid) {
+        this->fix_status = 2;
+        return;
+    }
+    
+    this->latitude = std::abs(pvt.latitude) / 10000000.0;
+    this->nsIndicator = pvt.latitude < 0 ? 'S' : 'N';
+    this->longitude = std::abs(pvt.longitude) / 10000000.0;
+    this->ewIndicator = pvt.longitude < 0 ? 'W' : 'E';
+    this->speed = pvt.speed > 0xFFFF ? 0xFFFF : pvt.speed;
+    this->speed_ms = now;
+    this->recordFix(pvt.time_valid,
+                    ((pvt.hour * 60 + pvt.minute) * 60 + pvt.second) * 1000 + pvt.millisecond,
+                    pvt.latitude, pvt.longitude);
+    
+    if (pvt.date_valid) {
+        char date_buffer[7];
+        snprintf(date_buffer, sizeof(date_buffer), "%02d%02d%02d", pvt.day, pvt.month, pvt.year % 100);
+        this->date = date_buffer;
+    }
+    
+    this->fix_status = 0;
+}
+
+void myGPS::recordFix(bool time_valid, uint32_t utc_ms, int32_t latitude, int32_t longitude) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint32_t fix_ms = now;
+    
+    // Fixes can wait in the receive buffer while the main loop reads the sensors, so their
+    // board time comes from their GPS time. Board time minus GPS time is smallest for the
+    // fixes that were parsed right after they arrived.
+    if (time_valid) {
+        uint32_t offset = now - utc_ms;
+        if (this->clock_offset_valid) {
+            // Keep the offset continuous over midnight UTC
+            int32_t difference = (int32_t)(offset - this->clock_offset_ms);
+            if (difference > 43200000) {
+                offset -= 86400000;
+            } else if (difference < -43200000) {
+                offset += 86400000;
             }
         }
         
-        std::getline(iss, token, ','); // N/S indicator
-        if (!token.empty()) this->nsIndicator = token[0];
-        
-        std::getline(iss, token, ','); // Longitude
-        if (!token.empty() && token.length() >= 4) {
-            try {
-                this->longitude = std::stod(token.substr(0, 3)) + std::stod(token.substr(3)) / 60.0;
-            } catch (...) {
-                this->longitude = 0;
-            }
+        if (!this->clock_offset_valid || now - this->window_start_ms >= GPS_CLOCK_WINDOW_MS) {
+            this->previous_window_offset_ms = this->window_offset_ms;
+            this->previous_window_valid = this->clock_offset_valid;
+            this->window_offset_ms = offset;
+            this->window_start_ms = now;
+        } else if ((int32_t)(offset - this->window_offset_ms) < 0) {
+            this->window_offset_ms = offset;
         }
         
-        std::getline(iss, token, ','); // E/W indicator
-        if (!token.empty()) this->ewIndicator = token[0];
-        
-        // Skip speed and course
-        std::getline(iss, token, ',');
-        std::getline(iss, token, ',');
-        
-        // Date field (format: ddmmyy)
-        std::getline(iss, token, ',');
-        if (!token.empty() && token.size() >= 6) {
-            this->date = token;
+        this->clock_offset_ms = this->window_offset_ms;
+        if (this->previous_window_valid &&
+            (int32_t)(this->previous_window_offset_ms - this->clock_offset_ms) < 0) {
+            this->clock_offset_ms = this->previous_window_offset_ms;
         }
-        
-        return valid_fix ? 0 : 2;  // Return 0 for valid fix, 2 for invalid
+        this->clock_offset_valid = true;
+        fix_ms = now - offset + this->clock_offset_ms;
     }
     
-    // If we get here, something went wrong with parsing
-    return 1;
+    // RMC and GLL of the same epoch share one entry
+    uint32_t index = this->fix_count % GPS_FIX_HISTORY;
+    if (this->fix_count > 0 && time_valid && this->last_fix_time_valid && utc_ms == this->last_fix_utc_ms) {
+        index = (this->fix_count - 1) % GPS_FIX_HISTORY;
+    } else {
+        this->fix_count++;
+    }
+    this->last_fix_utc_ms = utc_ms;
+    this->last_fix_time_valid = time_valid;
+    
+    GpsFix &fix = this->fix_history[index];
+    fix.time_ms = fix_ms;
+    fix.latitude = latitude;
+    fix.longitude = longitude;
+    fix.quality = this->currentQuality(now);
+}
+
+bool myGPS::isUbxActive() {
+    this->poll();
+    return this->pvt_messages > 0 &&
+           to_ms_since_boot(get_absolute_time()) - this->last_pvt_ms <= GPS_FIX_MAX_AGE_MS;
 }
 
 int myGPS::readLine(std::string &buffer, double &longitude, char &ewIndicator, double &latitude, char &nsIndicator, std::string &time) {
@@ -444,8 +589,8 @@ int myGPS::testConnection() {
     std::string sample_data;
     
     while (!absolute_time_diff_us(get_absolute_time(), timeout) <= 0) {
-        if (uart_is_readable(this->uart_id)) {
-            char c = uart_getc(this->uart_id);
+        if (this->rx.readable()) {
+            char c = this->rx.getc();
             chars_received++;
             
             // Keep a small sample of the data for debugging
@@ -466,8 +611,8 @@ int myGPS::testConnection() {
                 
                 // Read until newline or timeout
                 while (!complete_sentence && !absolute_time_diff_us(get_absolute_time(), sentence_timeout) <= 0) {
-                    if (uart_is_readable(this->uart_id)) {
-                        char nc = uart_getc(this->uart_id);
+                    if (this->rx.readable()) {
+                        char nc = this->rx.getc();
                         chars_received++;
                         nmea_sentence += nc;
                         
@@ -581,92 +726,71 @@ int myGPS::getVisibleSatellites() {
         return fake_satellites;
     }
     
-    // Original implementation continues below for real GPS
-    // Attempt to read from the GPS module for up to 2 seconds
-    absolute_time_t timeout = make_timeout_time_ms(2000);
-    int satellite_count = 0;
-    bool found_gsv_message = false;
+    // Counts are kept up to date from the GSV sentences received in the background
+    return getSatelliteCounts().in_view;
+}
+
+GpsSatelliteCounts myGPS::getSatelliteCounts() {
+    GpsSatelliteCounts counts;
+    if (use_fake_data) {
+        counts.in_view = counts.tracked = counts.used = fake_satellites;
+        counts.constellations[NMEA_TALKER_GPS].in_view = fake_satellites;
+        counts.constellations[NMEA_TALKER_GPS].tracked = fake_satellites;
+        counts.constellations[NMEA_TALKER_GPS].used = fake_satellites;
+        return counts;
+    }
     
-    printf("Checking for visible satellites...\n");
+    this->poll();
+    return this->satellites.counts(to_ms_since_boot(get_absolute_time()));
+}
+
+GpsFixQuality myGPS::getFixQuality() {
+    GpsFixQuality quality;
+    if (use_fake_data) {
+        quality.hdop = 100;
+        quality.fix_type = fake_fix_acquired ? 3 : 1;
+        quality.satellites_used = fake_satellites;
+        return quality;
+    }
     
-    while (!absolute_time_diff_us(get_absolute_time(), timeout) <= 0 && !found_gsv_message) {
-        if (uart_is_readable(this->uart_id)) {
-            std::string gsv_message = "";
-            char c = uart_getc(this->uart_id);
-            
-            // Look for the start of a GSV message
-            if (c == '$') {
-                gsv_message += c;
-                
-                // Read more characters to check if this is a GSV message
-                for (int i = 0; i < 5; i++) {
-                    if (uart_is_readable(this->uart_id)) {
-                        c = uart_getc(this->uart_id);
-                        gsv_message += c;
-                    } else {
-                        sleep_ms(1);
-                    }
-                }
-                
-                // If we've found a GSV message (satellites in view)
-                if (gsv_message == "$GPGSV" || gsv_message == "$GNGSV" || gsv_message == "$GLGSV") {
-                    found_gsv_message = true;
-                    
-                    // Continue reading the rest of the message
-                    bool reading_message = true;
-                    while (reading_message) {
-                        if (uart_is_readable(this->uart_id)) {
-                            c = uart_getc(this->uart_id);
-                            gsv_message += c;
-                            
-                            // End of message
-                            if (c == '\n' || c == '\r') {
-                                reading_message = false;
-                            }
-                        } else {
-                            sleep_ms(1);
-                        }
-                        
-                        // Safety check for message length
-                        if (gsv_message.length() > 100) {
-                            reading_message = false;
-                        }
-                    }
-                    
-                    // Parse the GSV message to get satellite count
-                    std::istringstream iss(gsv_message);
-                    std::string token;
-                    
-                    // GSV message format: $GPGSV,3,1,11,...
-                    // Third field is the total number of satellites in view
-                    
-                    // Skip the header
-                    std::getline(iss, token, ',');
-                    
-                    // Skip the total message count
-                    std::getline(iss, token, ',');
-                    
-                    // Skip the message number
-                    std::getline(iss, token, ',');
-                    
-                    // Get the number of satellites in view
-                    std::getline(iss, token, ',');
-                    if (!token.empty()) {
-                        try {
-                            satellite_count = std::stoi(token);
-                            printf("Satellites in view: %d\n", satellite_count);
-                        } catch (const std::exception& e) {
-                            printf("Error parsing satellite count: %s\n", e.what());
-                        }
-                    }
-                }
-            }
-        } else {
-            sleep_ms(10);
-        }
+    this->poll();
+    return this->currentQuality(to_ms_since_boot(get_absolute_time()));
+}
+
+GpsFixQuality myGPS::currentQuality(uint32_t now) {
+    GpsFixQuality quality;
+    if (now - this->hdop_ms <= GPS_FIX_MAX_AGE_MS) {
+        quality.hdop = this->hdop;
+    }
+    if (now - this->fix_type_ms <= GPS_FIX_MAX_AGE_MS) {
+        quality.fix_type = this->fix_type;
+    }
+    if (now - this->speed_ms <= GPS_FIX_MAX_AGE_MS) {
+        quality.speed = this->speed;
+    }
+    quality.satellites_used = this->satellites.counts(now).used;
+    return quality;
+}
+
+bool myGPS::getFixAt(uint32_t time_ms, GpsFix &fix) {
+    if (use_fake_data) {
+        return false;
     }
     
-    return satellite_count;
+    this->poll();
+    uint32_t count = this->fix_count < GPS_FIX_HISTORY ? this->fix_count : GPS_FIX_HISTORY;
+    bool found = false;
+    uint32_t best_distance = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const GpsFix &entry = this->fix_history[i];
+        uint32_t distance = (uint32_t)std::abs((int32_t)(entry.time_ms - time_ms));
+        if (distance <= GPS_FIX_MAX_AGE_MS && (!found || distance < best_distance)) {
+            fix = entry;
+            best_distance = distance;
+            found = true;
+        }
+    }
+    return found;
 }
 
 // Add a helper method to assist with getting a position fix
@@ -720,7 +844,7 @@ bool myGPS::waitForFix(int timeout_seconds) {
     bool got_fix = false;
     
     // Reset receiver if we haven't received any valid data
-    if (!uart_is_readable(this->uart_id)) {
+    if (this->source == &this->rx && !this->rx.readable() && this->position_sentences == 0) {
         printf("No data from GPS, reinitializing...\n");
         this->init();
         sleep_ms(200);
@@ -728,7 +852,7 @@ bool myGPS::waitForFix(int timeout_seconds) {
     
     while (!absolute_time_diff_us(get_absolute_time(), timeout) <= 0 && !got_fix) {
         // Check for readable data
-        if (uart_is_readable(this->uart_id)) {
+        if (this->source->readable()) {
             try {
                 // Try to read a full line with fix information
                 std::string tmp_buffer;
@@ -833,7 +957,7 @@ bool myGPS::sendHotStartCommand() {
     
     while (attempts > 0 && !data_received) {
         sleep_ms(100);
-        if (uart_is_readable(this->uart_id)) {
+        if (this->rx.readable()) {
             data_received = true;
         }
         attempts--;
@@ -843,8 +967,8 @@ bool myGPS::sendHotStartCommand() {
         printf("GPS module responded after hot start command\n");
         
         // Flush any pending data
-        while (uart_is_readable(this->uart_id)) {
-            uart_getc(this->uart_id);
+        while (this->rx.readable()) {
+            this->rx.getc();
         }
         
         return true;
@@ -882,7 +1006,7 @@ bool myGPS::sendWarmStartCommand() {
     
     while (attempts > 0 && !data_received) {
         sleep_ms(100);
-        if (uart_is_readable(this->uart_id)) {
+        if (this->rx.readable()) {
             data_received = true;
         }
         attempts--;
@@ -892,8 +1016,8 @@ bool myGPS::sendWarmStartCommand() {
         printf("GPS module responded after warm start command\n");
         
         // Flush any pending data
-        while (uart_is_readable(this->uart_id)) {
-            uart_getc(this->uart_id);
+        while (this->rx.readable()) {
+            this->rx.getc();
         }
         
         return true;
@@ -943,8 +1067,8 @@ bool myGPS::enableTimeMessages() {
     sleep_ms(500);
     
     // Flush any pending data
-    while (uart_is_readable(this->uart_id)) {
-        uart_getc(this->uart_id);
+    while (this->rx.readable()) {
+        this->rx.getc();
     }
     
     printf("Time message commands sent, waiting for response...\n");
@@ -955,8 +1079,8 @@ bool myGPS::enableTimeMessages() {
     std::string received_data;
     
     while (!absolute_time_diff_us(get_absolute_time(), timeout) <= 0 && received_data.length() < 100) {
-        if (uart_is_readable(this->uart_id)) {
-            char c = uart_getc(this->uart_id);
+        if (this->rx.readable()) {
+            char c = this->rx.getc();
             received_data += c;
             got_response = true;
             
@@ -1029,7 +1153,7 @@ bool myGPS::sendColdStartCommand() {
     
     while (attempts > 0 && !data_received) {
         sleep_ms(200);
-        if (uart_is_readable(this->uart_id)) {
+        if (this->rx.readable()) {
             data_received = true;
         }
         attempts--;
@@ -1039,8 +1163,8 @@ bool myGPS::sendColdStartCommand() {
         printf("GPS module responded after cold start command\n");
         
         // Flush any pending data
-        while (uart_is_readable(this->uart_id)) {
-            uart_getc(this->uart_id);
+        while (this->rx.readable()) {
+            this->rx.getc();
         }
         
         // Send enable time messages command after cold start
@@ -1072,12 +1196,11 @@ bool myGPS::optimizeForFastAcquisition() {
     }
     sleep_ms(100);
     
-    // 2. Set update rate to 1Hz for better sensitivity (MTK chipsets)
+    // 2. Set the update rate (MTK chipsets), 1Hz unless setNavigationRate() changed it
     // PMTK220,1000 - Update position every 1000ms
-    const char *update_rate = "$PMTK220,1000*1F\r\n";
-    for (const char *p = update_rate; *p != '\0'; p++) {
-        uart_putc(this->uart_id, *p);
-    }
+    char command[32];
+    snprintf(command, sizeof(command), "PMTK220,%u", this->nav_interval_ms);
+    this->sendNmeaCommand(command);
     sleep_ms(100);
     
     // 3. Enable SBAS (Satellite-Based Augmentation System) if available
@@ -1090,18 +1213,14 @@ bool myGPS::optimizeForFastAcquisition() {
     
     // 4. Set position fix interval (MTK chipsets)
     // PMTK300,1000,0,0,0,0 - Try to get position fix every 1000ms
-    const char *fix_interval = "$PMTK300,1000,0,0,0,0*1C\r\n";
-    for (const char *p = fix_interval; *p != '\0'; p++) {
-        uart_putc(this->uart_id, *p);
-    }
+    snprintf(command, sizeof(command), "PMTK300,%u,0,0,0,0", this->nav_interval_ms);
+    this->sendNmeaCommand(command);
     sleep_ms(100);
     
     // 5. Try u-blox specific commands for UART configuration
-    // This is for u-blox modules - configure NMEA protocol
-    const char *ublox_nmea = "$PUBX,41,1,0007,0003,9600,0*10\r\n";
-    for (const char *p = ublox_nmea; *p != '\0'; p++) {
-        uart_putc(this->uart_id, *p);
-    }
+    // This is for u-blox modules - configure NMEA protocol at the current baud rate
+    snprintf(command, sizeof(command), "PUBX,41,1,0007,0003,%d,0", this->baud_rate);
+    this->sendNmeaCommand(command);
     sleep_ms(100);
     
     printf("GPS optimization commands sent\n");
@@ -1112,12 +1231,12 @@ bool myGPS::optimizeForFastAcquisition() {
     bool data_received = false;
     
     while (!data_received && !absolute_time_diff_us(get_absolute_time(), start_time) <= 0) {
-        if (uart_is_readable(this->uart_id)) {
+        if (this->rx.readable()) {
             data_received = true;
             
             // Drain the buffer to avoid processing stale data
-            while (uart_is_readable(this->uart_id)) {
-                uart_getc(this->uart_id);
+            while (this->rx.readable()) {
+                this->rx.getc();
                 sleep_ms(1);
             }
         }
@@ -1133,3 +1252,207 @@ bool myGPS::optimizeForFastAcquisition() {
     }
 }
 
+
+bool myGPS::writeUbx(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t length) {
+    uint8_t frame[UBX_FRAME_OVERHEAD + 20];     // CFG-PRT is the longest message sent
+    if (length > sizeof(frame) - UBX_FRAME_OVERHEAD) {
+        return false;
+    }
+    size_t size = ubxBuildMessage(msg_class, msg_id, payload, length, frame);
+    for (size_t i = 0; i < size; i++) {
+        uart_putc(this->uart_id, (char)frame[i]);
+    }
+    return true;
+}
+
+bool myGPS::sendUbx(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t length) {
+    this->ack_received = false;
+    if (!this->writeUbx(msg_class, msg_id, payload, length)) {
+        return false;
+    }
+    
+    // The answer arrives in the background like every other message
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    while (to_ms_since_boot(get_absolute_time()) - start_ms < GPS_UBX_ACK_TIMEOUT_MS) {
+        this->poll();
+        if (this->ack_received && this->ack_class == msg_class && this->ack_id == msg_id) {
+            return this->ack_positive;
+        }
+        sleep_ms(10);
+    }
+    return false;
+}
+
+bool myGPS::setMessageRate(uint8_t msg_class, uint8_t msg_id, uint8_t rate) {
+    const uint8_t payload[3] = {msg_class, msg_id, rate};
+    return this->sendUbx(UBX_CLASS_CFG, UBX_CFG_MSG, payload, sizeof(payload));
+}
+
+bool myGPS::enableUbx() {
+    if (use_fake_data) {
+        return false;
+    }
+    
+    printf("GPS: Checking for a u-blox receiver...\n");
+    
+    // A receiver that doesn't acknowledge NAV-PVT stays on NMEA
+    if (!this->setMessageRate(UBX_CLASS_NAV, UBX_NAV_PVT, 1)) {
+        printf("GPS: No UBX acknowledge, using NMEA\n");
+        return false;
+    }
+    this->ubx_enabled = true;
+    this->last_pvt_ms = to_ms_since_boot(get_absolute_time());
+    
+    // HDOP comes from NAV-DOP, GSA stays on if the receiver has no NAV-DOP
+    bool has_dop = this->setMessageRate(UBX_CLASS_NAV, UBX_NAV_DOP, 1);
+    
+    // NMEA sentences NAV-PVT replaces, GSV only remains for the satellites in view
+    const uint8_t replaced[] = {UBX_NMEA_RMC, UBX_NMEA_GGA, UBX_NMEA_GLL, UBX_NMEA_VTG, UBX_NMEA_GSA};
+    uint32_t failed = 0;
+    for (size_t i = 0; i < sizeof(replaced); i++) {
+        if (replaced[i] == UBX_NMEA_GSA && !has_dop) {
+            continue;
+        }
+        if (!this->setMessageRate(UBX_CLASS_NMEA, replaced[i], 0)) {
+            failed++;
+        }
+    }
+    if (!this->setMessageRate(UBX_CLASS_NMEA, UBX_NMEA_GSV, UBX_GSV_RATE)) {
+        failed++;
+    }
+    
+    if (failed > 0) {
+        printf("GPS WARNING: %lu NMEA settings were not acknowledged\n", (unsigned long)failed);
+    }
+    printf("GPS: Using UBX NAV-PVT%s\n", has_dop ? " and NAV-DOP" : ", HDOP from GSA");
+    return true;
+}
+
+void myGPS::sendNmeaCommand(const char *body) {
+    uint8_t checksum = 0;
+    for (const char *p = body; *p != '\0'; p++) {
+        checksum ^= (uint8_t)*p;
+    }
+    char suffix[6];
+    snprintf(suffix, sizeof(suffix), "*%02X\r\n", checksum);
+    
+    uart_putc(this->uart_id, '$');
+    for (const char *p = body; *p != '\0'; p++) {
+        uart_putc(this->uart_id, *p);
+    }
+    for (const char *p = suffix; *p != '\0'; p++) {
+        uart_putc(this->uart_id, *p);
+    }
+}
+
+void myGPS::reopenUart(uint32_t baud_rate) {
+    uart_set_baudrate(this->uart_id, baud_rate);
+    this->baud_rate = (int)baud_rate;
+    
+    // Bytes received at the old rate are garbage
+    this->rx.clear();
+    this->parser.reset();
+    this->ubx.reset();
+    this->last_valid_ms = to_ms_since_boot(get_absolute_time());
+}
+
+bool myGPS::verifyBaudRate() {
+    uint32_t received = this->parser.stats().sentences + this->ubx.stats().messages;
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    while (to_ms_since_boot(get_absolute_time()) - start_ms < GPS_BAUD_VERIFY_MS) {
+        this->poll();
+        if (this->parser.stats().sentences + this->ubx.stats().messages != received) {
+            return true;
+        }
+        sleep_ms(10);
+    }
+    return false;
+}
+
+bool myGPS::negotiateBaudRate(uint32_t baud_rate) {
+    if (use_fake_data || this->source != &this->rx) {
+        return false;
+    }
+    if ((int)baud_rate == this->baud_rate) {
+        return true;
+    }
+    
+    int previous = this->baud_rate;
+    printf("GPS: Switching from %d to %lu baud...\n", previous, (unsigned long)baud_rate);
+    
+    // Both requests go out at the current rate, each receiver ignores the other one
+    char command[24];
+    snprintf(command, sizeof(command), "PMTK251,%lu", (unsigned long)baud_rate);
+    this->sendNmeaCommand(command);
+    
+    // u-blox UART1, 8N1, UBX + NMEA in and out like PUBX,41. Its acknowledge comes at the
+    // new rate, so data at the new rate is the check instead.
+    uint8_t port[20] = {0};
+    port[0] = 1;                                // Port id
+    port[4] = 0xD0;                             // Mode: 8 bits, no parity, 1 stop bit
+    port[5] = 0x08;
+    port[8] = baud_rate & 0xFF;
+    port[9] = (baud_rate >> 8) & 0xFF;
+    port[10] = (baud_rate >> 16) & 0xFF;
+    port[11] = (baud_rate >> 24) & 0xFF;
+    port[12] = 0x07;                            // In: UBX, NMEA, RTCM
+    port[14] = 0x03;                            // Out: UBX, NMEA
+    this->writeUbx(UBX_CLASS_CFG, UBX_CFG_PRT, port, sizeof(port));
+    
+    // The receiver switches after the last byte
+    uart_tx_wait_blocking(this->uart_id);
+    sleep_ms(100);
+    
+    this->reopenUart(baud_rate);
+    if (this->verifyBaudRate()) {
+        printf("GPS: Running at %d baud\n", this->baud_rate);
+        this->negotiated_baud_rate = this->baud_rate != this->default_baud_rate ? this->baud_rate : 0;
+        return true;
+    }
+    
+    printf("GPS WARNING: No valid data at %lu baud, staying at %d baud\n", (unsigned long)baud_rate, previous);
+    this->reopenUart(previous);
+    if (!this->verifyBaudRate()) {
+        printf("GPS WARNING: No valid data at %d baud either\n", previous);
+    }
+    return false;
+}
+
+bool myGPS::setNavigationRate(uint16_t rate_hz) {
+    if (use_fake_data) {
+        return false;
+    }
+    if (rate_hz == 0) {
+        rate_hz = 1;
+    }
+    this->requested_rate_hz = rate_hz;
+    
+    // 5 Hz of NMEA is about 3 KB/s, more than 9600 baud can carry
+    if (rate_hz > 1 && this->baud_rate < GPS_FAST_RATE_MIN_BAUD) {
+        printf("GPS WARNING: %u Hz needs at least %d baud, staying at 1 Hz\n", rate_hz, GPS_FAST_RATE_MIN_BAUD);
+        rate_hz = 1;
+    }
+    uint16_t interval_ms = 1000 / rate_hz;
+    
+    // u-blox: CFG-RATE, one navigation solution per measurement, aligned to GPS time
+    const uint8_t payload[6] = {(uint8_t)(interval_ms & 0xFF), (uint8_t)(interval_ms >> 8), 1, 0, 1, 0};
+    if (this->sendUbx(UBX_CLASS_CFG, UBX_CFG_RATE, payload, sizeof(payload))) {
+        if (this->ubx_enabled) {
+            // GSV stays at about every UBX_GSV_RATE seconds
+            uint16_t gsv_rate = UBX_GSV_RATE * rate_hz;
+            this->setMessageRate(UBX_CLASS_NMEA, UBX_NMEA_GSV, gsv_rate > 255 ? 255 : gsv_rate);
+        }
+    } else if (this->ubx_enabled) {
+        printf("GPS WARNING: Navigation rate of %u Hz was not acknowledged\n", rate_hz);
+        return false;
+    } else {
+        // MTK, its PMTK001 answer is not checked
+        char command[16];
+        snprintf(command, sizeof(command), "PMTK220,%u", interval_ms);
+        this->sendNmeaCommand(command);
+    }
+    
+    this->nav_interval_ms = interval_ms;
+    printf("GPS: Navigation rate %u Hz\n", rate_hz);
+    return true;
+}
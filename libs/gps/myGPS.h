@@ -7,6 +7,10 @@
 
 
 #include "hardware/uart.h"
+#include "libs/gps/nmea_parser.h"
+#include "libs/gps/ubx_parser.h"
+#include "libs/gps/gps_rx_buffer.h"
+#include "libs/gps/gps_satellites.h"
 #include <string>
 #include <sstream>
 #include <vector>
@@ -31,6 +35,24 @@
 #define UART0_TX_PIN 0
 #define UART0_RX_PIN 1
 
+// readLine() reports no data once the last RMC/GLL sentence or NAV-PVT is older than this
+#define GPS_FIX_MAX_AGE_MS 2000
+
+// enableUbx() waits this long for the receiver to acknowledge a CFG message
+#define GPS_UBX_ACK_TIMEOUT_MS 1000
+
+// Baud rate negotiation
+#define GPS_BAUD_VERIFY_MS 2500          // Valid data must arrive this soon after a switch
+#define GPS_BAUD_LOST_MS 5000            // Back to the default rate after this long without valid data
+#define GPS_FAST_RATE_MIN_BAUD 38400     // Navigation rates above 1 Hz need at least this baud rate
+
+// Fixes kept for getFixAt(), 6 s at 5 Hz
+#define GPS_FIX_HISTORY 32
+
+// The offset between GPS time and board time is the smallest one seen in the last two
+// windows of this length, so it follows the drift of the board clock
+#define GPS_CLOCK_WINDOW_MS 30000
+
 const std::string GNTXT = "$GNTXT";
 const std::string GNGLL = "$GNGLL";
 const std::string GNRMC = "$GNRMC";
@@ -40,10 +62,30 @@ const std::string AUTHRES = "$AUTHRES";
 const std::string DATASEND = "$DATASEND";
 const std::string DATAACKN = "$DATAACKN";
 
+// Receives the bytes poll() takes from the source, e.g. to record them (RawCapture)
+typedef void (*GpsCaptureCallback)(const char *data, uint32_t size, void *context);
+
+// Accuracy of the current fix, 0 where the receiver did not report it recently
+struct GpsFixQuality {
+    uint16_t hdop = 0;              // Horizontal dilution of precision * 100 (GGA, else GSA)
+    uint8_t fix_type = 0;           // GSA fix type: 1 = none, 2 = 2D, 3 = 3D
+    uint8_t satellites_used = 0;
+    uint16_t speed = 0;             // Ground speed in 0.01 km/h (RMC, VTG)
+};
+
+// Position fix of the history, to match fixes with sensor samples
+struct GpsFix {
+    uint32_t time_ms = 0;           // Board time (ms since boot) the fix arrived, from its GPS time
+    int32_t latitude = 0;           // 1e-7 degrees, negative = south
+    int32_t longitude = 0;          // 1e-7 degrees, negative = west
+    GpsFixQuality quality;          // At the time of the fix
+};
+
 class myGPS {
 private:
     uart_inst_t *uart_id;
     int baud_rate;
+    int default_baud_rate;               // Of the receiver after a reset
     int tx_pin;
     int rx_pin;
     double latitude = 0;
@@ -52,7 +94,82 @@ private:
     char ewIndicator = 'C';
     std::string time = "00:00:00";
     std::string date = "010170"; // Default date (January 1, 1970) in ddmmyy format
-    std::string buffer;
+    NmeaParser parser;           // Keeps partial sentences between readLine() calls
+    UbxParser ubx;               // Fed the same bytes, for u-blox receivers in UBX mode
+    GpsRxBuffer rx;              // Receives in the background
+    NmeaSource *source = &rx;    // Read by poll(), the UART unless a replay is attached
+    GpsCaptureCallback capture_callback = nullptr;
+    void *capture_context = nullptr;
+    
+    // Latest state parsed by poll(), readLine() returns it without waiting
+    int fix_status = 1;                  // readLine() result of the last RMC/GLL sentence or NAV-PVT
+    uint32_t position_sentences = 0;     // RMC/GLL sentences and NAV-PVT messages parsed so far
+    uint32_t last_position_ms = 0;       // When the last one arrived
+    char last_line[NMEA_MAX_SENTENCE_LENGTH + 1] = "";
+    GpsSatelliteTracker satellites;      // Satellite counts from GSV, GSA and GGA
+    uint16_t hdop = 0;
+    uint32_t hdop_ms = 0;
+    bool hdop_from_gga = false;          // GSA HDOP is only used without a recent GGA or NAV-DOP
+    uint8_t fix_type = 0;
+    uint32_t fix_type_ms = 0;
+    uint16_t speed = 0;
+    uint32_t speed_ms = 0;
+    bool ubx_enabled = false;            // enableUbx() switched the receiver to NAV-PVT
+    uint32_t pvt_messages = 0;
+    uint32_t last_pvt_ms = 0;
+    bool ack_received = false;           // Last ACK-ACK/NAK and the message it answered
+    bool ack_positive = false;
+    uint8_t ack_class = 0;
+    uint8_t ack_id = 0;
+    uint16_t nav_interval_ms = 1000;     // Set by setNavigationRate()
+    uint16_t requested_rate_hz = 1;      // Last rate asked of setNavigationRate()
+    uint32_t last_valid_ms = 0;          // Last valid sentence or UBX message
+    int negotiated_baud_rate = 0;        // Kept by negotiateBaudRate(), 0 if none
+    bool baud_lost = false;              // Fell back from it, until data arrives again
+    
+    // Recent fixes for getFixAt(), a ring
+    GpsFix fix_history[GPS_FIX_HISTORY];
+    uint32_t fix_count = 0;              // Fixes recorded in total
+    uint32_t last_fix_utc_ms = 0;        // GPS time of day of the newest fix
+    bool last_fix_time_valid = false;
+    
+    // Board time minus GPS time of day, see GPS_CLOCK_WINDOW_MS
+    bool clock_offset_valid = false;
+    uint32_t clock_offset_ms = 0;
+    uint32_t window_offset_ms = 0;       // Smallest offset of the current window
+    uint32_t window_start_ms = 0;
+    uint32_t previous_window_offset_ms = 0;
+    bool previous_window_valid = false;
+    
+    // Update the latest state from a sentence completed by the parser
+    void handleSentence();
+    
+    // Update the latest state from a message completed by the UBX parser
+    void handleUbxMessage();
+    
+    // Send a UBX message and wait up to GPS_UBX_ACK_TIMEOUT_MS for its ACK-ACK
+    bool sendUbx(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t length);
+    
+    // Send a UBX message without waiting for an answer, false if it is too long
+    bool writeUbx(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t length);
+    
+    // Set how often the receiver outputs a message on this port (CFG-MSG), 0 = off
+    bool setMessageRate(uint8_t msg_class, uint8_t msg_id, uint8_t rate);
+    
+    // Send "$<body>*<checksum>" with CR LF
+    void sendNmeaCommand(const char *body);
+    
+    // Switch the UART to baud_rate and start over with the stream
+    void reopenUart(uint32_t baud_rate);
+    
+    // Wait up to GPS_BAUD_VERIFY_MS for a valid sentence or UBX message
+    bool verifyBaudRate();
+    
+    // Fix quality from the latest state, without polling
+    GpsFixQuality currentQuality(uint32_t now);
+    
+    // Add a valid fix to the history. utc_ms is its GPS time of day, if time_valid.
+    void recordFix(bool time_valid, uint32_t utc_ms, int32_t latitude, int32_t longitude);
     
     // Fake GPS data flag and simulated coordinates
     bool use_fake_data = false;
@@ -73,6 +190,20 @@ public:
     int readLine(std::string &, double &, char &, double &, char &, std::string &, std::string &);
     std::string to_string(double, char, double, char, std::string &);
     
+    // Parse everything received since the last call. readLine() calls it, calling it
+    // more often only keeps the receive buffer short.
+    void poll();
+    
+    // Parse sentences from another source instead of the UART, e.g. a recorded trace
+    // played back by NmeaTraceReplay on the host. nullptr switches back to the UART.
+    void setSource(NmeaSource *source);
+    
+    // Pass every byte parsed by poll() to callback, nullptr stops it
+    void setCaptureCallback(GpsCaptureCallback callback, void *context) {
+        capture_callback = callback;
+        capture_context = context;
+    }
+    
     // Fake GPS data methods
     void enableFakeGPS(bool enable) { use_fake_data = enable; }
     bool isFakeGPSEnabled() const { return use_fake_data; }
@@ -85,6 +216,15 @@ public:
     // Returns empty string if no date is available
     std::string getDate() { return date; }
     
+    // Byte, sentence and checksum error counters of the NMEA parser
+    const NmeaParserStats &getParserStats() const { return parser.stats(); }
+    
+    // Message and checksum error counters of the UBX parser
+    const UbxParserStats &getUbxParserStats() const { return ubx.stats(); }
+    
+    // Received, dropped and overrun byte counters of the UART receive buffer
+    const GpsRxStats &getRxStats() const { return rx.stats(); }
+    
     // Tests GPS connection and returns a status code:
     // 0 = Good connection with valid NMEA data
     // 1 = Connected but no NMEA data received
@@ -93,9 +233,16 @@ public:
     // 4 = Connected but baud rate likely incorrect
     int testConnection();
     
-    // Returns the number of satellites currently visible to the GPS module
+    // Returns the number of satellites currently visible to the GPS module, from the
+    // sentences received in the background (never waits)
     int getVisibleSatellites();
     
+    // Satellites in view, tracked and used, in total and per constellation
+    GpsSatelliteCounts getSatelliteCounts();
+    
+    // HDOP, fix type, satellites used and speed of the current fix (never waits)
+    GpsFixQuality getFixQuality();
+    
     // Waits for a valid GPS fix with a specified timeout in seconds
     // Returns true if a fix was obtained, false if timeout occurred
     bool waitForFix(int timeout_seconds);
@@ -120,6 +267,35 @@ public:
     // This can help ensure time data is being sent by the module
     bool enableTimeMessages();
     
+    // Switch receiver and UART to a faster baud rate (MTK PMTK251 and u-blox UBX CFG-PRT are
+    // sent). The new rate is kept only if valid data arrives at it, otherwise the UART goes
+    // back to the current rate. Returns true if the receiver runs at baud_rate.
+    // If valid data stops for GPS_BAUD_LOST_MS later on (receiver reset to its defaults),
+    // poll() goes back to the baud rate given to the constructor, and tries both rates in
+    // turn until data arrives. Data at the default rate means the receiver lost its settings:
+    // the baud rate and the navigation rate are negotiated again (blocks up to 5 s once).
+    bool negotiateBaudRate(uint32_t baud_rate);
+    int getBaudRate() const { return baud_rate; }
+    
+    // Set the navigation rate in fixes per second (UBX CFG-RATE, else MTK PMTK220).
+    // Rates above 1 Hz need GPS_FAST_RATE_MIN_BAUD. Returns false if the receiver is in UBX
+    // mode and did not acknowledge it, MTK receivers are not verified.
+    bool setNavigationRate(uint16_t rate_hz);
+    uint16_t getNavigationInterval() const { return nav_interval_ms; }
+    
+    // The fix that arrived closest to time_ms (board time), e.g. the middle of the sensor
+    // reads of a sample. Returns false if no fix is within GPS_FIX_MAX_AGE_MS of it.
+    bool getFixAt(uint32_t time_ms, GpsFix &fix);
+    
+    // Switch a u-blox receiver to UBX NAV-PVT and NAV-DOP for position, time and accuracy,
+    // and turn off the NMEA sentences they replace (GSV stays, every UBX_GSV_RATE epochs).
+    // Returns false and leaves the receiver on NMEA if it does not acknowledge UBX.
+    // NMEA is parsed in either mode, so a receiver that resets to its defaults keeps working.
+    bool enableUbx();
+    
+    // NAV-PVT messages are arriving
+    bool isUbxActive();
+    
     // Optimizes GPS module for faster fix acquisition by sending various configuration commands
     // Returns true if the GPS module is still responding after sending the commands
     bool optimizeForFastAcquisition();
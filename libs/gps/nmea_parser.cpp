@@ -0,0 +1,524 @@
+#include "libs/gps/nmea_parser.h"
+#include <cstring>
+
+// Parser states
+#define NMEA_STATE_IDLE           0             // Waiting for "$"
+#define NMEA_STATE_BODY           1             // Between "$" and "*"
+#define NMEA_STATE_CHECKSUM_HIGH  2             // First hex digit after "*"
+#define NMEA_STATE_CHECKSUM_LOW   3             // Second hex digit after "*"
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Parse count digits at text into value
+static bool parseDigits(const char* text, uint8_t count, uint32_t& value) {
+    value = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (!isDigit(text[i])) {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+bool nmeaParseFixed(const char* text, uint8_t decimals, int32_t& value) {
+    bool negative = false;
+    if (*text == '-' || *text == '+') {
+        negative = *text == '-';
+        text++;
+    }
+
+    if (!isDigit(*text) && *text != '.') {
+        return false;
+    }
+
+    uint32_t result = 0;
+    while (isDigit(*text)) {
+        if (result > 200000000) {
+            return false;
+        }
+        result = result * 10 + (*text++ - '0');
+    }
+
+    // Scale by the decimals present, cut off the rest
+    uint8_t scaled = 0;
+    if (*text == '.') {
+        text++;
+        while (isDigit(*text)) {
+            if (scaled < decimals) {
+                if (result > 200000000) {
+                    return false;
+                }
+                result = result * 10 + (*text - '0');
+                scaled++;
+            }
+            text++;
+        }
+    }
+
+    if (*text != '\0') {
+        return false;
+    }
+
+    for (; scaled < decimals; scaled++) {
+        if (result > 200000000) {
+            return false;
+        }
+        result *= 10;
+    }
+
+    value = negative ? -(int32_t)result : (int32_t)result;
+    return true;
+}
+
+bool nmeaParseCoordinate(const char* text, const char* hemisphere, int32_t& value) {
+    // The minutes always take the two digits before the decimal point
+    const char* dot = strchr(text, '.');
+    size_t integer_digits = dot ? (size_t)(dot - text) : strlen(text);
+    if (integer_digits < 3 || integer_digits > 5) {
+        return false;
+    }
+
+    uint32_t degrees;
+    if (!parseDigits(text, integer_digits - 2, degrees) || degrees > 180) {
+        return false;
+    }
+
+    int32_t minutes_e6;
+    if (!nmeaParseFixed(text + integer_digits - 2, 6, minutes_e6) || minutes_e6 < 0 || minutes_e6 >= 60000000) {
+        return false;
+    }
+
+    // 1e-6 minutes to 1e-7 degrees is * 10 / 60, rounded
+    value = (int32_t)(degrees * 10000000 + (minutes_e6 + 3) / 6);
+
+    if (hemisphere[0] == 'S' || hemisphere[0] == 'W') {
+        value = -value;
+    } else if (hemisphere[0] != 'N' && hemisphere[0] != 'E') {
+        return false;
+    }
+    return true;
+}
+
+// Parse hhmmss[.sss]
+static bool parseTime(const char* text, NmeaSentence& sentence) {
+    uint32_t hour, minute;
+    int32_t second_e3;
+    if (!parseDigits(text, 2, hour) || !parseDigits(text + 2, 2, minute) ||
+        !nmeaParseFixed(text + 4, 3, second_e3) || hour > 23 || minute > 59 ||
+        second_e3 < 0 || second_e3 >= 61000) {
+        return false;
+    }
+
+    sentence.hour = hour;
+    sentence.minute = minute;
+    sentence.second = second_e3 / 1000;
+    sentence.millisecond = second_e3 % 1000;
+    sentence.time_valid = true;
+    return true;
+}
+
+// Parse ddmmyy
+static bool parseDate(const char* text, NmeaSentence& sentence) {
+    uint32_t day, month, year;
+    if (strlen(text) != 6 || !parseDigits(text, 2, day) || !parseDigits(text + 2, 2, month) ||
+        !parseDigits(text + 4, 2, year) || day < 1 || day > 31 || month < 1 || month > 12) {
+        return false;
+    }
+
+    sentence.day = day;
+    sentence.month = month;
+    sentence.year = year;
+    sentence.date_valid = true;
+    return true;
+}
+
+// Parse an unsigned integer field that must fit into max
+static bool parseUnsigned(const char* text, uint32_t max, uint32_t& value) {
+    int32_t parsed;
+    if (!nmeaParseFixed(text, 0, parsed) || parsed < 0 || (uint32_t)parsed > max) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+NmeaParser::NmeaParser() {
+    _line[0] = '\0';
+    memset(&_sentence, 0, sizeof(_sentence));
+    reset();
+}
+
+void NmeaParser::reset() {
+    _state = NMEA_STATE_IDLE;
+    _length = 0;
+    _checksum = 0;
+    _field_count = 0;
+}
+
+bool NmeaParser::feed(char c) {
+    _stats.bytes++;
+
+    // A "$" always starts a new sentence, the previous one was cut off
+    if (c == '$') {
+        if (_state != NMEA_STATE_IDLE) {
+            _stats.checksum_errors++;
+        }
+        _state = NMEA_STATE_BODY;
+        _length = 0;
+        _checksum = 0;
+        return false;
+    }
+
+    switch (_state) {
+        case NMEA_STATE_BODY:
+            if (c == '*') {
+                _state = NMEA_STATE_CHECKSUM_HIGH;
+            } else if (c == '\r' || c == '\n') {
+                // Sentences without a checksum are not trusted
+                _stats.checksum_errors++;
+                _state = NMEA_STATE_IDLE;
+            } else if (_length >= NMEA_MAX_SENTENCE_LENGTH) {
+                _stats.overflows++;
+                _state = NMEA_STATE_IDLE;
+            } else {
+                _buffer[_length++] = c;
+                _checksum ^= (uint8_t)c;
+            }
+            return false;
+
+        case NMEA_STATE_CHECKSUM_HIGH: {
+            int value = hexValue(c);
+            if (value < 0) {
+                _stats.checksum_errors++;
+                _state = NMEA_STATE_IDLE;
+                return false;
+            }
+            _received_checksum = value << 4;
+            _state = NMEA_STATE_CHECKSUM_LOW;
+            return false;
+        }
+
+        case NMEA_STATE_CHECKSUM_LOW: {
+            _state = NMEA_STATE_IDLE;
+            int value = hexValue(c);
+            if (value < 0 || (_received_checksum | value) != _checksum) {
+                _stats.checksum_errors++;
+                return false;
+            }
+            _buffer[_length] = '\0';
+            return decode();
+        }
+
+        default:
+            // Line ends and noise between sentences
+            return false;
+    }
+}
+
+uint32_t NmeaParser::feed(const char* data, size_t size) {
+    uint32_t sentences = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (feed(data[i])) {
+            sentences++;
+        }
+    }
+    return sentences;
+}
+
+const char* NmeaParser::field(uint8_t index) const {
+    return index < _field_count ? _fields[index] : "";
+}
+
+bool NmeaParser::decode() {
+    memcpy(_line, _buffer, _length + 1);
+
+    // Split in place, every comma ends a field
+    _field_count = 0;
+    _fields[_field_count++] = _buffer;
+    for (uint8_t i = 0; i < _length; i++) {
+        if (_buffer[i] == ',') {
+            if (_field_count >= NMEA_MAX_FIELDS) {
+                _stats.overflows++;
+                return false;
+            }
+            _buffer[i] = '\0';
+            _fields[_field_count++] = &_buffer[i + 1];
+        }
+    }
+
+    _stats.sentences++;
+    memset(&_sentence, 0, sizeof(_sentence));
+
+    // Address field: two character talker ID and three character sentence formatter
+    const char* address = _fields[0];
+    if (strlen(address) != 5 || address[0] == 'P') {
+        return true;
+    }
+
+    if (address[0] == 'G') {
+        switch (address[1]) {
+            case 'P': _sentence.talker = NMEA_TALKER_GPS; break;
+            case 'L': _sentence.talker = NMEA_TALKER_GLONASS; break;
+            case 'A': _sentence.talker = NMEA_TALKER_GALILEO; break;
+            case 'B': _sentence.talker = NMEA_TALKER_BEIDOU; break;
+            case 'N': _sentence.talker = NMEA_TALKER_COMBINED; break;
+            default:  _sentence.talker = NMEA_TALKER_OTHER; break;
+        }
+    } else if (address[0] == 'B' && address[1] == 'D') {
+        _sentence.talker = NMEA_TALKER_BEIDOU;
+    }
+
+    const char* formatter = address + 2;
+    bool decoded;
+    if (strcmp(formatter, "RMC") == 0) {
+        _sentence.type = NMEA_SENTENCE_RMC;
+        decoded = decodeRMC();
+    } else if (strcmp(formatter, "GLL") == 0) {
+        _sentence.type = NMEA_SENTENCE_GLL;
+        decoded = decodeGLL();
+    } else if (strcmp(formatter, "GGA") == 0) {
+        _sentence.type = NMEA_SENTENCE_GGA;
+        decoded = decodeGGA();
+    } else if (strcmp(formatter, "GSA") == 0) {
+        _sentence.type = NMEA_SENTENCE_GSA;
+        decoded = decodeGSA();
+    } else if (strcmp(formatter, "GSV") == 0) {
+        _sentence.type = NMEA_SENTENCE_GSV;
+        decoded = decodeGSV();
+    } else if (strcmp(formatter, "VTG") == 0) {
+        _sentence.type = NMEA_SENTENCE_VTG;
+        decoded = decodeVTG();
+    } else {
+        return true;
+    }
+
+    if (!decoded) {
+        _stats.field_errors++;
+        return false;
+    }
+
+    _stats.decoded++;
+    return true;
+}
+
+// Empty fields are allowed everywhere, receivers leave them empty without a fix
+
+bool NmeaParser::decodeRMC() {
+    // time, status, lat, N/S, lon, E/W, speed (knots), course, date, variation, E/W, mode
+    if (*field(1) && !parseTime(field(1), _sentence)) {
+        return false;
+    }
+    _sentence.fix_valid = field(2)[0] == 'A';
+
+    if (*field(3) && *field(5)) {
+        if (!nmeaParseCoordinate(field(3), field(4), _sentence.latitude) ||
+            !nmeaParseCoordinate(field(5), field(6), _sentence.longitude)) {
+            return false;
+        }
+        _sentence.position_valid = true;
+    }
+
+    int32_t knots_e3;
+    if (*field(7)) {
+        if (!nmeaParseFixed(field(7), 3, knots_e3) || knots_e3 < 0) {
+            return false;
+        }
+        // 1 knot = 1.852 km/h
+        _sentence.speed = (uint32_t)(((uint64_t)knots_e3 * 1852 + 5000) / 10000);
+        _sentence.speed_valid = true;
+    }
+
+    int32_t course;
+    if (*field(8)) {
+        if (!nmeaParseFixed(field(8), 2, course) || course < 0 || course >= 36000) {
+            return false;
+        }
+        _sentence.course = course;
+        _sentence.course_valid = true;
+    }
+
+    if (*field(9) && !parseDate(field(9), _sentence)) {
+        return false;
+    }
+    return true;
+}
+
+bool NmeaParser::decodeGLL() {
+    // lat, N/S, lon, E/W, time, status, mode
+    if (*field(1) && *field(3)) {
+        if (!nmeaParseCoordinate(field(1), field(2), _sentence.latitude) ||
+            !nmeaParseCoordinate(field(3), field(4), _sentence.longitude)) {
+            return false;
+        }
+        _sentence.position_valid = true;
+    }
+
+    if (*field(5) && !parseTime(field(5), _sentence)) {
+        return false;
+    }
+    _sentence.fix_valid = field(6)[0] == 'A';
+    return true;
+}
+
+bool NmeaParser::decodeGGA() {
+    // time, lat, N/S, lon, E/W, quality, satellites, HDOP, altitude, M, separation, M, age, station
+    if (*field(1) && !parseTime(field(1), _sentence)) {
+        return false;
+    }
+
+    if (*field(2) && *field(4)) {
+        if (!nmeaParseCoordinate(field(2), field(3), _sentence.latitude) ||
+            !nmeaParseCoordinate(field(4), field(5), _sentence.longitude)) {
+            return false;
+        }
+        _sentence.position_valid = true;
+    }
+
+    uint32_t value;
+    if (*field(6)) {
+        if (!parseUnsigned(field(6), 9, value)) {
+            return false;
+        }
+        _sentence.fix_quality = value;
+        _sentence.fix_valid = value > 0;
+    }
+
+    if (*field(7)) {
+        if (!parseUnsigned(field(7), 99, value)) {
+            return false;
+        }
+        _sentence.satellites_used = value;
+    }
+
+    int32_t dop;
+    if (*field(8)) {
+        if (!nmeaParseFixed(field(8), 2, dop) || dop < 0 || dop > 0xFFFF) {
+            return false;
+        }
+        _sentence.hdop = dop;
+    }
+
+    if (*field(9)) {
+        if (!nmeaParseFixed(field(9), 2, _sentence.altitude_cm)) {
+            return false;
+        }
+        _sentence.altitude_valid = true;
+    }
+    return true;
+}
+
+bool NmeaParser::decodeGSA() {
+    // mode, fix type, 12 satellite numbers, PDOP, HDOP, VDOP[, system ID]
+    uint32_t value;
+    if (*field(2)) {
+        if (!parseUnsigned(field(2), 3, value)) {
+            return false;
+        }
+        _sentence.fix_type = value;
+    }
+
+    for (uint8_t i = 3; i < 15; i++) {
+        if (*field(i)) {
+            _sentence.used_prn_count++;
+        }
+    }
+
+    // GN sentences name the constellation in the NMEA 4.10 system ID, older receivers
+    // only through the PRN range (1-32 GPS, 65-96 GLONASS)
+    uint32_t system_id, prn;
+    if (*field(18)) {
+        if (!parseUnsigned(field(18), 15, system_id)) {
+            return false;
+        }
+        switch (system_id) {
+            case 1:  _sentence.used_constellation = NMEA_TALKER_GPS; break;
+            case 2:  _sentence.used_constellation = NMEA_TALKER_GLONASS; break;
+            case 3:  _sentence.used_constellation = NMEA_TALKER_GALILEO; break;
+            case 4:  _sentence.used_constellation = NMEA_TALKER_BEIDOU; break;
+            default: _sentence.used_constellation = NMEA_TALKER_OTHER; break;
+        }
+    } else if (_sentence.talker != NMEA_TALKER_COMBINED) {
+        _sentence.used_constellation = _sentence.talker;
+    } else if (*field(3) && parseUnsigned(field(3), 255, prn)) {
+        if (prn >= 1 && prn <= 32) {
+            _sentence.used_constellation = NMEA_TALKER_GPS;
+        } else if (prn >= 65 && prn <= 96) {
+            _sentence.used_constellation = NMEA_TALKER_GLONASS;
+        } else {
+            _sentence.used_constellation = NMEA_TALKER_OTHER;
+        }
+    }
+
+    uint16_t* dops[3] = { &_sentence.pdop, &_sentence.hdop, &_sentence.vdop };
+    for (uint8_t i = 0; i < 3; i++) {
+        int32_t dop;
+        if (*field(15 + i)) {
+            if (!nmeaParseFixed(field(15 + i), 2, dop) || dop < 0 || dop > 0xFFFF) {
+                return false;
+            }
+            *dops[i] = dop;
+        }
+    }
+    return true;
+}
+
+bool NmeaParser::decodeGSV() {
+    // sentence count, sentence number, satellites in view, 4 * (PRN, elevation, azimuth, SNR)[, signal ID]
+    uint32_t count, index, in_view;
+    if (!parseUnsigned(field(1), 9, count) || !parseUnsigned(field(2), 9, index) ||
+        !parseUnsigned(field(3), 99, in_view)) {
+        return false;
+    }
+    _sentence.gsv_count = count;
+    _sentence.gsv_index = index;
+    _sentence.satellites_in_view = in_view;
+
+    for (uint8_t i = 4; i + 3 < _field_count && _sentence.satellite_count < 4; i += 4) {
+        NmeaSatellite& satellite = _sentence.satellites[_sentence.satellite_count];
+        uint32_t prn, elevation = 0, azimuth = 0, snr = 0;
+        if (!parseUnsigned(field(i), 255, prn) ||
+            (*field(i + 1) && !parseUnsigned(field(i + 1), 90, elevation)) ||
+            (*field(i + 2) && !parseUnsigned(field(i + 2), 359, azimuth)) ||
+            (*field(i + 3) && !parseUnsigned(field(i + 3), 99, snr))) {
+            return false;
+        }
+        satellite.prn = prn;
+        satellite.elevation = elevation;
+        satellite.azimuth = azimuth;
+        satellite.snr = snr;
+        _sentence.satellite_count++;
+    }
+    return true;
+}
+
+bool NmeaParser::decodeVTG() {
+    // course (true), T, course (magnetic), M, speed (knots), N, speed (km/h), K, mode
+    int32_t course;
+    if (*field(1)) {
+        if (!nmeaParseFixed(field(1), 2, course) || course < 0 || course >= 36000) {
+            return false;
+        }
+        _sentence.course = course;
+        _sentence.course_valid = true;
+    }
+
+    int32_t speed;
+    if (*field(7)) {
+        if (!nmeaParseFixed(field(7), 2, speed) || speed < 0) {
+            return false;
+        }
+        _sentence.speed = speed;
+        _sentence.speed_valid = true;
+    }
+    return true;
+}
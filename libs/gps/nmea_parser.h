@@ -0,0 +1,161 @@
+#ifndef NMEA_PARSER_H
+#define NMEA_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Longest sentence accepted, "$" to the checksum. NMEA 0183 allows 82 characters including
+// CR LF, some receivers exceed it slightly with NMEA 4.10 fields.
+#define NMEA_MAX_SENTENCE_LENGTH  100
+#define NMEA_MAX_FIELDS           24            // GSV: address, 3 header fields, 4 satellites * 4 fields, signal id
+
+// Sentence types
+#define NMEA_SENTENCE_UNKNOWN     0             // Valid checksum but not decoded (TXT, proprietary, ...)
+#define NMEA_SENTENCE_RMC         1             // Recommended minimum: time, date, position, speed, course
+#define NMEA_SENTENCE_GLL         2             // Position and time
+#define NMEA_SENTENCE_GGA         3             // Fix quality, satellites used, HDOP, altitude
+#define NMEA_SENTENCE_GSA         4             // Fix type, satellites used, DOP values
+#define NMEA_SENTENCE_GSV         5             // Satellites in view, up to 4 per sentence
+#define NMEA_SENTENCE_VTG         6             // Course and speed over ground
+
+// Talker IDs, the constellation a sentence describes
+#define NMEA_TALKER_OTHER         0
+#define NMEA_TALKER_GPS           1             // GP
+#define NMEA_TALKER_GLONASS       2             // GL
+#define NMEA_TALKER_GALILEO       3             // GA
+#define NMEA_TALKER_BEIDOU        4             // GB, BD
+#define NMEA_TALKER_COMBINED      5             // GN, several constellations
+
+// One satellite of a GSV sentence
+struct NmeaSatellite {
+    uint8_t prn;            // Satellite number
+    uint8_t elevation;      // Degrees
+    uint16_t azimuth;       // Degrees
+    uint8_t snr;            // dB-Hz, 0 if not tracked
+};
+
+// Decoded sentence. Only the fields of its type are set, the flags tell which optional
+// fields were present. Coordinates and decimals are fixed-point integers, no floats.
+struct NmeaSentence {
+    uint8_t type;           // NMEA_SENTENCE_*
+    uint8_t talker;         // NMEA_TALKER_*
+
+    // RMC, GLL, GGA
+    bool time_valid;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint16_t millisecond;
+
+    // RMC
+    bool date_valid;
+    uint8_t day;
+    uint8_t month;
+    uint8_t year;           // Years since 2000
+
+    // RMC, GLL, GGA
+    bool position_valid;    // Coordinates present
+    bool fix_valid;         // Status A (RMC, GLL) or fix quality > 0 (GGA)
+    int32_t latitude;       // 1e-7 degrees, negative = south
+    int32_t longitude;      // 1e-7 degrees, negative = west
+
+    // GGA
+    uint8_t fix_quality;    // 0 = none, 1 = GPS, 2 = DGPS, 6 = estimated
+    uint8_t satellites_used;
+    bool altitude_valid;
+    int32_t altitude_cm;    // Above mean sea level
+
+    // GGA (HDOP), GSA (all three), 0 if not present
+    uint16_t hdop;          // Hundredths
+    uint16_t pdop;
+    uint16_t vdop;
+
+    // GSA
+    uint8_t fix_type;       // 1 = none, 2 = 2D, 3 = 3D
+    uint8_t used_prn_count; // Satellite numbers listed (up to 12 per sentence)
+    uint8_t used_constellation; // NMEA_TALKER_* of the listed satellites
+
+    // RMC, VTG
+    bool speed_valid;
+    uint32_t speed;         // Hundredths of km/h
+    bool course_valid;
+    uint16_t course;        // Hundredths of a degree, true north
+
+    // GSV
+    uint8_t gsv_count;      // Sentences in the GSV group
+    uint8_t gsv_index;      // Number of this sentence, from 1
+    uint8_t satellites_in_view;
+    uint8_t satellite_count;    // Entries in satellites[]
+    NmeaSatellite satellites[4];
+};
+
+// Counters of the bytes and sentences seen by a parser
+struct NmeaParserStats {
+    uint32_t bytes = 0;
+    uint32_t sentences = 0;         // Valid checksum, including unknown types
+    uint32_t decoded = 0;           // Sentences of one of the decoded types
+    uint32_t checksum_errors = 0;   // Checksum mismatch or missing
+    uint32_t overflows = 0;         // Longer than NMEA_MAX_SENTENCE_LENGTH or too many fields
+    uint32_t field_errors = 0;      // Valid checksum but a malformed field
+};
+
+// Incremental NMEA 0183 parser. Bytes are fed one at a time as they arrive, sentences are
+// checked against their *XX checksum, split in place and decoded with integer arithmetic.
+// Uses no heap and no floating point, the whole state is the object itself.
+class NmeaParser {
+public:
+    NmeaParser();
+
+    // Feed one received byte. Returns true when it completed a sentence with a valid
+    // checksum, which is then available from sentence() and line() until the next byte.
+    bool feed(char c);
+
+    // Feed size bytes, returns the number of valid sentences completed
+    uint32_t feed(const char* data, size_t size);
+
+    // Drop a partially received sentence
+    void reset();
+
+    const NmeaSentence& sentence() const { return _sentence; }
+
+    // Text of the last sentence from "$" up to the checksum (without it)
+    const char* line() const { return _line; }
+
+    const NmeaParserStats& stats() const { return _stats; }
+    void resetStats() { _stats = NmeaParserStats(); }
+
+private:
+    // Split the completed sentence into fields and decode it
+    bool decode();
+
+    bool decodeRMC();
+    bool decodeGLL();
+    bool decodeGGA();
+    bool decodeGSA();
+    bool decodeGSV();
+    bool decodeVTG();
+
+    // Field index of the sentence, empty string past the end
+    const char* field(uint8_t index) const;
+
+    uint8_t _state;
+    uint8_t _length;
+    uint8_t _checksum;                  // XOR of the characters between "$" and "*"
+    uint8_t _received_checksum;
+    char _buffer[NMEA_MAX_SENTENCE_LENGTH + 1];     // Split into fields by decode()
+    char _line[NMEA_MAX_SENTENCE_LENGTH + 1];       // Unsplit copy for line()
+    const char* _fields[NMEA_MAX_FIELDS];
+    uint8_t _field_count;
+    NmeaSentence _sentence;
+    NmeaParserStats _stats;
+};
+
+// Parse the fixed-point number at text with the given number of decimals ("1.25", 2 -> 125).
+// Extra decimals are cut off. Returns false for an empty or malformed field.
+bool nmeaParseFixed(const char* text, uint8_t decimals, int32_t& value);
+
+// Parse an NMEA coordinate (ddmm.mmmm or dddmm.mmmm) and its hemisphere (N, S, E, W)
+// into 1e-7 degrees
+bool nmeaParseCoordinate(const char* text, const char* hemisphere, int32_t& value);
+
+#endif // NMEA_PARSER_H
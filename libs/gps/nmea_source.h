@@ -0,0 +1,23 @@
+#ifndef NMEA_SOURCE_H
+#define NMEA_SOURCE_H
+
+#include <cstdint>
+
+// Byte stream myGPS parses its NMEA sentences from.
+//
+// Sources:
+//   GpsRxBuffer      (gps_rx_buffer.cpp)        - the GPS UART, received in the background
+//   NmeaTraceReplay  (libs/replay/trace_replay.cpp) - recorded NMEA log played back on the host
+class NmeaSource {
+public:
+    virtual ~NmeaSource() {}
+
+    // Bytes that can be read without waiting
+    virtual uint32_t available() = 0;
+    bool readable() { return available() > 0; }
+
+    // Next byte, 0 if none is available. Call readable() or available() first.
+    virtual char getc() = 0;
+};
+
+#endif // NMEA_SOURCE_H
@@ -0,0 +1,231 @@
+#include "libs/gps/ubx_parser.h"
+#include <cstring>
+
+// Parser states
+#define UBX_STATE_SYNC_1          0             // Waiting for UBX_SYNC_CHAR_1
+#define UBX_STATE_SYNC_2          1
+#define UBX_STATE_CLASS           2
+#define UBX_STATE_ID              3
+#define UBX_STATE_LENGTH_LOW      4
+#define UBX_STATE_LENGTH_HIGH     5
+#define UBX_STATE_PAYLOAD         6
+#define UBX_STATE_CHECKSUM_A      7
+#define UBX_STATE_CHECKSUM_B      8
+
+// Little endian fields of a payload
+static uint16_t readU16(const uint8_t* data) {
+    return (uint16_t)(data[0] | data[1] << 8);
+}
+
+static uint32_t readU32(const uint8_t* data) {
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static int32_t readI32(const uint8_t* data) {
+    return (int32_t)readU32(data);
+}
+
+UbxParser::UbxParser() {
+    memset(&_message, 0, sizeof(_message));
+    reset();
+}
+
+void UbxParser::reset() {
+    _state = UBX_STATE_SYNC_1;
+    _received = 0;
+}
+
+bool UbxParser::feed(uint8_t c) {
+    _stats.bytes++;
+
+    // Class to payload are covered by the checksum
+    if (_state >= UBX_STATE_CLASS && _state <= UBX_STATE_PAYLOAD) {
+        _checksum_a += c;
+        _checksum_b += _checksum_a;
+    }
+
+    switch (_state) {
+        case UBX_STATE_SYNC_1:
+            if (c == UBX_SYNC_CHAR_1) {
+                _state = UBX_STATE_SYNC_2;
+            }
+            return false;
+
+        case UBX_STATE_SYNC_2:
+            if (c == UBX_SYNC_CHAR_2) {
+                _state = UBX_STATE_CLASS;
+                _checksum_a = 0;
+                _checksum_b = 0;
+            } else {
+                _state = c == UBX_SYNC_CHAR_1 ? UBX_STATE_SYNC_2 : UBX_STATE_SYNC_1;
+            }
+            return false;
+
+        case UBX_STATE_CLASS:
+            _msg_class = c;
+            _state = UBX_STATE_ID;
+            return false;
+
+        case UBX_STATE_ID:
+            _msg_id = c;
+            _state = UBX_STATE_LENGTH_LOW;
+            return false;
+
+        case UBX_STATE_LENGTH_LOW:
+            _length = c;
+            _state = UBX_STATE_LENGTH_HIGH;
+            return false;
+
+        case UBX_STATE_LENGTH_HIGH:
+            _length |= (uint16_t)c << 8;
+            _received = 0;
+            _state = _length > 0 ? UBX_STATE_PAYLOAD : UBX_STATE_CHECKSUM_A;
+            return false;
+
+        case UBX_STATE_PAYLOAD:
+            // Payloads that don't fit are still walked to stay in step with the stream
+            if (_received < UBX_MAX_PAYLOAD) {
+                _payload[_received] = c;
+            }
+            if (++_received >= _length) {
+                _state = UBX_STATE_CHECKSUM_A;
+            }
+            return false;
+
+        case UBX_STATE_CHECKSUM_A:
+            if (c != _checksum_a) {
+                _stats.checksum_errors++;
+                _state = c == UBX_SYNC_CHAR_1 ? UBX_STATE_SYNC_2 : UBX_STATE_SYNC_1;
+                return false;
+            }
+            _state = UBX_STATE_CHECKSUM_B;
+            return false;
+
+        case UBX_STATE_CHECKSUM_B:
+            _state = UBX_STATE_SYNC_1;
+            if (c != _checksum_b) {
+                _stats.checksum_errors++;
+                if (c == UBX_SYNC_CHAR_1) {
+                    _state = UBX_STATE_SYNC_2;
+                }
+                return false;
+            }
+            if (_length > UBX_MAX_PAYLOAD) {
+                _stats.overflows++;
+                return false;
+            }
+            _stats.messages++;
+            return decode();
+    }
+
+    reset();
+    return false;
+}
+
+uint32_t UbxParser::feed(const uint8_t* data, size_t size) {
+    uint32_t messages = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (feed(data[i])) {
+            messages++;
+        }
+    }
+    return messages;
+}
+
+bool UbxParser::decode() {
+    _message.type = UBX_MESSAGE_UNKNOWN;
+    _message.msg_class = _msg_class;
+    _message.msg_id = _msg_id;
+    _message.length = _length;
+    const uint8_t* p = _payload;
+
+    if (_msg_class == UBX_CLASS_NAV && _msg_id == UBX_NAV_PVT) {
+        if (_length != UBX_NAV_PVT_LENGTH) {
+            _stats.length_errors++;
+            return false;
+        }
+        UbxNavPvt& pvt = _message.nav_pvt;
+        pvt.itow = readU32(p);
+        pvt.year = readU16(p + 4);
+        pvt.month = p[6];
+        pvt.day = p[7];
+        pvt.hour = p[8];
+        pvt.minute = p[9];
+        pvt.second = p[10];
+        pvt.date_valid = (p[11] & UBX_PVT_VALID_DATE) != 0;
+        pvt.time_valid = (p[11] & (UBX_PVT_VALID_TIME | UBX_PVT_FULLY_RESOLVED)) ==
+                         (UBX_PVT_VALID_TIME | UBX_PVT_FULLY_RESOLVED);
+
+        // The nanoseconds correct the rounded time, -500 ms to +500 ms. A negative value
+        // (the second was rounded up) counts as 0.
+        int32_t nano = readI32(p + 16);
+        pvt.millisecond = nano > 0 ? (uint16_t)(nano / 1000000) : 0;
+
+        pvt.fix_type = p[20];
+        pvt.fix_valid = (p[21] & UBX_PVT_GNSS_FIX_OK) &&
+                        (pvt.fix_type == UBX_FIX_2D || pvt.fix_type == UBX_FIX_3D ||
+                         pvt.fix_type == UBX_FIX_GNSS_DEAD_RECKONING);
+        pvt.satellites_used = p[23];
+        pvt.longitude = readI32(p + 24);
+        pvt.latitude = readI32(p + 28);
+        pvt.altitude_cm = readI32(p + 36) / 10;
+        pvt.horizontal_accuracy_mm = readU32(p + 40);
+        pvt.vertical_accuracy_mm = readU32(p + 44);
+
+        // mm/s to hundredths of km/h is * 0.36, 1e-5 degrees to hundredths is / 1000
+        int32_t ground_speed = readI32(p + 60);
+        pvt.speed = ground_speed > 0 ? (uint32_t)(((uint64_t)ground_speed * 36 + 50) / 100) : 0;
+        int32_t heading = readI32(p + 64);
+        pvt.course = heading > 0 ? (uint16_t)((heading / 1000) % 36000) : 0;
+        pvt.pdop = readU16(p + 76);
+        _message.type = UBX_MESSAGE_NAV_PVT;
+    } else if (_msg_class == UBX_CLASS_NAV && _msg_id == UBX_NAV_DOP) {
+        if (_length != UBX_NAV_DOP_LENGTH) {
+            _stats.length_errors++;
+            return false;
+        }
+        UbxNavDop& dop = _message.nav_dop;
+        dop.itow = readU32(p);
+        dop.gdop = readU16(p + 4);
+        dop.pdop = readU16(p + 6);
+        dop.tdop = readU16(p + 8);
+        dop.vdop = readU16(p + 10);
+        dop.hdop = readU16(p + 12);
+        _message.type = UBX_MESSAGE_NAV_DOP;
+    } else if (_msg_class == UBX_CLASS_ACK && (_msg_id == UBX_ACK_ACK || _msg_id == UBX_ACK_NAK)) {
+        if (_length != UBX_ACK_LENGTH) {
+            _stats.length_errors++;
+            return false;
+        }
+        _message.ack.acknowledged = _msg_id == UBX_ACK_ACK;
+        _message.ack.msg_class = p[0];
+        _message.ack.msg_id = p[1];
+        _message.type = UBX_MESSAGE_ACK;
+    } else {
+        return true;
+    }
+
+    _stats.decoded++;
+    return true;
+}
+
+size_t ubxBuildMessage(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t length, uint8_t* out) {
+    out[0] = UBX_SYNC_CHAR_1;
+    out[1] = UBX_SYNC_CHAR_2;
+    out[2] = msg_class;
+    out[3] = msg_id;
+    out[4] = length & 0xFF;
+    out[5] = length >> 8;
+    if (length > 0) {
+        memcpy(out + 6, payload, length);
+    }
+
+    uint8_t checksum_a = 0, checksum_b = 0;
+    for (size_t i = 2; i < 6 + (size_t)length; i++) {
+        checksum_a += out[i];
+        checksum_b += checksum_a;
+    }
+    out[6 + length] = checksum_a;
+    out[7 + length] = checksum_b;
+    return length + UBX_FRAME_OVERHEAD;
+}
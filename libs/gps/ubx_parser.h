@@ -0,0 +1,165 @@
+#ifndef UBX_PARSER_H
+#define UBX_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Frame: sync chars, class, id, 16 bit little endian length, payload, 2 byte checksum
+#define UBX_SYNC_CHAR_1           0xB5
+#define UBX_SYNC_CHAR_2           0x62
+#define UBX_FRAME_OVERHEAD        8
+#define UBX_MAX_PAYLOAD           100           // Longer messages are skipped (NAV-PVT has 92 bytes)
+
+// Message classes and ids used
+#define UBX_CLASS_NAV             0x01
+#define UBX_CLASS_ACK             0x05
+#define UBX_CLASS_CFG             0x06
+#define UBX_CLASS_NMEA            0xF0          // Standard NMEA sentences, for CFG-MSG
+#define UBX_NAV_DOP               0x04
+#define UBX_NAV_PVT               0x07
+#define UBX_ACK_NAK               0x00
+#define UBX_ACK_ACK               0x01
+#define UBX_CFG_PRT               0x00
+#define UBX_CFG_MSG               0x01
+#define UBX_CFG_RATE              0x08
+#define UBX_NMEA_GGA              0x00
+#define UBX_NMEA_GLL              0x01
+#define UBX_NMEA_GSA              0x02
+#define UBX_NMEA_GSV              0x03
+#define UBX_NMEA_RMC              0x04
+#define UBX_NMEA_VTG              0x05
+
+// NMEA GSV sentences stay enabled in UBX mode every this many epochs for the satellites
+// in view, within GPS_SATELLITES_MAX_AGE_MS at 1 Hz
+#define UBX_GSV_RATE              3
+
+#define UBX_NAV_PVT_LENGTH        92
+#define UBX_NAV_DOP_LENGTH        18
+#define UBX_ACK_LENGTH            2
+
+// Message types
+#define UBX_MESSAGE_UNKNOWN       0             // Valid checksum but not decoded
+#define UBX_MESSAGE_NAV_PVT       1             // Position, velocity, time and accuracy
+#define UBX_MESSAGE_NAV_DOP       2             // Dilution of precision
+#define UBX_MESSAGE_ACK           3             // Answer to a CFG message
+
+// NAV-PVT fix types
+#define UBX_FIX_NONE              0
+#define UBX_FIX_DEAD_RECKONING    1
+#define UBX_FIX_2D                2
+#define UBX_FIX_3D                3
+#define UBX_FIX_GNSS_DEAD_RECKONING 4
+#define UBX_FIX_TIME_ONLY         5
+
+// NAV-PVT valid and flags bits
+#define UBX_PVT_VALID_DATE        0x01
+#define UBX_PVT_VALID_TIME        0x02
+#define UBX_PVT_FULLY_RESOLVED    0x04
+#define UBX_PVT_GNSS_FIX_OK       0x01
+
+// NAV-PVT, in the same fixed-point units as NmeaSentence where both have a field
+struct UbxNavPvt {
+    uint32_t itow;          // GPS time of week in ms, matches the other NAV messages of the epoch
+    bool date_valid;
+    bool time_valid;
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint16_t millisecond;   // Rounded from the nanosecond field, 0-999
+    uint8_t fix_type;       // UBX_FIX_*
+    bool fix_valid;         // gnssFixOK flag and a 2D, 3D or GNSS + dead reckoning fix
+    uint8_t satellites_used;
+    int32_t latitude;       // 1e-7 degrees, negative = south
+    int32_t longitude;      // 1e-7 degrees, negative = west
+    int32_t altitude_cm;    // Above mean sea level
+    uint32_t horizontal_accuracy_mm;
+    uint32_t vertical_accuracy_mm;
+    uint32_t speed;         // Ground speed in hundredths of km/h
+    uint16_t course;        // Heading of motion in hundredths of a degree
+    uint16_t pdop;          // Hundredths
+};
+
+// NAV-DOP, hundredths
+struct UbxNavDop {
+    uint32_t itow;
+    uint16_t gdop;
+    uint16_t pdop;
+    uint16_t tdop;
+    uint16_t vdop;
+    uint16_t hdop;
+};
+
+// ACK-ACK or ACK-NAK
+struct UbxAck {
+    bool acknowledged;      // ACK-ACK, false for ACK-NAK
+    uint8_t msg_class;      // Of the acknowledged message
+    uint8_t msg_id;
+};
+
+// Decoded message. Only the member of its type is set.
+struct UbxMessage {
+    uint8_t type;           // UBX_MESSAGE_*
+    uint8_t msg_class;
+    uint8_t msg_id;
+    uint16_t length;
+    UbxNavPvt nav_pvt;
+    UbxNavDop nav_dop;
+    UbxAck ack;
+};
+
+// Counters of the bytes and messages seen by a parser
+struct UbxParserStats {
+    uint32_t bytes = 0;
+    uint32_t messages = 0;          // Valid checksum, including unknown types
+    uint32_t decoded = 0;           // Messages of one of the decoded types
+    uint32_t checksum_errors = 0;
+    uint32_t overflows = 0;         // Payload longer than UBX_MAX_PAYLOAD, skipped
+    uint32_t length_errors = 0;     // Decoded type with an unexpected length
+};
+
+// Incremental UBX parser. Bytes are fed one at a time as they arrive, like NmeaParser, so
+// both can share the receive stream of a u-blox receiver that outputs NMEA and UBX. Frames
+// are checked with their Fletcher checksum and decoded from fixed offsets, without any
+// text conversion. Uses no heap and no floating point.
+class UbxParser {
+public:
+    UbxParser();
+
+    // Feed one received byte. Returns true when it completed a message with a valid
+    // checksum, which is then available from message() until the next byte.
+    bool feed(uint8_t c);
+
+    // Feed size bytes, returns the number of valid messages completed
+    uint32_t feed(const uint8_t* data, size_t size);
+
+    // Drop a partially received message
+    void reset();
+
+    const UbxMessage& message() const { return _message; }
+
+    const UbxParserStats& stats() const { return _stats; }
+    void resetStats() { _stats = UbxParserStats(); }
+
+private:
+    // Decode the completed message, false if a decoded type has the wrong length
+    bool decode();
+
+    uint8_t _state;
+    uint8_t _msg_class;
+    uint8_t _msg_id;
+    uint16_t _length;
+    uint16_t _received;                 // Payload bytes received
+    uint8_t _checksum_a;
+    uint8_t _checksum_b;
+    uint8_t _payload[UBX_MAX_PAYLOAD];
+    UbxMessage _message;
+    UbxParserStats _stats;
+};
+
+// Build a complete frame into out (length + UBX_FRAME_OVERHEAD bytes), returns its size
+size_t ubxBuildMessage(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t length, uint8_t* out);
+
+#endif // UBX_PARSER_H
@@ -16,7 +16,7 @@ bool HM3301::begin() {
 
 // Reads PM1.0, PM2.5, and PM10 data from the HM3301 sensor
 bool HM3301::read(uint16_t &pm1_0, uint16_t &pm2_5, uint16_t &pm10) {
-    uint8_t data[29];  // HM3301 outputs 29 bytes
+    uint8_t data[HM3301_FRAME_SIZE];  // HM3301 outputs 29 bytes
 
     // Read raw data from the sensor
     if (!readRawData(data, sizeof(data))) {
@@ -28,6 +28,7 @@ bool HM3301::read(uint16_t &pm1_0, uint16_t &pm2_5, uint16_t &pm10) {
     pm2_5 = (data[8] << 8) | data[9];
     pm10 = (data[10] << 8) | data[11];
 
+    memcpy(last_frame, data, sizeof(last_frame));
     return true;
 }
 
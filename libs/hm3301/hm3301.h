@@ -4,17 +4,23 @@
 #include <stdint.h>
 #include "hardware/i2c.h"
 
+#define HM3301_FRAME_SIZE 29  // Bytes the sensor sends per read
+
 class HM3301 {
 public:
     HM3301(i2c_inst_t *i2c_port, uint8_t addr, uint sda_pin, uint scl_pin);
     bool begin();
     bool read(uint16_t &pm1_0, uint16_t &pm2_5, uint16_t &pm10);
 
+    // Frame of the last successful read() as sent by the sensor (for raw capture)
+    const uint8_t *lastFrame() const { return last_frame; }
+
 private:
     i2c_inst_t *i2c_port;
     uint8_t addr;
     uint sda_pin;
     uint scl_pin;
+    uint8_t last_frame[HM3301_FRAME_SIZE] = {0};
 
     bool readRawData(uint8_t *data, size_t length);
 };
@@ -5,7 +5,7 @@
 
 // Constructor to initialize address
 Pas_co2::Pas_co2(uint8_t address, i2c_inst_t* i2c_instance) 
-    : i2c_address(address), i2c(i2c_instance), result(0) {}
+    : i2c_address(address), i2c(i2c_instance), lsb(0), msb(0), data_rdy(0), result(0) {}
 
 int Pas_co2::init() {
     uint8_t buffer[2];
@@ -18,6 +18,12 @@ public:
     // Getter for the CO2 result value
     uint16_t getResult() const { return result; }
 
+    // Bytes of the last read(): MEAS_STS status, CO2PPM_H and CO2PPM_L (for raw capture).
+    // The ppm bytes are only fresh when the status has the COMP_BIT set.
+    uint8_t getStatus() const { return data_rdy; }
+    uint8_t getRawHigh() const { return msb; }
+    uint8_t getRawLow() const { return lsb; }
+
 private:
     // I2C parameters
     uint8_t i2c_address;
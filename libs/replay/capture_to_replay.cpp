@@ -0,0 +1,325 @@
+// Converts the raw capture stream (libs/flash/raw_capture.h) of a flash image into the
+// trace files of libs/replay/trace_replay.h. Host only, not part of the firmware:
+//
+//   picotool save -a flash.bin
+//   cmake -S . -B build-host && cmake --build build-host --target capture_to_replay
+//   build-host/tests/capture_to_replay flash.bin ride      (writes ride.nmea and ride.csv)
+//
+// The capture pool is found by its sector headers, or given as address and sector count.
+// Times are ms since the first captured entry. Captures of several boots are joined one
+// second apart.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "libs/flash/flash_stream.h"
+#include "libs/flash/flash_hal_emulator.h"
+#include "libs/flash/raw_capture.h"
+#include "libs/replay/trace_replay.h"
+
+// The Bosch API reads the calibration and the fields from a register map in place of the sensor
+#include "libs/bme688/api/BME68x_SensorAPI/bme68x.h"
+
+#define CAPTURE_FLASH_SIZE (2 * 1024 * 1024)
+#define BOOT_JOIN_US 1000000            // Gap between the captures of two boots
+
+static uint8_t bme_registers[256];
+
+static BME68X_INTF_RET_TYPE bmeRead(uint8_t reg_addr, uint8_t *reg_data, uint32_t length, void *intf_ptr) {
+    (void)intf_ptr;
+    if (reg_addr + length > sizeof(bme_registers)) {
+        return -1;
+    }
+    memcpy(reg_data, &bme_registers[reg_addr], length);
+    return 0;
+}
+
+static BME68X_INTF_RET_TYPE bmeWrite(uint8_t reg_addr, const uint8_t *reg_data, uint32_t length, void *intf_ptr) {
+    (void)reg_addr;
+    (void)reg_data;
+    (void)length;
+    (void)intf_ptr;
+    return 0;
+}
+
+static void bmeDelay(uint32_t period, void *intf_ptr) {
+    (void)period;
+    (void)intf_ptr;
+}
+
+// Latest value of each sensor column, written as a CSV row after new frames
+struct SensorRow {
+    bool known[SENSOR_TRACE_COLUMNS] = {};
+    double values[SENSOR_TRACE_COLUMNS] = {};
+    bool pending = false;               // Changed since the last row was written
+    uint64_t time_ms = 0;               // Of the last change
+
+    void set(int column, double value) {
+        known[column] = true;
+        values[column] = value;
+    }
+};
+
+// Columns of the CSV, in the order of the names read by SensorTraceReplay
+#define COL_TEMP     0
+#define COL_HUM      1
+#define COL_PRES     2
+#define COL_GAS_RES  3
+#define COL_PM1_0    4
+#define COL_PM2_5    5
+#define COL_PM5      6
+#define COL_PM10     7
+#define COL_CO2      8
+static const char *const sensor_columns[] = {"temp", "hum", "pres", "gas_res", "pm1_0", "pm2_5", "pm5", "pm10", "co2"};
+#define CSV_COLUMNS (sizeof(sensor_columns) / sizeof(sensor_columns[0]))
+
+static void writeRow(FILE *csv, const SensorRow &row) {
+    fprintf(csv, "%" PRIu64, row.time_ms);
+    for (size_t i = 0; i < CSV_COLUMNS; i++) {
+        if (row.known[i]) {
+            fprintf(csv, ",%g", row.values[i]);
+        } else {
+            fprintf(csv, ",");
+        }
+    }
+    fprintf(csv, "\n");
+}
+
+// Find the sectors of the capture stream in the image, first to last
+static bool findPool(FlashHal &hal, uint32_t &address, uint32_t &sectors) {
+    uint32_t first = 0, last = 0;
+    bool found = false;
+    for (uint32_t sector_address = 0; sector_address < hal.size(); sector_address += FLASH_SECTOR_SIZE) {
+        StreamSectorHeader header;
+        memcpy(&header, hal.map(sector_address), sizeof(header));
+        if (header.magic == STREAM_SECTOR_MAGIC && header.stream_id == FLASH_STREAM_CAPTURE) {
+            if (!found) {
+                first = sector_address;
+            }
+            last = sector_address;
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    address = first;
+    sectors = (last - first) / FLASH_SECTOR_SIZE + 1;
+    return sectors <= STREAM_MAX_SECTORS;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3 && argc != 5) {
+        fprintf(stderr, "Usage: %s <flash image> <output prefix> [pool address] [sectors]\n", argv[0]);
+        return 2;
+    }
+
+    EmulatedFlashHal hal(CAPTURE_FLASH_SIZE);
+    if (!hal.loadImage(argv[1])) {
+        fprintf(stderr, "CAPTURE ERROR: Can't read %s\n", argv[1]);
+        return 1;
+    }
+
+    uint32_t address = 0, sectors = 0;
+    if (argc == 5) {
+        address = strtoul(argv[3], nullptr, 0);
+        sectors = strtoul(argv[4], nullptr, 0);
+    } else if (!findPool(hal, address, sectors)) {
+        fprintf(stderr, "CAPTURE ERROR: No capture stream in %s\n", argv[1]);
+        return 1;
+    }
+
+    FlashStream stream("capture", FLASH_STREAM_CAPTURE, address, sectors, &hal);
+    if (!stream.init()) {
+        fprintf(stderr, "CAPTURE ERROR: Invalid capture pool at 0x%08x\n", (unsigned int)address);
+        return 1;
+    }
+
+    std::string nmea_path = std::string(argv[2]) + ".nmea";
+    std::string csv_path = std::string(argv[2]) + ".csv";
+    FILE *nmea = fopen(nmea_path.c_str(), "w");
+    FILE *csv = fopen(csv_path.c_str(), "w");
+    if (!nmea || !csv) {
+        fprintf(stderr, "CAPTURE ERROR: Can't write %s.*\n", argv[2]);
+        return 1;
+    }
+    fprintf(nmea, "# Converted from %s\n", argv[1]);
+    fprintf(csv, "time_ms");
+    for (size_t i = 0; i < CSV_COLUMNS; i++) {
+        fprintf(csv, ",%s", sensor_columns[i]);
+    }
+    fprintf(csv, "\n");
+
+    struct bme68x_dev bme = {};
+    bme.intf = BME68X_I2C_INTF;
+    bme.read = bmeRead;
+    bme.write = bmeWrite;
+    bme.delay_us = bmeDelay;
+    bool bme_calibrated = false;
+
+    // Entry times are the low 32 bits of the uptime, extended with the last sync entry
+    bool synced = false;
+    uint64_t sync_uptime_us = 0;
+    uint32_t sync_time_us = 0;
+    uint64_t boot_offset_us = 0;        // Added to the uptime of the current boot
+    uint64_t last_us = 0;               // Latest joined time
+    bool started = false;
+    uint64_t first_us = 0;
+
+    std::string line;
+    uint64_t line_ms = 0;
+    SensorRow row;
+    uint32_t sentences = 0, rows = 0, gaps = 0, unsynced = 0;
+
+    FlashStreamCursor cursor = stream.entries();
+    FlashStreamEntry entry;
+    while (cursor.next(entry)) {
+        if (entry.size < sizeof(uint32_t)) {
+            continue;
+        }
+        uint32_t time_us;
+        memcpy(&time_us, entry.payload, sizeof(time_us));
+        const uint8_t *data = entry.payload + sizeof(time_us);
+        uint32_t size = entry.size - sizeof(time_us);
+
+        if (entry.type == CAPTURE_SYNC && entry.size >= sizeof(CaptureSync)) {
+            CaptureSync sync;
+            memcpy(&sync, entry.payload, sizeof(sync));
+            if (synced && sync.uptime_us + boot_offset_us < last_us) {
+                // The uptime went back, the board was reset
+                boot_offset_us = last_us + BOOT_JOIN_US - sync.uptime_us;
+                line.clear();
+            }
+            synced = true;
+            sync_uptime_us = sync.uptime_us;
+            sync_time_us = sync.time_us;
+        }
+        if (!synced) {
+            // The oldest entries of a wrapped pool come before their sync entry
+            unsynced++;
+            continue;
+        }
+
+        uint64_t now_us = sync_uptime_us + (uint32_t)(time_us - sync_time_us) + boot_offset_us;
+        if (!started) {
+            first_us = now_us;
+            started = true;
+        }
+        last_us = now_us;
+        uint64_t now_ms = (now_us - first_us) / 1000;
+
+        // Frames read in the same ms share a row
+        if (row.pending && row.time_ms != now_ms) {
+            writeRow(csv, row);
+            row.pending = false;
+            rows++;
+        }
+
+        switch (entry.type) {
+        case CAPTURE_GPS:
+            for (uint32_t i = 0; i < size; i++) {
+                char c = (char)data[i];
+                if (c == '\n') {
+                    // Fragments from before the capture started are dropped
+                    if (!line.empty() && line[0] == '$') {
+                        fprintf(nmea, "%" PRIu64 " %s\n", line_ms, line.c_str());
+                        sentences++;
+                    }
+                    line.clear();
+                } else if (c != '\r') {
+                    if (line.empty()) {
+                        line_ms = now_ms;
+                    }
+                    line += c;
+                }
+            }
+            continue;
+
+        case CAPTURE_GAP:
+            // Bytes of the open sentence are missing
+            line.clear();
+            gaps++;
+            continue;
+
+        case CAPTURE_BME688_CALIB:
+            if (size >= BME68X_LEN_COEFF_ALL + 1) {
+                memcpy(&bme_registers[BME68X_REG_COEFF1], data, BME68X_LEN_COEFF1);
+                memcpy(&bme_registers[BME68X_REG_COEFF2], data + BME68X_LEN_COEFF1, BME68X_LEN_COEFF2);
+                memcpy(&bme_registers[BME68X_REG_COEFF3], data + BME68X_LEN_COEFF1 + BME68X_LEN_COEFF2,
+                       BME68X_LEN_COEFF3);
+                bme_registers[BME68X_REG_CHIP_ID] = BME68X_CHIP_ID;
+                bme_registers[BME68X_REG_VARIANT_ID] = data[BME68X_LEN_COEFF_ALL];
+                bme_calibrated = bme68x_init(&bme) == BME68X_OK;
+            }
+            continue;
+
+        case CAPTURE_BME688: {
+            if (!bme_calibrated || size < BME68X_LEN_FIELD) {
+                continue;
+            }
+            memcpy(&bme_registers[BME68X_REG_FIELD0], data, BME68X_LEN_FIELD);
+            struct bme68x_data field = {};
+            uint8_t fields = 0;
+            if (bme68x_get_data(BME68X_FORCED_MODE, &field, &fields, &bme) != BME68X_OK || fields == 0) {
+                continue;
+            }
+            // Same units as BME688::readData()
+            row.set(COL_TEMP, field.temperature);
+            row.set(COL_HUM, field.humidity);
+            row.set(COL_PRES, field.pressure / 100.0);
+            row.set(COL_GAS_RES, field.gas_resistance);
+            break;
+        }
+
+        case CAPTURE_HM3301: {
+            if (size < 12) {
+                continue;
+            }
+            uint16_t pm1_0 = (uint16_t)(data[6] << 8 | data[7]);
+            row.set(COL_PM1_0, pm1_0);
+            row.set(COL_PM2_5, (uint16_t)(data[8] << 8 | data[9]));
+            row.set(COL_PM5, pm1_0);  // Same as the firmware, which sends PM1.0 as pm5
+            row.set(COL_PM10, (uint16_t)(data[10] << 8 | data[11]));
+            break;
+        }
+
+        case CAPTURE_PAS_CO2: {
+            if (size < 3) {
+                continue;
+            }
+            // Pas_co2::read() only takes fresh readings in range, otherwise it keeps the last one
+            uint32_t ppm = (uint32_t)data[1] << 8 | data[2];
+            if ((data[0] & 0x10) && ppm >= 400 && ppm <= 10000) {
+                row.set(COL_CO2, ppm);
+            }
+            break;
+        }
+
+        default:
+            continue;
+        }
+
+        row.pending = true;
+        row.time_ms = now_ms;
+    }
+    if (row.pending) {
+        writeRow(csv, row);
+        rows++;
+    }
+
+    fclose(nmea);
+    fclose(csv);
+
+    printf("CAPTURE: Pool at 0x%08x (%lu sectors), %lu entries, %lu skipped, %lu before the first sync\n",
+           (unsigned int)address, (unsigned long)sectors, (unsigned long)stream.getEntryCount(),
+           (unsigned long)cursor.skippedCount(), (unsigned long)unsynced);
+    printf("CAPTURE: %lu sentences to %s, %lu sensor rows to %s, %lu gaps, %.1f s\n",
+           (unsigned long)sentences, nmea_path.c_str(), (unsigned long)rows, csv_path.c_str(),
+           (unsigned long)gaps, started ? (last_us - first_us) / 1e6 : 0.0);
+    if (!bme_calibrated) {
+        printf("CAPTURE WARNING: No BME688 calibration in the capture, BME688 frames were skipped\n");
+    }
+    return 0;
+}
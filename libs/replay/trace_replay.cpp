@@ -0,0 +1,384 @@
+#include "trace_replay.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "libs/gps/nmea_parser.h"
+#include "pico/stdlib.h"
+
+#define MS_PER_DAY (24u * 60u * 60u * 1000u)
+
+// Epochs further apart than this are a gap in the recording or a day change we can't
+// tell, they are replayed one second apart
+#define REPLAY_MAX_EPOCH_GAP_MS (60u * 60u * 1000u)
+#define REPLAY_DEFAULT_EPOCH_MS 1000
+
+// Columns of a sensor trace
+#define SENSOR_COLUMN_TEMP        0
+#define SENSOR_COLUMN_HUM         1
+#define SENSOR_COLUMN_PRES        2
+#define SENSOR_COLUMN_GAS_RES     3
+#define SENSOR_COLUMN_PM1_0       4
+#define SENSOR_COLUMN_PM2_5       5
+#define SENSOR_COLUMN_PM5         6
+#define SENSOR_COLUMN_PM10        7
+#define SENSOR_COLUMN_CO2         8
+#define SENSOR_COLUMN_BATTERY_MV  9
+#define SENSOR_COLUMN_COUNT       SENSOR_TRACE_COLUMNS
+#define SENSOR_COLUMN_TIME        -1
+#define SENSOR_COLUMN_IGNORED     -2
+
+static const char *sensor_column_names[SENSOR_COLUMN_COUNT] = {
+    "temp", "hum", "pres", "gas_res", "pm1_0", "pm2_5", "pm5", "pm10", "co2", "battery_mv"
+};
+
+static bool readFile(const char *path, std::string &text) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        printf("REPLAY WARNING: Cannot open %s\n", path);
+        return false;
+    }
+
+    char buffer[4096];
+    size_t size;
+    text.clear();
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, size);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+// Call line(start, length) for every line of text, without the line end
+template <typename Func>
+static void forEachLine(const std::string &text, Func line) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        size_t length = end - pos;
+        if (length > 0 && text[pos + length - 1] == '\r') {
+            length--;
+        }
+        line(text.c_str() + pos, length);
+        pos = end + 1;
+    }
+}
+
+ReplayClock::ReplayClock(double speed) : _speed(speed) {
+    _host_start_ms = hostMs();
+}
+
+uint64_t ReplayClock::hostMs() const {
+    return time_us_64() / 1000;
+}
+
+uint64_t ReplayClock::nowMs() {
+    return _base_ms + (uint64_t)((hostMs() - _host_start_ms) * _speed);
+}
+
+void ReplayClock::advance(uint64_t ms) {
+    _base_ms += ms;
+}
+
+void ReplayClock::setSpeed(double speed) {
+    // Keep the current trace time, only the rate changes
+    _base_ms = nowMs();
+    _host_start_ms = hostMs();
+    _speed = speed;
+}
+
+NmeaTraceReplay::NmeaTraceReplay(ReplayClock &clock, uint32_t baud_rate)
+    : _clock(clock), _baud_rate(baud_rate) {
+}
+
+bool NmeaTraceReplay::load(const char *path) {
+    std::string text;
+    if (!readFile(path, text)) {
+        return false;
+    }
+    if (!loadText(text)) {
+        printf("REPLAY WARNING: No NMEA sentences in %s\n", path);
+        return false;
+    }
+    printf("REPLAY: %lu sentences, %llu s of GPS data from %s\n", (unsigned long)_entries.size(),
+           (unsigned long long)(_lap_ms / 1000), path);
+    return true;
+}
+
+bool NmeaTraceReplay::loadText(const std::string &text) {
+    NmeaParser parser;
+    uint64_t time_ms = 0;               // Receive time of the current line
+    uint64_t first_ms = 0;
+    int64_t epoch_tod = -1;             // UTC time of day of the current epoch
+    uint64_t free_ms = 0;               // End of the previous sentence at the baud rate
+
+    _stream.clear();
+    _entries.clear();
+    forEachLine(text, [&](const char *line, size_t length) {
+        if (length == 0 || line[0] == '#') {
+            return;
+        }
+
+        // Recorded receive time in front of the sentence
+        const char *sentence = line;
+        if (line[0] >= '0' && line[0] <= '9') {
+            char *end;
+            uint64_t recorded_ms = strtoull(line, &end, 10);
+            while (end < line + length && *end == ' ') {
+                end++;
+            }
+            if (end < line + length && end > line && end[-1] == ' ') {
+                time_ms = std::max(time_ms, recorded_ms);
+                sentence = end;
+            }
+        }
+        size_t sentence_length = line + length - sentence;
+
+        // Otherwise a new UTC time starts the next epoch
+        if (sentence == line) {
+            // The sentence is complete after its checksum, before the line end
+            parser.reset();
+            if (parser.feed(sentence, sentence_length) > 0) {
+                const NmeaSentence &decoded = parser.sentence();
+                if (decoded.time_valid && decoded.type != NMEA_SENTENCE_UNKNOWN) {
+                    int64_t tod = ((decoded.hour * 60 + decoded.minute) * 60 + decoded.second) * 1000 +
+                                  decoded.millisecond;
+                    if (epoch_tod >= 0 && tod != epoch_tod) {
+                        uint64_t gap = (tod - epoch_tod + MS_PER_DAY) % MS_PER_DAY;
+                        time_ms += gap <= REPLAY_MAX_EPOCH_GAP_MS ? gap : REPLAY_DEFAULT_EPOCH_MS;
+                    }
+                    epoch_tod = tod;
+                }
+            }
+        }
+
+        if (_entries.empty()) {
+            first_ms = time_ms;
+        }
+        Entry entry;
+        entry.start_ms = std::max(time_ms - first_ms, free_ms);
+        entry.offset = _stream.size();
+        entry.length = sentence_length + 2;
+        _stream.append(sentence, sentence_length);
+        _stream.append("\r\n");
+        _entries.push_back(entry);
+
+        // 10 bits per byte on the UART (start, 8 data, stop)
+        free_ms = entry.start_ms;
+        if (_baud_rate > 0) {
+            free_ms += (entry.length * 10000ull + _baud_rate - 1) / _baud_rate;
+        }
+    });
+
+    if (_entries.empty()) {
+        return false;
+    }
+
+    // The next pass starts one epoch after the last sentence
+    _lap_ms = free_ms + REPLAY_DEFAULT_EPOCH_MS;
+    rewind();
+    return true;
+}
+
+uint64_t NmeaTraceReplay::dueBytes(uint64_t t) const {
+    uint64_t laps = 0;
+    if (_loop) {
+        laps = t / _lap_ms;
+        t %= _lap_ms;
+    }
+
+    // Last sentence started by t
+    auto next = std::upper_bound(_entries.begin(), _entries.end(), t,
+                                 [](uint64_t time, const Entry &entry) { return time < entry.start_ms; });
+    uint64_t due = laps * _stream.size();
+    if (next == _entries.begin()) {
+        return due;
+    }
+    const Entry &entry = *(next - 1);
+    uint64_t sent = entry.length;
+    if (_baud_rate > 0) {
+        sent = std::min<uint64_t>(sent, (t - entry.start_ms) * _baud_rate / 10000 + 1);
+    }
+    return due + entry.offset + sent;
+}
+
+uint32_t NmeaTraceReplay::available() {
+    if (_entries.empty()) {
+        return 0;
+    }
+    _due = dueBytes(_clock.nowMs() - _start_ms);
+    return _due - _read > UINT32_MAX ? UINT32_MAX : _due - _read;
+}
+
+char NmeaTraceReplay::getc() {
+    if (_read >= _due) {
+        return 0;
+    }
+    return _stream[_read++ % _stream.size()];
+}
+
+void NmeaTraceReplay::rewind() {
+    _start_ms = _clock.nowMs();
+    _read = 0;
+    _due = 0;
+}
+
+bool NmeaTraceReplay::finished() {
+    return !_loop && _read >= _stream.size();
+}
+
+// Store the value of a column in data
+static void setSensorColumn(SensorData &data, int column, double value) {
+    switch (column) {
+        case SENSOR_COLUMN_TEMP:       data.temp = value; break;
+        case SENSOR_COLUMN_HUM:        data.hum = value; break;
+        case SENSOR_COLUMN_PRES:       data.pres = value; break;
+        case SENSOR_COLUMN_GAS_RES:    data.gasRes = value; break;
+        case SENSOR_COLUMN_PM1_0:      data.pm1_0 = value; break;
+        case SENSOR_COLUMN_PM2_5:      data.pm2_5 = value; break;
+        case SENSOR_COLUMN_PM5:        data.pm5 = value; break;
+        case SENSOR_COLUMN_PM10:       data.pm10 = value; break;
+        case SENSOR_COLUMN_CO2:        data.co2 = value; break;
+        case SENSOR_COLUMN_BATTERY_MV: data.battery_mv = value; break;
+    }
+}
+
+SensorTraceReplay::SensorTraceReplay(ReplayClock &clock) : _clock(clock) {
+}
+
+bool SensorTraceReplay::load(const char *path) {
+    std::string text;
+    if (!readFile(path, text)) {
+        return false;
+    }
+    if (!loadText(text)) {
+        printf("REPLAY WARNING: No sensor readings in %s\n", path);
+        return false;
+    }
+    printf("REPLAY: %lu readings, %llu s of sensor data from %s\n", (unsigned long)_samples.size(),
+           (unsigned long long)(_lap_ms / 1000), path);
+    return true;
+}
+
+bool SensorTraceReplay::loadText(const std::string &text) {
+    std::vector<int> columns;           // SENSOR_COLUMN_* of each cell, empty until the header
+    bool has_time = false;
+    uint64_t first_ms = 0;
+
+    _samples.clear();
+    forEachLine(text, [&](const char *line, size_t length) {
+        if (length == 0 || line[0] == '#') {
+            return;
+        }
+
+        // Split the line at the commas
+        std::vector<std::string> cells;
+        const char *end = line + length;
+        for (const char *cell = line; cell <= end; ) {
+            const char *comma = std::find(cell, end, ',');
+            cells.emplace_back(cell, comma);
+            cell = comma + 1;
+        }
+
+        if (columns.empty()) {
+            for (const std::string &name : cells) {
+                int column = SENSOR_COLUMN_IGNORED;
+                if (name == "time_ms") {
+                    column = SENSOR_COLUMN_TIME;
+                    has_time = true;
+                }
+                for (int i = 0; i < SENSOR_COLUMN_COUNT; i++) {
+                    if (name == sensor_column_names[i]) {
+                        column = i;
+                    }
+                }
+                columns.push_back(column);
+            }
+            return;
+        }
+
+        Sample sample;
+        sample.time_ms = 0;
+        sample.columns = 0;
+        bool has_sample_time = false;
+        for (size_t i = 0; i < cells.size() && i < columns.size(); i++) {
+            if (columns[i] == SENSOR_COLUMN_TIME) {
+                char *time_end;
+                sample.time_ms = strtoull(cells[i].c_str(), &time_end, 10);
+                has_sample_time = time_end != cells[i].c_str();
+            } else if (columns[i] >= 0) {
+                char *value_end;
+                sample.values[columns[i]] = strtod(cells[i].c_str(), &value_end);
+                if (value_end != cells[i].c_str()) {
+                    sample.columns |= 1u << columns[i];
+                }
+            }
+        }
+        if (!has_sample_time) {
+            return;
+        }
+
+        // Readings are kept in time order from the start of the recording
+        if (_samples.empty()) {
+            first_ms = sample.time_ms;
+        }
+        sample.time_ms = sample.time_ms > first_ms ? sample.time_ms - first_ms : 0;
+        if (!_samples.empty() && sample.time_ms < _samples.back().time_ms) {
+            sample.time_ms = _samples.back().time_ms;
+        }
+        _samples.push_back(sample);
+    });
+
+    if (!has_time || _samples.empty()) {
+        _samples.clear();
+        return false;
+    }
+
+    // The next pass starts one sample interval after the last reading
+    uint64_t interval = REPLAY_DEFAULT_EPOCH_MS;
+    if (_samples.size() > 1) {
+        interval = std::max<uint64_t>(1, _samples.back().time_ms - _samples[_samples.size() - 2].time_ms);
+    }
+    _lap_ms = _samples.back().time_ms + interval;
+    rewind();
+    return true;
+}
+
+bool SensorTraceReplay::read(SensorData &data) {
+    if (_samples.empty()) {
+        return false;
+    }
+    uint64_t t = _clock.nowMs() - _start_ms;
+    if (_loop) {
+        t %= _lap_ms;
+    } else if (t >= _lap_ms) {
+        return false;
+    }
+
+    // Last reading taken by t
+    auto next = std::upper_bound(_samples.begin(), _samples.end(), t,
+                                 [](uint64_t time, const Sample &sample) { return time < sample.time_ms; });
+    if (next == _samples.begin()) {
+        return false;
+    }
+    const Sample &sample = *(next - 1);
+
+    for (int i = 0; i < SENSOR_COLUMN_COUNT; i++) {
+        if (sample.columns & (1u << i)) {
+            setSensorColumn(data, i, sample.values[i]);
+        }
+    }
+    return true;
+}
+
+void SensorTraceReplay::rewind() {
+    _start_ms = _clock.nowMs();
+}
+
+bool SensorTraceReplay::finished() {
+    return !_loop && (_samples.empty() || _clock.nowMs() - _start_ms >= _lap_ms);
+}
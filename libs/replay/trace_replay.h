@@ -0,0 +1,142 @@
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "libs/gps/nmea_source.h"
+#include "libs/flash/flash.h"
+
+// Sensor values a trace can hold (the columns after time_ms)
+#define SENSOR_TRACE_COLUMNS 10
+
+// Replay of recorded rides for host builds (reads files, times with the SDK clock). The GPS
+// trace is fed to myGPS through setSource(), the sensor trace replaces the driver
+// readings, so the storage and upload code sees the input of a real ride.
+
+// Trace time of a replay. Runs at speed times the SDK clock (time_us_64), the clock myGPS
+// and the firmware read. With speed 1 trace and board time stay in step, so fix ages and
+// timeouts see the timing of the recording: on the simulated host clock the ride then
+// replays as fast as the loop sleeps, on the real clock in real time. Other speeds and
+// advance() move only the trace, with speed 0 it only moves with advance().
+class ReplayClock {
+public:
+    explicit ReplayClock(double speed = 1.0);
+
+    // Trace time in ms since the clock was created
+    uint64_t nowMs();
+
+    // Move the trace time forward, in addition to the running clock
+    void advance(uint64_t ms);
+
+    void setSpeed(double speed);
+    double speed() const { return _speed; }
+
+private:
+    uint64_t hostMs() const;
+
+    double _speed;
+    uint64_t _base_ms = 0;              // Trace time at _host_start_ms (SDK clock)
+    uint64_t _host_start_ms;
+};
+
+// Plays a recorded NMEA log back as the byte stream of myGPS.
+//
+// Each line is one sentence as received, optionally preceded by the time it arrived in
+// ms since the start of the recording ("1520 $GNRMC,..."). Lines without a time are
+// grouped into epochs by the UTC time of their RMC, GGA and GLL sentences, each epoch is
+// due as long after the previous one as their times differ. Empty lines and lines
+// starting with # are skipped, anything else is replayed unchanged, including sentences
+// with a bad checksum. The bytes of a sentence arrive at the baud rate, so the parser sees
+// partial sentences and gaps like on the UART.
+class NmeaTraceReplay : public NmeaSource {
+public:
+    // baud_rate 0 delivers each sentence at once
+    NmeaTraceReplay(ReplayClock &clock, uint32_t baud_rate = 9600);
+
+    // Load a trace file, replay starts at the current clock time. Returns false if the
+    // file can't be read or holds no sentence.
+    bool load(const char *path);
+    bool loadText(const std::string &text);
+
+    uint32_t available() override;
+    char getc() override;
+
+    // Start over at the current clock time
+    void rewind();
+
+    // Play the trace again after its end, for soak tests longer than the recording
+    void setLoop(bool loop) { _loop = loop; }
+
+    // Every byte was delivered (never with setLoop(true))
+    bool finished();
+
+    uint64_t durationMs() const { return _lap_ms; }
+    size_t sentenceCount() const { return _entries.size(); }
+    uint64_t bytesDelivered() const { return _read; }
+
+private:
+    struct Entry {
+        uint64_t start_ms;              // First byte due, from the start of the trace
+        uint32_t offset;                // In _stream
+        uint32_t length;                // Including CR LF
+    };
+
+    // Bytes of the stream due at trace time t (from the start of the replay)
+    uint64_t dueBytes(uint64_t t) const;
+
+    ReplayClock &_clock;
+    uint32_t _baud_rate;
+    std::string _stream;                // Sentences with CR LF, as sent by the receiver
+    std::vector<Entry> _entries;
+    uint64_t _lap_ms = 0;               // Length of one pass, the next one starts after it
+    uint64_t _start_ms = 0;             // Clock time the replay started
+    uint64_t _read = 0;                 // Bytes taken by getc(), over all passes
+    uint64_t _due = 0;                  // Bytes due at the last available() call
+    bool _loop = false;
+};
+
+// Plays recorded sensor readings back in place of the sensor drivers. The trace is a CSV
+// file with a header line naming the columns, lines starting with # are comments:
+//
+//   time_ms,temp,hum,pres,gas_res,pm1_0,pm2_5,pm5,pm10,co2,battery_mv
+//   0,21.4,45.2,981.2,51200,3,5,7,9,612,3980
+//
+// time_ms (ms since the start of the recording) is required, the other columns are
+// optional and may come in any order. Unknown columns and empty cells are ignored.
+class SensorTraceReplay {
+public:
+    explicit SensorTraceReplay(ReplayClock &clock);
+
+    // Load a trace file, replay starts at the current clock time. Returns false if the
+    // file can't be read, has no time_ms column or no readings.
+    bool load(const char *path);
+    bool loadText(const std::string &text);
+
+    // Set the sensor fields of data to the last reading due at the current trace time.
+    // Position, time and status are left alone. Returns false before the first reading
+    // and after the end of a trace that does not loop.
+    bool read(SensorData &data);
+
+    void rewind();
+    void setLoop(bool loop) { _loop = loop; }
+    bool finished();
+
+    uint64_t durationMs() const { return _lap_ms; }
+    size_t sampleCount() const { return _samples.size(); }
+
+private:
+    struct Sample {
+        uint64_t time_ms;
+        uint32_t columns;               // Bits of the cells that were set
+        double values[SENSOR_TRACE_COLUMNS];   // By SENSOR_COLUMN_*
+    };
+
+    ReplayClock &_clock;
+    std::vector<Sample> _samples;
+    uint64_t _lap_ms = 0;
+    uint64_t _start_ms = 0;
+    bool _loop = false;
+};
+
+#endif // TRACE_REPLAY_H
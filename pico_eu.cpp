@@ -26,6 +26,15 @@
 // Set to 1 to enable fake GPS data (for indoor testing)
 #define USE_FAKE_GPS 0
 
+// Set to 1 to switch u-blox receivers to binary UBX NAV-PVT (others stay on NMEA)
+#define GPS_USE_UBX 1
+
+// GPS UART rate after startup, the receiver starts at UART0_BAUD_RATE (9600). RAW_CAPTURE keeps the defaults.
+#define GPS_BAUD_RATE 115200
+
+// Position fixes per second, more than 1 needs the faster UART
+#define GPS_NAV_RATE_HZ 5
+
 // Debug helper defines to identify where code is getting stuck
 #define DEBUG_POINT(name) printf("DEBUG [%8lu ms]: %s\n", to_ms_since_boot(get_absolute_time()), name)
 #define DEBUG_LOOP_COUNT(var) static uint32_t var = 0; printf("DEBUG [%8lu ms]: Loop %s count %lu\n", to_ms_since_boot(get_absolute_time()), #var, ++var)
@@ -49,12 +58,18 @@ void check_for_hang();
 #include "libs/bme688/bme688.h"
 #include "libs/pas_co2/pas_co2.h"
 #include "libs/adc/adc.h"
+#include "libs/adc/power_monitor.h"
 #include "libs/wifi/wifi.h"
 #include "libs/eInk/GUI/GUI_Paint.h"
 #include "libs/eInk/EPD_1in54_V2/EPD_1in54_V2.h"
 #include "libs/eInk/Fonts/fonts.h"
 #include "libs/gps/myGPS.h"
 #include "libs/flash/flash.h"
+#include "libs/flash/flash_writer.h"
+#include "libs/flash/flash_bulk_reader.h"
+#include "libs/flash/aggregate_log.h"
+#include "libs/flash/event_log.h"
+#include "libs/flash/raw_capture.h"
 #include <cstdio>
 
 // Add this with other defines at the top of the file
@@ -90,7 +105,6 @@ void set_system_time(time_t new_time) {
 #define BME688_ADDRESS 0x76
 #define PAS_CO2_ADDRESS 0x28
 #define ADC 26
-#define FLASH_TARGET_OFFSET (1792 * 1024)  // 1.8MB offset in 2MB flash
 
 // GPIO for button control
 #define TASTER_COUNT 2  // Changed back to 2 buttons
@@ -127,6 +141,30 @@ void set_system_time(time_t new_time) {
 #define UPLOAD_ALL_AT_ONCE 1  
 // Maximum number of records per batch when using bulk upload
 #define UPLOAD_MAX_BATCH_SIZE 5  // Changed from 1 to 5 to upload 5 measurements per chunk
+// Set to 1 to hold records with a poor GPS fix back from the upload (they stay in flash)
+#define UPLOAD_DROP_POOR_FIXES 1
+#define UPLOAD_MAX_HDOP 500              // HDOP * 100, above 5 the position is too inaccurate for a street
+#define UPLOAD_MIN_SATELLITES_USED 4     // Fewer satellites than this give no reliable 3D fix
+
+// What happens to records that were not uploaded yet when flash storage wraps around
+#define FLASH_RETENTION_POLICY FLASH_RETENTION_OVERWRITE_OLDEST
+// Request an upload once this share of flash storage holds records that were not uploaded
+#define FLASH_HIGH_WATERMARK_PERCENT 80
+// Set to 1 to store new records delta encoded (about 3x more records, floats rounded to 0.01)
+#define FLASH_COMPRESSED_RECORDS 1
+// Sector pools of the aggregate and event streams, placed at the end of flash above the raw record journal
+#define FLASH_AGGREGATE_SECTORS 8   // About 14 hours of per-minute aggregates
+#define FLASH_EVENT_SECTORS 4       // About 780 events
+// Set to 1 to record raw GPS bytes and sensor frames into their own stream, converted to replay
+// traces by libs/replay/capture_to_replay.cpp. The capture pool is taken from the record journal
+// when the storage is formatted. A journal formatted without it keeps its records and its size,
+// the capture only starts on the boot after the storage was erased (refresh button at the startup prompt).
+#define RAW_CAPTURE 0
+#if RAW_CAPTURE
+#define FLASH_CAPTURE_SECTORS 64    // 256 KB, about 5-8 minutes of 1 Hz NMEA at 9600 baud (the GPS stays at that rate)
+#else
+#define FLASH_CAPTURE_SECTORS 0
+#endif
 
 // Add bike mode constant to make it clear this is a bike-specific configuration
 #define BIKE_MODE 1
@@ -144,7 +182,6 @@ int dataCollectionInterval = refreshInterval;
 // This is ideal for bike usage to capture frequent environmental changes
 const int DATA_COLLECTION_MULTIPLIER = 1;  // Collect data at same rate as display refresh
 
-const uint8_t *flash_target_contents = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET);
 UBYTE *ImageBuffer;
 UWORD Imagesize = ((EPD_1IN54_V2_WIDTH % 8 == 0) ? (EPD_1IN54_V2_WIDTH / 8) : (EPD_1IN54_V2_WIDTH / 8 + 1)) * EPD_1IN54_V2_HEIGHT;
 
@@ -161,6 +198,12 @@ int refresh_counter = 0;     // Counter to track when to do a full refresh
 
 myWIFI wifi;
 myADC batteryADC(ADC, 10);
+PowerMonitor power_monitor(batteryADC);  // Watches the battery for a collapsing supply
+
+// Time the emergency flush may spend on the flash writer queue before data_buffer is saved
+#define EMERGENCY_FLUSH_BUDGET_MS 150
+// Steps of sleepCheckingBrownout(), the longest a brownout waits during those sleeps
+#define BROWNOUT_CHECK_STEP_MS 50
 HM3301 hm3301_sensor(I2C_PORT, HM3301_ADDRESS, I2C_SDA, I2C_SCL);
 BME688 bme688_sensor(I2C_PORT, BME688_ADDRESS, I2C_SDA, I2C_SCL);
 Pas_co2 pas_co2_sensor(PAS_CO2_ADDRESS, I2C_PORT);
@@ -189,7 +232,22 @@ float batteryLevel = 0;
 extern "C" bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char const* server, char const* request, int timeout);
 
 // After other variable declarations, add:
-Flash flash_storage;  // Create flash storage object
+Flash flash_storage(0, nullptr, FLASH_AGGREGATE_SECTORS + FLASH_EVENT_SECTORS + FLASH_CAPTURE_SECTORS);  // All flash after the firmware image
+FlashWriter flash_writer(flash_storage);  // Writes saved batches from the main loop without blocking it
+
+// Streams next to the raw records, each in its own sector pool at the end of flash.
+// Placed again after flash_storage.init(), the pools follow the region end in use.
+FlashStream aggregate_stream("aggregates", FLASH_STREAM_AGGREGATES,
+                             flash_storage.getRegionEnd(), FLASH_AGGREGATE_SECTORS);
+FlashStream event_stream("events", FLASH_STREAM_EVENTS,
+                         aggregate_stream.endAddress(), FLASH_EVENT_SECTORS);
+FlashStream capture_stream("capture", FLASH_STREAM_CAPTURE,
+                           event_stream.endAddress(), FLASH_CAPTURE_SECTORS);
+AggregateLog aggregate_log(aggregate_stream);  // Per-minute aggregates of the readings
+EventLog event_log(event_stream);              // Uploads, GPS fix changes, resets, brownouts
+#if RAW_CAPTURE
+RawCapture raw_capture(capture_stream);        // Raw GPS bytes and sensor frames, about 6 KB of RAM
+#endif
 absolute_time_t last_flash_write_time;  // For timing flash writes
 bool flash_initialized = false;
 
@@ -203,6 +261,7 @@ void displayUploadStatus(const char* msg);
 void displayPage(int page, absolute_time_t gps_start_time, int fix_status, int satellites_visible, bool is_fake_gps);
 void forceDisplayRefresh();
 void debugPrintJSON(const char* json_data, size_t max_length);
+void pollGps();
 
 // Simple version of displayPage that just clears the screen - used by displayYesNo
 void displayPage(int page) {
@@ -587,6 +646,7 @@ void displayGPSStatus(absolute_time_t gps_start_time, int fix_status, int satell
     } else {
         EPD_1IN54_V2_Display(ImageBuffer);
     }
+    pollGps();
 }
 
 // Modify the displayPage function to include timing information
@@ -702,6 +762,11 @@ void displayPage(int page, absolute_time_t gps_start_time, int fix_status, int s
         Paint_DrawString_EN(10, 170, "Fast refresh:", &Font12, BLACK, WHITE);
         Paint_DrawString_EN(90, 170, fast_refresh_enabled ? "ON" : "OFF", &Font12, BLACK, WHITE);
 
+        // Flash wear: erase cycles of the most worn sector and write amplification
+        FlashWearStats wear = flash_storage.getStats();
+        sprintf(buffer, "Wear %lu WA %.2f", (unsigned long)wear.max_erase_count, wear.write_amplification);
+        Paint_DrawString_EN(10, 185, buffer, &Font12, BLACK, WHITE);
+
         printf("Displayed Page 4: Settings.\n");
     }
 
@@ -740,6 +805,7 @@ void displayPage(int page, absolute_time_t gps_start_time, int fix_status, int s
         printf("DISPLAY_TIMING: Calling EPD_1IN54_V2_Display\n");
         EPD_1IN54_V2_Display(ImageBuffer);
     }
+    pollGps();
     
     uint32_t end_time = to_ms_since_boot(get_absolute_time());
     printf("DISPLAY_TIMING [%8lu ms]: displayPage completed in %lu ms (display update: %lu ms)\n", 
@@ -767,6 +833,7 @@ void displayUploadStatus(const char* message) {
     
     // For upload status, always use full refresh for reliability
     EPD_1IN54_V2_Display(ImageBuffer);
+    pollGps();
     
     // After important messages, reset the fast refresh state
     if (fast_refresh_enabled) {
@@ -900,6 +967,27 @@ void refreshDisplay_Settings_Button(int page) {
     }
 }
 
+// Whether a record was taken with a fix too poor to place it on the map (urban canyons,
+// shortly after the fix was acquired). Records written before the fix quality was stored
+// have no quality information and are kept.
+bool isPoorFix(const SensorData& data) {
+    if (data.is_fake_gps) {
+        return false;
+    }
+    if (data.fix_type == GPS_FIX_TYPE_NONE) {
+        return true;
+    }
+    if (data.hdop > UPLOAD_MAX_HDOP) {
+        return true;
+    }
+    return data.fix_type != GPS_FIX_TYPE_UNKNOWN && data.satellites_used < UPLOAD_MIN_SATELLITES_USED;
+}
+
+// Upload filter of the flash storage, records with a poor fix are held back
+bool hasUploadableFix(const SensorData& data) {
+    return !isPoorFix(data);
+}
+
 // Add this function to format the data as JSON
 void prepareDataForTransmission(const SensorData& data, char* json_buffer, size_t buffer_size) {
     snprintf(json_buffer, buffer_size,
@@ -918,7 +1006,7 @@ void prepareDataForTransmission(const SensorData& data, char* json_buffer, size_
 }
 
 // Format multiple sensor data records as a JSON array for transmission
-void prepareBatchDataForTransmission(const std::vector<SensorData>& data_vec, char* json_buffer, size_t buffer_size, myGPS& gps) {
+void prepareBatchDataForTransmission(const SensorData* records, size_t record_count, char* json_buffer, size_t buffer_size, myGPS& gps) {
     if (!json_buffer || buffer_size < 100) {
         printf("[UPLOAD] ERROR: Invalid buffer provided for JSON data\n");
         if (json_buffer && buffer_size > 0) {
@@ -928,7 +1016,7 @@ void prepareBatchDataForTransmission(const std::vector<SensorData>& data_vec, ch
     }
     
     // Track how many records we've processed and will process
-    size_t total_records = data_vec.size();
+    size_t total_records = record_count;
     if (total_records == 0) {
         printf("[UPLOAD] ERROR: No records provided for transmission\n");
         json_buffer[0] = '\0';
@@ -989,7 +1077,9 @@ void prepareBatchDataForTransmission(const std::vector<SensorData>& data_vec, ch
     // Process each record
     size_t processed_count = 0;
     
-    for (const auto& data : data_vec) {
+    for (size_t record_index = 0; record_index < record_count; record_index++) {
+        const SensorData& data = records[record_index];
+        
         // Check if we have enough space for a record (approximate estimate)
         if (remaining < 400) {
             printf("[UPLOAD] WARNING: Buffer approaching capacity - truncating to %lu/%lu records\n", 
@@ -1095,17 +1185,34 @@ void prepareBatchDataForTransmission(const std::vector<SensorData>& data_vec, ch
     }
 }
 
+// Place the stream pools after the journal region and read their state. A region formatted
+// with other pool sizes keeps its end, the pools start there.
+void initStreamPools() {
+    aggregate_stream.setPool(flash_storage.getRegionEnd(), FLASH_AGGREGATE_SECTORS);
+    event_stream.setPool(aggregate_stream.endAddress(), FLASH_EVENT_SECTORS);
+    capture_stream.setPool(event_stream.endAddress(), FLASH_CAPTURE_SECTORS);
+    // Nothing uploads these pools, they keep the newest entries
+    aggregate_stream.setUploadTracking(false);
+    event_stream.setUploadTracking(false);
+    capture_stream.setUploadTracking(false);
+    aggregate_stream.init();
+    event_stream.init();
+}
+
 // Save the data buffer before sleeping
 void saveBufferBeforeSleep() {
+    // Records still queued in the writer go first to keep the order
+    if (!flash_writer.flush()) {
+        printf("ERROR: Failed to write queued records before sleep\n");
+    }
+    aggregate_log.flush();
+    
     if (buffer_modified && !data_buffer.empty()) {
         printf("Saving buffer data before sleep (%d entries)\n", data_buffer.size());
         
-        // Save each buffered entry to flash
-        for (const auto& buffered_data : data_buffer) {
-            if (!flash_storage.saveSensorData(buffered_data)) {
-                printf("ERROR: Failed to save data before sleep\n");
-                break;
-            }
+        // Save all buffered entries to flash in one batch
+        if (!flash_storage.saveSensorDataBatch(data_buffer)) {
+            printf("ERROR: Failed to save data before sleep\n");
         }
         
         printf("Buffer saved. Total records: %lu\n", flash_storage.getStoredCount());
@@ -1114,6 +1221,85 @@ void saveBufferBeforeSleep() {
     }
 }
 
+// Write everything held in RAM when the supply collapses. The writer queue gets a
+// bounded time. data_buffer (the newest, never queued records) is saved after it, or
+// queued behind it if the queue was not written in time, so records stay in order.
+void emergencyFlush() {
+    uint64_t start_us = time_us_64();
+    size_t queued = flash_writer.queuedCount();
+    size_t buffered = data_buffer.size();
+    
+    printf("BROWNOUT: Supply at %.2f V - emergency flush of %lu queued and %lu buffered records\n",
+           power_monitor.getVoltage(), (unsigned long)queued, (unsigned long)buffered);
+    
+    bool drained = flash_writer.flush(EMERGENCY_FLUSH_BUDGET_MS * 1000);
+    if (!drained) {
+        printf("BROWNOUT: Writer queue not fully written (%lu records left)\n",
+               (unsigned long)flash_writer.queuedCount());
+    }
+    
+    if (!data_buffer.empty()) {
+        if (!drained) {
+            // Saving it directly would put it in front of the older queued records
+            if (flash_writer.enqueue(data_buffer)) {
+                flash_writer.commit();
+                data_buffer.clear();
+                buffer_modified = false;
+            } else {
+                printf("BROWNOUT: Writer full, %lu buffered records stay in RAM\n", (unsigned long)data_buffer.size());
+            }
+        } else if (flash_storage.saveSensorDataBatch(data_buffer)) {
+            data_buffer.clear();
+            buffer_modified = false;
+        } else {
+            printf("BROWNOUT: Failed to save data buffer\n");
+        }
+    }
+    
+    printf("BROWNOUT: Emergency flush done in %lu us, total records: %lu\n",
+           (unsigned long)(time_us_64() - start_us), flash_storage.getStoredCount());
+    
+    // Diagnostics last, the sensor data matters more
+    aggregate_log.flush();
+    event_log.log(EVENT_BROWNOUT, (int32_t)(power_monitor.getVoltage() * 1000.0f), (int32_t)(queued + buffered));
+}
+
+// Run the emergency flush if the power monitor reported a brownout. Checked at the top
+// of the main loop and in the sleeps of the loop (sleepCheckingBrownout()). Elsewhere a
+// brownout waits for the rest of the iteration: the sensor reads and a display refresh
+// take a few seconds. Uploads flush RAM before WiFi connects, so nothing is at risk there.
+bool checkBrownout() {
+    if (!power_monitor.brownoutDetected()) {
+        return false;
+    }
+    emergencyFlush();
+    power_monitor.clearBrownout();
+    return true;
+}
+
+// The GPS of main(). Its receive ring holds GPS_RX_BUFFER_SIZE bytes, a few seconds at
+// 5 Hz, so it is also parsed during the sleeps, sensor reads and display refreshes of the loop.
+myGPS *loop_gps = nullptr;
+
+void pollGps() {
+    if (loop_gps != nullptr) {
+        loop_gps->poll();
+    }
+}
+
+// sleep_ms() for the main loop that runs a pending emergency flush right away and
+// keeps parsing the GPS
+void sleepCheckingBrownout(uint32_t ms) {
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    uint32_t elapsed_ms;
+    while ((elapsed_ms = to_ms_since_boot(get_absolute_time()) - start_ms) < ms) {
+        checkBrownout();
+        pollGps();
+        uint32_t left_ms = ms - elapsed_ms;
+        sleep_ms(left_ms < BROWNOUT_CHECK_STEP_MS ? left_ms : BROWNOUT_CHECK_STEP_MS);
+    }
+}
+
 // Enter low power sleep mode
 void enterSleepMode() {
     // First save any buffered data to flash
@@ -1637,7 +1823,8 @@ void dump_stack_info() {
     printf("Button states: %d, %d\n", tast_pressed[0], tast_pressed[1]);
     printf("Button changed flag: %s\n", button_state_changed ? "yes" : "no");
     printf("Data buffer size: %lu records\n", data_buffer.size());
-    printf("Stored flash records: %lu\n", flash_storage.getStoredCount());
+    printf("Stored flash records: %lu (%lu not uploaded)\n", flash_storage.getStoredCount(),
+           flash_storage.getPendingCount());
     printf("GPS fake mode: %s\n", USE_FAKE_GPS ? "enabled" : "disabled");
     printf("========================\n\n");
 }
@@ -1764,34 +1951,29 @@ bool safety_timer_callback(struct repeating_timer *t) {
 
 // Add this new function for extremely large uploads
 bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
-    if (flash.getStoredCount() == 0) {
+    if (flash.getPendingCount() == 0) {
         printf("No data to upload\n");
         displayUploadStatus("No data to upload");
         return true; // Nothing to upload is considered success
     }
     
     // For extremely large uploads (>300 records), use this specialized function
-    printf("Starting parallel upload for %lu records\n", flash.getStoredCount());
+    uint32_t pending_count = flash.getPendingCount();
+    printf("Starting parallel upload for %lu records\n", pending_count);
     displayUploadStatus("Large data upload");
     
-    // Load records from flash
-    std::vector<SensorData> records = flash.loadAllSensorData();
-    printf("Loaded %lu records from flash\n", records.size());
-    
-    if (records.empty()) {
-        printf("No valid records found in flash\n");
-        displayUploadStatus("No valid data");
-        return false;
-    }
-    
     // For very large uploads (>300 records), split into batches
     // and process them more optimally - use smaller batches for reliability
     const size_t RECORDS_PER_BATCH = 20; // Reduced from 30 to 20 for better reliability
-    const size_t BATCH_SIZE = 5; // Reduced from 10 to 5 for better reliability
+    const size_t BATCH_SIZE = UPLOAD_MAX_BATCH_SIZE; // Records per chunk, acknowledged chunk by chunk
+    const size_t CHUNKS_PER_BATCH = RECORDS_PER_BATCH / BATCH_SIZE;
     
-    size_t total_records = records.size();
-    size_t total_batches = (total_records + RECORDS_PER_BATCH - 1) / RECORDS_PER_BATCH;
+    // Chunks accepted by the server are persisted in flash, a retry only sends the missing ones
+    size_t total_records = pending_count;
+    size_t total_chunks = flash.beginUpload();
+    size_t total_batches = (total_chunks + CHUNKS_PER_BATCH - 1) / CHUNKS_PER_BATCH;
     size_t successful_batches = 0;
+    bool deferred = false;
     
     printf("Breaking %lu records into %lu batches of %lu records each\n", 
            total_records, total_batches, RECORDS_PER_BATCH);
@@ -1800,11 +1982,12 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
     uint32_t upload_start_time = to_ms_since_boot(get_absolute_time());
     
     // Process each batch with optimized settings
-    for (size_t batch = 0; batch < total_batches; batch++) {
+    for (size_t batch = 0; batch < total_batches && !deferred; batch++) {
         // Calculate batch boundaries
-        size_t start_idx = batch * RECORDS_PER_BATCH;
-        size_t end_idx = std::min(start_idx + RECORDS_PER_BATCH, total_records);
-        size_t batch_size = end_idx - start_idx;
+        size_t first_chunk = batch * CHUNKS_PER_BATCH;
+        size_t chunks_in_batch = std::min(CHUNKS_PER_BATCH, total_chunks - first_chunk);
+        size_t start_idx = first_chunk * BATCH_SIZE;
+        size_t end_idx = std::min(start_idx + chunks_in_batch * BATCH_SIZE, total_records);
         
         // Display current batch status
         char status_msg[64];
@@ -1814,11 +1997,7 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
         printf("Processing batch %lu/%lu (records %lu-%lu)\n", 
                batch + 1, total_batches, start_idx + 1, end_idx);
         
-        // Create subset for this batch
-        std::vector<SensorData> batch_records(records.begin() + start_idx, records.begin() + end_idx);
-        
         // Process this batch with chunked upload but minimal delays
-        size_t chunks_in_batch = (batch_size + BATCH_SIZE - 1) / BATCH_SIZE;
         size_t successful_chunks = 0;
         
         // Buffer for JSON data - smaller buffer for more reliable uploads
@@ -1826,14 +2005,43 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
         
         // Process each chunk in this batch
         for (size_t chunk = 0; chunk < chunks_in_batch; chunk++) {
-            // Calculate chunk boundaries
-            size_t chunk_start = chunk * BATCH_SIZE;
-            size_t chunk_end = std::min(chunk_start + BATCH_SIZE, batch_size);
-            size_t chunk_size = chunk_end - chunk_start;
+            size_t upload_chunk = first_chunk + chunk;
             
-            // Create subset for this chunk
-            std::vector<SensorData> chunk_records(batch_records.begin() + chunk_start, 
-                                                batch_records.begin() + chunk_end);
+            if (flash.isChunkAcknowledged(upload_chunk)) {
+                // Uploaded by an earlier attempt
+                successful_chunks++;
+                continue;
+            }
+            
+            if (!flash.canTrackChunk(upload_chunk)) {
+                // Too far after a failed chunk to remember, sent with the next upload instead
+                deferred = true;
+                break;
+            }
+            
+            // Decode the records of this chunk from flash, invalid records are skipped
+            FlashRecordCursor cursor = flash.chunkRecords(upload_chunk);
+            SensorData chunk_records[BATCH_SIZE];
+            size_t chunk_size = 0;
+            size_t poor_fixes = 0;
+            while (chunk_size < BATCH_SIZE && cursor.next(chunk_records[chunk_size])) {
+                if (!flash.isUploadable(chunk_records[chunk_size])) {
+                    poor_fixes++;
+                    continue;
+                }
+                chunk_size++;
+            }
+            if (poor_fixes > 0) {
+                printf("Holding back %lu records with a poor GPS fix\n", poor_fixes);
+            }
+            
+            if (chunk_size == 0) {
+                // Only invalid records or poor fixes in this chunk, held back instead of
+                // acknowledged. Counts as done for the batch, nothing is left to send.
+                flash.holdChunk(upload_chunk);
+                successful_chunks++;
+                continue;
+            }
             
             // Show progress
             printf("Uploading batch %lu/%lu, chunk %lu/%lu (%lu records)\n", 
@@ -1843,7 +2051,7 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
             memset(json_buffer, 0, sizeof(json_buffer));
             
             // Prepare JSON for just this chunk
-            prepareBatchDataForTransmission(chunk_records, json_buffer, sizeof(json_buffer), gps);
+            prepareBatchDataForTransmission(chunk_records, chunk_size, json_buffer, sizeof(json_buffer), gps);
             
             // Use more retries and longer delay for better reliability
             bool result = uploadDataWithRetry(json_buffer, 5, 500); // Increased from 3 to 5 retries, and from 250ms to 500ms delay
@@ -1852,6 +2060,7 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
                 printf("Batch %lu/%lu, Chunk %lu/%lu uploaded successfully\n", 
                        batch + 1, total_batches, chunk + 1, chunks_in_batch);
                 successful_chunks++;
+                flash.acknowledgeChunk(upload_chunk);
             } else {
                 printf("Batch %lu/%lu, Chunk %lu/%lu upload failed\n", 
                        batch + 1, total_batches, chunk + 1, chunks_in_batch);
@@ -1861,8 +2070,8 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
             sleep_ms(200); // Increased from 150ms to 200ms for better reliability
         }
         
-        // If most chunks in this batch succeeded, count the batch as successful
-        if (successful_chunks >= chunks_in_batch * 0.7) { // 70% success rate
+        // A batch is only done when every chunk in it was accepted
+        if (successful_chunks == chunks_in_batch) {
             successful_batches++;
             printf("Batch %lu/%lu completed successfully (%lu/%lu chunks)\n", 
                    batch + 1, total_batches, successful_chunks, chunks_in_batch);
@@ -1885,30 +2094,14 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
     float records_per_second = (float)total_records / (total_upload_time / 1000.0f);
     printf("Upload speed: %.1f records per second\n", records_per_second);
     
-    // Consider upload successful if most batches worked
-    bool mostly_successful = (successful_batches >= total_batches * 0.7); // 70% success threshold
+    // Done once every pending record was acknowledged. Uploaded sectors are reclaimed
+    // automatically once storage wraps around, failed chunks are sent by the next upload.
+    bool upload_complete = (flash.getPendingCount() == 0);
     
     // Display final status
-    if (mostly_successful) {
+    if (upload_complete) {
         displayUploadStatus("Upload complete!");
         sleep_ms(500);
-        
-        // Ask user if they want to clear data
-        bool clear_data = showYesNoPrompt("Data Uploaded", "Clear flash storage?");
-        
-        if (clear_data) {
-            displayUploadStatus("Clearing storage...");
-            if (flash_storage.eraseStorage()) {
-                displayUploadStatus("Storage cleared");
-                sleep_ms(500);
-            } else {
-                displayUploadStatus("Clear failed!");
-                sleep_ms(500);
-            }
-        } else {
-            displayUploadStatus("Data preserved");
-            sleep_ms(500);
-        }
     } else {
         char result_msg[64];
         sprintf(result_msg, "%lu/%lu batches uploaded", successful_batches, total_batches);
@@ -1916,7 +2109,7 @@ bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
         sleep_ms(500);
     }
     
-    return mostly_successful;
+    return upload_complete;
 }
 
 // Add this function near uploadDataWithRetry to provide a more reliable Vercel upload option
@@ -2061,31 +2254,25 @@ bool uploadDataWithVercelProxy(const char* json_data, int max_retries, int retry
 
 // Add a function to upload sensor data in chunks for better reliability
 bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
-    if (flash.getStoredCount() == 0) {
+    if (flash.getPendingCount() == 0) {
         printf("No data to upload\n");
         displayUploadStatus("No data to upload");
         return true; // Nothing to upload is considered success
     }
     
-    printf("Starting chunked upload for %lu records\n", flash.getStoredCount());
+    uint32_t pending_count = flash.getPendingCount();
+    printf("Starting chunked upload for %lu records\n", pending_count);
     displayUploadStatus("Starting upload...");
     
-    // Load records from flash
-    std::vector<SensorData> records = flash.loadAllSensorData();
-    printf("Loaded %lu records from flash\n", records.size());
-    
-    if (records.empty()) {
-        printf("No valid records found in flash\n");
-        displayUploadStatus("No valid data");
-        return false;
-    }
-    
     // For reliability, use much smaller chunks
     const size_t CHUNK_SIZE = UPLOAD_MAX_BATCH_SIZE; // Using the global max batch size
     
-    size_t total_records = records.size();
-    size_t total_chunks = (total_records + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    // Chunks accepted by the server are persisted in flash, a retry only sends the missing ones
+    size_t total_records = pending_count;
+    size_t total_chunks = flash.beginUpload();
     size_t successful_uploads = 0;
+    size_t skipped_chunks = 0;
+    size_t held_chunks = 0;
     
     printf("Breaking %lu records into %lu chunks of max %lu records each\n", 
            total_records, total_chunks, CHUNK_SIZE);
@@ -2095,10 +2282,43 @@ bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
     
     // Process each chunk
     for (size_t chunk = 0; chunk < total_chunks; chunk++) {
-        // Calculate chunk boundaries
-        size_t start_idx = chunk * CHUNK_SIZE;
-        size_t end_idx = std::min(start_idx + CHUNK_SIZE, total_records);
-        size_t chunk_size = end_idx - start_idx;
+        if (flash.isChunkAcknowledged(chunk)) {
+            // Uploaded by an earlier attempt
+            successful_uploads++;
+            skipped_chunks++;
+            continue;
+        }
+        
+        if (!flash.canTrackChunk(chunk)) {
+            // Too far after a failed chunk to remember, sent with the next upload instead
+            printf("Chunk %lu/%lu and later ones deferred to the next upload\n", chunk + 1, total_chunks);
+            break;
+        }
+        
+        // Decode the records of this chunk from flash, invalid records are skipped
+        FlashRecordCursor cursor = flash.chunkRecords(chunk);
+        size_t start_idx = cursor.position();
+        SensorData chunk_records[CHUNK_SIZE];
+        size_t chunk_size = 0;
+        size_t poor_fixes = 0;
+        while (chunk_size < CHUNK_SIZE && cursor.next(chunk_records[chunk_size])) {
+            if (!flash.isUploadable(chunk_records[chunk_size])) {
+                poor_fixes++;
+                continue;
+            }
+            chunk_size++;
+        }
+        if (poor_fixes > 0) {
+            printf("Holding back %lu records with a poor GPS fix\n", poor_fixes);
+        }
+        size_t end_idx = cursor.position();
+        
+        if (chunk_size == 0) {
+            // Only invalid records or poor fixes in this chunk, held back instead of acknowledged
+            flash.holdChunk(chunk);
+            held_chunks++;
+            continue;
+        }
         
         // Display current chunk status
         char status_msg[64];
@@ -2108,9 +2328,6 @@ bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
         printf("Processing chunk %lu/%lu (records %lu-%lu)\n", 
                chunk + 1, total_chunks, start_idx + 1, end_idx);
         
-        // Create subset for this chunk
-        std::vector<SensorData> chunk_records(records.begin() + start_idx, records.begin() + end_idx);
-        
         // Buffer for JSON data
         char json_buffer[15360]; // Large buffer for JSON data
         
@@ -2118,7 +2335,7 @@ bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
         memset(json_buffer, 0, sizeof(json_buffer));
         
         // Prepare JSON for just this chunk
-        prepareBatchDataForTransmission(chunk_records, json_buffer, sizeof(json_buffer), gps);
+        prepareBatchDataForTransmission(chunk_records, chunk_size, json_buffer, sizeof(json_buffer), gps);
         
         // Debug print the JSON data before sending
         printf("Chunk %lu/%lu JSON content:\n", chunk + 1, total_chunks);
@@ -2165,6 +2382,7 @@ bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
         
         if (chunk_successful) {
             successful_uploads++;
+            flash.acknowledgeChunk(chunk);
             printf("Chunk %lu/%lu upload successful (%lu records)\n", 
                    chunk + 1, total_chunks, chunk_size);
             
@@ -2184,36 +2402,17 @@ bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
     uint32_t total_upload_time = upload_end_time - upload_start_time;
     
     // Show final results with timing information
-    printf("Upload complete: %lu/%lu chunks successful (%lu/%lu records) in %lu ms (%.1f seconds)\n", 
-           successful_uploads, total_chunks, 
-           successful_uploads * CHUNK_SIZE < total_records ? successful_uploads * CHUNK_SIZE : total_records, 
-           total_records, total_upload_time, total_upload_time / 1000.0f);
+    printf("Upload complete: %lu/%lu chunks successful (%lu from earlier attempts), %lu held back, %lu records pending, in %lu ms (%.1f seconds)\n", 
+           successful_uploads, total_chunks, skipped_chunks, held_chunks, flash.getPendingCount(),
+           total_upload_time, total_upload_time / 1000.0f);
     
-    // Only consider upload successful if at least 70% of chunks were uploaded
-    bool mostly_successful = (successful_uploads >= total_chunks * 0.7);
+    // Done once every pending record was acknowledged. Uploaded sectors are reclaimed
+    // automatically once storage wraps around, failed chunks are sent by the next upload.
+    bool upload_complete = (flash.getPendingCount() == 0);
     
-    // If upload was mostly successful, ask if user wants to clear the data
-    if (mostly_successful) {
+    if (upload_complete) {
         displayUploadStatus("Upload complete!");
         sleep_ms(500);
-        
-        // Ask user if they want to clear the uploaded data
-        bool clear_data = showYesNoPrompt("Data Uploaded", "Clear flash storage?");
-        
-        if (clear_data) {
-            displayUploadStatus("Clearing storage...");
-            if (flash.eraseStorage()) {
-                displayUploadStatus("Storage cleared");
-                sleep_ms(500);
-                printf("Flash storage cleared after successful upload\n");
-            } else {
-                displayUploadStatus("Clear failed!");
-                sleep_ms(500);
-            }
-        } else {
-            displayUploadStatus("Data preserved");
-            sleep_ms(500);
-        }
     } else if (successful_uploads > 0) {
         char result_msg[64];
         sprintf(result_msg, "%lu/%lu chunks uploaded", successful_uploads, total_chunks);
@@ -2224,7 +2423,7 @@ bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
         sleep_ms(500);
     }
     
-    return mostly_successful;
+    return upload_complete;
 }
 
 // Function to display initialization progress on the e-ink display
@@ -2431,6 +2630,7 @@ int main() {
     checkSensors();
     printf("Sensors checked, initializing ADC...\n");
     batteryADC.init();
+    power_monitor.start();
     
     // Add delay to ensure all sensors are stable
     printf("Waiting for sensors to stabilize...\n");
@@ -2447,8 +2647,18 @@ int main() {
     printf("Initializing flash storage...\n");
 #if defined(DISABLE_FLASH) && DISABLE_FLASH == 1
     flash_storage.setFlashEnabled(false);
+    aggregate_stream.setFlashEnabled(false);
+    event_stream.setFlashEnabled(false);
+    capture_stream.setFlashEnabled(false);
     printf("Flash operations DISABLED by configuration\n");
 #endif
+    flash_storage.setRetentionPolicy(FLASH_RETENTION_POLICY);
+    flash_storage.setHighWatermarkPercent(FLASH_HIGH_WATERMARK_PERCENT);
+    flash_storage.setUploadChunkSize(UPLOAD_MAX_BATCH_SIZE);
+    if (UPLOAD_DROP_POOR_FIXES) {
+        flash_storage.setUploadFilter(hasUploadableFix);
+    }
+    flash_storage.setCompressionEnabled(FLASH_COMPRESSED_RECORDS == 1);
     flash_initialized = flash_storage.init();
     if (flash_initialized) {
         printf("Flash storage initialized successfully\n");
@@ -2458,9 +2668,29 @@ int main() {
         printf("Flash storage initialization failed\n");
     }
     
+    initStreamPools();
+    event_log.log(EVENT_BOOT, watchdog_caused_reboot() ? 1 : 0);
+#if RAW_CAPTURE
+    bool capture_ready = capture_stream.getSectorCount() == FLASH_CAPTURE_SECTORS && capture_stream.init();
+    if (!capture_ready) {
+        printf("CAPTURE: No room for the %d capture sectors after the stored records, erase the storage and restart to record\n",
+               FLASH_CAPTURE_SECTORS);
+    }
+#endif
+    
     printf("Initializing GPS module...\n");
     myGPS gps(uart0, 9600, 0, 1);
+    loop_gps = &gps;
     printf("GPS module initialized\n");
+#if RAW_CAPTURE
+    if (capture_ready) {
+        raw_capture.setStaticFrame(CAPTURE_BME688_CALIB, bme688_sensor.calibrationDump(), BME688_CALIB_DUMP_SIZE);
+        raw_capture.start();
+        gps.setCaptureCallback([](const char *data, uint32_t size, void *context) {
+            static_cast<RawCapture *>(context)->addGps(data, size);
+        }, &raw_capture);
+    }
+#endif
 
     DEBUG_POINT("Core initialization complete");
 
@@ -2503,6 +2733,21 @@ int main() {
     printf("Optimizing GPS for faster fix acquisition...\n");
     gps.optimizeForFastAcquisition();
     
+#if RAW_CAPTURE
+    // The capture queue and pool are sized for the receiver defaults, and replay traces
+    // hold NMEA only
+    printf("CAPTURE: Keeping the GPS at %d baud, 1 Hz NMEA\n", UART0_BAUD_RATE);
+#else
+    // Room for several fixes per second, stays at 9600 baud if the receiver doesn't follow
+    gps.negotiateBaudRate(GPS_BAUD_RATE);
+    
+#if GPS_USE_UBX
+    // Less to receive and parse per fix, falls back to NMEA if the module has no UBX
+    gps.enableUbx();
+#endif
+    gps.setNavigationRate(GPS_NAV_RATE_HZ);
+#endif
+    
     printf("Starting continuous GPS acquisition in the background...\n");
 #endif
 
@@ -2626,8 +2871,8 @@ int main() {
 
     // Set up storage and data collection timing variables
     // Reduce collection interval to match refresh interval (already handled by dataCollectionInterval)
-    // Reduce flash save interval for more frequent saves while biking (every 30s instead of 3min)
-    const uint32_t FLASH_SAVE_INTERVAL_MS = 30000;    // Save to flash every 30 seconds for bike mode
+    // The power monitor flushes the RAM buffer when the battery collapses, so saves can be rare
+    const uint32_t FLASH_SAVE_INTERVAL_MS = 300000;   // Save to flash every 5 minutes
     uint32_t current_time_ms = to_ms_since_boot(get_absolute_time());
     uint32_t last_data_collection_ms = current_time_ms;
     uint32_t last_flash_save_ms = current_time_ms;
@@ -2638,9 +2883,10 @@ int main() {
     printf("BIKE MODE: Display refresh=%d ms, data collection=%d ms, flash save=%d ms\n",
            refreshInterval, dataCollectionInterval, (unsigned int)FLASH_SAVE_INTERVAL_MS);
 
-    // Reduce buffer size for bike mode to ensure more frequent saves
-    // and prevent large data loss in case of power issues during the ride
-    const int MAX_BUFFER_SIZE = 10; // Reduced from 25 for more frequent saves during biking
+    // Hold up to 5 minutes of readings in RAM (one reading per refresh interval),
+    // power failures are covered by the emergency flush. Its latency (see checkBrownout())
+    // does not depend on the buffer size, 60 raw records are about 18 flash pages to program.
+    const int MAX_BUFFER_SIZE = 60;
     // Smaller buffer size during initialization - keep this the same
     const int INIT_MAX_BUFFER_SIZE = 2;  // Save after just 2 readings during initialization
     
@@ -2716,8 +2962,13 @@ timeout_complete:
                 printf("Erasing flash storage\n");
                 displayUploadStatus("Erasing old data");
                 
-                // Clear the storage
+                // Clear the storage. A region kept at an old end moves to the configured one,
+                // the pools have to follow before they are written again.
+                uint32_t region_end = flash_storage.getRegionEnd();
                 flash_storage.eraseStorage();
+                if (flash_storage.getRegionEnd() != region_end) {
+                    initStreamPools();
+                }
                 
                 printf("Flash storage erased\n");
                 displayUploadStatus("Starting fresh");
@@ -2744,6 +2995,13 @@ timeout_complete:
     printf("Enable from Settings page if desired (double press button)\n");
     // Do not call setFastRefreshMode here
     
+    // Main loop latency caused by flash writes
+    uint64_t last_loop_start_us = 0;
+    bool loop_wrote_flash = false;
+    uint32_t worst_flash_loop_us = 0;
+    uint32_t known_write_failures = 0;
+    bool write_failure_reported = false;
+    
     // Main loop
     while (true) {
         // Call hang detection at the start of each loop
@@ -2757,6 +3015,50 @@ timeout_complete:
         watchdog_update();
 #endif
         
+        // Track the longest iteration that wrote to flash
+        uint64_t loop_start_us = time_us_64();
+        if (loop_wrote_flash && loop_start_us - last_loop_start_us > worst_flash_loop_us) {
+            worst_flash_loop_us = (uint32_t)(loop_start_us - last_loop_start_us);
+        }
+        last_loop_start_us = loop_start_us;
+        
+        // A collapsing supply takes priority over everything else
+        checkBrownout();
+        
+        // Write at most one queued batch to flash
+        loop_wrote_flash = flash_writer.poll();
+
+        // A failed batch is retried on every iteration, report it once until a write succeeds
+        if (loop_wrote_flash) {
+            write_failure_reported = false;
+        } else if (flash_writer.stats().write_failures != known_write_failures && !write_failure_reported) {
+            printf("ERROR: Failed to write queued records to flash (stored count: %lu)\n", 
+                   flash_storage.getStoredCount());
+            write_failure_reported = true;
+            event_log.log(EVENT_FLASH_ERROR, (int32_t)flash_writer.stats().write_failures);
+            
+            if (flash_storage.isStorageFull()) {
+                printf("Flash storage is full - cannot save more records\n");
+                
+                // Show a warning on the display
+                displayUploadStatus("Storage FULL!");
+                sleepCheckingBrownout(2000);
+                displayUploadStatus("Upload required");
+                sleepCheckingBrownout(2000);
+            }
+        }
+        known_write_failures = flash_writer.stats().write_failures;
+        
+        // Nothing to write, use the time to erase the next journal sector ahead of its first append
+        if (!loop_wrote_flash && flash_writer.isIdle()) {
+            flash_storage.eraseAhead();
+        }
+        
+#if RAW_CAPTURE
+        // Write the captured raw data every few seconds
+        raw_capture.update();
+#endif
+        
         // Handle any pending button input
         DEBUG_POINT("Processing button inputs");
         volatile uint32_t events = btn1_events;
@@ -2817,7 +3119,7 @@ timeout_complete:
                     } else {
                         // Briefly show a waiting message if not on GPS page
                         displayUploadStatus("Waiting for GPS fix");
-                        sleep_ms(1000);
+                        sleepCheckingBrownout(1000);
                         forceDisplayRefresh(); // Return to current page
                     }
                     
@@ -2837,25 +3139,39 @@ timeout_complete:
                 printf("Collecting sensor data with %s GPS coordinates\n", 
                       (fix_status == 0) ? "current" : "last valid");
                 
-                // Read latest data from sensors and GPS
+                // Read latest data from sensors and GPS. The reads take a second or more, the
+                // position is taken from the fix closest to their middle.
+                uint32_t sample_start_ms = to_ms_since_boot(get_absolute_time());
                 DEBUG_POINT("Reading battery level");
-                batteryLevel = batteryADC.calculateBatteryLevel();
+                // The power monitor owns the ADC while its timer runs
+                float battery_voltage = power_monitor.isRunning() ? power_monitor.getAverageVoltage()
+                                                                  : batteryADC.readAverageVoltage();
+                batteryLevel = batteryADC.calculateBatteryLevel(battery_voltage);
                 if (batteryLevel == 0) {
                     batteryLevel = 50;  // Use default value if reading fails
                 }
+                sensor_data_obj.battery_mv = (uint16_t)(battery_voltage * 1000.0f);
+                
+                // Which sensors delivered fresh values for this record
+                uint16_t sensor_status = 0;
                 
                 DEBUG_POINT("Reading BME688 sensor");
                 // Read real sensor values from BME688
                 float temp, hum, pres, gas;
                 if (bme688_sensor.readData(temp, hum, pres, gas)) {
+                    sensor_status |= SENSOR_STATUS_BME688_OK;
                     sensor_data_obj.temp = temp;
                     sensor_data_obj.hum = hum;
                     sensor_data_obj.pres = pres;
                     sensor_data_obj.gasRes = gas;
+#if RAW_CAPTURE
+                    raw_capture.addFrame(CAPTURE_BME688, bme688_sensor.fieldDump(), BME688_FIELD_DUMP_SIZE);
+#endif
                 } else {
                     printf("Failed to read from BME688 sensor\n");
                 }
                 
+                pollGps();
                 DEBUG_POINT("Reading HM3301 sensor");
                 // Read real values from HM3301 particulate matter sensor
                 uint16_t pm1_0 = 0, pm2_5 = 0, pm10 = 0;
@@ -2880,9 +3196,14 @@ timeout_complete:
                        hm3301_end, hm3301_duration, hm3301_success ? "yes" : "no");
                 
                 if (hm3301_success) {
+                    sensor_status |= SENSOR_STATUS_HM3301_OK;
+                    sensor_data_obj.pm1_0 = pm1_0;
                     sensor_data_obj.pm2_5 = pm2_5;
-                    sensor_data_obj.pm5 = pm1_0;  // Using PM1.0 for PM5 since there's no direct PM5 reading
+                    sensor_data_obj.pm5 = pm1_0;  // Still sent as part_5 by the upload, PM1.0 is stored separately since schema 2
                     sensor_data_obj.pm10 = pm10;
+#if RAW_CAPTURE
+                    raw_capture.addFrame(CAPTURE_HM3301, hm3301_sensor.lastFrame(), HM3301_FRAME_SIZE);
+#endif
                     printf("HM3301_DEBUG: Values read - PM1.0: %u, PM2.5: %u, PM10: %u\n", pm1_0, pm2_5, pm10);
                 } else {
                     printf("HM3301_DEBUG: Failed to read from HM3301 sensor\n");
@@ -2890,6 +3211,7 @@ timeout_complete:
                     printf("HM3301_DEBUG: Using previous or default values\n");
                 }
                 
+                pollGps();
                 DEBUG_POINT("Reading CO2 sensor");
                 // Read real CO2 values from PAS CO2 sensor with timeout protection
                 absolute_time_t co2_start_time = get_absolute_time();
@@ -2899,6 +3221,10 @@ timeout_complete:
                 
                 // Use the modified read function with built-in timeout
                 pas_co2_sensor.read();
+#if RAW_CAPTURE
+                uint8_t co2_frame[3] = {pas_co2_sensor.getStatus(), pas_co2_sensor.getRawHigh(), pas_co2_sensor.getRawLow()};
+                raw_capture.addFrame(CAPTURE_PAS_CO2, co2_frame, sizeof(co2_frame));
+#endif
                 
                 // Check if the operation took too long (indicating a potential hang)
                 int64_t co2_read_time_us = absolute_time_diff_us(co2_start_time, get_absolute_time());
@@ -2917,6 +3243,7 @@ timeout_complete:
                     sensor_data_obj.co2 = 400;
                 } else {
                     sensor_data_obj.co2 = co2_reading;
+                    sensor_status |= SENSOR_STATUS_CO2_OK;
                     printf("CO2 reading: %u ppm\n", co2_reading);
                 }
                 
@@ -2941,9 +3268,26 @@ timeout_complete:
                     printf("WARNING: GPS read took %lu ms (expected <100ms)\n", gps_duration_ms);
                 }
                 
-                // Set GPS data in the sensor data object
-                sensor_data_obj.longitude = (int32_t)(longitude * 10000000); // Store as fixed-point
-                sensor_data_obj.latitude = (int32_t)(latitude * 10000000);   // Store as fixed-point
+                // Set GPS data in the sensor data object, from the fix of the sample time if
+                // there is one, the latest fix can be newer by the length of the reads
+                uint32_t sample_ms = sample_start_ms + (gps_start_ms - sample_start_ms) / 2;
+                GpsFix sample_fix;
+                GpsFixQuality fix_quality;
+                if (gps.getFixAt(sample_ms, sample_fix)) {
+                    sensor_data_obj.longitude = (int32_t)abs(sample_fix.longitude); // Magnitudes like readLine()
+                    sensor_data_obj.latitude = (int32_t)abs(sample_fix.latitude);
+                    fix_quality = sample_fix.quality;
+                } else {
+                    sensor_data_obj.longitude = (int32_t)(longitude * 10000000); // Store as fixed-point
+                    sensor_data_obj.latitude = (int32_t)(latitude * 10000000);   // Store as fixed-point
+                    
+                    // Keep the fix quality with the record so poor fixes can be filtered later
+                    fix_quality = gps.getFixQuality();
+                }
+                sensor_data_obj.hdop = fix_quality.hdop;
+                sensor_data_obj.fix_type = fix_quality.fix_type;
+                sensor_data_obj.satellites_used = fix_quality.satellites_used;
+                sensor_data_obj.speed = fix_quality.speed;
                 
                 // Set timestamp from system time
                 sensor_data_obj.timestamp = time(NULL);
@@ -2951,10 +3295,16 @@ timeout_complete:
                 // Set fake GPS flag based on gps settings
                 sensor_data_obj.is_fake_gps = (USE_FAKE_GPS == 1);
                 
+                if (fix_status == 0) {
+                    sensor_status |= SENSOR_STATUS_GPS_FIX;
+                }
+                sensor_data_obj.sensor_status = sensor_status;
+                
                 DEBUG_POINT("Adding data to buffer");
                 // Add to in-memory buffer
                 data_buffer.push_back(sensor_data_obj);
                 buffer_modified = true;
+                aggregate_log.add(sensor_data_obj);
                 printf("Added data record #%lu to buffer (now %lu records in buffer)\n",
                        flash_storage.getStoredCount() + data_buffer.size(), data_buffer.size());
                 
@@ -2984,11 +3334,12 @@ timeout_complete:
                 DEBUG_POINT("Data collection complete");
             }
             
-            // Check if it's time to save to flash or if buffer is getting too full
+            // Check if it's time to save to flash, the buffer is getting too full or the supply is low
             if (((current_time - last_flash_save_ms >= 
                   (initializationComplete ? FLASH_SAVE_INTERVAL_MS : INIT_FLASH_SAVE_INTERVAL_MS)) || 
                  (data_buffer.size() >= 
-                  (initializationComplete ? MAX_BUFFER_SIZE : INIT_MAX_BUFFER_SIZE))) && 
+                  (initializationComplete ? MAX_BUFFER_SIZE : INIT_MAX_BUFFER_SIZE)) ||
+                 power_monitor.isSupplyLow()) && 
                 data_buffer.size() > 0) {
                 
                 DEBUG_POINT("Starting flash save");
@@ -3003,33 +3354,34 @@ timeout_complete:
                     // Save is being handled below, so we don't need additional code here
                 }
                 
-                // Save entire buffer to flash
+                // Queue the entire buffer as one batch, the flash writer saves it in the background
                 size_t saved_count = 0;
-                for (const auto& data : data_buffer) {
-                    DEBUG_POINT("Saving record to flash");
-                    if (flash_storage.saveSensorData(data)) {
-                        saved_count++;
-                    } else {
-                        printf("ERROR: Failed to save record to flash (stored count: %lu)\n", 
-                               flash_storage.getStoredCount());
-                        
-                        if (flash_storage.isStorageFull()) {
-                            printf("Flash storage is full - cannot save more records\n");
-                            
-                            // Show a warning on the display
-                            displayUploadStatus("Storage FULL!");
-                            sleep_ms(2000);
-                            displayUploadStatus("Upload required");
-                            sleep_ms(2000);
-                            
-                            break;
-                        }
-                    }
+                DEBUG_POINT("Queueing buffer for flash");
+                if (flash_writer.enqueue(data_buffer)) {
+                    flash_writer.commit();
+                    saved_count = data_buffer.size();
+                } else {
+                    // Both writer buffers are full, keep collecting and try again on the next save
+                    printf("WARNING: Flash writer busy (%lu records queued) - keeping %lu records in buffer\n",
+                           (unsigned long)flash_writer.queuedCount(), (unsigned long)data_buffer.size());
                 }
                 
-                printf("Saved %lu/%lu records to flash. Total stored: %lu\n",
+                printf("Queued %lu/%lu records for flash. Total stored: %lu\n",
                        saved_count, data_buffer.size(), flash_storage.getStoredCount());
                 
+                // Ask for an upload once, when the data not uploaded yet crosses the high watermark
+                static bool high_watermark_reported = false;
+                if (flash_storage.isAboveHighWatermark()) {
+                    if (!high_watermark_reported) {
+                        printf("Flash storage above high watermark (%lu records not uploaded)\n",
+                               flash_storage.getPendingCount());
+                        displayUploadStatus("Upload required");
+                        high_watermark_reported = true;
+                    }
+                } else {
+                    high_watermark_reported = false;
+                }
+                
                 // Clear buffer after successful save
                 if (saved_count > 0) {
                     data_buffer.clear();
@@ -3042,7 +3394,7 @@ timeout_complete:
                         // Update initialization page if we're still in init mode
                         if (!initializationComplete) {
                             displayInitializationPage("First save complete", 3, 5);
-                            sleep_ms(500);
+                            sleepCheckingBrownout(500);
                             displayInitializationPage("Press any button", 4, 5);
                         }
                     }
@@ -3112,35 +3464,37 @@ timeout_complete:
                     tast_pressed[0] = NOT_PRESSED;
                     printf("Long press detected on button 0 - starting data upload\n");
                     
+                    // First flush any data from the writer and the buffer to flash. Done before
+                    // connecting, the WiFi connection and the upload don't check for a brownout.
+                    flash_writer.flush();
+                    if (data_buffer.size() > 0) {
+                        printf("Flushing %d records from buffer to flash before upload\n", data_buffer.size());
+                        displayUploadStatus("Saving buffer...");
+                        
+                        flash_storage.saveSensorDataBatch(data_buffer);
+                        
+                        printf("Buffer saved to flash\n");
+                        data_buffer.clear();
+                    }
+                    
                     // Use our optimized WiFi connection function
                     if (ensureWiFiConnection()) {
                         // WiFi is connected, proceed with upload
                         DEBUG_POINT("WiFi connected - preparing for upload");
                         
-                        // First flush any data from the buffer to flash
-                        if (data_buffer.size() > 0) {
-                            printf("Flushing %d records from buffer to flash before upload\n", data_buffer.size());
-                            displayUploadStatus("Saving buffer...");
-                            
-                            for (const auto& data : data_buffer) {
-                                flash_storage.saveSensorData(data);
-                            }
-                            
-                            printf("Buffer saved to flash\n");
-                            data_buffer.clear();
-                        }
-                        
                         // Now attempt the upload with the more reliable chunked function 
                         // instead of the parallel function that was failing
                         DEBUG_POINT("Starting data upload");
                         
                         // Check the number of records to determine best upload method
-                        uint32_t record_count = flash_storage.getStoredCount();
+                        uint32_t record_count = flash_storage.getPendingCount();
                         
                         if (record_count > 0) {
                             // Always use the more reliable chunked upload method
                             printf("Using reliable chunked upload method for %lu records\n", record_count);
-                            uploadSensorDataChunked(flash_storage, gps, UPLOAD_ALL_AT_ONCE);
+                            bool upload_complete = uploadSensorDataChunked(flash_storage, gps, UPLOAD_ALL_AT_ONCE);
+                            event_log.log(EVENT_UPLOAD, (int32_t)(record_count - flash_storage.getPendingCount()),
+                                          upload_complete ? 1 : 0);
                         } else {
                             displayUploadStatus("No data to upload");
                             sleep_ms(1000); // Reduced from 2000ms
@@ -3219,6 +3573,30 @@ timeout_complete:
                 // Print memory usage
                 printf("DEBUG: Buffer size: %lu records, Flash storage: %lu records\n",
                        data_buffer.size(), flash_storage.getStoredCount());
+                printf("DEBUG: Worst main loop iteration with a flash write: %lu us\n",
+                       (unsigned long)worst_flash_loop_us);
+                flash_writer.printStats();
+                printf("DEBUG: Supply %.2f V (min %.2f V), brownouts: %lu\n",
+                       power_monitor.getVoltage(), power_monitor.getMinVoltage(),
+                       (unsigned long)power_monitor.getBrownoutCount());
+                printf("DEBUG: Aggregates: %lu stored, events: %lu stored\n",
+                       aggregate_stream.getEntryCount(), event_stream.getEntryCount());
+                printf("DEBUG: Flash sectors erased ahead: %lu, erased during append: %lu\n",
+                       flash_storage.getEraseAheadCount(), flash_storage.getSyncEraseCount());
+                flash_storage.printStats(current_time);
+                printf("DEBUG: GPS received %lu bytes, dropped %lu, UART overruns %lu, NMEA checksum errors %lu\n",
+                       (unsigned long)gps.getRxStats().bytes_received, (unsigned long)gps.getRxStats().dropped_bytes,
+                       (unsigned long)gps.getRxStats().uart_overruns, (unsigned long)gps.getParserStats().checksum_errors);
+                printf("DEBUG: GPS UBX %s, %lu messages, %lu checksum errors, %d baud, %u ms navigation interval\n",
+                       gps.isUbxActive() ? "active" : "inactive", (unsigned long)gps.getUbxParserStats().messages,
+                       (unsigned long)gps.getUbxParserStats().checksum_errors, gps.getBaudRate(),
+                       gps.getNavigationInterval());
+#if RAW_CAPTURE
+                printf("DEBUG: Capture %lu GPS bytes, %lu frames, %lu entries stored, dropped %lu bytes/%lu frames, worst flush %lu us\n",
+                       (unsigned long)raw_capture.stats().gps_bytes, (unsigned long)raw_capture.stats().frames,
+                       (unsigned long)capture_stream.getEntryCount(), (unsigned long)raw_capture.stats().dropped_bytes,
+                       (unsigned long)raw_capture.stats().dropped_frames, (unsigned long)raw_capture.stats().worst_flush_us);
+#endif
                 last_debug_print_time = current_time;
             }
         }
@@ -3257,15 +3635,36 @@ timeout_complete:
                 }
             }
             
+            // Log fix changes to the event stream once the new state held for a few seconds,
+            // single failed reads would otherwise flood the log
+            static int logged_fix_status = 2;
+            static uint32_t fix_status_since_ms = 0;
+            static int last_fix_status = 2;
+            if (fix_status != last_fix_status) {
+                last_fix_status = fix_status;
+                fix_status_since_ms = current_time;
+            } else if (fix_status != logged_fix_status && current_time - fix_status_since_ms >= 5000) {
+                event_log.log(EVENT_GPS_FIX, fix_status == 0 ? 1 : 0, satellites_visible);
+                logged_fix_status = fix_status;
+            }
+            
             // Update satellites visible count periodically
             if (current_time - last_gps_status_update_ms >= GPS_STATUS_UPDATE_MS) {
-                satellites_visible = gps.getVisibleSatellites();
+                GpsSatelliteCounts satellite_counts = gps.getSatelliteCounts();
+                satellites_visible = satellite_counts.in_view;
                 
                 // Only log periodic updates if fix status hasn't changed
-                printf("GPS Status Update: Fix=%s, Satellites=%d, Coords: %.6f, %.6f\n", 
+                printf("GPS Status Update: Fix=%s, Satellites=%d (used %d), Coords: %.6f, %.6f\n", 
                       (fix_status == 0) ? "VALID" : "INVALID", 
-                      satellites_visible,
+                      satellites_visible, satellite_counts.used,
                       gps_lat, gps_lon);
+                for (int i = 0; i < GPS_CONSTELLATION_COUNT; i++) {
+                    const GpsConstellationCounts &counts = satellite_counts.constellations[i];
+                    if (counts.in_view > 0 || counts.used > 0) {
+                        printf("GPS Status Update:   %s: %d in view, %d tracked, %d used\n",
+                               gpsConstellationName(i), counts.in_view, counts.tracked, counts.used);
+                    }
+                }
                 
                 last_gps_status_update_ms = current_time;
             }
@@ -0,0 +1,128 @@
+// Sentences/s and heap use of NmeaParser over an NMEA log, against the std::string and
+// istringstream parsing myGPS::readLine() did before it.
+//
+//   bench_nmea_parser [log.nmea [repeat]]
+//
+// Without arguments one embedded epoch is parsed DEFAULT_REPEAT times. The log may be raw
+// NMEA or a replay trace (tests/data/ride.nmea, capture_to_replay output): the time prefix
+// and the comment lines of a trace are dropped. Times are measured on the host, not on the Pico.
+#include <malloc.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "libs/gps/nmea_parser.h"
+#include "host_sdk.h"
+#include "nmea_corpus.h"
+
+#define DEFAULT_REPEAT 2000
+
+// Heap bytes in use
+static size_t heapInUse() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks;
+}
+
+// The parsing myGPS::readLine() did before NmeaParser, for the comparison
+static uint32_t legacyParse(const char* corpus, size_t& peak_heap) {
+    uint32_t sentences = 0;
+    size_t heap_before = heapInUse();
+    std::string buffer;
+
+    for (const char* c = corpus; *c; c++) {
+        buffer += *c;
+        if (*c != '\n') {
+            continue;
+        }
+
+        if (buffer.find("$GNRMC") == 0 || buffer.find("$GNGLL") == 0 || buffer.find("$GNGGA") == 0) {
+            std::istringstream iss(buffer);
+            std::string token;
+            double value = 0;
+            while (std::getline(iss, token, ',')) {
+                try {
+                    if (!token.empty() && token[0] >= '0' && token[0] <= '9') {
+                        value += std::stod(token);
+                    }
+                } catch (...) {
+                }
+            }
+
+            size_t heap = heapInUse() - heap_before;
+            if (heap > peak_heap) {
+                peak_heap = heap;
+            }
+            sentences += value != 0;
+        }
+        buffer.clear();
+    }
+    return sentences;
+}
+
+// Returns false if the parser found no sentence or a bad checksum in the corpus
+static bool benchmarkNmeaParser(const char* corpus, uint32_t repeat) {
+    size_t corpus_size = strlen(corpus);
+
+    NmeaParser parser;
+    size_t heap_before = heapInUse();
+    uint64_t start_us = time_us_64();
+    for (uint32_t i = 0; i < repeat; i++) {
+        parser.feed(corpus, corpus_size);
+    }
+    uint64_t parser_us = time_us_64() - start_us;
+    size_t parser_heap = heapInUse() - heap_before;
+
+    size_t legacy_heap = 0;
+    uint32_t legacy_sentences = 0;
+    start_us = time_us_64();
+    for (uint32_t i = 0; i < repeat; i++) {
+        legacy_sentences += legacyParse(corpus, legacy_heap);
+    }
+    uint64_t legacy_us = time_us_64() - start_us;
+
+    const NmeaParserStats& stats = parser.stats();
+    printf("GPS: NMEA benchmark over %lu bytes x %lu\n", (unsigned long)corpus_size, (unsigned long)repeat);
+    printf("GPS: NmeaParser: %lu sentences (%lu decoded, %lu checksum errors) in %lu us, %.0f sentences/s, "
+           "%lu bytes of heap, %lu bytes of state\n",
+           (unsigned long)stats.sentences, (unsigned long)stats.decoded, (unsigned long)stats.checksum_errors,
+           (unsigned long)parser_us, parser_us > 0 ? stats.sentences * 1e6 / parser_us : 0.0,
+           (unsigned long)parser_heap, (unsigned long)sizeof(NmeaParser));
+    printf("GPS: istringstream parsing: %lu position sentences in %lu us, %.0f sentences/s, %lu bytes of heap at peak\n",
+           (unsigned long)legacy_sentences, (unsigned long)legacy_us,
+           legacy_us > 0 ? legacy_sentences * 1e6 / legacy_us : 0.0, (unsigned long)legacy_heap);
+    return stats.sentences > 0 && stats.checksum_errors == 0;
+}
+
+int main(int argc, char** argv) {
+    std::string corpus = nmea_benchmark_corpus;
+    if (argc > 1) {
+        std::ifstream file(argv[1]);
+        if (!file) {
+            printf("Can't read %s\n", argv[1]);
+            return 1;
+        }
+        // Keep each line from its "$" on, both parsers then see plain sentences
+        corpus.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            size_t start = line.find('$');
+            if (start != std::string::npos) {
+                corpus += line.substr(start);
+                if (corpus.back() != '\r') {
+                    corpus += '\r';
+                }
+                corpus += '\n';
+            }
+        }
+    }
+    uint32_t repeat = argc > 2 ? strtoul(argv[2], nullptr, 10) : DEFAULT_REPEAT;
+
+    hostUseRealClock(true);
+    if (!benchmarkNmeaParser(corpus.c_str(), repeat)) {
+        printf("The corpus did not parse cleanly\n");
+        return 1;
+    }
+    return 0;
+}
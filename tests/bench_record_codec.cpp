@@ -0,0 +1,133 @@
+// Compression ratio and decode throughput of the delta record format on a ride corpus.
+//
+//   bench_record_codec [ride.nmea ride.csv [records]]
+//
+// The traces are in the replay format (libs/replay/trace_replay.h), so the output of
+// capture_to_replay can be used as well. Without arguments the corpus in tests/data is
+// used. Records are built every SAMPLE_INTERVAL_MS like the firmware does, the traces
+// loop until enough records exist. Throughput is measured on the host, not on the Pico.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "libs/gps/nmea_parser.h"
+#include "libs/replay/trace_replay.h"
+#include "host_sdk.h"
+
+#define SAMPLE_INTERVAL_MS 5000
+#define DEFAULT_RECORDS    10000
+#define DECODE_PASSES      20
+
+// Build count records from the traces
+static bool buildRecords(const char* nmea_path, const char* csv_path, uint32_t count,
+                         std::vector<SensorData>& records) {
+    ReplayClock clock(0);
+    NmeaTraceReplay nmea(clock, 0);
+    SensorTraceReplay sensors(clock);
+    if (!nmea.load(nmea_path) || !sensors.load(csv_path)) {
+        return false;
+    }
+    nmea.setLoop(true);
+    sensors.setLoop(true);
+
+    NmeaParser parser;
+    SensorData fix;
+    bool have_fix = false;
+    for (uint32_t i = 0; i < count; i++) {
+        while (nmea.available() > 0) {
+            if (!parser.feed(nmea.getc())) {
+                continue;
+            }
+            const NmeaSentence& sentence = parser.sentence();
+            if (sentence.type == NMEA_SENTENCE_RMC && sentence.fix_valid) {
+                fix.latitude = (uint32_t)abs(sentence.latitude);    // Magnitudes like the firmware
+                fix.longitude = (uint32_t)abs(sentence.longitude);
+                fix.speed = sentence.speed_valid ? (uint16_t)sentence.speed : 0;
+                have_fix = true;
+            } else if (sentence.type == NMEA_SENTENCE_GGA && sentence.fix_valid) {
+                fix.hdop = sentence.hdop;
+                fix.satellites_used = sentence.satellites_used;
+            }
+        }
+
+        SensorData data = fix;
+        sensors.read(data);
+        data.timestamp = 1776326400 + i * (SAMPLE_INTERVAL_MS / 1000);
+        data.fix_type = have_fix ? GPS_FIX_TYPE_3D : GPS_FIX_TYPE_NONE;
+        data.sensor_status = SENSOR_STATUS_BME688_OK | SENSOR_STATUS_HM3301_OK | SENSOR_STATUS_CO2_OK |
+                             (have_fix ? SENSOR_STATUS_GPS_FIX : 0);
+        records.push_back(data);
+        clock.advance(SAMPLE_INTERVAL_MS);
+    }
+    return true;
+}
+
+// Journal sectors holding records
+static uint32_t usedSectors(const Flash& flash) {
+    JournalSectorSummary summary;
+    uint32_t sectors = 0;
+    while (flash.getSectorSummary(sectors, summary)) {
+        sectors++;
+    }
+    return sectors;
+}
+
+// Decoded records per second over the whole journal
+static double decodeRate(Flash& flash) {
+    uint64_t decoded = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < DECODE_PASSES; pass++) {
+        FlashRecordCursor cursor = flash.records();
+        SensorData data;
+        while (cursor.next(data)) {
+            decoded++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return decoded / seconds;
+}
+
+int main(int argc, char** argv) {
+    const char* nmea_path = argc > 2 ? argv[1] : TEST_DATA_DIR "/ride.nmea";
+    const char* csv_path = argc > 2 ? argv[2] : TEST_DATA_DIR "/ride.csv";
+    uint32_t count = argc > 3 ? strtoul(argv[3], nullptr, 10) : DEFAULT_RECORDS;
+
+    std::vector<SensorData> records;
+    if (!buildRecords(nmea_path, csv_path, count, records)) {
+        printf("Can't read %s / %s\n", nmea_path, csv_path);
+        return 1;
+    }
+
+    EmulatedFlashHal raw_hal, delta_hal;
+    raw_hal.setImageEnd(512 * 1024);
+    delta_hal.setImageEnd(512 * 1024);
+    Flash raw(0, &raw_hal), delta(0, &delta_hal);
+    raw.setDebugLevel(0);
+    delta.setDebugLevel(0);
+    delta.setCompressionEnabled(true);
+    if (!raw.init() || !delta.init() ||
+        !raw.saveSensorDataBatch(records) || !delta.saveSensorDataBatch(records)) {
+        printf("Storing the records failed\n");
+        return 1;
+    }
+    if (raw.getStoredCount() != count || delta.getStoredCount() != count) {
+        printf("Corpus of %u records does not fit the journal\n", count);
+        return 1;
+    }
+
+    uint32_t raw_sectors = usedSectors(raw);
+    uint32_t delta_sectors = usedSectors(delta);
+    double raw_per_sector = (double)count / raw_sectors;
+    double delta_per_sector = (double)count / delta_sectors;
+    hostUseRealClock(true);
+    double raw_rate = decodeRate(raw);
+    double delta_rate = decodeRate(delta);
+
+    printf("Corpus: %s, %s, %u records every %u ms\n", nmea_path, csv_path, count, SAMPLE_INTERVAL_MS);
+    printf("Raw:   %u sectors, %.1f records/sector, %.0f records/s decoded\n", raw_sectors, raw_per_sector, raw_rate);
+    printf("Delta: %u sectors, %.1f records/sector, %.0f records/s decoded\n", delta_sectors, delta_per_sector, delta_rate);
+    printf("Compression ratio %.2fx, decode throughput %.2fx of raw (host)\n",
+           delta_per_sector / raw_per_sector, delta_rate / raw_rate);
+    return 0;
+}
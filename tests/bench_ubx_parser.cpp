@@ -0,0 +1,130 @@
+// Per-fix decode time and bytes per fix of UBX NAV-PVT + NAV-DOP against the NMEA sentences
+// of the same fix.
+//
+//   bench_ubx_parser [fixes]
+//
+// Times are measured on the host, not on the Pico.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "libs/gps/nmea_parser.h"
+#include "libs/gps/ubx_parser.h"
+#include "host_sdk.h"
+#include "nmea_corpus.h"
+
+#define DEFAULT_FIXES 20000
+
+// Store a little endian field for the benchmark frames
+static void writeU32(uint8_t* data, uint32_t value) {
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = value >> 24;
+}
+
+// NAV-PVT and NAV-DOP of the fix in the NMEA benchmark corpus
+static size_t buildBenchmarkEpoch(uint8_t* out) {
+    uint8_t pvt[UBX_NAV_PVT_LENGTH] = {0};
+    writeU32(pvt, 381330000);               // iTOW, Thursday 10:15:30
+    pvt[4] = 2024 & 0xFF;
+    pvt[5] = 2024 >> 8;
+    pvt[6] = 5;
+    pvt[7] = 16;
+    pvt[8] = 10;
+    pvt[9] = 15;
+    pvt[10] = 30;
+    pvt[11] = UBX_PVT_VALID_DATE | UBX_PVT_VALID_TIME | UBX_PVT_FULLY_RESOLVED;
+    pvt[20] = UBX_FIX_3D;
+    pvt[21] = UBX_PVT_GNSS_FIX_OK;
+    pvt[23] = 9;
+    writeU32(pvt + 24, 156175138);          // 015 37.05083 E
+    writeU32(pvt + 28, 482066202);          // 48 12.39721 N
+    writeU32(pvt + 32, 313000);             // Height above the ellipsoid
+    writeU32(pvt + 36, 268400);
+    writeU32(pvt + 40, 2100);
+    writeU32(pvt + 44, 3400);
+    writeU32(pvt + 60, 2169);               // 7.807 km/h
+    writeU32(pvt + 64, 8752000);            // 87.52 degrees
+    pvt[76] = 198;
+
+    uint8_t dop[UBX_NAV_DOP_LENGTH] = {0};
+    writeU32(dop, 381330000);
+    dop[6] = 198;                           // PDOP
+    dop[10] = 163;                          // VDOP
+    dop[12] = 112;                          // HDOP
+
+    size_t size = ubxBuildMessage(UBX_CLASS_NAV, UBX_NAV_PVT, pvt, sizeof(pvt), out);
+    size += ubxBuildMessage(UBX_CLASS_NAV, UBX_NAV_DOP, dop, sizeof(dop), out + size);
+    return size;
+}
+
+// Returns false if a fix was not decoded from either stream
+static bool benchmarkUbxParser(uint32_t repeat) {
+    // myGPS feeds every byte to both parsers, so both streams are measured that way.
+    // In UBX mode the receiver still sends the GSV group every UBX_GSV_RATE epochs.
+    uint8_t epoch[2 * UBX_FRAME_OVERHEAD + UBX_NAV_PVT_LENGTH + UBX_NAV_DOP_LENGTH];
+    size_t epoch_size = buildBenchmarkEpoch(epoch);
+
+    std::string gsv;
+    for (const char* line = nmea_benchmark_corpus; *line;) {
+        const char* end = strchr(line, '\n');
+        size_t length = end ? (size_t)(end - line + 1) : strlen(line);
+        if (length > 6 && strncmp(line + 3, "GSV", 3) == 0) {
+            gsv.append(line, length);
+        }
+        line += length;
+    }
+    size_t nmea_size = strlen(nmea_benchmark_corpus);
+
+    NmeaParser nmea;
+    UbxParser ubx;
+    uint64_t start_us = time_us_64();
+    for (uint32_t i = 0; i < repeat; i++) {
+        for (size_t j = 0; j < nmea_size; j++) {
+            nmea.feed(nmea_benchmark_corpus[j]);
+            ubx.feed((uint8_t)nmea_benchmark_corpus[j]);
+        }
+    }
+    uint64_t nmea_us = time_us_64() - start_us;
+    uint32_t nmea_sentences = nmea.stats().sentences;
+
+    nmea.resetStats();
+    ubx.resetStats();
+    uint32_t gsv_epochs = 0;
+    start_us = time_us_64();
+    for (uint32_t i = 0; i < repeat; i++) {
+        for (size_t j = 0; j < epoch_size; j++) {
+            nmea.feed((char)epoch[j]);
+            ubx.feed(epoch[j]);
+        }
+        if (i % UBX_GSV_RATE == 0) {
+            for (size_t j = 0; j < gsv.size(); j++) {
+                nmea.feed(gsv[j]);
+                ubx.feed((uint8_t)gsv[j]);
+            }
+            gsv_epochs++;
+        }
+    }
+    uint64_t ubx_us = time_us_64() - start_us;
+    double ubx_bytes = epoch_size + (double)gsv.size() * gsv_epochs / repeat;
+
+    printf("GPS: UBX benchmark over %lu fixes\n", (unsigned long)repeat);
+    printf("GPS: NMEA: %lu bytes per fix (%.0f ms at 9600 baud), %lu sentences in %lu us, %.1f us per fix\n",
+           (unsigned long)nmea_size, nmea_size * 10000.0 / 9600, (unsigned long)nmea_sentences,
+           (unsigned long)nmea_us, (double)nmea_us / repeat);
+    printf("GPS: UBX NAV-PVT + NAV-DOP, GSV every %d fixes: %.0f bytes per fix (%.0f ms at 9600 baud), %lu messages in %lu us, %.1f us per fix\n",
+           UBX_GSV_RATE, ubx_bytes, ubx_bytes * 10000.0 / 9600, (unsigned long)ubx.stats().decoded,
+           (unsigned long)ubx_us, (double)ubx_us / repeat);
+    return nmea_sentences > 0 && nmea_sentences % repeat == 0 && ubx.stats().decoded == 2 * repeat;
+}
+
+int main(int argc, char** argv) {
+    uint32_t repeat = argc > 1 ? strtoul(argv[1], nullptr, 10) : DEFAULT_FIXES;
+    hostUseRealClock(true);
+    if (!benchmarkUbxParser(repeat)) {
+        printf("Not every fix was decoded\n");
+        return 1;
+    }
+    return 0;
+}
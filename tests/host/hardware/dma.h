@@ -0,0 +1,50 @@
+// Host stand-in for the Pico SDK header, only what the libraries built in tests/ use.
+// No channel is ever free, so the receive buffers fill from the UART FIFO.
+#ifndef HOST_HARDWARE_DMA_H
+#define HOST_HARDWARE_DMA_H
+
+#include "pico/stdlib.h"
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+    uint32_t ctrl;
+} dma_channel_config;
+
+typedef struct {
+    volatile uint32_t read_addr;
+    volatile uint32_t write_addr;
+    volatile uint32_t transfer_count;
+    volatile uint32_t ctrl_trig;
+} dma_channel_hw_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline int dma_claim_unused_channel(bool required) { (void)required; return -1; }
+static inline void dma_channel_unclaim(uint channel) { (void)channel; }
+static inline dma_channel_config dma_channel_get_default_config(uint channel) { (void)channel; return {0}; }
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) { (void)c; (void)size; }
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool increment) { (void)c; (void)increment; }
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool increment) { (void)c; (void)increment; }
+static inline void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits) { (void)c; (void)write; (void)size_bits; }
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) { (void)c; (void)dreq; }
+static inline void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                                         const volatile void *read_addr, uint transfer_count, bool trigger) {
+    (void)channel; (void)config; (void)write_addr; (void)read_addr; (void)transfer_count; (void)trigger;
+}
+static inline bool dma_channel_is_busy(uint channel) { (void)channel; return false; }
+static inline void dma_channel_set_trans_count(uint channel, uint32_t count, bool trigger) { (void)channel; (void)count; (void)trigger; }
+static inline void dma_channel_abort(uint channel) { (void)channel; }
+static inline dma_channel_hw_t *dma_channel_hw_addr(uint channel) {
+    (void)channel;
+    static dma_channel_hw_t hw;
+    return &hw;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_HARDWARE_DMA_H
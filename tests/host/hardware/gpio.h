@@ -0,0 +1,20 @@
+// Host stand-in for the Pico SDK header, only what the libraries built in tests/ use
+#ifndef HOST_HARDWARE_GPIO_H
+#define HOST_HARDWARE_GPIO_H
+
+#include "pico/stdlib.h"
+
+#define GPIO_FUNC_UART 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void gpio_set_function(uint gpio, uint function) { (void)gpio; (void)function; }
+static inline void gpio_pull_up(uint gpio) { (void)gpio; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_HARDWARE_GPIO_H
@@ -0,0 +1,44 @@
+// Host stand-in for the Pico SDK header, only what the libraries built in tests/ use.
+// The UART is a receive FIFO and a transmit hook, see tests/host/uart_host.cpp.
+#ifndef HOST_HARDWARE_UART_H
+#define HOST_HARDWARE_UART_H
+
+#include "pico/stdlib.h"
+
+#define NUM_UARTS 2
+
+#define UART_UARTRSR_OE_BITS 0x8u
+#define UART_UARTRSR_BE_BITS 0x4u
+#define UART_UARTRSR_PE_BITS 0x2u
+#define UART_UARTRSR_FE_BITS 0x1u
+
+typedef struct {
+    volatile uint32_t dr;
+    volatile uint32_t rsr;
+} uart_hw_t;
+
+typedef struct uart_inst uart_inst_t;
+extern uart_inst_t *const host_uarts[NUM_UARTS];
+#define uart0 (host_uarts[0])
+#define uart1 (host_uarts[1])
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate);
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+bool uart_is_readable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
+void uart_putc(uart_inst_t *uart, char c);
+void uart_tx_wait_blocking(uart_inst_t *uart);
+uart_hw_t *uart_get_hw(uart_inst_t *uart);
+uint uart_get_index(uart_inst_t *uart);
+uint uart_get_dreq(uart_inst_t *uart, bool is_tx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_HARDWARE_UART_H
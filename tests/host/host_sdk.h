@@ -0,0 +1,25 @@
+#ifndef HOST_SDK_H
+#define HOST_SDK_H
+
+#include <cstddef>
+#include <cstdint>
+#include "hardware/uart.h"
+
+// Control of the host stand-ins for the Pico SDK (tests/host)
+
+// The clock only moves when the code sleeps or a test advances it, plus a microsecond
+// per reading so polling loops always end. Benchmarks switch to the real clock.
+void hostAdvanceTime(uint64_t us);
+void hostUseRealClock(bool real);
+
+// Called after every sleep, so an emulated device can answer while the code waits
+typedef void (*HostSleepHook)();
+void hostSetSleepHook(HostSleepHook hook);
+
+// The UARTs: bytes a test puts into the receive FIFO, and a hook that sees every sent byte
+typedef void (*HostUartTxHook)(uart_inst_t *uart, char c);
+void hostUartReceive(uart_inst_t *uart, const char *data, size_t size);
+void hostSetUartTxHook(HostUartTxHook hook);
+uint hostUartBaudRate(uart_inst_t *uart);
+
+#endif // HOST_SDK_H
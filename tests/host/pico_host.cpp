@@ -0,0 +1,53 @@
+#include "pico/stdlib.h"
+#include "host_sdk.h"
+#include <chrono>
+
+static uint64_t simulated_us = 0;
+static bool real_clock = false;
+static HostSleepHook sleep_hook = nullptr;
+
+static uint64_t realTimeUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void hostAdvanceTime(uint64_t us) {
+    simulated_us += us;
+}
+
+void hostUseRealClock(bool real) {
+    real_clock = real;
+}
+
+void hostSetSleepHook(HostSleepHook hook) {
+    sleep_hook = hook;
+}
+
+extern "C" {
+
+uint64_t time_us_64(void) {
+    if (real_clock) {
+        return realTimeUs();
+    }
+    return ++simulated_us;
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+void sleep_ms(uint32_t ms) {
+    simulated_us += ms * 1000ull;
+    if (sleep_hook) {
+        sleep_hook();
+    }
+}
+
+void sleep_us(uint64_t us) {
+    simulated_us += us;
+    if (sleep_hook) {
+        sleep_hook();
+    }
+}
+
+}
@@ -0,0 +1,82 @@
+#include "hardware/uart.h"
+#include "host_sdk.h"
+#include <deque>
+
+struct uart_inst {
+    uint baudrate;
+    uart_hw_t hw;
+    std::deque<char> rx;
+};
+
+static uart_inst uarts[NUM_UARTS];
+uart_inst_t *const host_uarts[NUM_UARTS] = {&uarts[0], &uarts[1]};
+
+static HostUartTxHook tx_hook = nullptr;
+
+void hostUartReceive(uart_inst_t *uart, const char *data, size_t size) {
+    uart->rx.insert(uart->rx.end(), data, data + size);
+}
+
+void hostSetUartTxHook(HostUartTxHook hook) {
+    tx_hook = hook;
+}
+
+uint hostUartBaudRate(uart_inst_t *uart) {
+    return uart->baudrate;
+}
+
+extern "C" {
+
+uint uart_init(uart_inst_t *uart, uint baudrate) {
+    uart->baudrate = baudrate;
+    uart->rx.clear();
+    return baudrate;
+}
+
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate) {
+    uart->baudrate = baudrate;
+    return baudrate;
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled) {
+    (void)uart;
+    (void)enabled;
+}
+
+bool uart_is_readable(uart_inst_t *uart) {
+    return !uart->rx.empty();
+}
+
+char uart_getc(uart_inst_t *uart) {
+    if (uart->rx.empty()) {
+        return 0;
+    }
+    char c = uart->rx.front();
+    uart->rx.pop_front();
+    return c;
+}
+
+void uart_putc(uart_inst_t *uart, char c) {
+    if (tx_hook) {
+        tx_hook(uart, c);
+    }
+}
+
+void uart_tx_wait_blocking(uart_inst_t *uart) {
+    (void)uart;
+}
+
+uart_hw_t *uart_get_hw(uart_inst_t *uart) {
+    return &uart->hw;
+}
+
+uint uart_get_index(uart_inst_t *uart) {
+    return uart == host_uarts[0] ? 0 : 1;
+}
+
+uint uart_get_dreq(uart_inst_t *uart, bool is_tx) {
+    (void)is_tx;
+    return uart_get_index(uart);
+}
+
+}
@@ -0,0 +1,19 @@
+#ifndef NMEA_CORPUS_H
+#define NMEA_CORPUS_H
+
+// One epoch of a u-blox receiver on a bike ride with every decoded type, for the GPS parser
+// benchmarks
+static const char nmea_benchmark_corpus[] =
+    "$GNRMC,101530.00,A,4812.39721,N,01537.05083,E,4.215,87.52,160524,,,A*47\r\n"
+    "$GNVTG,87.52,T,,M,4.215,N,7.807,K,A*11\r\n"
+    "$GNGGA,101530.00,4812.39721,N,01537.05083,E,1,09,1.12,268.4,M,44.6,M,,*4E\r\n"
+    "$GNGSA,A,3,05,13,15,18,23,24,,,,,,,1.98,1.12,1.63*17\r\n"
+    "$GNGSA,A,3,68,78,79,,,,,,,,,,1.98,1.12,1.63*15\r\n"
+    "$GPGSV,3,1,11,05,42,292,38,10,05,023,,13,64,178,41,15,37,229,36*78\r\n"
+    "$GPGSV,3,2,11,18,22,312,33,20,08,121,,23,29,066,35,24,48,093,40*71\r\n"
+    "$GPGSV,3,3,11,29,02,331,,30,10,185,24,32,04,146,*4F\r\n"
+    "$GLGSV,1,1,04,68,35,066,31,78,61,288,37,79,48,185,33,88,05,341,*68\r\n"
+    "$GNGLL,4812.39721,N,01537.05083,E,101530.00,A,A*7E\r\n"
+    "$GNTXT,01,01,02,ANTSTATUS=OK*25\r\n";
+
+#endif // NMEA_CORPUS_H
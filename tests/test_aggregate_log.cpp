@@ -0,0 +1,99 @@
+// AggregateLog: one entry per minute with the means, maxima and the last fix of its
+// readings, written when the next minute starts or on flush()
+#include <vector>
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "aggregate_log.h"
+#include "test_util.h"
+
+#define MINUTE 1776326400u              // Start of a minute (Unix time)
+
+static SensorData reading(uint32_t timestamp, float temp, uint16_t pm2_5, bool fix) {
+    SensorData data = {};
+    data.timestamp = timestamp;
+    data.temp = temp;
+    data.hum = 50.0f;
+    data.pres = 980.0f;
+    data.co2 = 600;
+    data.pm1_0 = pm2_5 / 2;
+    data.pm2_5 = pm2_5;
+    data.pm10 = pm2_5 * 2;
+    data.battery_mv = 4000 - (uint16_t)(timestamp % 60);
+    if (fix) {
+        data.sensor_status = SENSOR_STATUS_GPS_FIX;
+        data.latitude = 482000000 + timestamp % 60;
+        data.longitude = 156000000;
+    }
+    return data;
+}
+
+static std::vector<AggregateRecord> records(FlashStream& stream) {
+    std::vector<AggregateRecord> result;
+    FlashStreamCursor cursor = stream.entries();
+    FlashStreamEntry entry;
+    AggregateRecord record;
+    while (cursor.next(entry)) {
+        CHECK(AggregateLog::decode(entry, record));
+        result.push_back(record);
+    }
+    return result;
+}
+
+int main() {
+    EmulatedFlashHal hal;
+    FlashStream stream("aggregates", FLASH_STREAM_AGGREGATES, 0x100000, 4, &hal);
+    stream.setDebugLevel(0);
+    stream.setUploadTracking(false);
+    CHECK(stream.init());
+    AggregateLog log(stream);
+
+    // Six readings 10 s apart, the fix is lost for the last two
+    const float temps[] = {20.0f, 20.5f, 21.0f, 21.5f, 22.0f, 22.5f};
+    const uint16_t pm2_5[] = {4, 6, 8, 30, 6, 6};
+    for (int i = 0; i < 6; i++) {
+        CHECK(log.add(reading(MINUTE + 5 + i * 10, temps[i], pm2_5[i], i < 4)));
+    }
+    CHECK(stream.getEntryCount() == 0);
+
+    // The first reading of the next minute writes the previous one
+    CHECK(log.add(reading(MINUTE + 60, 18.0f, 10, true)));
+    CHECK(stream.getEntryCount() == 1);
+    std::vector<AggregateRecord> stored = records(stream);
+    CHECK(stored.size() == 1);
+    const AggregateRecord& first = stored[0];
+    CHECK(first.timestamp == MINUTE);
+    CHECK(first.samples == 6 && first.fix_samples == 4);
+    CHECK(first.temp == 2125);
+    CHECK(first.hum == 5000 && first.pres == 9800 && first.co2 == 600);
+    CHECK(first.pm2_5 == 10 && first.pm2_5_max == 30);
+    CHECK(first.pm1_0 == 5);                    // (2 + 3 + 4 + 15 + 3 + 3) / 6
+    CHECK(first.pm10 == 20 && first.pm10_max == 60);
+    CHECK(first.battery_mv == 4000 - 55);       // Lowest of the minute
+    CHECK(first.latitude == 482000000 + 35 && first.longitude == 156000000);   // Last fix
+
+    // A gap of minutes writes no empty entries, readings without a battery value or fix
+    // leave those fields 0
+    SensorData quiet = reading(MINUTE + 5 * 60 + 1, -5.25f, 2, false);
+    quiet.battery_mv = 0;
+    CHECK(log.add(quiet));
+    CHECK(log.flush());
+    CHECK(log.flush());                         // Nothing in progress, nothing written
+    stored = records(stream);
+    CHECK(stored.size() == 3);
+    CHECK(stored[1].timestamp == MINUTE + 60 && stored[1].samples == 1 && stored[1].temp == 1800);
+    CHECK(stored[2].timestamp == MINUTE + 5 * 60 && stored[2].samples == 1);
+    CHECK(stored[2].temp == -525);
+    CHECK(stored[2].battery_mv == 0);
+    CHECK(stored[2].fix_samples == 0 && stored[2].latitude == 0 && stored[2].longitude == 0);
+
+    // After a restart the aggregates are still there
+    FlashStream restarted("aggregates", FLASH_STREAM_AGGREGATES, 0x100000, 4, &hal);
+    restarted.setDebugLevel(0);
+    restarted.setUploadTracking(false);
+    CHECK(restarted.init());
+    CHECK(restarted.getEntryCount() == 3);
+    CHECK(restarted.getPendingCount() == 0);
+    CHECK(records(restarted).size() == 3);
+
+    return testResult("aggregate_log");
+}
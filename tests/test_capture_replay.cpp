@@ -0,0 +1,112 @@
+// A raw capture written by RawCapture into a flash image must come out of capture_to_replay
+// as replay traces holding every captured sentence and the decoded sensor frames
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include "flash_hal_emulator.h"
+#include "flash_stream.h"
+#include "raw_capture.h"
+#include "host_sdk.h"
+#include "libs/bme688/api/BME68x_SensorAPI/bme68x_defs.h"
+#include "libs/replay/trace_replay.h"
+#include "test_util.h"
+
+// Frame sizes of the drivers, whose headers need the I2C hardware
+#define BME688_CALIB_DUMP_SIZE (BME68X_LEN_COEFF_ALL + 1)
+#define BME688_FIELD_DUMP_SIZE BME68X_LEN_FIELD
+#define HM3301_FRAME_SIZE 29
+
+#define CAPTURE_SECONDS   120
+#define CHUNK_BYTES       40            // GPS bytes per UART read
+#define CHUNK_US          30000
+
+static std::string sentence(const char *body) {
+    unsigned char checksum = 0;
+    for (const char *p = body; *p; p++) {
+        checksum ^= *p;
+    }
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "$%s*%02X\r\n", body, checksum);
+    return buffer;
+}
+
+int main() {
+    EmulatedFlashHal hal;
+    FlashStream stream("capture", FLASH_STREAM_CAPTURE, 0x100000, 16, &hal);
+    stream.setDebugLevel(0);
+    CHECK(stream.init());
+    RawCapture capture(stream);
+
+    uint8_t calib[BME688_CALIB_DUMP_SIZE];
+    for (int i = 0; i < BME688_CALIB_DUMP_SIZE; i++) {
+        calib[i] = (uint8_t)(i * 5 + 1);
+    }
+    calib[BME688_CALIB_DUMP_SIZE - 1] = 0;  // Variant id
+    capture.setStaticFrame(CAPTURE_BME688_CALIB, calib, sizeof(calib));
+
+    hostAdvanceTime(5000000);
+    capture.start();
+    // The capture starts in the middle of a sentence, the converter drops the fragment
+    capture.addGps("87,N*3A\r\n", 9);
+    uint32_t sent = 0;
+    for (int second = 0; second < CAPTURE_SECONDS; second++) {
+        char body[100];
+        snprintf(body, sizeof(body), "GNRMC,10%02d%02d.00,A,4812.0000,N,01537.0000,E,1.0,0.0,160126,,,A",
+                 second / 60, second % 60);
+        std::string text = sentence(body);
+        snprintf(body, sizeof(body), "GNGGA,10%02d%02d.00,4812.0000,N,01537.0000,E,1,08,0.9,300.0,M,45.0,M,,",
+                 second / 60, second % 60);
+        text += sentence(body);
+        sent += 2;
+        uint32_t chunks = 0;
+        for (size_t offset = 0; offset < text.size(); offset += CHUNK_BYTES) {
+            size_t size = text.size() - offset < CHUNK_BYTES ? text.size() - offset : CHUNK_BYTES;
+            capture.addGps(text.data() + offset, size);
+            hostAdvanceTime(CHUNK_US);
+            chunks++;
+        }
+        if (second % 3 == 0) {
+            uint8_t hm3301[HM3301_FRAME_SIZE] = {};
+            hm3301[7] = 5;      // PM1.0
+            hm3301[9] = 8;      // PM2.5
+            hm3301[11] = 12;    // PM10
+            capture.addFrame(CAPTURE_HM3301, hm3301, sizeof(hm3301));
+            uint8_t co2[3] = {0x10, 0x02, 0x58};    // Fresh reading, 600 ppm
+            capture.addFrame(CAPTURE_PAS_CO2, co2, sizeof(co2));
+            uint8_t field[BME688_FIELD_DUMP_SIZE] = {0x80, 0, 0x50, 0, 0, 0x80, 0, 0, 0x60, 0,
+                                                     0, 0, 0, 0x40, 0x30, 0x40, 0x30};
+            capture.addFrame(CAPTURE_BME688, field, sizeof(field));
+        }
+        hostAdvanceTime(1000000 - CHUNK_US * chunks);
+        capture.update();
+    }
+    capture.stop();
+    CHECK(capture.stats().dropped_bytes == 0);
+    CHECK(capture.stats().write_failures == 0);
+
+    std::string image = std::string(TEST_OUTPUT_DIR) + "/capture.bin";
+    std::string prefix = std::string(TEST_OUTPUT_DIR) + "/capture";
+    CHECK(hal.saveImage(image.c_str()));
+    std::string command = std::string(CAPTURE_TO_REPLAY) + " " + image + " " + prefix;
+    CHECK(system(command.c_str()) == 0);
+
+    ReplayClock clock(0);
+    NmeaTraceReplay nmea(clock, 0);
+    SensorTraceReplay sensors(clock);
+    CHECK(nmea.load((prefix + ".nmea").c_str()));
+    CHECK(sensors.load((prefix + ".csv").c_str()));
+    CHECK(nmea.sentenceCount() == sent);
+    CHECK(nmea.durationMs() >= (CAPTURE_SECONDS - 1) * 1000);
+    CHECK(sensors.sampleCount() == CAPTURE_SECONDS / 3);
+
+    clock.advance(CAPTURE_SECONDS * 1000 / 2);
+    SensorData data;
+    CHECK(sensors.read(data));
+    CHECK(data.pm2_5 == 8);
+    CHECK(data.pm10 == 12);
+    CHECK(data.co2 == 600);
+    // Only decoded when the calibration frame reached the converter
+    CHECK(data.temp != 0 && std::isfinite(data.temp));
+
+    return testResult("capture_replay");
+}
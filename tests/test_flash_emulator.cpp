@@ -0,0 +1,75 @@
+// EmulatedFlashHal: NOR bit semantics, alignment checks, erase counters, cost model and images
+#include <cstdio>
+#include <cstring>
+#include "flash_hal_emulator.h"
+#include "test_util.h"
+
+int main() {
+    FlashCostModel cost;
+    EmulatedFlashHal hal(64 * 1024, cost);
+    CHECK(hal.size() == 64 * 1024);
+    CHECK(hal.map(0)[0] == 0xFF);
+
+    // Programming only clears bits, a second program ANDs with the contents
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xF0, sizeof(page));
+    CHECK(hal.program(FLASH_SECTOR_SIZE, page, sizeof(page)));
+    memset(page, 0x3C, sizeof(page));
+    CHECK(hal.program(FLASH_SECTOR_SIZE, page, sizeof(page)));
+    CHECK(hal.map(FLASH_SECTOR_SIZE)[0] == 0x30);
+    CHECK(hal.map(FLASH_SECTOR_SIZE)[FLASH_PAGE_SIZE] == 0xFF);
+
+    // Erase sets the whole sector back to 0xFF and counts the cycle
+    CHECK(hal.erase(FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE));
+    CHECK(hal.map(FLASH_SECTOR_SIZE)[0] == 0xFF);
+    CHECK(hal.eraseCount(1) == 1);
+    CHECK(hal.eraseCount(0) == 0);
+    CHECK(hal.erase(0, 2 * FLASH_SECTOR_SIZE));
+    CHECK(hal.eraseCount(1) == 2);
+    CHECK(hal.maxEraseCount() == 2);
+
+    // Misaligned or out of range calls are rejected and change nothing
+    hal.resetStats();
+    CHECK(!hal.erase(100, FLASH_SECTOR_SIZE));
+    CHECK(!hal.erase(0, 100));
+    CHECK(!hal.program(10, page, sizeof(page)));
+    CHECK(!hal.program(0, page, 10));
+    CHECK(!hal.program(64 * 1024, page, sizeof(page)));
+    CHECK(hal.stats().rejected_calls == 5);
+    CHECK(hal.stats().erase_calls == 0);
+    CHECK(hal.stats().program_calls == 0);
+    CHECK(hal.map(0)[10] == 0xFF);
+
+    // Every call is charged against the cost model
+    hal.resetStats();
+    CHECK(hal.erase(0, 2 * FLASH_SECTOR_SIZE));
+    uint8_t pages[4 * FLASH_PAGE_SIZE];
+    memset(pages, 0, sizeof(pages));
+    CHECK(hal.program(0, pages, sizeof(pages)));
+    const FlashEmulatorStats& stats = hal.stats();
+    CHECK(stats.erase_calls == 1);
+    CHECK(stats.sectors_erased == 2);
+    CHECK(stats.program_calls == 1);
+    CHECK(stats.pages_programmed == 4);
+    CHECK(stats.bytes_programmed == sizeof(pages));
+    uint32_t erase_us = cost.call_overhead_us + 2 * cost.sector_erase_us;
+    uint32_t program_us = cost.call_overhead_us + 4 * cost.page_program_us;
+    CHECK(stats.busy_us == erase_us + program_us);
+    CHECK(stats.worst_call_us == erase_us);
+
+    // The contents survive a save and load, a shorter image leaves the rest erased
+    const char* path = "test_flash_emulator.img";
+    CHECK(hal.saveImage(path));
+    EmulatedFlashHal loaded(64 * 1024);
+    CHECK(loaded.loadImage(path));
+    CHECK(memcmp(loaded.map(0), hal.map(0), 64 * 1024) == 0);
+    EmulatedFlashHal larger(128 * 1024);
+    memset(larger.raw(100 * 1024), 0, 16);
+    CHECK(larger.loadImage(path));
+    CHECK(larger.map(0)[0] == 0x00);
+    CHECK(larger.map(100 * 1024)[0] == 0xFF);
+    CHECK(!loaded.loadImage("does/not/exist.img"));
+    remove(path);
+
+    return testResult("test_flash_emulator");
+}
@@ -0,0 +1,77 @@
+// Erase-ahead: with a reserve of erased sectors no append has to erase after the journal
+// wrapped, for both record formats and both retention policies
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "test_util.h"
+
+#define TEST_BATCHES 1500
+
+static void run(bool erase_ahead, int policy, bool compressed) {
+    EmulatedFlashHal hal;
+    hal.setImageEnd(1792 * 1024);   // Small region, both formats wrap several times
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    CHECK(flash.init());
+    flash.setRetentionPolicy(policy);
+    flash.setCompressionEnabled(compressed);
+    flash.setEraseAheadSectors(erase_ahead ? 1 : 0);
+
+    std::vector<SensorData> batch(10);
+    uint32_t timestamp = 1700000000;
+    uint32_t worst_append_us = 0;
+    for (int round = 0; round < TEST_BATCHES; round++) {
+        for (SensorData& data : batch) {
+            data.timestamp = ++timestamp;
+            data.temp = 20 + (timestamp % 50) / 10.0f;
+        }
+        hal.resetStats();
+        CHECK(flash.saveSensorDataBatch(batch));
+        if (hal.stats().worst_call_us > worst_append_us) {
+            worst_append_us = hal.stats().worst_call_us;
+        }
+        if (policy == FLASH_RETENTION_KEEP_UNUPLOADED && round % 40 == 39) {
+            flash.markUploaded(flash.getPendingCount());
+        }
+        // The main loop calls it when the writer is idle, once per iteration
+        flash.eraseAhead();
+    }
+
+    printf("erase ahead %d, policy %d, compressed %d: %u sync erases, %u ahead, slowest append call %u us\n",
+           erase_ahead, policy, compressed, flash.getSyncEraseCount(), flash.getEraseAheadCount(), worst_append_us);
+    if (erase_ahead) {
+        CHECK(flash.getSyncEraseCount() == 0);
+        CHECK(flash.getEraseAheadCount() > 0);
+        CHECK(worst_append_us < FlashCostModel().sector_erase_us);
+    } else {
+        CHECK(flash.getSyncEraseCount() > 0);
+        CHECK(worst_append_us >= FlashCostModel().sector_erase_us);
+    }
+
+    // The reclaimed sectors never took records that are still in the journal
+    Flash restarted(0, &hal);
+    restarted.setDebugLevel(0);
+    CHECK(restarted.init());
+    FlashRecordCursor cursor = restarted.records();
+    SensorData data;
+    uint32_t read = 0, previous = 0, out_of_order = 0;
+    while (cursor.next(data)) {
+        if (data.timestamp <= previous) {
+            out_of_order++;
+        }
+        previous = data.timestamp;
+        read++;
+    }
+    CHECK(read > 0);
+    CHECK(out_of_order == 0);
+    CHECK(previous == timestamp);
+}
+
+int main() {
+    for (int policy : {FLASH_RETENTION_OVERWRITE_OLDEST, FLASH_RETENTION_KEEP_UNUPLOADED}) {
+        for (bool compressed : {false, true}) {
+            run(false, policy, compressed);
+            run(true, policy, compressed);
+        }
+    }
+    return testResult("test_flash_erase_ahead");
+}
@@ -0,0 +1,54 @@
+// Journal appends on the flash emulator: erases per record in steady state and the
+// record count rebuilt by init() after a restart
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "test_util.h"
+
+int main() {
+    EmulatedFlashHal hal;
+    hal.setImageEnd(512 * 1024);
+
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    flash.setCompressionEnabled(false);
+    CHECK(flash.init());
+    uint32_t capacity = flash.getMaxDataCount();
+    CHECK(capacity > 0);
+
+    // Fill the journal once so the measured laps reuse (and erase) every sector
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        CHECK(flash.saveSensorData(testRecord(next++)));
+    }
+
+    // Before the journal every save erased the record sector and the count sector (2 erases
+    // per record). Now a sector is erased when it is opened, once per JOURNAL_RECORDS_PER_SECTOR
+    // records, plus the occasional upload log sector for the wear entries.
+    hal.resetStats();
+    uint32_t measured = 2 * capacity;
+    for (uint32_t i = 0; i < measured; i++) {
+        CHECK(flash.saveSensorData(testRecord(next++)));
+    }
+    double per_record = (double)hal.stats().sectors_erased / measured;
+    double expected = 1.0 / JOURNAL_RECORDS_PER_SECTOR;
+    printf("FLASH: %u records, %u sectors erased, %.5f erases per record (1/%.1f, expected 1/%u)\n",
+           measured, hal.stats().sectors_erased, per_record, 1.0 / per_record,
+           (unsigned)JOURNAL_RECORDS_PER_SECTOR);
+    CHECK(per_record >= 0.9 * expected);
+    CHECK(per_record <= 1.1 * expected);
+
+    // Every record is one program call of whole pages, no read-modify-write of a sector
+    CHECK(hal.stats().program_calls >= measured);
+    CHECK(hal.stats().rejected_calls == 0);
+
+    // A restart rebuilds the count and the newest record from the sector headers
+    Flash restarted(0, &hal);
+    restarted.setDebugLevel(0);
+    CHECK(restarted.init());
+    CHECK(restarted.getStoredCount() == flash.getStoredCount());
+    SensorData newest = restarted.loadSensorData(restarted.getStoredCount() - 1);
+    CHECK(newest.timestamp == testRecord(next - 1).timestamp);
+    CHECK(newest.co2 == testRecord(next - 1).co2);
+
+    return testResult("test_flash_journal");
+}
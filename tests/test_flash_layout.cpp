@@ -0,0 +1,133 @@
+// Changing the sectors reserved after the journal (aggregate, event and capture pools)
+// must not cost stored records: the region keeps its end until the storage is erased
+// and the pools are placed above it, as pico_eu does
+#include "flash.h"
+#include "flash_stream.h"
+#include "flash_hal_emulator.h"
+#include "test_util.h"
+
+#define AGGREGATE_SECTORS 8
+#define EVENT_SECTORS     4
+#define CAPTURE_SECTORS   64
+
+struct Storage {
+    Flash flash;
+    FlashStream aggregates;
+    FlashStream events;
+    FlashStream capture;
+
+    Storage(EmulatedFlashHal& hal, uint32_t aggregate_sectors, uint32_t event_sectors, uint32_t capture_sectors)
+        : flash(0, &hal, aggregate_sectors + event_sectors + capture_sectors),
+          aggregates("aggregates", 1, 0, 0, &hal), events("events", 2, 0, 0, &hal),
+          capture("capture", 4, 0, 0, &hal) {
+        flash.setDebugLevel(0);
+        CHECK(flash.init());
+        aggregates.setDebugLevel(0);
+        events.setDebugLevel(0);
+        capture.setDebugLevel(0);
+        aggregates.setPool(flash.getRegionEnd(), aggregate_sectors);
+        events.setPool(aggregates.endAddress(), event_sectors);
+        capture.setPool(events.endAddress(), capture_sectors);
+        aggregates.init();
+        events.init();
+        if (capture_sectors > 0) {
+            capture.init();
+        }
+    }
+};
+
+// Append to the pools until they wrapped, which erases every pool sector
+static void fillPools(Storage& storage, bool capture) {
+    uint8_t payload[STREAM_MAX_PAYLOAD] = {};
+    for (int i = 0; i < 3000; i++) {
+        storage.aggregates.append(1, payload, sizeof(payload));
+        storage.events.append(1, payload, sizeof(payload));
+        if (capture) {
+            storage.capture.append(1, payload, sizeof(payload));
+        }
+    }
+}
+
+// Check that the journal holds records 0..count-1
+static void checkRecords(Flash& flash, uint32_t count) {
+    CHECK(flash.getStoredCount() == count);
+    FlashRecordCursor cursor = flash.records();
+    SensorData data;
+    uint32_t read = 0;
+    while (cursor.next(data)) {
+        CHECK(data.timestamp == testRecord(read).timestamp);
+        read++;
+    }
+    CHECK(read == count);
+}
+
+int main() {
+    EmulatedFlashHal hal;
+    hal.setImageEnd(512 * 1024);
+    uint32_t count = 2000;
+    uint32_t formatted_end;
+    {
+        Storage storage(hal, AGGREGATE_SECTORS, EVENT_SECTORS, 0);
+        for (uint32_t i = 0; i < count; i++) {
+            CHECK(storage.flash.saveSensorData(testRecord(i)));
+        }
+        storage.flash.markUploaded(500);
+        fillPools(storage, false);
+        formatted_end = storage.flash.getRegionEnd();
+    }
+
+    // RAW_CAPTURE on: 64 more sectors reserved. The region keeps its end, the capture pool
+    // has no room left and is cut to nothing.
+    {
+        Storage storage(hal, AGGREGATE_SECTORS, EVENT_SECTORS, CAPTURE_SECTORS);
+        CHECK(storage.flash.getRegionEnd() == formatted_end);
+        checkRecords(storage.flash, count);
+        CHECK(storage.flash.getUploadedCount() == 500);
+        CHECK(storage.capture.endAddress() == storage.events.endAddress());
+        CHECK(storage.events.endAddress() == hal.size());
+        fillPools(storage, false);
+        for (uint32_t i = count; i < count + 100; i++) {
+            CHECK(storage.flash.saveSensorData(testRecord(i)));
+        }
+        count += 100;
+    }
+
+    // And off again: the configured end is the formatted one
+    {
+        Storage storage(hal, AGGREGATE_SECTORS, EVENT_SECTORS, 0);
+        CHECK(storage.flash.getRegionEnd() == formatted_end);
+        checkRecords(storage.flash, count);
+    }
+
+    // Smaller pools: the configured header sector lies in the old aggregate pool
+    {
+        Storage storage(hal, 2, 2, 0);
+        CHECK(storage.flash.getRegionEnd() == formatted_end);
+        checkRecords(storage.flash, count);
+        CHECK(storage.aggregates.getEntryCount() > 0);
+        fillPools(storage, false);
+    }
+
+    // Larger aggregate pool
+    {
+        Storage storage(hal, 16, EVENT_SECTORS, 0);
+        CHECK(storage.flash.getRegionEnd() == formatted_end);
+        checkRecords(storage.flash, count);
+        fillPools(storage, false);
+
+        // Erasing the storage moves the region to the configured end and drops the old header
+        CHECK(storage.flash.eraseStorage());
+        CHECK(storage.flash.getRegionEnd() == hal.size() - (16 + EVENT_SECTORS) * FLASH_SECTOR_SIZE);
+        CHECK(storage.flash.getStoredCount() == 0);
+        for (uint32_t i = 0; i < 10; i++) {
+            CHECK(storage.flash.saveSensorData(testRecord(i)));
+        }
+    }
+    {
+        Storage storage(hal, 16, EVENT_SECTORS, 0);
+        CHECK(storage.flash.getRegionEnd() == hal.size() - (16 + EVENT_SECTORS) * FLASH_SECTOR_SIZE);
+        checkRecords(storage.flash, 10);
+    }
+
+    return testResult("test_flash_layout");
+}
@@ -0,0 +1,238 @@
+// Journal on the flash emulator across restarts: rebuild of both record formats,
+// a save torn by a power loss and the persisted wear counters
+#include <cmath>
+#include "flash.h"
+#include "crc32.h"
+#include "flash_hal_emulator.h"
+#include "test_util.h"
+
+// Emulator that loses power during a program call: only the first half of the data
+// reaches the flash, every later call fails until restore()
+class TornFlashHal : public EmulatedFlashHal {
+public:
+    void tearAfter(uint32_t calls) { _calls_left = calls; _armed = true; }
+    void restore() { _armed = false; _dead = false; }
+
+    bool program(uint32_t address, const uint8_t* data, size_t size) override {
+        if (_dead) {
+            return false;
+        }
+        if (_armed && _calls_left-- == 0) {
+            std::vector<uint8_t> partial(data, data + size);
+            std::fill(partial.begin() + size / 2, partial.end(), 0xFF);
+            EmulatedFlashHal::program(address, partial.data(), size);
+            _dead = true;
+            return false;
+        }
+        return EmulatedFlashHal::program(address, data, size);
+    }
+
+    bool erase(uint32_t address, size_t size) override {
+        return _dead ? false : EmulatedFlashHal::erase(address, size);
+    }
+
+private:
+    uint32_t _calls_left = 0;
+    bool _armed = false;
+    bool _dead = false;
+};
+
+// Equal within the quantization of the delta format
+static bool sameRecord(const SensorData& a, const SensorData& b) {
+    return a.timestamp == b.timestamp && a.latitude == b.latitude && a.longitude == b.longitude &&
+           fabsf(a.temp - b.temp) < 0.006f && fabsf(a.hum - b.hum) < 0.006f &&
+           fabsf(a.pres - b.pres) < 0.006f && fabsf(a.gasRes - b.gasRes) < 0.6f &&
+           a.pm2_5 == b.pm2_5 && a.pm10 == b.pm10 && a.co2 == b.co2 && a.fix_type == b.fix_type;
+}
+
+// Check that a fresh Flash on hal finds records 0..count-1. Discarded records keep their
+// slot in the count and are skipped by the cursor, torn is set if there may be some.
+static void checkRebuild(FlashHal& hal, bool compressed, uint32_t count, bool torn = false) {
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    flash.setCompressionEnabled(compressed);
+    CHECK(flash.init());
+    CHECK(torn ? flash.getStoredCount() >= count : flash.getStoredCount() == count);
+
+    FlashRecordCursor cursor = flash.records();
+    SensorData data;
+    uint32_t read = 0, bad = 0;
+    while (cursor.next(data)) {
+        if (!sameRecord(data, testRecord(read))) {
+            bad++;
+        }
+        read++;
+    }
+    CHECK(read == count);
+    CHECK(bad == 0);
+    CHECK(torn || cursor.skippedCount() == 0);
+}
+
+static void testRebuild(bool compressed) {
+    EmulatedFlashHal hal;
+    hal.setImageEnd(512 * 1024);
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    flash.setCompressionEnabled(compressed);
+    CHECK(flash.init());
+
+    // Single saves and batches, crossing several sectors
+    std::vector<SensorData> batch;
+    uint32_t count = 0;
+    for (; count < 300; count++) {
+        CHECK(flash.saveSensorData(testRecord(count)));
+    }
+    for (int round = 0; round < 50; round++) {
+        batch.clear();
+        for (int i = 0; i < 10; i++) {
+            batch.push_back(testRecord(count++));
+        }
+        CHECK(flash.saveSensorDataBatch(batch));
+    }
+    checkRebuild(hal, compressed, count);
+}
+
+static void testTornWrite(bool compressed) {
+    TornFlashHal hal;
+    hal.setImageEnd(512 * 1024);
+    {
+        Flash flash(0, &hal);
+        flash.setDebugLevel(0);
+        flash.setCompressionEnabled(compressed);
+        CHECK(flash.init());
+        for (uint32_t i = 0; i < 100; i++) {
+            CHECK(flash.saveSensorData(testRecord(i)));
+        }
+
+        // Power fails while the batch is programmed, nothing of it may show up later
+        std::vector<SensorData> batch;
+        for (uint32_t i = 100; i < 110; i++) {
+            batch.push_back(testRecord(i));
+        }
+        hal.tearAfter(0);
+        CHECK(!flash.saveSensorDataBatch(batch));
+    }
+    hal.restore();
+    checkRebuild(hal, compressed, 100, true);
+
+    // Appending after the torn write continues the journal
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    flash.setCompressionEnabled(compressed);
+    CHECK(flash.init());
+    for (uint32_t i = 100; i < 120; i++) {
+        CHECK(flash.saveSensorData(testRecord(i)));
+    }
+    checkRebuild(hal, compressed, 120, true);
+}
+
+static void testWearCounters() {
+    EmulatedFlashHal hal;
+    hal.setImageEnd(1536 * 1024);
+    uint32_t saved_erases;
+    {
+        Flash flash(0, &hal);
+        flash.setDebugLevel(0);
+        CHECK(flash.init());
+        uint32_t records = 3 * flash.getMaxDataCount();
+        for (uint32_t i = 0; i < records; i++) {
+            CHECK(flash.saveSensorData(testRecord(i)));
+        }
+
+        // The region counters follow the erases the emulator saw
+        FlashWearStats stats = flash.getStats();
+        CHECK(stats.total_erases == hal.stats().sectors_erased);
+        CHECK(stats.max_erase_count == hal.maxEraseCount());
+        CHECK(stats.write_amplification >= 1.0f);
+        saved_erases = stats.total_erases;
+    }
+
+    // After a restart at most the erases since the last wear entry are missing
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    CHECK(flash.init());
+    FlashWearStats stats = flash.getStats();
+    CHECK(stats.total_erases <= saved_erases);
+    CHECK(stats.total_erases + FLASH_WEAR_SAVE_SECTORS + FLASH_UPLOAD_LOG_SECTORS >= saved_erases);
+    CHECK(stats.session_erases == 0);
+}
+
+// Wear entry of older firmware: 16 bit counters, all stopped at 0xFFFF
+static void writeWearEntryV1(EmulatedFlashHal& hal, uint32_t address, uint32_t sectors) {
+    std::vector<uint16_t> counters(sectors, 0xFFFF);
+    WearLogEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.marker = WEAR_LOG_MARKER_V1;
+    entry.serial = 1000;
+    entry.sector_count = sectors;
+    entry.counts_crc = crc32Compute(counters.data(), sectors * sizeof(uint16_t));
+    entry.crc = crc32Compute(&entry, offsetof(WearLogEntry, crc));
+
+    std::vector<uint8_t> pages(FLASH_SECTOR_SIZE, 0xFF);
+    memcpy(pages.data(), &entry, sizeof(entry));
+    memcpy(pages.data() + sizeof(entry), counters.data(), sectors * sizeof(uint16_t));
+    CHECK(hal.program(address, pages.data(), pages.size()));
+}
+
+static void testWearCountersPast16Bit() {
+    EmulatedFlashHal hal;
+    hal.setImageEnd(1536 * 1024);
+    uint32_t sectors, region_end;
+    {
+        Flash flash(0, &hal);
+        flash.setDebugLevel(0);
+        CHECK(flash.init());
+        sectors = flash.getRegionSectors();
+        region_end = flash.getRegionEnd();
+    }
+    // Formatting wrote to the first log sector, the second one (right below the region
+    // header) is erased
+    writeWearEntryV1(hal, region_end - 2 * FLASH_SECTOR_SIZE, sectors);
+
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    CHECK(flash.init());
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        CHECK(flash.getEraseCount(sector) == 0xFFFF);
+    }
+
+    uint32_t records = 4 * flash.getMaxDataCount();
+    for (uint32_t i = 0; i < records; i++) {
+        CHECK(flash.saveSensorData(testRecord(i)));
+    }
+
+    // Every journal and log sector counted past 0xFFFF, the estimate includes all of them
+    uint32_t uptime_ms = 3600000;
+    float expected_days = -1.0f;
+    for (uint32_t sector = 1; sector < sectors; sector++) {
+        uint32_t count = flash.getEraseCount(sector);
+        CHECK(count > 0xFFFF);
+        float erases_per_day = (count - 0xFFFF) * (86400000.0f / uptime_ms);
+        float days = (FLASH_RATED_ERASE_CYCLES - count) / erases_per_day;
+        if (expected_days < 0.0f || days < expected_days) {
+            expected_days = days;
+        }
+    }
+    float days = flash.estimateLifetimeDays(uptime_ms);
+    CHECK(days > 0.0f && fabsf(days - expected_days) <= 0.001f * expected_days);
+    FlashWearStats stats = flash.getStats();
+    CHECK(stats.max_erase_count > 0xFFFF);
+
+    // The counters are saved in the 32 bit format and come back after a restart
+    Flash restarted(0, &hal);
+    restarted.setDebugLevel(0);
+    CHECK(restarted.init());
+    CHECK(restarted.getStats().max_erase_count > 0xFFFF);
+    CHECK(restarted.getStats().total_erases <= stats.total_erases);
+    CHECK(restarted.getStats().total_erases + FLASH_WEAR_SAVE_SECTORS + FLASH_UPLOAD_LOG_SECTORS >= stats.total_erases);
+}
+
+int main() {
+    testRebuild(false);
+    testRebuild(true);
+    testTornWrite(false);
+    testTornWrite(true);
+    testWearCounters();
+    testWearCountersPast16Bit();
+    return testResult("test_flash_recovery");
+}
@@ -0,0 +1,209 @@
+// FlashStream pools: wrap under both retention policies, markUploaded(), the state
+// rebuilt by init() after a restart, pools without upload tracking, and EventLog on top
+#include <cstring>
+#include <vector>
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "flash_stream.h"
+#include "event_log.h"
+#include "test_util.h"
+
+#define POOL_ADDRESS 0x100000
+#define POOL_SECTORS 4
+#define TEST_TYPE 9
+
+struct TestEntry {
+    uint32_t index;
+    uint8_t filler[24];
+};
+
+static const uint32_t per_sector = (FLASH_SECTOR_SIZE - sizeof(StreamSectorHeader)) /
+                                   (sizeof(StreamEntryHeader) + sizeof(TestEntry));
+
+static FlashStream* openStream(EmulatedFlashHal& hal, int policy, bool track_uploads = true) {
+    FlashStream* stream = new FlashStream("test", FLASH_STREAM_EVENTS, POOL_ADDRESS, POOL_SECTORS, &hal);
+    stream->setDebugLevel(0);
+    stream->setRetentionPolicy(policy);
+    stream->setUploadTracking(track_uploads);
+    CHECK(stream->init());
+    return stream;
+}
+
+static bool append(FlashStream& stream, uint32_t index) {
+    TestEntry entry;
+    entry.index = index;
+    for (uint32_t i = 0; i < sizeof(entry.filler); i++) {
+        entry.filler[i] = (uint8_t)(index + i);
+    }
+    return stream.append(TEST_TYPE, &entry, sizeof(entry));
+}
+
+// Indices of the entries of a cursor, oldest first
+static std::vector<uint32_t> indices(FlashStreamCursor cursor) {
+    std::vector<uint32_t> result;
+    FlashStreamEntry entry;
+    TestEntry payload;
+    while (cursor.next(entry)) {
+        CHECK(entry.type == TEST_TYPE && entry.size == sizeof(payload));
+        memcpy(&payload, entry.payload, sizeof(payload));
+        result.push_back(payload.index);
+    }
+    return result;
+}
+
+static bool consecutive(const std::vector<uint32_t>& values, uint32_t first, uint32_t count) {
+    if (values.size() != count) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (values[i] != first + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testOverwriteOldest() {
+    EmulatedFlashHal hal;
+    FlashStream* stream = openStream(hal, FLASH_RETENTION_OVERWRITE_OLDEST);
+
+    // One entry past the full pool reclaims the oldest sector, its entries are dropped
+    uint32_t total = POOL_SECTORS * per_sector + 1;
+    for (uint32_t i = 0; i < total; i++) {
+        CHECK(append(*stream, i));
+    }
+    CHECK(!stream->isFull());
+    CHECK(stream->getEntryCount() == total - per_sector);
+    CHECK(stream->getPendingCount() == total - per_sector);
+    CHECK(stream->getDroppedCount() == per_sector);
+    CHECK(consecutive(indices(stream->entries()), per_sector, total - per_sector));
+
+    // Uploaded entries are not counted as dropped when their sector is reclaimed
+    CHECK(stream->markUploaded(per_sector));
+    for (uint32_t i = total; i < total + per_sector; i++) {
+        CHECK(append(*stream, i));
+    }
+    CHECK(stream->getDroppedCount() == per_sector);
+    CHECK(consecutive(indices(stream->entries()), 2 * per_sector, total - per_sector));
+    delete stream;
+}
+
+static void testKeepUnuploaded() {
+    EmulatedFlashHal hal;
+    FlashStream* stream = openStream(hal, FLASH_RETENTION_KEEP_UNUPLOADED);
+
+    // A full pool of pending entries rejects the next one
+    uint32_t total = POOL_SECTORS * per_sector;
+    for (uint32_t i = 0; i < total; i++) {
+        CHECK(append(*stream, i));
+    }
+    CHECK(stream->isFull());
+    CHECK(!append(*stream, total));
+    CHECK(stream->getEntryCount() == total);
+
+    // Uploading the oldest sector makes room for one more sector of entries
+    CHECK(stream->markUploaded(per_sector));
+    CHECK(stream->getPendingCount() == total - per_sector);
+    CHECK(consecutive(indices(stream->pendingEntries()), per_sector, total - per_sector));
+    CHECK(!stream->isFull());
+    for (uint32_t i = total; i < total + per_sector; i++) {
+        CHECK(append(*stream, i));
+    }
+    CHECK(!append(*stream, total + per_sector));
+    CHECK(stream->getDroppedCount() == 0);
+    CHECK(consecutive(indices(stream->entries()), per_sector, total));
+    delete stream;
+}
+
+static void testRestart() {
+    EmulatedFlashHal hal;
+    FlashStream* stream = openStream(hal, FLASH_RETENTION_OVERWRITE_OLDEST);
+
+    // Wrapped once, part uploaded
+    uint32_t total = POOL_SECTORS * per_sector + per_sector / 2;
+    for (uint32_t i = 0; i < total; i++) {
+        CHECK(append(*stream, i));
+    }
+    uint32_t first = total - stream->getEntryCount();
+    CHECK(stream->markUploaded(per_sector + 3));
+    uint32_t entries = stream->getEntryCount();
+    uint32_t pending = stream->getPendingCount();
+    delete stream;
+
+    // init() finds the oldest and newest sector and the uploaded flags again
+    stream = openStream(hal, FLASH_RETENTION_OVERWRITE_OLDEST);
+    CHECK(stream->getEntryCount() == entries);
+    CHECK(stream->getPendingCount() == pending);
+    CHECK(consecutive(indices(stream->entries()), first, entries));
+    CHECK(consecutive(indices(stream->pendingEntries()), first + per_sector + 3, pending));
+
+    // Appending goes on in the head sector after the last entry
+    for (uint32_t i = total; i < total + 5; i++) {
+        CHECK(append(*stream, i));
+    }
+    CHECK(consecutive(indices(stream->entries()), first, entries + 5));
+
+    // A torn entry is skipped by init() and the cursors
+    uint32_t torn_address = POOL_ADDRESS + ((total / per_sector) % POOL_SECTORS) * FLASH_SECTOR_SIZE +
+                            sizeof(StreamSectorHeader) + sizeof(StreamEntryHeader);
+    hal.raw(torn_address)[0] ^= 0x01;
+    delete stream;
+    stream = openStream(hal, FLASH_RETENTION_OVERWRITE_OLDEST);
+    CHECK(stream->getEntryCount() == entries + 5 - 1);
+    CHECK(indices(stream->entries()).size() == entries + 5 - 1);
+    delete stream;
+}
+
+static void testWithoutUploadTracking() {
+    EmulatedFlashHal hal;
+    FlashStream* stream = openStream(hal, FLASH_RETENTION_KEEP_UNUPLOADED, false);
+
+    // Nothing is pending, so even this policy keeps appending and nothing counts as dropped
+    uint32_t total = 2 * POOL_SECTORS * per_sector;
+    for (uint32_t i = 0; i < total; i++) {
+        CHECK(append(*stream, i));
+    }
+    CHECK(stream->getPendingCount() == 0);
+    CHECK(stream->getDroppedCount() == 0);
+    CHECK(!stream->isFull());
+    CHECK(indices(stream->pendingEntries()).empty());
+    uint32_t entries = stream->getEntryCount();
+    CHECK(consecutive(indices(stream->entries()), total - entries, entries));
+    delete stream;
+
+    stream = openStream(hal, FLASH_RETENTION_KEEP_UNUPLOADED, false);
+    CHECK(stream->getEntryCount() == entries);
+    CHECK(stream->getPendingCount() == 0);
+    delete stream;
+}
+
+static void testEventLog() {
+    EmulatedFlashHal hal;
+    FlashStream* stream = openStream(hal, FLASH_RETENTION_OVERWRITE_OLDEST, false);
+    EventLog events(*stream);
+    CHECK(events.log(EVENT_BOOT, 1));
+    CHECK(events.log(EVENT_UPLOAD, 120, 1));
+    CHECK(events.log(EVENT_GPS_FIX, 0, 7));
+
+    FlashStreamCursor cursor = stream->entries();
+    FlashStreamEntry entry;
+    EventRecord record;
+    CHECK(cursor.next(entry) && EventLog::decode(entry, record));
+    CHECK(entry.type == EVENT_BOOT && record.value == 1);
+    CHECK(cursor.next(entry) && EventLog::decode(entry, record));
+    CHECK(entry.type == EVENT_UPLOAD && record.value == 120 && record.value2 == 1);
+    CHECK(cursor.next(entry) && EventLog::decode(entry, record));
+    CHECK(entry.type == EVENT_GPS_FIX && record.value == 0 && record.value2 == 7);
+    CHECK(!cursor.next(entry));
+    events.printEvents(2);
+    delete stream;
+}
+
+int main() {
+    testOverwriteOldest();
+    testKeepUnuploaded();
+    testRestart();
+    testWithoutUploadTracking();
+    testEventLog();
+    return testResult("flash_stream");
+}
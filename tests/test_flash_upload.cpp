@@ -0,0 +1,94 @@
+// Chunked upload with an upload filter: chunks with only rejected records are held back,
+// not acknowledged. Held records are neither pending nor uploaded, the upload still gets
+// past them and completes, and the held state is the same after a restart.
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "test_util.h"
+
+#define TEST_RECORDS 1500           // More chunks than the upload window tracks
+#define CHUNK_RECORDS 5
+
+// Records without a fix: the first 40 (cold start) and every 7th after that
+static bool hasFix(uint32_t i) {
+    return i >= 40 && i % 7 != 0;
+}
+
+static bool uploadFilter(const SensorData& data) {
+    return data.fix_type != GPS_FIX_TYPE_NONE;
+}
+
+static uint32_t countHeld(Flash& flash) {
+    FlashRecordCursor cursor = flash.heldRecords();
+    SensorData data;
+    uint32_t held = 0;
+    while (cursor.next(data)) {
+        CHECK(data.fix_type == GPS_FIX_TYPE_NONE);
+        held++;
+    }
+    return held;
+}
+
+int main() {
+    EmulatedFlashHal hal;
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    CHECK(flash.init());
+    flash.setUploadChunkSize(CHUNK_RECORDS);
+    flash.setUploadFilter(uploadFilter);
+
+    uint32_t expected_held = 0;
+    for (uint32_t i = 0; i < TEST_RECORDS; i++) {
+        SensorData data = {};
+        data.timestamp = 1700000000 + i;
+        data.fix_type = hasFix(i) ? GPS_FIX_TYPE_3D : GPS_FIX_TYPE_NONE;
+        data.satellites_used = hasFix(i) ? 8 : 0;
+        CHECK(flash.saveSensorData(data));
+        expected_held += hasFix(i) ? 0 : 1;
+    }
+
+    // Nothing was uploaded yet, nothing is held
+    CHECK(countHeld(flash) == 0);
+
+    uint32_t chunks = flash.beginUpload();
+    uint32_t sent = 0, held_chunks = 0;
+    for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+        CHECK(flash.canTrackChunk(chunk));
+        FlashRecordCursor cursor = flash.chunkRecords(chunk);
+        SensorData data;
+        uint32_t accepted = 0;
+        while (cursor.next(data)) {
+            accepted += flash.isUploadable(data) ? 1 : 0;
+        }
+        if (accepted == 0) {
+            CHECK(flash.holdChunk(chunk));
+            held_chunks++;
+        } else {
+            // A chunk with records to send cannot be held back
+            CHECK(!flash.holdChunk(chunk));
+            CHECK(flash.acknowledgeChunk(chunk));
+            sent += accepted;
+        }
+    }
+
+    // The cold start chunks were held back and did not stall the upload
+    CHECK(held_chunks == 40 / CHUNK_RECORDS);
+    CHECK(flash.getPendingCount() == 0);
+    CHECK(sent == TEST_RECORDS - expected_held);
+
+    // Held records of held chunks and of mixed chunks, none of them sent
+    CHECK(countHeld(flash) == expected_held);
+
+    // The held state survives a restart
+    Flash restarted(0, &hal);
+    restarted.setDebugLevel(0);
+    CHECK(restarted.init());
+    restarted.setUploadFilter(uploadFilter);
+    CHECK(restarted.getPendingCount() == 0);
+    CHECK(countHeld(restarted) == expected_held);
+
+    // Without a filter nothing is held back
+    restarted.setUploadFilter(nullptr);
+    CHECK(countHeld(restarted) == 0);
+
+    return testResult("flash_upload");
+}
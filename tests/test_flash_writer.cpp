@@ -0,0 +1,69 @@
+// FlashWriter double buffer: records move from the fill buffer to the writer on commit(),
+// enqueue() is refused once both buffers are full and accepted again after poll()
+#include <vector>
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "flash_writer.h"
+#include "test_util.h"
+
+static std::vector<SensorData> batch(size_t size, uint32_t& timestamp) {
+    std::vector<SensorData> data(size);
+    for (SensorData& record : data) {
+        record.timestamp = ++timestamp;
+    }
+    return data;
+}
+
+int main() {
+    EmulatedFlashHal hal;
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    CHECK(flash.init());
+    FlashWriter writer(flash);
+    uint32_t timestamp = 1700000000;
+
+    // Nothing is written before a commit
+    CHECK(writer.enqueue(batch(10, timestamp)));
+    CHECK(!writer.poll());
+    CHECK(flash.getStoredDataCount() == 0);
+    writer.commit();
+    CHECK(writer.poll());
+    CHECK(flash.getStoredDataCount() == 10);
+    CHECK(writer.isIdle());
+
+    // Fill both buffers without polling: the full fill buffer is handed over once, then
+    // the writer is busy and the next call is refused as a whole
+    CHECK(writer.enqueue(batch(FLASH_WRITER_BUFFER_RECORDS, timestamp)));
+    CHECK(writer.enqueue(batch(FLASH_WRITER_BUFFER_RECORDS, timestamp)));
+    CHECK(writer.queuedCount() == 2 * FLASH_WRITER_BUFFER_RECORDS);
+    CHECK(!writer.enqueue(batch(10, timestamp)));
+    CHECK(!writer.enqueue(batch(1, timestamp)));
+    CHECK(writer.stats().rejected_calls == 2);
+    CHECK(writer.stats().rejected_records == 11);
+    CHECK(writer.stats().max_queued == 2 * FLASH_WRITER_BUFFER_RECORDS);
+    CHECK(writer.queuedCount() == 2 * FLASH_WRITER_BUFFER_RECORDS);
+
+    // One poll frees the writer and hands the waiting buffer over, the fill buffer is free
+    CHECK(writer.poll());
+    CHECK(writer.queuedCount() == FLASH_WRITER_BUFFER_RECORDS);
+    CHECK(writer.enqueue(batch(10, timestamp)));
+
+    // flush() writes everything, in order
+    CHECK(writer.flush());
+    CHECK(writer.isIdle());
+    CHECK(flash.getStoredDataCount() == 10 + 2 * FLASH_WRITER_BUFFER_RECORDS + 10);
+    CHECK(writer.stats().enqueued_records == writer.stats().written_records);
+    CHECK(writer.stats().batches_written == 4);
+    CHECK(writer.stats().write_failures == 0);
+
+    FlashRecordCursor cursor = flash.records();
+    SensorData data;
+    uint32_t previous = 0, out_of_order = 0;
+    while (cursor.next(data)) {
+        out_of_order += data.timestamp <= previous ? 1 : 0;
+        previous = data.timestamp;
+    }
+    CHECK(out_of_order == 0);
+
+    return testResult("flash_writer");
+}
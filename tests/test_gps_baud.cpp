@@ -0,0 +1,217 @@
+// Baud rate negotiation, the fallback of poll() when the receiver is reset or goes quiet,
+// and getFixAt() picking the fix closest to a sample time
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include "libs/gps/myGPS.h"
+#include "host_sdk.h"
+#include "test_util.h"
+
+#define FAST_BAUD 115200
+
+static std::string nmea(const std::string& body) {
+    uint8_t checksum = 0;
+    for (char c : body) {
+        checksum ^= (uint8_t)c;
+    }
+    char suffix[8];
+    snprintf(suffix, sizeof(suffix), "*%02X\r\n", checksum);
+    return "$" + body + suffix;
+}
+
+// Emulated MTK receiver: talks at its baud rate every RECEIVER_PERIOD sleeps, follows
+// PMTK251 if it is set to. At another UART rate only garbage arrives.
+#define RECEIVER_PERIOD 10
+
+struct Receiver {
+    uint baud_rate = 9600;
+    bool follows = true;
+    bool silent = false;
+    std::string line;
+    std::string sent;               // Everything the board sent
+    int sleeps = 0;
+};
+
+static Receiver receiver;
+
+static void receiverInput(uart_inst_t* uart, char c) {
+    (void)uart;
+    receiver.sent += c;
+    if (c == '$') {
+        receiver.line.clear();
+    }
+    receiver.line += c;
+    if (c == '\n' && receiver.line.rfind("$PMTK251,", 0) == 0 && receiver.follows) {
+        receiver.baud_rate = atoi(receiver.line.c_str() + 9);
+    }
+}
+
+static void receiverOutput() {
+    if (++receiver.sleeps % RECEIVER_PERIOD != 0 || receiver.silent) {
+        return;
+    }
+    std::string data = hostUartBaudRate(uart0) == receiver.baud_rate
+                           ? nmea("GPGSA,A,3,01,02,03,,,,,,,,,,2.0,1.0,1.5")
+                           : std::string("\xF0\x13\x77garbage\xFE", 11);
+    hostUartReceive(uart0, data.data(), data.size());
+}
+
+static bool sent(const std::string& text) {
+    return receiver.sent.find(text) != std::string::npos;
+}
+
+// Poll like the main loop for ms
+static void run(myGPS& gps, uint32_t ms) {
+    for (uint32_t i = 0; i < ms / 10; i++) {
+        sleep_ms(10);
+        gps.poll();
+    }
+}
+
+static void testNegotiation(myGPS& gps) {
+    CHECK(gps.negotiateBaudRate(FAST_BAUD));
+    CHECK(gps.getBaudRate() == FAST_BAUD && hostUartBaudRate(uart0) == FAST_BAUD);
+    CHECK(sent(nmea("PMTK251,115200")));
+    CHECK(receiver.sent.find("\xB5\x62\x06\x00\x14\x00", 0, 6) != std::string::npos);  // CFG-PRT
+
+    // No UBX acknowledge, PMTK220 instead
+    receiver.sent.clear();
+    CHECK(gps.setNavigationRate(5));
+    CHECK(gps.getNavigationInterval() == 200);
+    CHECK(sent(nmea("PMTK220,200")));
+}
+
+static void testReceiverReset(myGPS& gps) {
+    // Back at its defaults, the receiver is set up again once data arrives at 9600 baud
+    receiver.baud_rate = 9600;
+    receiver.sent.clear();
+    run(gps, GPS_BAUD_LOST_MS + 2000);
+    CHECK(gps.getBaudRate() == FAST_BAUD && receiver.baud_rate == FAST_BAUD);
+    CHECK(sent(nmea("PMTK251,115200")));
+    CHECK(sent(nmea("PMTK220,200")));
+    CHECK(gps.getNavigationInterval() == 200);
+}
+
+static void testReceiverQuiet(myGPS& gps) {
+    // Quiet long enough to give up the fast rate, then back at it: the fast rate is tried
+    // again and kept, the receiver is not set up again
+    receiver.silent = true;
+    receiver.sent.clear();
+    run(gps, GPS_BAUD_LOST_MS + 1000);
+    CHECK(gps.getBaudRate() == 9600);
+    receiver.silent = false;
+    run(gps, 2 * GPS_BAUD_LOST_MS);
+    CHECK(gps.getBaudRate() == FAST_BAUD);
+    run(gps, 2 * GPS_BAUD_LOST_MS);
+    CHECK(gps.getBaudRate() == FAST_BAUD);
+    CHECK(!sent("PMTK251"));
+    CHECK(gps.getNavigationInterval() == 200);
+}
+
+static void testReceiverNotFollowing(myGPS& gps) {
+    // Reset to defaults and no longer able to switch: stays at 9600 baud and 1 Hz
+    receiver.baud_rate = 9600;
+    receiver.follows = false;
+    receiver.sent.clear();
+    run(gps, GPS_BAUD_LOST_MS + 2 * GPS_BAUD_VERIFY_MS + 1000);
+    CHECK(gps.getBaudRate() == 9600 && hostUartBaudRate(uart0) == 9600);
+    CHECK(sent(nmea("PMTK220,1000")));
+    CHECK(gps.getNavigationInterval() == 1000);
+    run(gps, 3 * GPS_BAUD_LOST_MS);
+    CHECK(gps.getBaudRate() == 9600);
+
+    receiver.sent.clear();
+    CHECK(!gps.negotiateBaudRate(FAST_BAUD));
+    CHECK(gps.getBaudRate() == 9600 && hostUartBaudRate(uart0) == 9600);
+}
+
+// Replay in place of the UART
+struct TestSource : NmeaSource {
+    std::deque<char> bytes;
+
+    uint32_t available() override { return bytes.size(); }
+    char getc() override {
+        char c = bytes.front();
+        bytes.pop_front();
+        return c;
+    }
+    void add(const std::string& text) { bytes.insert(bytes.end(), text.begin(), text.end()); }
+};
+
+// RMC whose latitude minutes encode the fix number
+static std::string rmc(int hours, int minutes, int seconds, int centiseconds, int number) {
+    char body[120];
+    snprintf(body, sizeof(body), "GPRMC,%02d%02d%02d.%02d,A,48%02d.%04d,N,01537.0508,E,12.3,0.0,161026,,,A",
+             hours, minutes, seconds, centiseconds, number / 10000, number % 10000);
+    return nmea(body);
+}
+
+static int fixNumber(const GpsFix& fix) {
+    for (int i = 0; i < 100; i++) {
+        int32_t latitude = 480000000 + (int32_t)((int64_t)i * 10000000 / 600000);
+        if (std::abs(latitude - fix.latitude) <= 1) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void testFixAt(myGPS& gps) {
+    TestSource source;
+    gps.setSource(&source);
+    GpsFix fix;
+    CHECK(!gps.getFixAt(to_ms_since_boot(get_absolute_time()), fix));
+
+    // 5 Hz, 2 s polled right away
+    uint32_t first_ms = 0;
+    for (int i = 0; i < 10; i++) {
+        sleep_ms(200);
+        source.add(rmc(10, 0, i / 5, (i % 5) * 20, i));
+        gps.poll();
+        if (i == 0) {
+            first_ms = to_ms_since_boot(get_absolute_time());
+        }
+    }
+    // 2 s that sit in the buffer while the sensors are read
+    uint32_t sample_ms = to_ms_since_boot(get_absolute_time()) + 350;
+    for (int i = 10; i < 20; i++) {
+        sleep_ms(200);
+        source.add(rmc(10, 0, i / 5, (i % 5) * 20, i));
+    }
+    CHECK(gps.getFixAt(sample_ms, fix));
+    int expected = (int)((sample_ms - first_ms + 100) / 200);
+    CHECK(fixNumber(fix) == expected);
+    CHECK(fix.time_ms - first_ms == (uint32_t)expected * 200);
+    CHECK(!gps.getFixAt(sample_ms + 60000, fix));
+
+    // Fix times stay continuous over midnight UTC
+    TestSource midnight;
+    gps.setSource(&midnight);
+    sleep_ms(200);
+    midnight.add(rmc(23, 59, 59, 80, 1));
+    gps.poll();
+    uint32_t before_ms = to_ms_since_boot(get_absolute_time());
+    sleep_ms(200);
+    midnight.add(rmc(0, 0, 0, 0, 2));
+    gps.poll();
+    CHECK(gps.getFixAt(before_ms + 200, fix));
+    CHECK(fix.time_ms == before_ms + 200);
+    CHECK(fixNumber(fix) == 2);
+    gps.setSource(nullptr);
+}
+
+int main() {
+    myGPS gps(uart0, 9600, 0, 1);
+    hostSetUartTxHook(receiverInput);
+    hostSetSleepHook(receiverOutput);
+
+    testNegotiation(gps);
+    testReceiverReset(gps);
+    testReceiverQuiet(gps);
+    testReceiverNotFollowing(gps);
+
+    hostSetSleepHook(nullptr);
+    hostSetUartTxHook(nullptr);
+    testFixAt(gps);
+    return testResult("gps_baud");
+}
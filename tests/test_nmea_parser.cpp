@@ -0,0 +1,235 @@
+// NmeaParser on valid, corrupt and cut-off input: checksums, fixed-point coordinates,
+// the fields of every decoded sentence type and the recovery after an overflow
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "libs/gps/nmea_parser.h"
+#include "test_util.h"
+
+static std::string nmea(const std::string& body) {
+    uint8_t checksum = 0;
+    for (char c : body) {
+        checksum ^= (uint8_t)c;
+    }
+    char suffix[8];
+    snprintf(suffix, sizeof(suffix), "*%02X\r\n", checksum);
+    return "$" + body + suffix;
+}
+
+// Feed text, returns the number of valid sentences
+static uint32_t feed(NmeaParser& parser, const std::string& text) {
+    return parser.feed(text.data(), text.size());
+}
+
+static void testNumbers() {
+    int32_t value;
+    CHECK(nmeaParseFixed("1.25", 2, value) && value == 125);
+    CHECK(nmeaParseFixed("1.259", 2, value) && value == 125);       // Cut off, not rounded
+    CHECK(nmeaParseFixed("-0.5", 1, value) && value == -5);
+    CHECK(nmeaParseFixed("7", 3, value) && value == 7000);
+    CHECK(nmeaParseFixed(".5", 1, value) && value == 5);
+    CHECK(!nmeaParseFixed("", 2, value));
+    CHECK(!nmeaParseFixed("1a", 2, value));
+    CHECK(!nmeaParseFixed("99999999999", 0, value));
+
+    CHECK(nmeaParseCoordinate("4812.39721", "N", value) && value == 482066202);
+    CHECK(nmeaParseCoordinate("01537.05083", "E", value) && value == 156175138);
+    CHECK(nmeaParseCoordinate("4812.39721", "S", value) && value == -482066202);
+    CHECK(nmeaParseCoordinate("01537.05083", "W", value) && value == -156175138);
+    CHECK(nmeaParseCoordinate("4800.0000", "N", value) && value == 480000000);
+    CHECK(!nmeaParseCoordinate("4812.39721", "X", value));
+    CHECK(!nmeaParseCoordinate("4860.0000", "N", value));           // 60 minutes
+    CHECK(!nmeaParseCoordinate("12.5", "N", value));
+    CHECK(!nmeaParseCoordinate("18100.0000", "E", value));
+}
+
+static void testChecksum() {
+    NmeaParser parser;
+    std::string rmc = nmea("GNRMC,094107.12,A,4812.39721,N,01537.05083,E,4.215,87.52,161026,,,A");
+    CHECK(feed(parser, rmc) == 1);
+    CHECK(parser.stats().checksum_errors == 0);
+
+    // Wrong checksum
+    std::string wrong = rmc;
+    wrong[wrong.size() - 3] = wrong[wrong.size() - 3] == '0' ? '1' : '0';
+    CHECK(feed(parser, wrong) == 0);
+    CHECK(parser.stats().checksum_errors == 1);
+
+    // Changed character
+    std::string changed = rmc;
+    changed[20] = changed[20] == '1' ? '2' : '1';
+    CHECK(feed(parser, changed) == 0);
+    CHECK(parser.stats().checksum_errors == 2);
+
+    // No checksum at all
+    CHECK(feed(parser, "$GNRMC,094107.12,A,4812.39721,N,01537.05083,E,4.215,87.52,161026,,,A\r\n") == 0);
+    CHECK(parser.stats().checksum_errors == 3);
+
+    // A non-hex checksum digit
+    std::string bad_hex = rmc;
+    bad_hex[bad_hex.size() - 4] = 'G';
+    CHECK(feed(parser, bad_hex) == 0);
+    CHECK(parser.stats().checksum_errors == 4);
+
+    // Lower case hex digits are accepted
+    std::string lower = rmc;
+    for (size_t i = lower.size() - 4; i < lower.size() - 2; i++) {
+        lower[i] = tolower(lower[i]);
+    }
+    CHECK(feed(parser, lower) == 1);
+
+    // Noise between sentences is ignored
+    CHECK(feed(parser, "\xF0\x13garbage\r\n" + rmc) == 1);
+    CHECK(parser.stats().sentences == 3);
+}
+
+static void testRMC() {
+    NmeaParser parser;
+    CHECK(feed(parser, nmea("GNRMC,094107.12,A,4812.39721,N,01537.05083,E,4.215,87.52,161026,,,A")) == 1);
+    const NmeaSentence& s = parser.sentence();
+    CHECK(s.type == NMEA_SENTENCE_RMC && s.talker == NMEA_TALKER_COMBINED);
+    CHECK(s.time_valid && s.hour == 9 && s.minute == 41 && s.second == 7 && s.millisecond == 120);
+    CHECK(s.date_valid && s.day == 16 && s.month == 10 && s.year == 26);
+    CHECK(s.fix_valid && s.position_valid);
+    CHECK(s.latitude == 482066202 && s.longitude == 156175138);
+    CHECK(s.speed_valid && s.speed == 781);          // 4.215 knots = 7.81 km/h
+    CHECK(s.course_valid && s.course == 8752);
+    CHECK(strcmp(parser.line(), "GNRMC,094107.12,A,4812.39721,N,01537.05083,E,4.215,87.52,161026,,,A") == 0);
+
+    // No fix yet: empty fields, status V
+    CHECK(feed(parser, nmea("GPRMC,094108.00,V,,,,,,,161026,,,N")) == 1);
+    CHECK(parser.sentence().talker == NMEA_TALKER_GPS);
+    CHECK(!parser.sentence().fix_valid && !parser.sentence().position_valid);
+    CHECK(!parser.sentence().speed_valid && parser.sentence().date_valid);
+
+    // Malformed field behind a valid checksum
+    CHECK(feed(parser, nmea("GNRMC,094107.12,A,48x2.39721,N,01537.05083,E,4.215,87.52,161026,,,A")) == 0);
+    CHECK(parser.stats().field_errors == 1);
+    CHECK(feed(parser, nmea("GNRMC,250000.00,A,4812.39721,N,01537.05083,E,,,161026,,,A")) == 0);
+    CHECK(parser.stats().field_errors == 2);
+}
+
+static void testGLLAndGGA() {
+    NmeaParser parser;
+    CHECK(feed(parser, nmea("GLGLL,4812.39721,S,01537.05083,W,094107.00,A,A")) == 1);
+    const NmeaSentence& s = parser.sentence();
+    CHECK(s.type == NMEA_SENTENCE_GLL && s.talker == NMEA_TALKER_GLONASS);
+    CHECK(s.latitude == -482066202 && s.longitude == -156175138);
+    CHECK(s.fix_valid && s.time_valid && s.second == 7);
+
+    CHECK(feed(parser, nmea("GNGGA,094107.00,4812.39721,N,01537.05083,E,2,09,0.80,270.5,M,43.1,M,,")) == 1);
+    CHECK(s.type == NMEA_SENTENCE_GGA);
+    CHECK(s.fix_quality == 2 && s.fix_valid && s.satellites_used == 9);
+    CHECK(s.hdop == 80);
+    CHECK(s.altitude_valid && s.altitude_cm == 27050);
+    CHECK(s.latitude == 482066202);
+
+    CHECK(feed(parser, nmea("GNGGA,094108.00,,,,,0,00,99.99,,M,,M,,")) == 1);
+    CHECK(!s.fix_valid && !s.position_valid && !s.altitude_valid && s.hdop == 9999);
+}
+
+static void testGSA() {
+    NmeaParser parser;
+    CHECK(feed(parser, nmea("GNGSA,A,3,05,13,15,18,,,,,,,,,1.98,1.12,1.63,1")) == 1);
+    const NmeaSentence& s = parser.sentence();
+    CHECK(s.type == NMEA_SENTENCE_GSA);
+    CHECK(s.fix_type == 3 && s.used_prn_count == 4);
+    CHECK(s.pdop == 198 && s.hdop == 112 && s.vdop == 163);
+    CHECK(s.used_constellation == NMEA_TALKER_GPS);
+
+    // Without a system ID the PRN range tells the constellation
+    CHECK(feed(parser, nmea("GNGSA,A,3,67,68,81,,,,,,,,,,2.10,1.20,1.70")) == 1);
+    CHECK(s.used_constellation == NMEA_TALKER_GLONASS && s.used_prn_count == 3);
+    CHECK(feed(parser, nmea("GAGSA,A,2,,,,,,,,,,,,,,,")) == 1);
+    CHECK(s.used_constellation == NMEA_TALKER_GALILEO && s.fix_type == 2 && s.used_prn_count == 0);
+    CHECK(feed(parser, nmea("GPGSA,A,4,05,,,,,,,,,,,,1.0,1.0,1.0")) == 0);
+}
+
+static void testGSV() {
+    NmeaParser parser;
+    CHECK(feed(parser, nmea("GPGSV,3,1,11,05,42,292,38,13,64,178,41,15,37,229,,18,22,312,33")) == 1);
+    const NmeaSentence& s = parser.sentence();
+    CHECK(s.type == NMEA_SENTENCE_GSV);
+    CHECK(s.gsv_count == 3 && s.gsv_index == 1 && s.satellites_in_view == 11);
+    CHECK(s.satellite_count == 4);
+    CHECK(s.satellites[0].prn == 5 && s.satellites[0].elevation == 42 && s.satellites[0].azimuth == 292 &&
+          s.satellites[0].snr == 38);
+    CHECK(s.satellites[2].prn == 15 && s.satellites[2].snr == 0);     // Not tracked
+    CHECK(s.satellites[3].prn == 18 && s.satellites[3].azimuth == 312);
+
+    // Last sentence of a group with fewer satellites and an NMEA 4.10 signal ID
+    CHECK(feed(parser, nmea("GPGSV,3,3,11,29,10,045,20,1")) == 1);
+    CHECK(s.gsv_index == 3 && s.satellite_count == 1 && s.satellites[0].prn == 29);
+
+    CHECK(feed(parser, nmea("GPGSV,3,1,11,05,95,292,38")) == 0);         // Elevation above 90
+}
+
+static void testVTGAndUnknown() {
+    NmeaParser parser;
+    CHECK(feed(parser, nmea("GNVTG,87.52,T,,M,4.215,N,7.806,K,A")) == 1);
+    const NmeaSentence& s = parser.sentence();
+    CHECK(s.type == NMEA_SENTENCE_VTG);
+    CHECK(s.course_valid && s.course == 8752);
+    CHECK(s.speed_valid && s.speed == 780);
+
+    CHECK(feed(parser, nmea("GNVTG,,T,,M,,N,,K,N")) == 1);
+    CHECK(!s.course_valid && !s.speed_valid);
+
+    // Valid checksum, not decoded
+    CHECK(feed(parser, nmea("GPTXT,01,01,02,ANTSTATUS=OK")) == 1);
+    CHECK(s.type == NMEA_SENTENCE_UNKNOWN);
+    CHECK(feed(parser, nmea("PMTK001,220,3")) == 1);
+    CHECK(s.type == NMEA_SENTENCE_UNKNOWN);
+    CHECK(parser.stats().sentences == 4 && parser.stats().decoded == 2);
+}
+
+static void testRecovery() {
+    NmeaParser parser;
+    std::string gga = nmea("GNGGA,094107.00,4812.39721,N,01537.05083,E,1,09,0.80,270.0,M,43.1,M,,");
+
+    // Cut off by the next "$"
+    CHECK(feed(parser, "$GNRMC,094107.12,A,4812.3" + gga) == 1);
+    CHECK(parser.stats().checksum_errors == 1);
+    CHECK(parser.sentence().type == NMEA_SENTENCE_GGA);
+
+    // Too long, dropped without touching the next sentence
+    std::string long_body = "GPTXT," + std::string(NMEA_MAX_SENTENCE_LENGTH, 'A');
+    CHECK(feed(parser, nmea(long_body) + gga) == 1);
+    CHECK(parser.stats().overflows == 1);
+
+    // Too many fields
+    std::string many_fields = "GPGSV,9,1,99";
+    for (int i = 0; i < NMEA_MAX_FIELDS; i++) {
+        many_fields += ",1";
+    }
+    CHECK(feed(parser, nmea(many_fields) + gga) == 1);
+    CHECK(parser.stats().overflows == 2);
+
+    // Byte by byte and in one piece give the same result
+    NmeaParser bytewise;
+    uint32_t sentences = 0;
+    for (char c : gga + gga) {
+        sentences += bytewise.feed(c) ? 1 : 0;
+    }
+    CHECK(sentences == 2);
+    CHECK(bytewise.sentence().latitude == 482066202 && bytewise.sentence().altitude_cm == 27000);
+
+    // reset() drops a partial sentence
+    bytewise.feed(gga.data(), 20);
+    bytewise.reset();
+    CHECK(feed(bytewise, gga.substr(20)) == 0);
+    CHECK(feed(bytewise, gga) == 1);
+}
+
+int main() {
+    testNumbers();
+    testChecksum();
+    testRMC();
+    testGLLAndGGA();
+    testGSA();
+    testGSV();
+    testVTGAndUnknown();
+    testRecovery();
+    return testResult("nmea_parser");
+}
@@ -0,0 +1,149 @@
+// Soak test of the GPS and storage path on a recorded ride: tests/data/ride.nmea goes
+// through myGPS at 9600 baud and ride.csv in place of the sensors, a record is stored every
+// SAMPLE_INTERVAL_MS like the main loop does. The replay runs on the simulated SDK clock,
+// so fix ages, getFixAt() and the timeouts of myGPS see the timing of the recording while
+// the ride replays as fast as the loop runs.
+//
+//   test_replay_soak [ride.nmea ride.csv]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "flash.h"
+#include "flash_hal_emulator.h"
+#include "libs/gps/myGPS.h"
+#include "libs/replay/trace_replay.h"
+#include "test_util.h"
+
+#define POLL_MS 10                  // Main loop iteration
+#define SAMPLE_INTERVAL_MS 5000
+#define SAMPLE_OFFSET_MS 300        // After the epoch, its fix has arrived at 9600 baud
+#define EPOCH_MS 1000               // ride.nmea is 1 Hz
+#define FIX_TIME_TOLERANCE_MS 200
+
+struct Position {
+    int32_t latitude;
+    int32_t longitude;
+};
+
+// Positions of the RMC sentences of a trace, one per epoch
+static std::vector<Position> tracePositions(const char* path) {
+    std::vector<Position> positions;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return positions;
+    }
+    NmeaParser parser;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        const char* sentence = strchr(line, '$');
+        if (line[0] == '#' || sentence == nullptr) {
+            continue;
+        }
+        parser.reset();
+        parser.feed(sentence, strlen(sentence));
+        const NmeaSentence& decoded = parser.sentence();
+        if (decoded.type == NMEA_SENTENCE_RMC && decoded.position_valid) {
+            positions.push_back({decoded.latitude, decoded.longitude});
+        }
+    }
+    fclose(file);
+    return positions;
+}
+
+int main(int argc, char** argv) {
+    const char* nmea_path = argc > 2 ? argv[1] : TEST_DATA_DIR "/ride.nmea";
+    const char* csv_path = argc > 2 ? argv[2] : TEST_DATA_DIR "/ride.csv";
+    std::vector<Position> positions = tracePositions(nmea_path);
+    CHECK(!positions.empty());
+
+    EmulatedFlashHal hal;
+    Flash flash(0, &hal);
+    flash.setDebugLevel(0);
+    CHECK(flash.init());
+    myGPS gps(uart0, 9600, 0, 1);
+
+    ReplayClock clock;
+    NmeaTraceReplay nmea(clock, 9600);
+    SensorTraceReplay sensors(clock);
+    CHECK(nmea.load(nmea_path));
+    CHECK(sensors.load(csv_path));
+    gps.setSource(&nmea);
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    auto host_start = std::chrono::steady_clock::now();
+
+    uint32_t next_sample_ms = SAMPLE_OFFSET_MS;
+    uint32_t samples = 0, fixes = 0, matched = 0, stored = 0;
+    std::vector<Position> expected;
+    // Ends after the trace even if it is not read, e.g. when the clocks drift apart
+    while (!nmea.finished() && to_ms_since_boot(get_absolute_time()) - start_ms < nmea.durationMs() + EPOCH_MS) {
+        sleep_ms(POLL_MS);
+        gps.poll();
+        uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+        if (now_ms - start_ms < next_sample_ms) {
+            continue;
+        }
+        next_sample_ms += SAMPLE_INTERVAL_MS;
+        samples++;
+
+        SensorData data;
+        CHECK(sensors.read(data));
+        std::string line;
+        CHECK(gps.readLine(line) == 0);
+
+        // The fix of the epoch the sample was taken in
+        GpsFix fix;
+        if (!gps.getFixAt(now_ms, fix)) {
+            continue;
+        }
+        fixes++;
+        uint32_t epoch = (now_ms - start_ms) / EPOCH_MS;
+        uint32_t epoch_ms = start_ms + epoch * EPOCH_MS;
+        if (epoch < positions.size() && fix.latitude == positions[epoch].latitude &&
+            fix.longitude == positions[epoch].longitude && fix.time_ms >= epoch_ms &&
+            fix.time_ms - epoch_ms <= FIX_TIME_TOLERANCE_MS) {
+            matched++;
+        }
+
+        data.latitude = fix.latitude;
+        data.longitude = fix.longitude;
+        data.hdop = fix.quality.hdop;
+        data.satellites_used = fix.quality.satellites_used;
+        data.speed = fix.quality.speed;
+        data.timestamp = 1776326000 + (now_ms - start_ms) / 1000;
+        if (flash.saveSensorData(data)) {
+            stored++;
+            expected.push_back(epoch < positions.size() ? positions[epoch] : Position{0, 0});
+        }
+    }
+    uint32_t trace_ms = to_ms_since_boot(get_absolute_time()) - start_ms;
+    double host_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - host_start).count();
+
+    // Every sample of the ride has the fix of its epoch and is stored
+    CHECK(samples == nmea.durationMs() / SAMPLE_INTERVAL_MS);
+    CHECK(samples == sensors.sampleCount());
+    CHECK(fixes == samples);
+    CHECK(matched == samples);
+    CHECK(stored == samples);
+    CHECK(gps.getParserStats().checksum_errors == 0);
+
+    // The records come back in order with the positions of their epochs
+    CHECK(flash.getStoredDataCount() == samples);
+    FlashRecordCursor cursor = flash.records();
+    SensorData data;
+    uint32_t read = 0, wrong = 0;
+    while (cursor.next(data)) {
+        wrong += read >= expected.size() || (int32_t)data.latitude != expected[read].latitude ||
+                 (int32_t)data.longitude != expected[read].longitude ? 1 : 0;
+        read++;
+    }
+    CHECK(read == samples);
+    CHECK(wrong == 0);
+
+    printf("REPLAY: %lu s of ride in %.0f ms (%.0fx), %lu samples, %lu with the fix of their epoch\n",
+           (unsigned long)(trace_ms / 1000), host_ms, trace_ms / (host_ms > 0 ? host_ms : 1),
+           (unsigned long)samples, (unsigned long)matched);
+    return testResult("replay_soak");
+}
@@ -0,0 +1,171 @@
+// UbxParser on good, corrupt and split frames, and myGPS in UBX mode against an emulated
+// u-blox receiver: decoding NAV-PVT, the CFG-MSG handshake of enableUbx() and the return to
+// NMEA when the receiver was reset
+#include <cstring>
+#include <deque>
+#include <string>
+#include "libs/gps/myGPS.h"
+#include "libs/gps/ubx_parser.h"
+#include "host_sdk.h"
+#include "test_util.h"
+
+// Bytes handed to myGPS in place of the UART
+struct TestSource : NmeaSource {
+    std::deque<uint8_t> bytes;
+
+    uint32_t available() override { return bytes.size(); }
+    char getc() override {
+        if (bytes.empty()) {
+            return 0;
+        }
+        char c = (char)bytes.front();
+        bytes.pop_front();
+        return c;
+    }
+    void add(const uint8_t* data, size_t size) { bytes.insert(bytes.end(), data, data + size); }
+    void add(const char* text) { add((const uint8_t*)text, strlen(text)); }
+};
+
+static TestSource source;
+
+static void writeU32(uint8_t* data, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        data[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// NAV-PVT of 2026-10-16 09:41:07.120
+static size_t buildPvt(uint8_t* out, int32_t latitude, int32_t longitude, uint8_t fix_type, uint8_t flags,
+                       uint8_t satellites, int32_t ground_speed) {
+    uint8_t pvt[UBX_NAV_PVT_LENGTH] = {0};
+    writeU32(pvt, 1000);
+    pvt[4] = 2026 & 0xFF;
+    pvt[5] = 2026 >> 8;
+    pvt[6] = 10;
+    pvt[7] = 16;
+    pvt[8] = 9;
+    pvt[9] = 41;
+    pvt[10] = 7;
+    pvt[11] = UBX_PVT_VALID_DATE | UBX_PVT_VALID_TIME | UBX_PVT_FULLY_RESOLVED;
+    writeU32(pvt + 16, 120000000);          // Nanoseconds
+    pvt[20] = fix_type;
+    pvt[21] = flags;
+    pvt[23] = satellites;
+    writeU32(pvt + 24, longitude);
+    writeU32(pvt + 28, latitude);
+    writeU32(pvt + 36, 268400);             // Height above mean sea level in mm
+    writeU32(pvt + 60, ground_speed);       // mm/s
+    writeU32(pvt + 64, 8752000);            // 87.52 degrees
+    pvt[76] = 198;                          // PDOP
+    return ubxBuildMessage(UBX_CLASS_NAV, UBX_NAV_PVT, pvt, sizeof(pvt), out);
+}
+
+// Receiver that acknowledges every complete frame sent to it
+static UbxParser receiver;
+static int acks_sent = 0;
+
+static void acknowledgeFrames(uart_inst_t* uart, char c) {
+    (void)uart;
+    if (receiver.feed((uint8_t)c)) {
+        uint8_t ack[2] = {receiver.message().msg_class, receiver.message().msg_id};
+        uint8_t frame[UBX_FRAME_OVERHEAD + 2];
+        source.add(frame, ubxBuildMessage(UBX_CLASS_ACK, UBX_ACK_ACK, ack, sizeof(ack), frame));
+        acks_sent++;
+    }
+}
+
+static void testParser() {
+    uint8_t frame[UBX_FRAME_OVERHEAD + UBX_NAV_PVT_LENGTH];
+    size_t size = buildPvt(frame, 482066202, -156175138, UBX_FIX_3D, UBX_PVT_GNSS_FIX_OK, 9, 2169);
+    CHECK(size == sizeof(frame));
+
+    // Resync after stray sync characters
+    UbxParser parser;
+    uint8_t garbage[] = {UBX_SYNC_CHAR_1, 0x00, UBX_SYNC_CHAR_1, UBX_SYNC_CHAR_1};
+    parser.feed(garbage, sizeof(garbage));
+    CHECK(parser.feed(frame, size) == 1);
+    CHECK(parser.message().type == UBX_MESSAGE_NAV_PVT);
+    const UbxNavPvt& pvt = parser.message().nav_pvt;
+    CHECK(pvt.latitude == 482066202 && pvt.longitude == -156175138);
+    CHECK(pvt.fix_valid && pvt.satellites_used == 9);
+    CHECK(pvt.speed == 781);                // Knots x 100
+    CHECK(pvt.course == 8752);
+    CHECK(pvt.altitude_cm == 26840);
+    CHECK(pvt.year == 2026 && pvt.day == 16 && pvt.millisecond == 120);
+    CHECK(pvt.time_valid && pvt.date_valid);
+
+    // A corrupt frame is counted and dropped, the next one decodes
+    frame[50] ^= 1;
+    CHECK(parser.feed(frame, size) == 0);
+    CHECK(parser.stats().checksum_errors == 1);
+    frame[50] ^= 1;
+
+    uint8_t payload[200] = {0};
+    uint8_t big[UBX_FRAME_OVERHEAD + sizeof(payload)];
+    size_t big_size = ubxBuildMessage(0x0A, 0x09, payload, sizeof(payload), big);
+    CHECK(parser.feed(big, big_size) == 0);
+    CHECK(parser.stats().overflows == 1);
+    CHECK(parser.feed(frame, size) == 1);
+
+    uint8_t short_pvt[UBX_FRAME_OVERHEAD + 12];
+    size_t short_size = ubxBuildMessage(UBX_CLASS_NAV, UBX_NAV_PVT, payload, 12, short_pvt);
+    CHECK(parser.feed(short_pvt, short_size) == 0);
+    CHECK(parser.stats().length_errors == 1);
+
+    // Split at every position
+    for (size_t cut = 0; cut <= size; cut++) {
+        UbxParser split;
+        CHECK(split.feed(frame, cut) + split.feed(frame + cut, size - cut) == 1);
+    }
+}
+
+static void testReceiver() {
+    myGPS gps(uart0, 9600, 0, 1);
+    gps.setSource(&source);
+
+    // NAV-PVT and NAV-DOP between NMEA sentences
+    source.add("$GNGSV,1,1,04,05,42,292,38,13,64,178,41,15,37,229,36,18,22,312,33,1*71\r\n");
+    uint8_t frame[UBX_FRAME_OVERHEAD + UBX_NAV_PVT_LENGTH];
+    source.add(frame, buildPvt(frame, 482066202, 156175138, UBX_FIX_3D, UBX_PVT_GNSS_FIX_OK, 9, 2169));
+    uint8_t dop[UBX_NAV_DOP_LENGTH] = {0};
+    dop[12] = 112;                          // HDOP
+    source.add(frame, ubxBuildMessage(UBX_CLASS_NAV, UBX_NAV_DOP, dop, sizeof(dop), frame));
+
+    std::string line, time, date;
+    double longitude = 0, latitude = 0;
+    char east_west = 0, north_south = 0;
+    CHECK(gps.readLine(line, longitude, east_west, latitude, north_south, time, date) == 0);
+    CHECK(north_south == 'N' && east_west == 'E');
+    CHECK(latitude > 48.2066 && latitude < 48.20663);
+    CHECK(time == "09:41:07" && date == "161026");
+    GpsFixQuality quality = gps.getFixQuality();
+    CHECK(quality.hdop == 112 && quality.fix_type == 3 && quality.satellites_used == 9 && quality.speed == 781);
+    CHECK(gps.isUbxActive());
+
+    // No fix
+    source.add(frame, buildPvt(frame, 0, 0, UBX_FIX_NONE, 0, 0, 0));
+    CHECK(gps.readLine(line) == 2);
+
+    // Every CFG message is acknowledged
+    hostSetUartTxHook(acknowledgeFrames);
+    CHECK(gps.enableUbx());
+    CHECK(acks_sent == 8);
+
+    // The receiver was reset: no more NAV-PVT, RMC is back
+    sleep_ms(3000);
+    source.add("$GNRMC,094110.00,A,4812.39721,N,01537.05083,E,4.215,87.52,161026,,,A*4A\r\n");
+    CHECK(gps.readLine(line) == 0);
+    CHECK(line.rfind("GNRMC", 0) == 0);
+    CHECK(!gps.isUbxActive());
+    CHECK(gps.getSatelliteCounts().in_view == 4);
+
+    // A receiver without UBX stays on NMEA
+    hostSetUartTxHook(nullptr);
+    CHECK(!gps.enableUbx());
+}
+
+int main() {
+    testParser();
+    testReceiver();
+    return testResult("ubx_parser");
+}
@@ -0,0 +1,41 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <cstdio>
+
+// Minimal checks for the host tests: a failed CHECK prints its line and the test
+// returns non-zero from testResult()
+static int test_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        test_failures++; \
+    } \
+} while (0)
+
+static inline int testResult(const char *name) {
+    printf("%s: %s (%d failures)\n", name, test_failures == 0 ? "OK" : "FAILED", test_failures);
+    return test_failures == 0 ? 0 : 1;
+}
+
+#ifdef FLASH_H
+// Record number i of a 5 s series on a short track, for the flash tests (include flash.h first)
+static inline SensorData testRecord(uint32_t i) {
+    SensorData data;
+    data.timestamp = 1700000000 + i * 5;
+    data.latitude = 482047000 + i * 30;
+    data.longitude = 156256000 - (i % 7) * 10;
+    data.temp = 21.5f + 0.01f * (i % 13);
+    data.hum = 45.2f + 0.03f * (i % 5);
+    data.pres = 985.12f;
+    data.gasRes = 120000 + i % 50;
+    data.pm2_5 = 5 + i % 3;
+    data.pm10 = 9 + i % 2;
+    data.co2 = 420 + i % 11;
+    data.fix_type = GPS_FIX_TYPE_3D;
+    return data;
+}
+#endif
+
+#endif // TEST_UTIL_H